@@ -719,6 +719,7 @@ static int examine_directory(struct Menu *menu, struct BrowserState *state,
     struct NntpAccountData *adata = CurrentNewsSrv;
 
     init_state(state, menu);
+    nntp_groups_load(adata);
 
     for (unsigned int i = 0; i < adata->groups_num; i++)
     {
@@ -2099,6 +2100,7 @@ void mutt_buffer_select_file(struct Buffer *file, SelectFileFlags flags,
           if (nntp_newsrc_parse(adata) < 0)
             break;
 
+          nntp_groups_load(adata);
           for (size_t i = 0; i < adata->groups_num; i++)
           {
             struct NntpMboxData *mdata = adata->groups_list[i];
@@ -2196,6 +2198,8 @@ void mutt_buffer_select_file(struct Buffer *file, SelectFileFlags flags,
           }
           if (op == OP_SUBSCRIBE_PATTERN)
           {
+            if (adata)
+              nntp_groups_load(adata);
             for (size_t j = 0; adata && (j < adata->groups_num); j++)
             {
               struct NntpMboxData *mdata = adata->groups_list[j];
@@ -206,7 +206,9 @@ int mutt_display_message(struct MuttWindow *win_index, struct MuttWindow *win_ib
   struct Buffer *tempfile = NULL;
   int res;
 
+  OptPartialFetch = true;
   mutt_parse_mime_message(m, e);
+  OptPartialFetch = false;
   mutt_message_hook(m, e, MUTT_MESSAGE_HOOK);
 
   char columns[16];
@@ -297,7 +299,9 @@ int mutt_display_message(struct MuttWindow *win_index, struct MuttWindow *win_ib
   if (m->magic == MUTT_NOTMUCH)
     chflags |= CH_VIRTUAL;
 #endif
+  OptPartialFetch = true;
   res = mutt_copy_message(fp_out, m, e, cmflags, chflags, win_pager->state.cols);
+  OptPartialFetch = false;
 
   if (((mutt_file_fclose(&fp_out) != 0) && (errno != EPIPE)) || (res < 0))
   {
@@ -1171,6 +1175,11 @@ int mutt_save_message(struct Mailbox *m, struct EmailList *el,
 #ifdef USE_NOTMUCH
     if (m->magic == MUTT_NOTMUCH)
       nm_db_longrun_init(m, true);
+#endif
+#ifdef USE_IMAP
+    /* Upload the messages in bulk, rather than one APPEND each */
+    if (ctx_save->mailbox->magic == MUTT_IMAP)
+      imap_append_begin(ctx_save->mailbox);
 #endif
     STAILQ_FOREACH(en, el, entries)
     {
@@ -1198,6 +1207,23 @@ int mutt_save_message(struct Mailbox *m, struct EmailList *el,
 #ifdef USE_NOTMUCH
     if (m->magic == MUTT_NOTMUCH)
       nm_db_longrun_done(m);
+#endif
+#ifdef USE_IMAP
+    if (ctx_save->mailbox->magic == MUTT_IMAP)
+    {
+      if (imap_append_end(ctx_save->mailbox) != 0)
+        rc = -1;
+
+      /* We can't tell which messages made it, so keep all the originals */
+      if ((rc != 0) && delete_original)
+      {
+        STAILQ_FOREACH(en, el, entries)
+        {
+          mutt_set_flag(m, en->email, MUTT_DELETE, false);
+          mutt_set_flag(m, en->email, MUTT_PURGE, false);
+        }
+      }
+    }
 #endif
     if (rc != 0)
     {
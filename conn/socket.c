@@ -244,10 +244,30 @@ int mutt_socket_readchar(struct Connection *conn, char *c)
 int mutt_socket_readln_d(char *buf, size_t buflen, struct Connection *conn, int dbg)
 {
   char ch;
-  int i;
+  size_t i = 0;
 
-  for (i = 0; i < buflen - 1; i++)
+  while (i < (buflen - 1))
   {
+    /* copy straight out of the connection's buffer, up to the newline */
+    if (conn->bufpos < conn->available)
+    {
+      const char *start = conn->inbuf + conn->bufpos;
+      size_t n = MIN((size_t)(conn->available - conn->bufpos), buflen - 1 - i);
+      const char *nl = memchr(start, '\n', n);
+      if (nl)
+        n = nl - start;
+
+      memcpy(buf + i, start, n);
+      i += n;
+      conn->bufpos += n;
+      if (!nl)
+        continue;
+
+      conn->bufpos++;
+      break;
+    }
+
+    /* refill */
     if (mutt_socket_readchar(conn, &ch) != 1)
     {
       buf[i] = '\0';
@@ -256,7 +276,7 @@ int mutt_socket_readln_d(char *buf, size_t buflen, struct Connection *conn, int
 
     if (ch == '\n')
       break;
-    buf[i] = ch;
+    buf[i++] = ch;
   }
 
   /* strip \r from \r\n termination */
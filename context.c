@@ -39,6 +39,7 @@
 #include "mx.h"
 #include "ncrypt/ncrypt.h"
 #include "pattern.h"
+#include "range_index.h"
 #include "score.h"
 #include "sort.h"
 
@@ -87,6 +88,8 @@ static void ctx_cleanup(struct Context *ctx)
 {
   FREE(&ctx->pattern);
   mutt_pattern_free(&ctx->limit_pattern);
+  FREE(&ctx->limit_matches);
+  mutt_range_index_free(&ctx->range_index);
   if (ctx->mailbox)
     notify_observer_remove(ctx->mailbox->notify, ctx_mailbox_observer, ctx);
 
@@ -97,6 +100,40 @@ static void ctx_cleanup(struct Context *ctx)
   ctx->mailbox = m;
 }
 
+/**
+ * ctx_threads_valid - Can new Emails be added to the thread tree?
+ * @param ctx Mailbox
+ * @retval true The threaded Emails are all still present
+ *
+ * The new Emails are appended to the Mailbox, after the threaded ones.  If any
+ * of the threaded Emails have been replaced or removed, the tree refers to
+ * freed Emails and must be rebuilt.
+ */
+static bool ctx_threads_valid(struct Context *ctx)
+{
+  struct Mailbox *m = ctx->mailbox;
+
+  if (!ctx->tree || !ctx->thread_hash || ((C_Sort & SORT_MASK) != SORT_THREADS) ||
+      (ctx->thread_count > m->msg_count))
+  {
+    return false;
+  }
+
+  for (int i = 0; i < m->msg_count; i++)
+  {
+    struct Email *e = m->emails[i];
+    if (i < ctx->thread_count)
+    {
+      if (!e || !e->thread || (e->thread->message != e))
+        return false;
+    }
+    else if (e && e->thread)
+      return false;
+  }
+
+  return true;
+}
+
 /**
  * ctx_update - Update the Context's message counts
  * @param ctx          Mailbox
@@ -110,8 +147,13 @@ void ctx_update(struct Context *ctx)
 
   struct Mailbox *m = ctx->mailbox;
 
-  mutt_hash_free(&m->subj_hash);
-  mutt_hash_free(&m->id_hash);
+  /* If new Emails have just been appended, thread them into the tree */
+  const bool append = ctx_threads_valid(ctx);
+  if (!append)
+  {
+    mutt_hash_free(&m->subj_hash);
+    mutt_hash_free(&m->id_hash);
+  }
 
   /* reset counters */
   m->msg_unread = 0;
@@ -122,7 +164,8 @@ void ctx_update(struct Context *ctx)
   m->vcount = 0;
   m->changed = false;
 
-  mutt_clear_threads(ctx);
+  if (!append)
+    mutt_clear_threads(ctx);
 
   struct Email *e = NULL;
   for (int msgno = 0; msgno < m->msg_count; msgno++)
@@ -165,11 +208,14 @@ void ctx_update(struct Context *ctx)
     }
 
     /* add this message to the hash tables */
-    if (m->id_hash && e->env->message_id)
-      mutt_hash_insert(m->id_hash, e->env->message_id, e);
-    if (m->subj_hash && e->env->real_subj)
-      mutt_hash_insert(m->subj_hash, e->env->real_subj, e);
-    mutt_label_hash_add(m, e);
+    if (!append || !e->thread)
+    {
+      if (m->id_hash && e->env->message_id)
+        mutt_hash_insert(m->id_hash, e->env->message_id, e);
+      if (m->subj_hash && e->env->real_subj)
+        mutt_hash_insert(m->subj_hash, e->env->real_subj, e);
+      mutt_label_hash_add(m, e);
+    }
 
     if (C_Score)
       mutt_score_message(ctx->mailbox, e, false);
@@ -188,7 +234,8 @@ void ctx_update(struct Context *ctx)
     }
   }
 
-  mutt_sort_headers(ctx, true); /* rethread from scratch */
+  mutt_range_index_update(ctx);
+  mutt_sort_headers(ctx, !append); /* otherwise rethread from scratch */
 }
 
 /**
@@ -283,6 +330,7 @@ void ctx_update_tables(struct Context *ctx, bool committing)
        * last_tag being stale if it's not reset here.  */
       if (ctx->last_tag == m->emails[i])
         ctx->last_tag = NULL;
+      mutt_range_index_remove(ctx->range_index, m->emails[i]);
       email_free(&m->emails[i]);
     }
   }
@@ -28,6 +28,7 @@
 
 struct Email;
 struct EmailList;
+struct RangeIndex;
 struct NotifyCallback;
 
 /**
@@ -38,9 +39,14 @@ struct Context
   off_t vsize;
   char *pattern;                     ///< Limit pattern string
   struct PatternList *limit_pattern; ///< Compiled limit pattern
+  bool *limit_matches;               ///< Result of the limit pattern, by msgno
+  int limit_count;                   ///< Number of Emails in limit_matches
+  unsigned int limit_gen;            ///< Mailbox::gen when limit_matches was made
+  struct RangeIndex *range_index;    ///< Emails sorted by date and size, for range patterns
   struct Email *last_tag;            ///< Last tagged msg (used to link threads)
   struct MuttThread *tree;           ///< Top of thread tree
   struct Hash *thread_hash;          ///< Hash table for threading
+  int thread_count;                  ///< Number of Emails in the thread tree
   int msg_not_read_yet;              ///< Which msg "new" in pager, -1 if none
 
   struct Menu *menu;                 ///< Needed for pattern compilation
@@ -45,6 +45,7 @@
 #include "hdrline.h"
 #include "mx.h"
 #include "ncrypt/ncrypt.h"
+#include "range_index.h"
 #include "sendlib.h"
 #include "state.h"
 #ifdef USE_NOTMUCH
@@ -678,7 +679,10 @@ int mutt_copy_message_fp(FILE *fp_out, FILE *fp_in, struct Email *e,
         if (Context->mailbox->v2r[e->msgno] != -1)
           Context->vsize -= body->length - new_length;
 
+        /* the size is a key of the range index */
+        mutt_range_index_remove(Context->range_index, e);
         body->length = new_length;
+        mutt_range_index_add(Context->range_index, e);
         mutt_body_free(&body->parts);
       }
 
@@ -173,6 +173,7 @@ void mailbox_changed(struct Mailbox *m, enum NotifyMailbox action)
   if (!m)
     return;
 
+  m->gen++;
   struct EventMailbox ev_m = { m };
   notify_send(m->notify, NT_MAILBOX, action, &ev_m);
 }
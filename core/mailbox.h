@@ -99,6 +99,7 @@ struct Mailbox
   int email_max;                      ///< Number of pointers in emails
   int *v2r;                           ///< Mapping from virtual to real msgno
   int vcount;                         ///< The number of virtual messages
+  unsigned int gen;                   ///< Incremented whenever the Emails change or are renumbered
 
   bool notified;                      ///< User has been notified
   enum MailboxType magic;             ///< Mailbox type
@@ -53,6 +53,7 @@ void email_free(struct Email **ptr)
   FREE(&e->maildir_flags);
   FREE(&e->tree);
   FREE(&e->path);
+  FREE(&e->memo);
 #ifdef MIXMASTER
   mutt_list_free(&e->chain);
 #endif
@@ -31,6 +31,8 @@
 #include "ncrypt/ncrypt.h"
 #include "tags.h"
 
+struct PatternMemo;
+
 /**
  * struct Email - The envelope/body of an email
  */
@@ -68,6 +70,7 @@ struct Email
   bool matched  : 1;           ///< Search matches this Email
 
   bool attach_valid : 1;       ///< true when the attachment count is valid
+  bool range_indexed : 1;      ///< Email is in the Context's range index
 
   // the following are used to support collapsing threads
   bool collapsed : 1;          ///< Is this message part of a collapsed thread?
@@ -103,6 +106,7 @@ struct Email
 
   char *maildir_flags;         ///< Unknown maildir flags
 
+  struct PatternMemo *memo;    ///< Remembered Pattern results, a single allocation
   void *edata;                 ///< Driver-specific data
   void (*free_edata)(void **); ///< Driver-specific data free function
   struct Notify *notify;       ///< Notifications handler
@@ -327,6 +327,7 @@ void mutt_set_flag_update(struct Mailbox *m, struct Email *e, int flag, bool bf,
 
   if (update)
   {
+    m->gen++; /* invalidate any cached limit results */
     mutt_set_header_color(m, e);
 #ifdef USE_SIDEBAR
     mutt_menu_set_current_redraw(REDRAW_SIDEBAR);
@@ -604,6 +604,7 @@ void *mutt_hcache_dump(header_cache_t *hc, const struct Email *e, int *off, size
   nh.recipient = 0;
   nh.pair = 0;
   nh.attach_valid = false;
+  nh.range_indexed = false;
   nh.path = NULL;
   nh.tree = NULL;
   nh.thread = NULL;
@@ -611,6 +612,7 @@ void *mutt_hcache_dump(header_cache_t *hc, const struct Email *e, int *off, size
 #ifdef MIXMASTER
   STAILQ_INIT(&nh.chain);
 #endif
+  nh.memo = NULL;
   nh.edata = NULL;
 
   memcpy(d + *off, &nh, sizeof(struct Email));
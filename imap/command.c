@@ -55,6 +55,7 @@
 bool C_ImapServernoise; ///< Config: (imap) Display server warnings as error messages
 
 #define IMAP_CMD_BUFSIZE 512
+#define IMAP_CMD_BUFKEEP 65536 ///< Keep a line buffer of up to this size between lines
 
 /**
  * Capabilities - Server capabilities strings that we understand
@@ -68,7 +69,9 @@ static const char *const Capabilities[] = {
   "STARTTLS",    "LOGINDISABLED",  "IDLE",
   "SASL-IR",     "ENABLE",         "CONDSTORE",
   "QRESYNC",     "LIST-EXTENDED",  "X-GM-EXT-1",
-  NULL,
+  "NOTIFY",      "ESEARCH",        "BINARY",
+  "MULTIAPPEND", "LITERAL+",       "LITERAL-",
+  "UIDPLUS",     NULL,
 };
 
 /**
@@ -144,6 +147,49 @@ static int cmd_queue(struct ImapAccountData *adata, const char *cmdstr, ImapCmdF
   return 0;
 }
 
+/**
+ * imap_cmd_reserve - Make room in the command queue for a burst of commands
+ * @param adata Imap Account data
+ * @param count Number of commands about to be queued
+ *
+ * Grow the command queue so that @a count more commands can be queued with
+ * #IMAP_CMD_QUEUE and then sent to the server together, rather than draining
+ * the pipeline every `$imap_pipeline_depth` commands.  Any commands that are
+ * already queued, or in flight, are kept in order.
+ *
+ * The queue is never grown beyond #IMAP_MAX_BURST slots, so that the tag
+ * sequence numbers stay unique.  Bursts larger than that are still sent, but
+ * the pipeline will be drained part-way.
+ */
+void imap_cmd_reserve(struct ImapAccountData *adata, int count)
+{
+  if (!adata || (count <= 0))
+    return;
+
+  const int used = (adata->nextcmd - adata->lastcmd + adata->cmdslots) % adata->cmdslots;
+  int want = used + count + 1;
+  if (want <= adata->cmdslots)
+    return;
+
+  /* Grow geometrically, in case we're called for one command at a time */
+  want = MAX(want, 2 * adata->cmdslots);
+  if (want > IMAP_MAX_BURST)
+    want = IMAP_MAX_BURST;
+  if (want <= adata->cmdslots)
+    return;
+
+  struct ImapCommand *cmds = mutt_mem_calloc(want, sizeof(*cmds));
+  for (int i = 0; i < used; i++)
+    cmds[i] = adata->cmds[(adata->lastcmd + i) % adata->cmdslots];
+
+  FREE(&adata->cmds);
+  adata->cmds = cmds;
+  adata->cmdslots = want;
+  adata->lastcmd = 0;
+  adata->nextcmd = used;
+  mutt_debug(LL_DEBUG3, "grew IMAP command queue to %d slots\n", want);
+}
+
 /**
  * cmd_handle_fatal - When ImapAccountData is in fatal state, do what we can
  * @param adata Imap Account data
@@ -277,6 +323,16 @@ static void cmd_parse_expunge(struct ImapAccountData *adata, const char *s)
   mdata->reopen |= IMAP_EXPUNGE_PENDING;
 }
 
+/**
+ * compare_msn - Compare two MSNs - Implements ::sort_t
+ */
+static int compare_msn(const void *a, const void *b)
+{
+  const unsigned int ma = *(const unsigned int *) a;
+  const unsigned int mb = *(const unsigned int *) b;
+  return (ma > mb) - (ma < mb);
+}
+
 /**
  * cmd_parse_vanished - Parse vanished command
  * @param adata Imap Account data
@@ -319,9 +375,14 @@ static void cmd_parse_vanished(struct ImapAccountData *adata, char *s)
     return;
   }
 
+  /* MSNs of the vanished messages, in the numbering before this response */
+  unsigned int *exp_msns = NULL;
+  size_t num_exp = 0;
+  size_t max_exp = 0;
+
   while ((rc = mutt_seqset_iterator_next(iter, &uid)) == 0)
   {
-    struct Email *e = mutt_hash_int_find(mdata->uid_hash, uid);
+    struct Email *e = imap_uid_find(mdata, uid);
     if (!e)
       continue;
 
@@ -348,19 +409,42 @@ static void cmd_parse_vanished(struct ImapAccountData *adata, char *s)
 
     if (!earlier)
     {
-      /* decrement seqno of those above. */
-      for (unsigned int cur = exp_msn; cur < mdata->max_msn; cur++)
+      if (num_exp == max_exp)
       {
-        e = mdata->msn_index[cur];
-        if (e)
-          imap_edata_get(e)->msn--;
-        mdata->msn_index[cur - 1] = e;
+        max_exp = MAX(2 * max_exp, 64);
+        mutt_mem_realloc(&exp_msns, max_exp * sizeof(unsigned int));
       }
+      exp_msns[num_exp++] = exp_msn;
+    }
+  }
+
+  /* Close the gaps in the msn_index and renumber the messages above them
+   * in a single pass, rather than once per vanished message. */
+  if (num_exp > 0)
+  {
+    qsort(exp_msns, num_exp, sizeof(unsigned int), compare_msn);
 
-      mdata->msn_index[mdata->max_msn - 1] = NULL;
-      mdata->max_msn--;
+    size_t next = 0;
+    unsigned int dst = exp_msns[0] - 1;
+    for (unsigned int cur = dst; cur < mdata->max_msn; cur++)
+    {
+      if ((next < num_exp) && (cur == (exp_msns[next] - 1)))
+      {
+        next++;
+        continue;
+      }
+
+      struct Email *e = mdata->msn_index[cur];
+      if (e)
+        imap_edata_get(e)->msn = dst + 1;
+      mdata->msn_index[dst++] = e;
     }
+
+    for (unsigned int cur = dst; cur < mdata->max_msn; cur++)
+      mdata->msn_index[cur] = NULL;
+    mdata->max_msn = dst;
   }
+  FREE(&exp_msns);
 
   if (rc < 0)
     mutt_debug(LL_DEBUG1, "VANISHED: illegal seqset %s\n", s);
@@ -381,10 +465,11 @@ static void cmd_parse_vanished(struct ImapAccountData *adata, char *s)
  */
 static void cmd_parse_fetch(struct ImapAccountData *adata, char *s)
 {
-  unsigned int msn, uid;
+  unsigned int msn;
+  unsigned long long num;
+  struct ImapToken tok;
   struct Email *e = NULL;
   char *flags = NULL;
-  int uid_checked = 0;
   bool server_changes = false;
 
   struct ImapMboxData *mdata = imap_mdata_get(adata->mailbox);
@@ -415,83 +500,74 @@ static void cmd_parse_fetch(struct ImapAccountData *adata, char *s)
   s = imap_next_word(s);
   s = imap_next_word(s);
 
-  if (*s != '(')
+  s = imap_next_token(s, &tok);
+  if (tok.type != IMAP_TOK_OPEN)
   {
     mutt_debug(LL_DEBUG1, "Malformed FETCH response\n");
     return;
   }
-  s++;
 
-  while (*s)
+  while (true)
   {
-    SKIPWS(s);
-    size_t plen = mutt_str_startswith(s, "FLAGS", CASE_IGNORE);
-    if (plen != 0)
+    char *next = imap_next_token(s, &tok);
+    if (imap_token_is(&tok, "FLAGS"))
     {
-      flags = s;
-      if (uid_checked)
-        break;
-
-      s += plen;
-      SKIPWS(s);
-      if (*s != '(')
+      flags = tok.str;
+      s = imap_next_token(next, &tok);
+      if (tok.type != IMAP_TOK_OPEN)
       {
-        mutt_debug(LL_DEBUG1, "bogus FLAGS response: %s\n", s);
+        mutt_debug(LL_DEBUG1, "bogus FLAGS response: %s\n", tok.str);
         return;
       }
-      s++;
-      while (*s && (*s != ')'))
-        s++;
-      if (*s == ')')
-        s++;
-      else
+      do
+      {
+        s = imap_next_token(s, &tok);
+      } while (tok.type == IMAP_TOK_ATOM);
+      if (tok.type != IMAP_TOK_CLOSE)
       {
-        mutt_debug(LL_DEBUG1, "Unterminated FLAGS response: %s\n", s);
+        mutt_debug(LL_DEBUG1, "Unterminated FLAGS response: %s\n", tok.str);
         return;
       }
     }
-    else if ((plen = mutt_str_startswith(s, "UID", CASE_IGNORE)))
+    else if (imap_token_is(&tok, "UID"))
     {
-      s += plen;
-      SKIPWS(s);
-      if (mutt_str_atoui(s, &uid) < 0)
+      s = imap_next_token(next, &tok);
+      if ((imap_token_number(&tok, &num) < 0) || (num > UINT_MAX))
       {
         mutt_debug(LL_DEBUG1, "Illegal UID.  Skipping update\n");
         return;
       }
-      if (uid != imap_edata_get(e)->uid)
+      if (num != imap_edata_get(e)->uid)
       {
         mutt_debug(LL_DEBUG1, "UID vs MSN mismatch.  Skipping update\n");
         return;
       }
-      uid_checked = 1;
-      if (flags)
+    }
+    else if (imap_token_is(&tok, "BODYSTRUCTURE"))
+    {
+      s = next;
+      if (imap_parse_bodystructure(adata->mailbox, e, &s) < 0)
         break;
-      s = imap_next_word(s);
     }
-    else if ((plen = mutt_str_startswith(s, "MODSEQ", CASE_IGNORE)))
+    else if (imap_token_is(&tok, "MODSEQ"))
     {
-      s += plen;
-      SKIPWS(s);
-      if (*s != '(')
+      s = imap_next_token(next, &tok);
+      if (tok.type != IMAP_TOK_OPEN)
       {
-        mutt_debug(LL_DEBUG1, "bogus MODSEQ response: %s\n", s);
+        mutt_debug(LL_DEBUG1, "bogus MODSEQ response: %s\n", tok.str);
         return;
       }
-      s++;
-      while (*s && (*s != ')'))
-        s++;
-      if (*s == ')')
-        s++;
-      else
+      s = imap_next_token(s, &tok);
+      s = imap_next_token(s, &tok);
+      if (tok.type != IMAP_TOK_CLOSE)
       {
-        mutt_debug(LL_DEBUG1, "Unterminated MODSEQ response: %s\n", s);
+        mutt_debug(LL_DEBUG1, "Unterminated MODSEQ response: %s\n", tok.str);
         return;
       }
     }
-    else if (*s == ')')
+    else if ((tok.type == IMAP_TOK_CLOSE) || (tok.type == IMAP_TOK_END))
       break; /* end of request */
-    else if (*s)
+    else
     {
       mutt_debug(LL_DEBUG2, "Only handle FLAGS updates\n");
       break;
@@ -774,10 +850,67 @@ static void cmd_parse_search(struct ImapAccountData *adata, const char *s)
   {
     if (mutt_str_atoui(s, &uid) < 0)
       continue;
-    e = mutt_hash_int_find(mdata->uid_hash, uid);
+    e = imap_uid_find(mdata, uid);
+    if (e)
+      e->matched = true;
+  }
+}
+
+/**
+ * cmd_parse_esearch - Store ESEARCH response for searched messages
+ * @param adata Imap Account data
+ * @param s     Command string with search results
+ *
+ * Handle an ESEARCH (RFC4731) response, e.g.
+ * `* ESEARCH (TAG "a0012") UID ALL 4:19,21,28`
+ */
+static void cmd_parse_esearch(struct ImapAccountData *adata, char *s)
+{
+  unsigned int uid = 0;
+  struct ImapMboxData *mdata = adata->mailbox->mdata;
+
+  mutt_debug(LL_DEBUG2, "Handling ESEARCH\n");
+
+  s = imap_next_word(s);
+
+  /* skip the search correlator */
+  if (*s == '(')
+  {
+    s = strchr(s, ')');
+    if (!s)
+      return;
+    s++;
+    SKIPWS(s);
+  }
+
+  if (mutt_str_startswith(s, "UID", CASE_IGNORE))
+    s = imap_next_word(s);
+
+  /* return data is a list of name/value pairs */
+  while (*s && !mutt_str_startswith(s, "ALL ", CASE_IGNORE))
+    s = imap_next_word(imap_next_word(s));
+
+  if (*s == '\0')
+    return;
+
+  s = imap_next_word(s);
+  char *end = s;
+  while (*end && !IS_SPACE(*end))
+    end++;
+  *end = '\0';
+
+  struct SeqsetIterator *iter = mutt_seqset_iterator_new(s);
+  if (!iter)
+    return;
+
+  while (mutt_seqset_iterator_next(iter, &uid) == 0)
+  {
+    struct Email *e = imap_uid_find(mdata, uid);
     if (e)
       e->matched = true;
   }
+
+  mutt_seqset_iterator_free(&iter);
 }
 
 /**
@@ -1014,6 +1147,8 @@ static int cmd_handle_untagged(struct ImapAccountData *adata)
     cmd_parse_myrights(adata, s);
   else if (mutt_str_startswith(s, "SEARCH", CASE_IGNORE))
     cmd_parse_search(adata, s);
+  else if (mutt_str_startswith(s, "ESEARCH", CASE_IGNORE))
+    cmd_parse_esearch(adata, s);
   else if (mutt_str_startswith(s, "STATUS", CASE_IGNORE))
     cmd_parse_status(adata, s);
   else if (mutt_str_startswith(s, "ENABLED", CASE_IGNORE))
@@ -1091,8 +1226,10 @@ int imap_cmd_step(struct ImapAccountData *adata)
   {
     if (len == adata->blen)
     {
-      mutt_mem_realloc(&adata->buf, adata->blen + IMAP_CMD_BUFSIZE);
-      adata->blen = adata->blen + IMAP_CMD_BUFSIZE;
+      /* grow geometrically, huge SEARCH or FETCH lines are common */
+      size_t blen = MAX(adata->blen * 2, IMAP_CMD_BUFSIZE);
+      mutt_mem_realloc(&adata->buf, blen);
+      adata->blen = blen;
       mutt_debug(LL_DEBUG3, "grew buffer to %lu bytes\n", adata->blen);
     }
 
@@ -1114,8 +1251,9 @@ int imap_cmd_step(struct ImapAccountData *adata)
    * one character free when we've read a full line) */
   while (len == adata->blen);
 
-  /* don't let one large string make cmd->buf hog memory forever */
-  if ((adata->blen > IMAP_CMD_BUFSIZE) && (len <= IMAP_CMD_BUFSIZE))
+  /* don't let one large string make cmd->buf hog memory forever, but don't
+   * reallocate for every line of a response that mixes long and short ones */
+  if ((adata->blen > IMAP_CMD_BUFKEEP) && (len <= IMAP_CMD_BUFSIZE))
   {
     mutt_mem_realloc(&adata->buf, IMAP_CMD_BUFSIZE);
     adata->blen = IMAP_CMD_BUFSIZE;
@@ -45,6 +45,7 @@
 #include "mutt.h"
 #include "imap.h"
 #include "auth.h"
+#include "bcache.h"
 #include "commands.h"
 #include "globals.h"
 #include "hook.h"
@@ -65,6 +66,7 @@ struct stat;
 
 /* These Config Variables are only used in imap/imap.c */
 bool C_ImapIdle; ///< Config: (imap) Use the IMAP IDLE extension to check for new mail
+bool C_ImapNotify; ///< Config: (imap) Use the IMAP NOTIFY extension to watch all mailboxes
 bool C_ImapRfc5161; ///< Config: (imap) Use the IMAP ENABLE extension to select capabilities
 
 /**
@@ -293,191 +295,1042 @@ static bool compare_flags_for_copy(struct Email *e)
 }
 
 /**
- * sync_helper - Sync flag changes to the server
- * @param m     Selected Imap Mailbox
- * @param right ACL, see #AclFlags
- * @param flag  NeoMutt flag, e.g. #MUTT_DELETED
- * @param name  Name of server flag
+ * compare_uid - Compare two Emails by UID - Implements ::sort_t
+ */
+static int compare_uid(const void *a, const void *b)
+{
+  const struct Email *ea = *(struct Email const *const *) a;
+  const struct Email *eb = *(struct Email const *const *) b;
+  return imap_edata_get((struct Email *) ea)->uid -
+         imap_edata_get((struct Email *) eb)->uid;
+}
+
+/**
+ * struct SyncFlag - A server flag that can be synced
+ */
+struct SyncFlag
+{
+  AclFlags right;   ///< ACL needed to change the flag, e.g. #MUTT_ACL_SEEN
+  const char *name; ///< Name of server flag
+};
+
+/**
+ * SyncFlags - Server flags that mirror the Email flags
+ *
+ * @note The order must match the bits set by sync_flag_change()
+ */
+static const struct SyncFlag SyncFlags[] = {
+  { MUTT_ACL_DELETE, "\\Deleted" },
+  { MUTT_ACL_WRITE,  "\\Flagged" },
+  { MUTT_ACL_WRITE,  "Old" },
+  { MUTT_ACL_SEEN,   "\\Seen" },
+  { MUTT_ACL_WRITE,  "\\Answered" },
+};
+
+#define SYNC_FLAG_COUNT mutt_array_size(SyncFlags)
+
+/**
+ * sync_flag_change - Work out which server flags need changing for an Email
+ * @param[in]  e      Email
+ * @param[in]  usable Bitmask of flags that we may change, see #SyncFlags
+ * @param[out] add    Bitmask of flags to be set on the server
+ * @param[out] del    Bitmask of flags to be cleared on the server
+ */
+static void sync_flag_change(struct Email *e, unsigned int usable,
+                             unsigned int *add, unsigned int *del)
+{
+  struct ImapEmailData *edata = imap_edata_get(e);
+  const bool local[SYNC_FLAG_COUNT] = { e->deleted, e->flagged, e->old, e->read,
+                                        e->replied };
+  const bool remote[SYNC_FLAG_COUNT] = { edata->deleted, edata->flagged, edata->old,
+                                         edata->read, edata->replied };
+
+  *add = 0;
+  *del = 0;
+  for (size_t i = 0; i < SYNC_FLAG_COUNT; i++)
+  {
+    if (!(usable & (1 << i)) || (local[i] == remote[i]))
+      continue;
+    if (local[i])
+      *add |= (1 << i);
+    else
+      *del |= (1 << i);
+  }
+}
+
+/**
+ * sync_flag_names - Create a list of server flag names
+ * @param buf  Buffer for the result
+ * @param mask Bitmask of flags, see #SyncFlags
+ */
+static void sync_flag_names(struct Buffer *buf, unsigned int mask)
+{
+  mutt_buffer_reset(buf);
+  for (size_t i = 0; i < SYNC_FLAG_COUNT; i++)
+  {
+    if (!(mask & (1 << i)))
+      continue;
+    if (!mutt_buffer_is_empty(buf))
+      mutt_buffer_addch(buf, ' ');
+    mutt_buffer_addstr(buf, SyncFlags[i].name);
+  }
+}
+
+/**
+ * sync_plan_group - Create the STORE commands for one group of changes
+ * @param[in]  emails  Emails, sorted by UID
+ * @param[in]  count   Number of Emails
+ * @param[in]  keys    Change key for each Email, 0 if unchanged
+ * @param[in]  key     Key of the group to create commands for
+ * @param[in]  add     Server flags to set, e.g. "\\Seen \\Flagged"
+ * @param[in]  del     Server flags to clear
+ * @param[in]  mods    STORE modifiers, e.g. "(UNCHANGEDSINCE 42) ", or ""
+ * @param[in]  silent  If true, the server needn't echo the new flags
+ * @param[out] cmds    List of commands to append to
+ * @retval num Number of Emails in the group
+ *
+ * The UIDs of the group are turned into compact message sets.  A range is only
+ * broken by an active Email that doesn't belong to the group.
+ */
+static int sync_plan_group(struct Email **emails, int count, const unsigned int *keys,
+                           unsigned int key, const char *add, const char *del,
+                           const char *mods, bool silent, struct ListHead *cmds)
+{
+  const char *store = silent ? "FLAGS.SILENT" : "FLAGS";
+
+  struct Buffer set = mutt_buffer_make(IMAP_MAX_CMDLEN);
+  unsigned int setstart = 0;
+  unsigned int setend = 0;
+  int matched = 0;
+
+  for (int n = 0; n <= count; n++)
+  {
+    const bool last = (n == count);
+    struct Email *e = last ? NULL : emails[n];
+
+    if (!last && (keys[n] == key))
+    {
+      const unsigned int uid = imap_edata_get(e)->uid;
+      matched++;
+      if (setstart == 0)
+        setstart = uid;
+      setend = uid;
+      continue;
+    }
+
+    /* inactive Emails don't break a range */
+    if (!last && !e->active)
+      continue;
+
+    if (setstart != 0)
+    {
+      if (!mutt_buffer_is_empty(&set))
+        mutt_buffer_addch(&set, ',');
+      if (setend > setstart)
+        mutt_buffer_add_printf(&set, "%u:%u", setstart, setend);
+      else
+        mutt_buffer_add_printf(&set, "%u", setstart);
+      setstart = 0;
+    }
+
+    if (mutt_buffer_is_empty(&set) || (!last && (mutt_buffer_len(&set) < IMAP_MAX_CMDLEN)))
+      continue;
+
+    struct Buffer cmd = mutt_buffer_make(IMAP_MAX_CMDLEN + 64);
+    if (add)
+    {
+      mutt_buffer_printf(&cmd, "UID STORE %s %s+%s (%s)", mutt_b2s(&set), mods, store, add);
+      mutt_list_insert_tail(cmds, mutt_str_strdup(mutt_b2s(&cmd)));
+    }
+    if (del)
+    {
+      mutt_buffer_printf(&cmd, "UID STORE %s %s-%s (%s)", mutt_b2s(&set), mods, store, del);
+      mutt_list_insert_tail(cmds, mutt_str_strdup(mutt_b2s(&cmd)));
+    }
+    mutt_buffer_dealloc(&cmd);
+    mutt_buffer_reset(&set);
+  }
+
+  mutt_buffer_dealloc(&set);
+  return matched;
+}
+
+/**
+ * sync_flags_usable - Which server flags may we change?
+ * @param m Selected Imap Mailbox
+ * @retval num Bitmask of flags, see #SyncFlags
+ */
+static unsigned int sync_flags_usable(struct Mailbox *m)
+{
+  struct ImapMboxData *mdata = imap_mdata_get(m);
+  unsigned int usable = 0;
+
+  for (size_t i = 0; i < SYNC_FLAG_COUNT; i++)
+  {
+    if ((m->rights & SyncFlags[i].right) == 0)
+      continue;
+    if ((SyncFlags[i].right == MUTT_ACL_WRITE) &&
+        !imap_has_flag(&mdata->flags, SyncFlags[i].name))
+    {
+      continue;
+    }
+    usable |= (1 << i);
+  }
+
+  return usable;
+}
+
+/**
+ * sync_flags - Sync all flag changes to the server in one burst
+ * @param m Selected Imap Mailbox
  * @retval >=0 Success, number of messages
  * @retval  -1 Failure
+ *
+ * Every changed Email is classified by the set of server flags that must be
+ * added and removed.  Emails with the same changes are grouped together and
+ * each group is turned into as few `UID STORE` commands as possible.
+ *
+ * All the commands are pipelined in a single burst and we wait for the server
+ * once, rather than once per flag (or per message).
  */
-static int sync_helper(struct Mailbox *m, AclFlags right, int flag, const char *name)
+static int sync_flags(struct Mailbox *m)
 {
+  struct ImapAccountData *adata = imap_adata_get(m);
+  struct ImapMboxData *mdata = imap_mdata_get(m);
+  if (!adata || !mdata || (adata->mailbox != m))
+    return -1;
+
+  unsigned int usable = sync_flags_usable(m);
+  if ((usable == 0) || (m->msg_count == 0))
+    return 0;
+
+  /* Work on a copy sorted by UID, so that the message sets are compact */
+  struct Email **emails = mutt_mem_malloc(m->msg_count * sizeof(struct Email *));
   int count = 0;
-  int rc;
-  char buf[1024];
+  for (int i = 0; i < m->msg_count; i++)
+  {
+    if (!m->emails[i])
+      break;
+    emails[count++] = m->emails[i];
+  }
+  qsort(emails, count, sizeof(struct Email *), compare_uid);
+
+  /* A key combines the flags to add (high bits) and delete (low bits) */
+  unsigned int *keys = mutt_mem_calloc(MAX(count, 1), sizeof(unsigned int));
+  bool used[1 << (2 * SYNC_FLAG_COUNT)] = { false };
+  for (int i = 0; i < count; i++)
+  {
+    struct Email *e = emails[i];
+    /* don't include pending expunged messages */
+    if (!e->active || !e->changed || (e->index == INT_MAX))
+      continue;
+
+    unsigned int add = 0;
+    unsigned int del = 0;
+    sync_flag_change(e, usable, &add, &del);
+    keys[i] = (add << SYNC_FLAG_COUNT) | del;
+    used[keys[i]] = true;
+  }
+
+  struct ListHead cmds = STAILQ_HEAD_INITIALIZER(cmds);
+  struct Buffer add = mutt_buffer_make(128);
+  struct Buffer del = mutt_buffer_make(128);
+  int rc = 0;
+
+  for (unsigned int key = 1; key < mutt_array_size(used); key++)
+  {
+    if (!used[key])
+      continue;
+
+    sync_flag_names(&add, key >> SYNC_FLAG_COUNT);
+    sync_flag_names(&del, key & ((1 << SYNC_FLAG_COUNT) - 1));
+    rc += sync_plan_group(emails, count, keys, key,
+                          mutt_buffer_is_empty(&add) ? NULL : mutt_b2s(&add),
+                          mutt_buffer_is_empty(&del) ? NULL : mutt_b2s(&del), "",
+                          true, &cmds);
+  }
+
+  mutt_buffer_dealloc(&add);
+  mutt_buffer_dealloc(&del);
+  FREE(&keys);
+  FREE(&emails);
+
+  int num_cmds = 0;
+  struct ListNode *np = NULL;
+  STAILQ_FOREACH(np, &cmds, entries)
+  {
+    num_cmds++;
+  }
+
+  mutt_debug(LL_DEBUG2, "syncing %d messages with %d commands\n", rc, num_cmds);
+  imap_cmd_reserve(adata, num_cmds);
+
+  STAILQ_FOREACH(np, &cmds, entries)
+  {
+    if (imap_exec(adata, np->data, IMAP_CMD_QUEUE) != IMAP_EXEC_SUCCESS)
+    {
+      rc = -1;
+      break;
+    }
+  }
+
+  mutt_list_free(&cmds);
+  return rc;
+}
+
+/**
+ * struct JournalEntry - A change that hasn't reached the server yet
+ */
+struct JournalEntry
+{
+  unsigned int uid;          ///< UID of the Email
+  unsigned int add;          ///< Server flags to set, see #SyncFlags
+  unsigned int del;          ///< Server flags to clear, see #SyncFlags
+  unsigned long long modseq; ///< Mailbox MODSEQ the change was based on, 0 if unknown
+  bool expunge;              ///< Expunge the Email, once it's deleted
+  size_t seq;                ///< Order in which the changes were made
+};
+
+/* The journal is kept in the message cache, under a name that
+ * msg_cache_clean_cb() won't mistake for a message */
+#define IMAP_JOURNAL_ID "journal"
+
+#define SYNC_FLAG_DELETED (1 << 0) ///< "\Deleted" in #SyncFlags
+
+/**
+ * journal_read - Read the pending changes of a Mailbox
+ * @param[in]  m       Selected Imap Mailbox
+ * @param[out] entries Changes, must be freed by the caller
+ * @retval num Number of changes
+ *
+ * A journal belonging to a different UIDVALIDITY is useless, so it's deleted.
+ */
+static size_t journal_read(struct Mailbox *m, struct JournalEntry **entries)
+{
+  struct ImapMboxData *mdata = imap_mdata_get(m);
+  size_t count = 0;
+  size_t max = 0;
+
+  *entries = NULL;
+  mdata->bcache = imap_cache_open(m);
+  FILE *fp = mutt_bcache_get(mdata->bcache, IMAP_JOURNAL_ID);
+  if (!fp)
+    return 0;
+
+  unsigned int uv = 0;
+  if ((fscanf(fp, "uidvalidity %u\n", &uv) != 1) || (uv != mdata->uid_validity))
+  {
+    mutt_debug(LL_DEBUG1, "discarding journal for UIDVALIDITY %u\n", uv);
+    mutt_file_fclose(&fp);
+    mutt_bcache_del(mdata->bcache, IMAP_JOURNAL_ID);
+    return 0;
+  }
+
+  struct JournalEntry je = { 0 };
+  int expunge = 0;
+  while (fscanf(fp, "%u %u %u %llu %d\n", &je.uid, &je.add, &je.del,
+                &je.modseq, &expunge) == 5)
+  {
+    if (count == max)
+    {
+      max += 256;
+      mutt_mem_realloc(entries, max * sizeof(struct JournalEntry));
+    }
+    je.expunge = expunge;
+    je.seq = count;
+    (*entries)[count++] = je;
+  }
+
+  mutt_file_fclose(&fp);
+  return count;
+}
+
+/**
+ * journal_sort - Compare two journal entries by UID, then age - Implements ::sort_t
+ */
+static int journal_sort(const void *a, const void *b)
+{
+  const struct JournalEntry *ja = a;
+  const struct JournalEntry *jb = b;
+
+  if (ja->uid != jb->uid)
+    return (ja->uid < jb->uid) ? -1 : 1;
+  return (ja->seq < jb->seq) ? -1 : (ja->seq > jb->seq);
+}
+
+/**
+ * journal_coalesce - Merge all the changes to each Email
+ * @param entries Changes
+ * @param count   Number of changes
+ * @retval num Number of changes left, sorted by UID
+ *
+ * Later changes override earlier ones, so setting and clearing a flag cancel
+ * out.  The oldest known MODSEQ is kept, so that conflicts are still noticed.
+ */
+static size_t journal_coalesce(struct JournalEntry *entries, size_t count)
+{
+  if (count == 0)
+    return 0;
+
+  qsort(entries, count, sizeof(struct JournalEntry), journal_sort);
+
+  size_t out = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    struct JournalEntry *je = &entries[i];
+    struct JournalEntry *prev = (out > 0) ? &entries[out - 1] : NULL;
+
+    if (!prev || (prev->uid != je->uid))
+    {
+      entries[out++] = *je;
+      continue;
+    }
+
+    prev->add = (prev->add & ~je->del) | je->add;
+    prev->del = (prev->del & ~je->add) | je->del;
+    prev->expunge = je->expunge || (prev->expunge && !(je->del & SYNC_FLAG_DELETED));
+    if (prev->modseq == 0)
+      prev->modseq = je->modseq;
+  }
+
+  size_t keep = 0;
+  for (size_t i = 0; i < out; i++)
+  {
+    if ((entries[i].add != 0) || (entries[i].del != 0) || entries[i].expunge)
+      entries[keep++] = entries[i];
+  }
+
+  return keep;
+}
+
+/**
+ * journal_write - Save the pending changes of a Mailbox
+ * @param m       Selected Imap Mailbox
+ * @param entries Changes, coalesced
+ * @param count   Number of changes
+ * @retval  0 Success
+ * @retval -1 Failure
+ */
+static int journal_write(struct Mailbox *m, const struct JournalEntry *entries, size_t count)
+{
+  struct ImapMboxData *mdata = imap_mdata_get(m);
+
+  if (count == 0)
+  {
+    mutt_bcache_del(mdata->bcache, IMAP_JOURNAL_ID);
+    return 0;
+  }
+
+  FILE *fp = mutt_bcache_put(mdata->bcache, IMAP_JOURNAL_ID);
+  if (!fp)
+    return -1;
+
+  fprintf(fp, "uidvalidity %u\n", mdata->uid_validity);
+  for (size_t i = 0; i < count; i++)
+  {
+    fprintf(fp, "%u %u %u %llu %d\n", entries[i].uid, entries[i].add,
+            entries[i].del, entries[i].modseq, entries[i].expunge);
+  }
+
+  if (mutt_file_fclose(&fp) != 0)
+    return -1;
+
+  return mutt_bcache_commit(mdata->bcache, IMAP_JOURNAL_ID);
+}
+
+/**
+ * journal_record - Save the local changes of a Mailbox in its journal
+ * @param m       Selected Imap Mailbox
+ * @param expunge If true, the deleted Emails will be expunged
+ * @param commit  If true, treat the changes as done
+ * @retval >=0 Success, number of Emails recorded
+ * @retval  -1 Failure, e.g. there's no message cache
+ *
+ * The journal is replayed by journal_replay() the next time the Mailbox is
+ * opened, so nothing is lost if the connection drops.
+ *
+ * If commit is set, the Emails are considered to be in sync: the hcache is
+ * updated and the later changes are recorded relative to these ones.
+ */
+static int journal_record(struct Mailbox *m, bool expunge, bool commit)
+{
+  struct ImapMboxData *mdata = imap_mdata_get(m);
+  struct JournalEntry *entries = NULL;
+  size_t count = journal_read(m, &entries);
+  size_t max = count;
+  int recorded = 0;
+
+  if (!mdata->bcache)
+    return -1;
+
+  const unsigned int usable = sync_flags_usable(m);
+
+#ifdef USE_HCACHE
+  if (commit)
+    mdata->hcache = imap_hcache_open(imap_adata_get(m), mdata);
+#endif
+
+  for (int i = 0; i < m->msg_count; i++)
+  {
+    struct Email *e = m->emails[i];
+    if (!e)
+      break;
+    if (!e->active || (e->index == INT_MAX))
+      continue;
+
+    struct JournalEntry je = { 0 };
+    if (e->changed)
+      sync_flag_change(e, usable, &je.add, &je.del);
+    je.expunge = expunge && e->deleted && (m->rights & MUTT_ACL_DELETE);
+    if ((je.add == 0) && (je.del == 0) && !je.expunge)
+      continue;
+
+    struct ImapEmailData *edata = imap_edata_get(e);
+    je.uid = edata->uid;
+    je.modseq = mdata->modseq;
+    je.seq = count;
+
+    if (count == max)
+    {
+      max += 256;
+      mutt_mem_realloc(&entries, max * sizeof(struct JournalEntry));
+    }
+    entries[count++] = je;
+    recorded++;
+
+    if (commit)
+    {
+      edata->deleted = e->deleted;
+      edata->flagged = e->flagged;
+      edata->old = e->old;
+      edata->read = e->read;
+      edata->replied = e->replied;
+      e->changed = false;
+#ifdef USE_HCACHE
+      imap_hcache_put(mdata, e);
+#endif
+    }
+  }
+
+#ifdef USE_HCACHE
+  if (commit)
+    imap_hcache_close(mdata);
+#endif
+
+  int rc = recorded;
+  if (recorded > 0)
+  {
+    count = journal_coalesce(entries, count);
+    if (journal_write(m, entries, count) < 0)
+      rc = -1;
+  }
+
+  FREE(&entries);
+  return rc;
+}
+
+/**
+ * journal_clear - Forget the pending changes of a Mailbox
+ * @param m Selected Imap Mailbox
+ */
+static void journal_clear(struct Mailbox *m)
+{
+  struct ImapMboxData *mdata = imap_mdata_get(m);
+
+  mdata->bcache = imap_cache_open(m);
+  if (mutt_bcache_exists(mdata->bcache, IMAP_JOURNAL_ID) == 0)
+    mutt_bcache_del(mdata->bcache, IMAP_JOURNAL_ID);
+}
+
+/**
+ * journal_replay - Send the changes made while we were offline
+ * @param m Selected Imap Mailbox
+ * @retval >=0 Success, number of Emails changed
+ * @retval  -1 Failure, the journal is kept
+ *
+ * The changes are coalesced and grouped, like sync_flags() does.  If the
+ * server supports CONDSTORE, each STORE is made conditional on the MODSEQ
+ * that the change was based on.  If the Email was changed on the server in
+ * the meantime, the server's flags win.
+ *
+ * The flags aren't stored silently, so the server's FETCH responses update
+ * the Emails, whatever the outcome.  Deleted Emails are only expunged if the
+ * server supports UIDPLUS, otherwise they're left for the next sync.
+ */
+static int journal_replay(struct Mailbox *m)
+{
+  struct ImapAccountData *adata = imap_adata_get(m);
+  struct JournalEntry *entries = NULL;
+  size_t count = journal_read(m, &entries);
+  if (count == 0)
+    return 0;
+
+  count = journal_coalesce(entries, count);
+  if ((count == 0) || (m->msg_count == 0))
+  {
+    FREE(&entries);
+    journal_clear(m);
+    return 0;
+  }
+
+  /* Work on a copy sorted by UID, so that the entries can be matched up */
+  struct Email **emails = mutt_mem_malloc(m->msg_count * sizeof(struct Email *));
+  int num = 0;
+  for (int i = 0; i < m->msg_count; i++)
+  {
+    if (!m->emails[i])
+      break;
+    emails[num++] = m->emails[i];
+  }
+  qsort(emails, num, sizeof(struct Email *), compare_uid);
+
+  const unsigned int usable = sync_flags_usable(m);
+  const bool condstore = (adata->capabilities & IMAP_CAP_CONDSTORE) && C_ImapCondstore;
+  const bool uidplus = (adata->capabilities & IMAP_CAP_UIDPLUS) &&
+                       (m->rights & MUTT_ACL_DELETE);
+  unsigned int *keys = mutt_mem_calloc(MAX(num, 1), sizeof(unsigned int));
+  unsigned long long *modseqs = mutt_mem_calloc(MAX(num, 1), sizeof(unsigned long long));
+  bool *expunge = mutt_mem_calloc(MAX(num, 1), sizeof(bool));
+
+  size_t j = 0;
+  for (int i = 0; (i < num) && (j < count); i++)
+  {
+    const unsigned int uid = imap_edata_get(emails[i])->uid;
+    while ((j < count) && (entries[j].uid < uid))
+      j++;
+    if ((j == count) || (entries[j].uid != uid) || !emails[i]->active)
+      continue;
 
-  if (!m)
-    return -1;
+    keys[i] = ((entries[j].add & usable) << SYNC_FLAG_COUNT) | (entries[j].del & usable);
+    modseqs[i] = condstore ? entries[j].modseq : 0;
+    expunge[i] = uidplus && entries[j].expunge;
+  }
+  FREE(&entries);
 
-  if ((m->rights & right) == 0)
-    return 0;
+  struct ListHead cmds = STAILQ_HEAD_INITIALIZER(cmds);
+  struct Buffer add = mutt_buffer_make(128);
+  struct Buffer del = mutt_buffer_make(128);
+  unsigned int *group = mutt_mem_calloc(MAX(num, 1), sizeof(unsigned int));
+  char mods[64];
+  int rc = 0;
 
-  if ((right == MUTT_ACL_WRITE) && !imap_has_flag(&imap_mdata_get(m)->flags, name))
-    return 0;
+  /* One pass per MODSEQ, there's rarely more than one */
+  for (int first = 0; first < num; first++)
+  {
+    if (keys[first] == 0)
+      continue;
 
-  snprintf(buf, sizeof(buf), "+FLAGS.SILENT (%s)", name);
-  rc = imap_exec_msgset(m, "UID STORE", buf, flag, true, false);
-  if (rc < 0)
-    return rc;
-  count += rc;
+    const unsigned long long modseq = modseqs[first];
+    bool used[1 << (2 * SYNC_FLAG_COUNT)] = { false };
+    for (int i = 0; i < num; i++)
+    {
+      group[i] = 0;
+      if ((keys[i] != 0) && (modseqs[i] == modseq))
+      {
+        group[i] = keys[i];
+        used[keys[i]] = true;
+        keys[i] = 0;
+      }
+    }
 
-  buf[0] = '-';
-  rc = imap_exec_msgset(m, "UID STORE", buf, flag, true, true);
-  if (rc < 0)
-    return rc;
-  count += rc;
+    mods[0] = '\0';
+    if (modseq != 0)
+      snprintf(mods, sizeof(mods), "(UNCHANGEDSINCE %llu) ", modseq);
 
-  return count;
+    for (unsigned int key = 1; key < mutt_array_size(used); key++)
+    {
+      if (!used[key])
+        continue;
+
+      sync_flag_names(&add, key >> SYNC_FLAG_COUNT);
+      sync_flag_names(&del, key & ((1 << SYNC_FLAG_COUNT) - 1));
+      rc += sync_plan_group(emails, num, group, key,
+                            mutt_buffer_is_empty(&add) ? NULL : mutt_b2s(&add),
+                            mutt_buffer_is_empty(&del) ? NULL : mutt_b2s(&del),
+                            mods, false, &cmds);
+    }
+  }
+
+  /* The expunges go last, once the \Deleted flags have been set */
+  struct Buffer set = mutt_buffer_make(IMAP_MAX_CMDLEN);
+  for (int i = 0; i <= num; i++)
+  {
+    const bool last = (i == num);
+    if (!last && expunge[i])
+    {
+      int end = i;
+      while ((end + 1 < num) && expunge[end + 1])
+        end++;
+      if (!mutt_buffer_is_empty(&set))
+        mutt_buffer_addch(&set, ',');
+      mutt_buffer_add_printf(&set, "%u", imap_edata_get(emails[i])->uid);
+      if (end > i)
+        mutt_buffer_add_printf(&set, ":%u", imap_edata_get(emails[end])->uid);
+      i = end;
+    }
+
+    if (mutt_buffer_is_empty(&set) || (!last && (mutt_buffer_len(&set) < IMAP_MAX_CMDLEN)))
+      continue;
+
+    struct Buffer cmd = mutt_buffer_make(IMAP_MAX_CMDLEN + 16);
+    mutt_buffer_printf(&cmd, "UID EXPUNGE %s", mutt_b2s(&set));
+    mutt_list_insert_tail(&cmds, mutt_str_strdup(mutt_b2s(&cmd)));
+    mutt_buffer_dealloc(&cmd);
+    mutt_buffer_reset(&set);
+  }
+
+  mutt_buffer_dealloc(&set);
+  mutt_buffer_dealloc(&add);
+  mutt_buffer_dealloc(&del);
+  FREE(&group);
+  FREE(&expunge);
+  FREE(&modseqs);
+  FREE(&keys);
+  FREE(&emails);
+
+  int num_cmds = 0;
+  struct ListNode *np = NULL;
+  STAILQ_FOREACH(np, &cmds, entries)
+  {
+    num_cmds++;
+  }
+
+  mutt_debug(LL_DEBUG2, "replaying %d messages with %d commands\n", rc, num_cmds);
+  imap_cmd_reserve(adata, num_cmds);
+
+  int exec = IMAP_EXEC_SUCCESS;
+  STAILQ_FOREACH(np, &cmds, entries)
+  {
+    exec = imap_exec(adata, np->data, IMAP_CMD_QUEUE);
+    if (exec != IMAP_EXEC_SUCCESS)
+      break;
+  }
+  if ((exec == IMAP_EXEC_SUCCESS) && (num_cmds > 0))
+    exec = imap_exec(adata, NULL, IMAP_CMD_NO_FLAGS);
+  mutt_list_free(&cmds);
+
+  /* If the server refused the changes, retrying won't help */
+  if (exec == IMAP_EXEC_FATAL)
+    return -1;
+  if (exec != IMAP_EXEC_SUCCESS)
+    mutt_debug(LL_DEBUG1, "discarding journal: %s\n", adata->buf);
+
+  journal_clear(m);
+  return rc;
 }
 
 /**
- * do_search - Perform a search of messages
- * @param search  List of pattern to match
- * @param allpats Must all patterns match?
- * @retval num Number of patterns search that should be done server-side
+ * enum SearchPush - How much of a Pattern can be checked by the server
+ */
+enum SearchPush
+{
+  SEARCH_LOCAL,    ///< The server can't help, the Pattern must be checked locally
+  SEARCH_SUPERSET, ///< The server finds every match, but possibly some more
+  SEARCH_EXACT,    ///< The server finds exactly the matches
+};
+
+/**
+ * search_is_costly - Does a Pattern need message data that we don't have?
+ * @param pl Patterns to check
+ * @retval true At least one Pattern needs the message header or body
  *
- * Count the number of patterns that can be done by the server (are full-text).
+ * Only these Patterns are worth a round trip to the server.  Everything else
+ * can be checked locally, using the headers we've already downloaded.
  */
-static int do_search(const struct PatternList *search, bool allpats)
+static bool search_is_costly(const struct PatternList *pl)
 {
-  int rc = 0;
   const struct Pattern *pat = NULL;
-
-  SLIST_FOREACH(pat, search, entries)
+  SLIST_FOREACH(pat, pl, entries)
   {
     switch (pat->op)
     {
       case MUTT_PAT_BODY:
       case MUTT_PAT_HEADER:
       case MUTT_PAT_WHOLE_MSG:
-        if (pat->string_match)
-          rc++;
-        break;
       case MUTT_PAT_SERVERSEARCH:
-        rc++;
-        break;
+        return true;
       default:
-        if (pat->child && do_search(pat->child, true))
-          rc++;
+        if (pat->child && search_is_costly(pat->child))
+          return true;
     }
-
-    if (!allpats)
-      break;
   }
 
-  return rc;
+  return false;
 }
 
 /**
- * compile_search - Convert NeoMutt pattern to IMAP search
- * @param m   Mailbox
- * @param pat Pattern to convert
- * @param buf Buffer for result
- * @retval  0 Success
- * @retval -1 Failure
+ * search_add_string - Add a search key and a quoted string
+ * @param buf Buffer for the result
+ * @param key Search key, e.g. "BODY"
+ * @param str String to search for
+ */
+static void search_add_string(struct Buffer *buf, const char *key, const char *str)
+{
+  char term[256];
+
+  imap_quote_string(term, sizeof(term), str, false);
+  mutt_buffer_add_printf(buf, "%s %s", key, term);
+}
+
+/**
+ * search_add_date - Add a search key and a date
+ * @param buf  Buffer for the result
+ * @param key  Search key, e.g. "SENTSINCE"
+ * @param date Date
+ */
+static void search_add_date(struct Buffer *buf, const char *key, time_t date)
+{
+  char term[64];
+
+  /* Just the date part, e.g. "08-Mar-2019" */
+  mutt_date_make_imap(term, sizeof(term), date);
+  char *space = strchr(term, ' ');
+  if (space)
+    *space = '\0';
+
+  if (!mutt_buffer_is_empty(buf))
+    mutt_buffer_addch(buf, ' ');
+  mutt_buffer_add_printf(buf, "%s %s", key, term);
+}
+
+/**
+ * search_add_range - Add a date range to a search
+ * @param buf    Buffer for the result
+ * @param since  Search key for the lower bound, e.g. "SENTSINCE"
+ * @param before Search key for the upper bound, e.g. "SENTBEFORE"
+ * @param pat    Date Pattern
+ * @retval enum #SearchPush
  *
- * Convert neomutt Pattern to IMAP SEARCH command containing only elements
- * that require full-text search (neomutt already has what it needs for most
- * match types, and does a better job (eg server doesn't support regexes).
+ * The server only compares dates, in its own timezone, so the range is
+ * widened by a day at both ends.
  */
-static int compile_search(struct Mailbox *m, const struct PatternList *pat, struct Buffer *buf)
+static enum SearchPush search_add_range(struct Buffer *buf, const char *since,
+                                        const char *before, const struct Pattern *pat)
 {
-  struct Pattern *firstpat = SLIST_FIRST(pat);
+  const time_t day = 24 * 60 * 60;
 
-  if (do_search(pat, false) == 0)
-    return 0;
+  if (pat->dynamic)
+    return SEARCH_LOCAL;
 
-  if (firstpat->pat_not)
-    mutt_buffer_addstr(buf, "NOT ");
+  if (pat->min > day)
+    search_add_date(buf, since, pat->min - day);
+  if (pat->max < (INT_MAX - (2 * day)))
+    search_add_date(buf, before, pat->max + (2 * day));
 
-  if (firstpat->child)
-  {
-    int clauses;
+  return mutt_buffer_is_empty(buf) ? SEARCH_LOCAL : SEARCH_SUPERSET;
+}
 
-    clauses = do_search(firstpat->child, true);
-    if (clauses > 0)
+/**
+ * compile_leaf - Convert a simple NeoMutt Pattern to an IMAP search
+ * @param m   Mailbox
+ * @param pat Pattern to convert
+ * @param buf Buffer for the result
+ * @retval enum #SearchPush
+ * @retval -1   Error
+ */
+static int compile_leaf(struct Mailbox *m, const struct Pattern *pat, struct Buffer *buf)
+{
+  const char *str = pat->string_match ? pat->p.str : pat->required;
+  /* The server's substring search ignores case */
+  const bool exact = pat->string_match ||
+                     (pat->required_only && !pat->required_bol && pat->ign_case);
+
+  switch (pat->op)
+  {
+    case MUTT_ALL:
+      mutt_buffer_addstr(buf, "ALL");
+      return SEARCH_EXACT;
+
+    /* The server ignores case, so it can only be exact for caseless matches */
+    case MUTT_PAT_BODY:
+      if (!str)
+        return SEARCH_LOCAL;
+      search_add_string(buf, "BODY", str);
+      return exact ? SEARCH_EXACT : SEARCH_SUPERSET;
+    case MUTT_PAT_WHOLE_MSG:
+      if (!str)
+        return SEARCH_LOCAL;
+      search_add_string(buf, "TEXT", str);
+      return exact ? SEARCH_EXACT : SEARCH_SUPERSET;
+
+    case MUTT_PAT_HEADER:
     {
-      mutt_buffer_addch(buf, '(');
+      if (!pat->string_match)
+        return SEARCH_LOCAL;
 
-      while (clauses)
+      /* extract header name */
+      const char *delim = strchr(pat->p.str, ':');
+      if (!delim)
       {
-        if (do_search(firstpat->child, false))
-        {
-          if ((firstpat->op == MUTT_PAT_OR) && (clauses > 1))
-            mutt_buffer_addstr(buf, "OR ");
-          clauses--;
-
-          if (compile_search(m, firstpat->child, buf) < 0)
-            return -1;
+        mutt_error(_("Header search without header name: %s"), pat->p.str);
+        return -1;
+      }
 
-          if (clauses)
-            mutt_buffer_addch(buf, ' ');
-        }
+      char term[256];
+      char *name = mutt_str_substr_dup(pat->p.str, delim);
+      search_add_string(buf, "HEADER", name);
+      FREE(&name);
+
+      /* and field */
+      delim++;
+      SKIPWS(delim);
+      imap_quote_string(term, sizeof(term), delim, false);
+      mutt_buffer_add_printf(buf, " %s", term);
+      return SEARCH_EXACT;
+    }
 
-        SLIST_REMOVE_HEAD(firstpat->child, entries);
+    case MUTT_PAT_SERVERSEARCH:
+    {
+      struct ImapAccountData *adata = imap_adata_get(m);
+      if (!(adata->capabilities & IMAP_CAP_X_GM_EXT_1))
+      {
+        mutt_error(_("Server-side custom search not supported: %s"), pat->p.str);
+        return -1;
       }
-
-      mutt_buffer_addch(buf, ')');
+      search_add_string(buf, "X-GM-RAW", pat->p.str);
+      return SEARCH_EXACT;
     }
-  }
-  else
+
+    /* NeoMutt decodes and parses these, so the server can only narrow them */
+    case MUTT_PAT_SUBJECT:
+    case MUTT_PAT_FROM:
+    case MUTT_PAT_TO:
+    case MUTT_PAT_CC:
+      if (!str || pat->group_match || pat->is_alias)
+        return SEARCH_LOCAL;
+      search_add_string(buf,
+                        (pat->op == MUTT_PAT_SUBJECT) ? "SUBJECT" :
+                        (pat->op == MUTT_PAT_FROM)    ? "FROM" :
+                        (pat->op == MUTT_PAT_TO)      ? "TO" : "CC",
+                        str);
+      return SEARCH_SUPERSET;
+
+    case MUTT_PAT_DATE:
+      return search_add_range(buf, "SENTSINCE", "SENTBEFORE", pat);
+    case MUTT_PAT_DATE_RECEIVED:
+      return search_add_range(buf, "SINCE", "BEFORE", pat);
+
+    /* The server counts the headers too */
+    case MUTT_PAT_SIZE:
+      if (pat->min <= 1)
+        return SEARCH_LOCAL;
+      mutt_buffer_add_printf(buf, "LARGER %d", pat->min - 1);
+      return SEARCH_SUPERSET;
+
+    /* Local flag changes may not have been synced yet.
+     * imap_search() callers check the changed Emails themselves. */
+    case MUTT_FLAG:
+      mutt_buffer_addstr(buf, "FLAGGED");
+      return SEARCH_SUPERSET;
+    case MUTT_DELETED:
+      mutt_buffer_addstr(buf, "DELETED");
+      return SEARCH_SUPERSET;
+    case MUTT_READ:
+      mutt_buffer_addstr(buf, "SEEN");
+      return SEARCH_SUPERSET;
+    case MUTT_UNREAD:
+      mutt_buffer_addstr(buf, "UNSEEN");
+      return SEARCH_SUPERSET;
+    case MUTT_REPLIED:
+      mutt_buffer_addstr(buf, "ANSWERED");
+      return SEARCH_SUPERSET;
+  }
+
+  return SEARCH_LOCAL;
+}
+
+/**
+ * compile_search - Convert NeoMutt pattern to IMAP search
+ * @param m        Mailbox
+ * @param pat      Pattern to convert
+ * @param buf      Buffer for result
+ * @param conjunct Pattern must match for the whole search to match
+ * @retval enum #SearchPush
+ * @retval -1   Error
+ *
+ * Convert a NeoMutt Pattern to an IMAP SEARCH key.  Where the server can't
+ * match a Pattern exactly, e.g. it doesn't support regexes, we ask it for a
+ * superset of the matches, which NeoMutt will check locally.
+ *
+ * Header and body Patterns that the server can check exactly and that must
+ * match for the whole search to match, are marked with Pattern.server_match.
+ * NeoMutt won't need to download the messages to check them.
+ */
+static int compile_search(struct Mailbox *m, struct Pattern *pat,
+                          struct Buffer *buf, bool conjunct)
+{
+  int rc = SEARCH_LOCAL;
+  struct Buffer *expr = mutt_buffer_pool_get();
+
+  pat->server_match = false;
+  conjunct = conjunct && !pat->pat_not;
+
+  if ((pat->op == MUTT_PAT_AND) || (pat->op == MUTT_PAT_OR))
   {
-    char term[256];
-    char *delim = NULL;
+    const bool is_and = (pat->op == MUTT_PAT_AND);
+    struct Buffer *child = mutt_buffer_pool_get();
+    struct Pattern *np = NULL;
+    int count = 0;
 
-    switch (firstpat->op)
+    rc = SEARCH_EXACT;
+    SLIST_FOREACH(np, pat->child, entries)
     {
-      case MUTT_PAT_HEADER:
-        mutt_buffer_addstr(buf, "HEADER ");
-
-        /* extract header name */
-        delim = strchr(firstpat->p.str, ':');
-        if (!delim)
-        {
-          mutt_error(_("Header search without header name: %s"), firstpat->p.str);
-          return -1;
-        }
-        *delim = '\0';
-        imap_quote_string(term, sizeof(term), firstpat->p.str, false);
-        mutt_buffer_addstr(buf, term);
-        mutt_buffer_addch(buf, ' ');
-
-        /* and field */
-        *delim = ':';
-        delim++;
-        SKIPWS(delim);
-        imap_quote_string(term, sizeof(term), delim, false);
-        mutt_buffer_addstr(buf, term);
-        break;
-      case MUTT_PAT_BODY:
-        mutt_buffer_addstr(buf, "BODY ");
-        imap_quote_string(term, sizeof(term), firstpat->p.str, false);
-        mutt_buffer_addstr(buf, term);
-        break;
-      case MUTT_PAT_WHOLE_MSG:
-        mutt_buffer_addstr(buf, "TEXT ");
-        imap_quote_string(term, sizeof(term), firstpat->p.str, false);
-        mutt_buffer_addstr(buf, term);
+      mutt_buffer_reset(child);
+      const int crc = compile_search(m, np, child, is_and && conjunct);
+      if (crc < 0)
+      {
+        rc = -1;
         break;
-      case MUTT_PAT_SERVERSEARCH:
+      }
+
+      if (crc == SEARCH_LOCAL)
       {
-        struct ImapAccountData *adata = imap_adata_get(m);
-        if (!(adata->capabilities & IMAP_CAP_X_GM_EXT_1))
+        if (is_and)
         {
-          mutt_error(_("Server-side custom search not supported: %s"),
-                     firstpat->p.str);
-          return -1;
+          /* The other clauses still narrow the search */
+          rc = SEARCH_SUPERSET;
+          continue;
         }
-      }
-        mutt_buffer_addstr(buf, "X-GM-RAW ");
-        imap_quote_string(term, sizeof(term), firstpat->p.str, false);
-        mutt_buffer_addstr(buf, term);
+        /* Anything could match an OR */
+        rc = SEARCH_LOCAL;
         break;
+      }
+
+      if (crc == SEARCH_SUPERSET)
+        rc = SEARCH_SUPERSET;
+
+      /* IMAP has an implicit AND, but OR only takes two keys */
+      if (count++ != 0)
+        mutt_buffer_addch(expr, ' ');
+      if (!is_and && SLIST_NEXT(np, entries))
+        mutt_buffer_addstr(expr, "OR ");
+      mutt_buffer_add_printf(expr, "(%s)", mutt_b2s(child));
     }
+    mutt_buffer_pool_release(&child);
+
+    if (count == 0)
+      rc = SEARCH_LOCAL;
+  }
+  else if (!pat->child)
+  {
+    rc = compile_leaf(m, pat, expr);
+    if ((rc == SEARCH_EXACT) && conjunct)
+      pat->server_match = true;
   }
 
-  return 0;
+  if (rc > SEARCH_LOCAL)
+  {
+    /* The inverse of a superset isn't a superset of the inverse */
+    if (pat->pat_not && (rc != SEARCH_EXACT))
+      rc = SEARCH_LOCAL;
+    else if (pat->pat_not)
+      mutt_buffer_add_printf(buf, "NOT (%s)", mutt_b2s(expr));
+    else
+      mutt_buffer_addstr(buf, mutt_b2s(expr));
+  }
+
+  mutt_buffer_pool_release(&expr);
+  return rc;
 }
 
 /**
@@ -809,7 +1662,7 @@ void imap_expunge_mailbox(struct Mailbox *m)
       imap_hcache_del(mdata, imap_edata_get(e)->uid);
 #endif
 
-      mutt_hash_int_delete(mdata->uid_hash, imap_edata_get(e)->uid, e);
+      imap_uid_remove(mdata, imap_edata_get(e)->uid, e);
 
       imap_edata_free((void **) &e->edata);
     }
@@ -827,7 +1680,7 @@ void imap_expunge_mailbox(struct Mailbox *m)
        * The ctx_update_tables() will free and remove these "inactive" headers,
        * despite that an EXPUNGE was not received for them.
        * This would result in memory leaks and segfaults due to dangling
-       * pointers in the msn_index and uid_hash.
+       * pointers in the msn_index and uid_index.
        *
        * So this is another hack to work around the hacks.  We don't want to
        * remove the messages, so make sure active is on.
@@ -951,6 +1804,7 @@ void imap_close_connection(struct ImapAccountData *adata)
   adata->nextcmd = 0;
   adata->lastcmd = 0;
   adata->status = 0;
+  adata->notify = false;
   memset(adata->cmds, 0, sizeof(struct ImapCommand) * adata->cmdslots);
 }
 
@@ -989,17 +1843,6 @@ bool imap_has_flag(struct ListHead *flag_list, const char *flag)
   return false;
 }
 
-/**
- * compare_uid - Compare two Emails by UID - Implements ::sort_t
- */
-static int compare_uid(const void *a, const void *b)
-{
-  const struct Email *ea = *(struct Email const *const *) a;
-  const struct Email *eb = *(struct Email const *const *) b;
-  return imap_edata_get((struct Email *) ea)->uid -
-         imap_edata_get((struct Email *) eb)->uid;
-}
-
 /**
  * imap_exec_msgset - Prepare commands for all messages matching conditions
  * @param m       Selected Imap Mailbox
@@ -1254,6 +2097,80 @@ int imap_check_mailbox(struct Mailbox *m, bool force)
   return rc;
 }
 
+/**
+ * imap_notify_set - Ask the server to push changes to all the Account's Mailboxes
+ * @param a     Account
+ * @param adata Imap Account data
+ * @retval true NOTIFY is active
+ *
+ * Use NOTIFY (RFC5465) to register all the Mailboxes of the Account.  The
+ * server will send an initial STATUS for each one, then push STATUS responses
+ * whenever messages arrive, are expunged or change flags.
+ */
+static bool imap_notify_set(struct Account *a, struct ImapAccountData *adata)
+{
+  if (!C_ImapNotify || !(adata->capabilities & IMAP_CAP_NOTIFY))
+    return false;
+
+  if (adata->notify)
+    return true;
+
+  struct Buffer cmd = mutt_buffer_make(1024);
+  int count = 0;
+
+  mutt_buffer_addstr(&cmd, "NOTIFY SET STATUS (SELECTED (MessageNew MessageExpunge "
+                           "FlagChange)) (MAILBOXES (");
+
+  struct MailboxNode *np = NULL;
+  STAILQ_FOREACH(np, &a->mailboxes, entries)
+  {
+    struct ImapMboxData *mdata = imap_mdata_get(np->mailbox);
+    if (!mdata)
+      continue;
+    if (count++ != 0)
+      mutt_buffer_addch(&cmd, ' ');
+    mutt_buffer_addstr(&cmd, mdata->munge_name);
+  }
+
+  mutt_buffer_addstr(&cmd, ") (MessageNew MessageExpunge FlagChange))");
+
+  if (count != 0)
+  {
+    if (imap_exec(adata, mutt_b2s(&cmd), IMAP_CMD_POLL) == IMAP_EXEC_SUCCESS)
+    {
+      mutt_debug(LL_DEBUG2, "NOTIFY set for %d mailboxes\n", count);
+      adata->notify = true;
+    }
+    else if (adata->status != IMAP_FATAL)
+    {
+      mutt_debug(LL_DEBUG1, "NOTIFY failed, falling back to STATUS\n");
+      adata->capabilities &= ~IMAP_CAP_NOTIFY;
+    }
+  }
+
+  mutt_buffer_dealloc(&cmd);
+  return adata->notify;
+}
+
+/**
+ * imap_notify_poll - Read any changes pushed by the server
+ * @param adata Imap Account data
+ *
+ * Process the untagged STATUS, EXISTS, etc, responses that have arrived since
+ * we last read from the connection, without waiting.
+ */
+static void imap_notify_poll(struct ImapAccountData *adata)
+{
+  while (mutt_socket_poll(adata->conn, 0) > 0)
+  {
+    if (imap_cmd_step(adata) < 0)
+    {
+      mutt_debug(LL_DEBUG1, "Error reading NOTIFY response\n");
+      break;
+    }
+  }
+}
+
 /**
  * imap_status - Refresh the number of total and new messages
  * @param adata  IMAP Account data
@@ -1292,6 +2209,11 @@ static int imap_status(struct ImapAccountData *adata, struct ImapMboxData *mdata
   snprintf(cmd, sizeof(cmd), "STATUS %s (UIDNEXT %s UNSEEN RECENT MESSAGES)",
            mdata->munge_name, uid_validity_flag);
 
+  /* Make room, so that all the queued STATUS commands are sent in one burst
+   * by imap_status_flush() */
+  if (queue)
+    imap_cmd_reserve(adata, 1);
+
   int rc = imap_exec(adata, cmd, queue ? IMAP_CMD_QUEUE : IMAP_CMD_NO_FLAGS | IMAP_CMD_POLL);
   if (rc < 0)
   {
@@ -1340,6 +2262,9 @@ int imap_path_status(const char *path, bool queue)
  * @retval -1  Error
  *
  * @note Prepare the mailbox if we are not connected
+ *
+ * If the server supports NOTIFY, the counts are kept up to date by the server
+ * and no STATUS command is needed.
  */
 int imap_mailbox_status(struct Mailbox *m, bool queue)
 {
@@ -1347,19 +2272,63 @@ int imap_mailbox_status(struct Mailbox *m, bool queue)
   struct ImapMboxData *mdata = imap_mdata_get(m);
   if (!adata || !mdata)
     return -1;
+
+  if (m->account && imap_notify_set(m->account, adata))
+  {
+    imap_notify_poll(adata);
+    if (!adata->mailbox || (adata->mailbox->mdata != mdata))
+      return mdata->messages;
+  }
+
   return imap_status(adata, mdata, queue);
 }
 
 /**
- * imap_search - Find a matching mailbox
+ * imap_status_flush - Send the queued STATUS commands
+ *
+ * The STATUS commands queued by imap_mbox_check_stats() are sent to each
+ * server in a single burst and we wait for all the replies at once.
+ */
+void imap_status_flush(void)
+{
+  struct Account *np = NULL;
+  TAILQ_FOREACH(np, &NeoMutt->accounts, entries)
+  {
+    if (np->magic != MUTT_IMAP)
+      continue;
+
+    struct ImapAccountData *adata = np->adata;
+    if (!adata || (adata->state < IMAP_AUTHENTICATED))
+      continue;
+
+    /* Nothing queued, or just the IDLE terminator */
+    if ((adata->nextcmd == adata->lastcmd) || mutt_buffer_is_empty(&adata->cmdbuf))
+      continue;
+
+    if (imap_exec(adata, NULL, IMAP_CMD_POLL) != IMAP_EXEC_SUCCESS)
+      mutt_debug(LL_DEBUG1, "Error flushing STATUS commands\n");
+  }
+}
+
+/**
+ * imap_search - Find messages matching a Pattern on the server
  * @param m   Mailbox
  * @param pat Pattern to match
- * @retval  0 Success
+ * @retval #IMAP_SEARCH_NONE       Nothing was searched on the server
+ * @retval #IMAP_SEARCH_CANDIDATES Only Emails marked 'matched' can match
+ * @retval #IMAP_SEARCH_EXACT      Exactly the Emails marked 'matched' match
  * @retval -1 Failure
+ *
+ * If the Pattern needs the message headers or bodies, as much of it as
+ * possible is pushed down to the server.  The Patterns that can't be checked
+ * exactly by the server are used to narrow the number of messages that need
+ * to be downloaded.
+ *
+ * @note The server doesn't know about flag changes that haven't been synced
+ *       yet.  With #IMAP_SEARCH_CANDIDATES, changed Emails must be checked too.
  */
-int imap_search(struct Mailbox *m, const struct PatternList *pat)
+int imap_search(struct Mailbox *m, struct PatternList *pat)
 {
-  struct Buffer buf;
   struct ImapAccountData *adata = imap_adata_get(m);
   for (int i = 0; i < m->msg_count; i++)
   {
@@ -1369,24 +2338,34 @@ int imap_search(struct Mailbox *m, const struct PatternList *pat)
     e->matched = false;
   }
 
-  if (do_search(pat, true) == 0)
-    return 0;
+  if (!search_is_costly(pat))
+    return IMAP_SEARCH_NONE;
 
-  mutt_buffer_init(&buf);
+  struct Buffer buf = mutt_buffer_make(256);
   mutt_buffer_addstr(&buf, "UID SEARCH ");
-  if (compile_search(m, pat, &buf) < 0)
-  {
-    FREE(&buf.data);
-    return -1;
-  }
-  if (imap_exec(adata, buf.data, IMAP_CMD_NO_FLAGS) != IMAP_EXEC_SUCCESS)
+  /* Get the results as a compact seqset, rather than a list of UIDs */
+  if (adata->capabilities & IMAP_CAP_ESEARCH)
+    mutt_buffer_addstr(&buf, "RETURN (ALL) ");
+
+  int rc = compile_search(m, SLIST_FIRST(pat), &buf, true);
+  if (rc == SEARCH_LOCAL)
   {
-    FREE(&buf.data);
-    return -1;
+    rc = IMAP_SEARCH_NONE;
+    goto done;
   }
+  if (rc < 0)
+    goto done;
 
-  FREE(&buf.data);
-  return 0;
+  mutt_debug(LL_DEBUG2, "%s search: %s\n",
+             (rc == SEARCH_EXACT) ? "exact" : "narrowing", mutt_b2s(&buf));
+  rc = (rc == SEARCH_EXACT) ? IMAP_SEARCH_EXACT : IMAP_SEARCH_CANDIDATES;
+
+  if (imap_exec(adata, mutt_b2s(&buf), IMAP_CMD_NO_FLAGS) != IMAP_EXEC_SUCCESS)
+    rc = -1;
+
+done:
+  mutt_buffer_dealloc(&buf);
+  return rc;
 }
 
 /**
@@ -1644,8 +2623,6 @@ int imap_sync_mailbox(struct Mailbox *m, bool expunge, bool close)
   if (!m)
     return -1;
 
-  struct Email **emails = NULL;
-  int oldsort;
   int rc;
 
   struct ImapAccountData *adata = imap_adata_get(m);
@@ -1653,10 +2630,30 @@ int imap_sync_mailbox(struct Mailbox *m, bool expunge, bool close)
 
   if (adata->state < IMAP_SELECTED)
   {
+    /* We've lost the connection, keep the changes for later */
+    if ((adata->mailbox == m) && !m->readonly)
+    {
+      rc = journal_record(m, expunge, true);
+      if (rc >= 0)
+      {
+        if (rc > 0)
+          mutt_message(_("Server unavailable, changes will be sent on reconnect"));
+        m->changed = false;
+        return 0;
+      }
+    }
     mutt_debug(LL_DEBUG2, "no mailbox selected\n");
     return -1;
   }
 
+  /* Send anything left over from a previous session, then make sure that this
+   * sync can't get lost */
+  if (!m->readonly)
+  {
+    journal_replay(m);
+    journal_record(m, expunge, false);
+  }
+
   /* This function is only called when the calling code expects the context
    * to be changed. */
   imap_allow_reopen(m);
@@ -1743,36 +2740,9 @@ int imap_sync_mailbox(struct Mailbox *m, bool expunge, bool close)
   imap_hcache_close(mdata);
 #endif
 
-  /* presort here to avoid doing 10 resorts in imap_exec_msgset */
-  oldsort = C_Sort;
-  if (C_Sort != SORT_ORDER)
-  {
-    emails = m->emails;
-    m->emails = mutt_mem_malloc(m->msg_count * sizeof(struct Email *));
-    memcpy(m->emails, emails, m->msg_count * sizeof(struct Email *));
-
-    C_Sort = SORT_ORDER;
-    qsort(m->emails, m->msg_count, sizeof(struct Email *), mutt_get_sort_func(SORT_ORDER));
-  }
-
-  rc = sync_helper(m, MUTT_ACL_DELETE, MUTT_DELETED, "\\Deleted");
-  if (rc >= 0)
-    rc |= sync_helper(m, MUTT_ACL_WRITE, MUTT_FLAG, "\\Flagged");
-  if (rc >= 0)
-    rc |= sync_helper(m, MUTT_ACL_WRITE, MUTT_OLD, "Old");
-  if (rc >= 0)
-    rc |= sync_helper(m, MUTT_ACL_SEEN, MUTT_READ, "\\Seen");
-  if (rc >= 0)
-    rc |= sync_helper(m, MUTT_ACL_WRITE, MUTT_REPLIED, "\\Answered");
-
-  if (oldsort != C_Sort)
-  {
-    C_Sort = oldsort;
-    FREE(&m->emails);
-    m->emails = emails;
-  }
+  rc = sync_flags(m);
 
-  /* Flush the queued flags if any were changed in sync_helper. */
+  /* Flush the queued flags if any were changed in sync_flags(). */
   if (rc > 0)
     if (imap_exec(adata, NULL, IMAP_CMD_NO_FLAGS) != IMAP_EXEC_SUCCESS)
       rc = -1;
@@ -1809,6 +2779,7 @@ int imap_sync_mailbox(struct Mailbox *m, bool expunge, bool close)
     e->changed = false;
   }
   m->changed = false;
+  journal_clear(m);
 
   /* We must send an EXPUNGE command if we're not closing. */
   if (expunge && !close && (m->rights & MUTT_ACL_DELETE))
@@ -1914,6 +2885,9 @@ static int imap_ac_add(struct Account *a, struct Mailbox *m)
     m->mdata = mdata;
     m->free_mdata = imap_mdata_free;
     url_free(&url);
+
+    /* The NOTIFY list needs to include the new Mailbox */
+    adata->notify = false;
   }
   return 0;
 }
@@ -2203,6 +3177,10 @@ static int imap_mbox_open(struct Mailbox *m)
     goto fail;
   }
 
+  /* Catch up with the changes made while we were offline */
+  if (!m->readonly)
+    journal_replay(m);
+
   mutt_debug(LL_DEBUG2, "msg_count is %d\n", m->msg_count);
   return 0;
 
@@ -2481,6 +3459,8 @@ static int imap_tags_commit(struct Mailbox *m, struct Email *e, char *buf)
   /* We are good sync them */
   mutt_debug(LL_DEBUG1, "NEW TAGS: %s\n", buf);
   driver_tags_replace(&e->tags, buf);
+  mutt_pattern_memo_clear(e);
+  m->gen++;
   FREE(&imap_edata_get(e)->flags_remote);
   imap_edata_get(e)->flags_remote = driver_tags_get_with_hidden(&e->tags);
   return 0;
@@ -54,6 +54,7 @@
 #include "core/lib.h"
 #include "mx.h"
 
+struct Body;
 struct BrowserState;
 struct Buffer;
 struct ConnAccount;
@@ -61,16 +62,23 @@ struct EmailList;
 struct PatternList;
 struct stat;
 
+/* Results of imap_search() */
+#define IMAP_SEARCH_NONE        0 ///< Nothing was searched on the server
+#define IMAP_SEARCH_CANDIDATES  1 ///< Only Emails marked 'matched' can match
+#define IMAP_SEARCH_EXACT       2 ///< Exactly the Emails marked 'matched' match
+
 /* These Config Variables are only used in imap/auth.c */
 extern struct Slist *C_ImapAuthenticators;
 
 /* These Config Variables are only used in imap/imap.c */
 extern bool C_ImapIdle;
+extern bool C_ImapNotify;
 extern bool C_ImapRfc5161;
 
 /* These Config Variables are only used in imap/message.c */
 extern char *C_ImapHeaders;
 extern long C_ImapFetchChunkSize;
+extern long C_ImapPartialFetch;
 
 /* These Config Variables are only used in imap/command.c */
 extern bool C_ImapServernoise;
@@ -86,7 +94,8 @@ int imap_delete_mailbox(struct Mailbox *m, char *path);
 int imap_sync_mailbox(struct Mailbox *m, bool expunge, bool close);
 int imap_path_status(const char *path, bool queue);
 int imap_mailbox_status(struct Mailbox *m, bool queue);
-int imap_search(struct Mailbox *m, const struct PatternList *pat);
+void imap_status_flush(void);
+int imap_search(struct Mailbox *m, struct PatternList *pat);
 int imap_subscribe(char *path, bool subscribe);
 int imap_complete(char *buf, size_t buflen, const char *path);
 int imap_fast_trash(struct Mailbox *m, char *dest);
@@ -101,6 +110,9 @@ int imap_mailbox_create(const char *folder);
 int imap_mailbox_rename(const char *path);
 
 /* message.c */
+void imap_append_begin(struct Mailbox *m);
+int imap_append_end(struct Mailbox *m);
+struct Body *imap_body_structure(struct Mailbox *m, struct Email *e);
 int imap_copy_messages(struct Mailbox *m, struct EmailList *el, const char *dest, bool delete_original);
 
 /* socket.c */
@@ -58,6 +58,9 @@ struct Progress;
 
 #define SEQ_LEN 16
 #define IMAP_MAX_CMDLEN 1024 ///< Maximum length of command lines before they must be split (for lazy servers)
+#define IMAP_MAX_BURST  4096 ///< Maximum number of commands that may be sent in a single burst
+#define IMAP_BODYSTRUCTURE_WINDOW 256 ///< Number of Emails to ask for in one BODYSTRUCTURE request
+#define IMAP_APPEND_BATCH 64 ///< Number of messages to send in one bulk APPEND
 
 typedef uint8_t ImapOpenFlags;         ///< Flags, e.g. #MUTT_THREAD_COLLAPSE
 #define IMAP_OPEN_NO_FLAGS          0  ///< No flags are set
@@ -135,8 +138,15 @@ typedef uint32_t ImapCapFlags;              ///< Flags, e.g. #IMAP_CAP_IMAP4
 #define IMAP_CAP_QRESYNC          (1 << 15) ///< RFC7162
 #define IMAP_CAP_LIST_EXTENDED    (1 << 16) ///< RFC5258: IMAP4 LIST Command Extensions
 #define IMAP_CAP_X_GM_EXT_1       (1 << 17) ///< https://developers.google.com/gmail/imap/imap-extensions
+#define IMAP_CAP_NOTIFY           (1 << 18) ///< RFC5465: IMAP NOTIFY
+#define IMAP_CAP_ESEARCH          (1 << 19) ///< RFC4731: IMAP4 Extension for Returning SEARCH Results
+#define IMAP_CAP_BINARY           (1 << 20) ///< RFC3516: IMAP4 Binary Content Extension
+#define IMAP_CAP_MULTIAPPEND      (1 << 21) ///< RFC3502: IMAP MULTIAPPEND Extension
+#define IMAP_CAP_LITERALPLUS      (1 << 22) ///< RFC7888: IMAP4 Non-synchronizing Literals
+#define IMAP_CAP_LITERALMINUS     (1 << 23) ///< RFC7888: LITERAL-, for literals up to 4096 bytes
+#define IMAP_CAP_UIDPLUS          (1 << 24) ///< RFC4315: IMAP UIDPLUS Extension
 
-#define IMAP_CAP_ALL             ((1 << 18) - 1)
+#define IMAP_CAP_ALL             ((1 << 25) - 1)
 
 /**
  * struct ImapList - Items in an IMAP browser
@@ -149,6 +159,33 @@ struct ImapList
   bool noinferiors;
 };
 
+/**
+ * enum ImapTokenType - Types of token in an IMAP response
+ */
+enum ImapTokenType
+{
+  IMAP_TOK_END,     ///< End of the response line
+  IMAP_TOK_ATOM,    ///< Atom, number or NIL, e.g. `FLAGS`, `BODY[HEADER]`, `\\Seen`
+  IMAP_TOK_STRING,  ///< Quoted string, without the quotes; escapes are left in
+  IMAP_TOK_LITERAL, ///< Literal `{n}` or `~{n}`; the data follows on the connection
+  IMAP_TOK_OPEN,    ///< Opening parenthesis
+  IMAP_TOK_CLOSE,   ///< Closing parenthesis
+  IMAP_TOK_ERROR,   ///< Unterminated string or malformed literal
+};
+
+/**
+ * struct ImapToken - A token of an IMAP response
+ *
+ * The token points into the response buffer; nothing is copied.
+ */
+struct ImapToken
+{
+  enum ImapTokenType type; ///< Type of token
+  char *str;               ///< Start of the token
+  size_t len;              ///< Length of the token
+  unsigned int literal;    ///< Size of a literal, #IMAP_TOK_LITERAL
+};
+
 /**
  * struct ImapCommand - IMAP command structure
  */
@@ -189,6 +226,7 @@ struct ImapAccountData
 
   bool unicode; /* If true, we can send UTF-8, and the server will use UTF8 rather than mUTF7 */
   bool qresync; /* true, if QRESYNC is successfully ENABLE'd */
+  bool notify;  /* true, if NOTIFY SET covers all the Account's mailboxes */
 
   /* if set, the response parser will store results for complicated commands
    * here. */
@@ -230,13 +268,24 @@ struct ImapMboxData
   unsigned int unseen;
 
   // Cached data used only when the mailbox is opened
-  struct Hash *uid_hash;
+  unsigned int *uid_index;     ///< Sorted UIDs, see imap_uid_find()
+  struct Email **uid_emails;   ///< Emails matching uid_index, NULL if removed
+  size_t uid_count;            ///< Number of entries in uid_index
+  size_t uid_size;             ///< allocation size
+  size_t uid_removed;          ///< Removed entries awaiting compaction
   struct Email **msn_index;   ///< look up headers by (MSN-1)
   size_t msn_index_size;       ///< allocation size
   unsigned int max_msn;        ///< the largest MSN fetched so far
   struct BodyCache *bcache;
 
   header_cache_t *hcache;
+
+  // Messages waiting to be appended, see imap_append_begin()
+  struct Message **append_queue; ///< Queued messages, the temporary files are ours
+  size_t append_count;           ///< Number of queued messages
+  size_t append_max;             ///< allocation size
+  bool append_batch;             ///< Queue messages instead of appending them
+  bool append_failed;            ///< A queued message couldn't be appended
 };
 
 /**
@@ -276,6 +325,7 @@ int imap_authenticate(struct ImapAccountData *adata);
 int imap_cmd_start(struct ImapAccountData *adata, const char *cmdstr);
 int imap_cmd_step(struct ImapAccountData *adata);
 void imap_cmd_finish(struct ImapAccountData *adata);
+void imap_cmd_reserve(struct ImapAccountData *adata, int count);
 bool imap_code(const char *s);
 const char *imap_cmd_trailer(struct ImapAccountData *adata);
 int imap_exec(struct ImapAccountData *adata, const char *cmdstr, ImapCmdFlags flags);
@@ -286,14 +336,17 @@ void imap_edata_free(void **ptr);
 struct ImapEmailData *imap_edata_get(struct Email *e);
 int imap_read_headers(struct Mailbox *m, unsigned int msn_begin, unsigned int msn_end, bool initial_download);
 char *imap_set_flags(struct Mailbox *m, struct Email *e, char *s, bool *server_changes);
+struct BodyCache *imap_cache_open(struct Mailbox *m);
 int imap_cache_del(struct Mailbox *m, struct Email *e);
 int imap_cache_clean(struct Mailbox *m);
 int imap_append_message(struct Mailbox *m, struct Message *msg);
+int imap_append_messages(struct Mailbox *m, struct Message **msgs, size_t count);
 
 int imap_msg_open(struct Mailbox *m, struct Message *msg, int msgno);
 int imap_msg_close(struct Mailbox *m, struct Message *msg);
 int imap_msg_commit(struct Mailbox *m, struct Message *msg);
 int imap_msg_save_hcache(struct Mailbox *m, struct Email *e);
+int imap_parse_bodystructure(struct Mailbox *m, struct Email *e, char **s);
 
 /* util.c */
 struct ImapAccountData *imap_adata_get(struct Mailbox *m);
@@ -304,6 +357,8 @@ void imap_hcache_close(struct ImapMboxData *mdata);
 struct Email *imap_hcache_get(struct ImapMboxData *mdata, unsigned int uid);
 int imap_hcache_put(struct ImapMboxData *mdata, struct Email *e);
 int imap_hcache_del(struct ImapMboxData *mdata, unsigned int uid);
+int imap_hcache_put_bodystructure(struct ImapMboxData *mdata, unsigned int uid, const char *bs, size_t bslen);
+char *imap_hcache_get_bodystructure(struct ImapMboxData *mdata, unsigned int uid);
 int imap_hcache_store_uid_seqset(struct ImapMboxData *mdata);
 int imap_hcache_clear_uid_seqset(struct ImapMboxData *mdata);
 char *imap_hcache_get_uid_seqset(struct ImapMboxData *mdata);
@@ -316,12 +371,20 @@ void imap_adata_free(void **ptr);
 struct ImapMboxData *imap_mdata_new(struct ImapAccountData *adata, const char* name);
 void imap_mdata_free(void **ptr);
 void imap_mdata_cache_reset(struct ImapMboxData *mdata);
+void imap_uid_alloc(struct ImapMboxData *mdata, size_t count);
+struct Email *imap_uid_find(struct ImapMboxData *mdata, unsigned int uid);
+void imap_uid_insert(struct ImapMboxData *mdata, unsigned int uid, struct Email *e);
+void imap_uid_remove(struct ImapMboxData *mdata, unsigned int uid, struct Email *e);
 char *imap_fix_path(char delim, const char *mailbox, char *path, size_t plen);
 void imap_cachepath(char delim, const char *mailbox, struct Buffer *dest);
 int imap_get_literal_count(const char *buf, unsigned int *bytes);
 char *imap_get_qualifier(char *buf);
 int imap_mxcmp(const char *mx1, const char *mx2);
 char *imap_next_word(char *s);
+char *imap_next_token(char *s, struct ImapToken *tok);
+bool imap_token_is(const struct ImapToken *tok, const char *atom);
+bool imap_token_prefix(const struct ImapToken *tok, const char *prefix);
+int imap_token_number(const struct ImapToken *tok, unsigned long long *num);
 void imap_qualify_path(char *buf, size_t buflen, struct ConnAccount *conn_account, char *path);
 void imap_quote_string(char *dest, size_t dlen, const char *src, bool quote_backtick);
 void imap_unquote_string(char *s);
@@ -46,12 +46,15 @@
 #include "message.h"
 #include "bcache.h"
 #include "globals.h"
+#include "handler.h"
 #include "imap/imap.h"
 #include "mutt_account.h"
 #include "mutt_logging.h"
 #include "mutt_socket.h"
 #include "muttlib.h"
 #include "mx.h"
+#include "options.h"
+#include "pattern.h"
 #include "progress.h"
 #include "protos.h"
 #ifdef ENABLE_NLS
@@ -66,6 +69,7 @@ struct BodyCache;
 /* These Config Variables are only used in imap/message.c */
 char *C_ImapHeaders; ///< Config: (imap) Additional email headers to download when getting index
 long C_ImapFetchChunkSize; ///< Config: (imap) Download headers in blocks of this size
+long C_ImapPartialFetch; ///< Config: (imap) Download messages bigger than this one MIME part at a time
 
 /**
  * imap_edata_free - free ImapHeader structure
@@ -80,6 +84,7 @@ void imap_edata_free(void **ptr)
   /* this should be safe even if the list wasn't used */
   FREE(&edata->flags_system);
   FREE(&edata->flags_remote);
+  mutt_body_free(&edata->bodystructure);
   FREE(ptr);
 }
 
@@ -105,13 +110,13 @@ struct ImapEmailData *imap_edata_get(struct Email *e)
 }
 
 /**
- * msg_cache_open - Open a message cache
+ * imap_cache_open - Open a message cache
  * @param m     Selected Imap Mailbox
  * @retval ptr  Success, using existing cache
  * @retval ptr  Success, opened new cache
  * @retval NULL Failure
  */
-static struct BodyCache *msg_cache_open(struct Mailbox *m)
+struct BodyCache *imap_cache_open(struct Mailbox *m)
 {
   struct ImapAccountData *adata = imap_adata_get(m);
   struct ImapMboxData *mdata = imap_mdata_get(m);
@@ -146,7 +151,7 @@ static FILE *msg_cache_get(struct Mailbox *m, struct Email *e)
   if (!e || !adata || (adata->mailbox != m))
     return NULL;
 
-  mdata->bcache = msg_cache_open(m);
+  mdata->bcache = imap_cache_open(m);
   char id[64];
   snprintf(id, sizeof(id), "%u-%u", mdata->uid_validity, imap_edata_get(e)->uid);
   return mutt_bcache_get(mdata->bcache, id);
@@ -167,7 +172,7 @@ static FILE *msg_cache_put(struct Mailbox *m, struct Email *e)
   if (!e || !adata || (adata->mailbox != m))
     return NULL;
 
-  mdata->bcache = msg_cache_open(m);
+  mdata->bcache = imap_cache_open(m);
   char id[64];
   snprintf(id, sizeof(id), "%u-%u", mdata->uid_validity, imap_edata_get(e)->uid);
   return mutt_bcache_put(mdata->bcache, id);
@@ -188,7 +193,7 @@ static int msg_cache_commit(struct Mailbox *m, struct Email *e)
   if (!e || !adata || (adata->mailbox != m))
     return -1;
 
-  mdata->bcache = msg_cache_open(m);
+  mdata->bcache = imap_cache_open(m);
   char id[64];
   snprintf(id, sizeof(id), "%u-%u", mdata->uid_validity, imap_edata_get(e)->uid);
 
@@ -208,7 +213,7 @@ static int msg_cache_clean_cb(const char *id, struct BodyCache *bcache, void *da
     return 0;
 
   /* bad UID */
-  if ((uv != mdata->uid_validity) || !mutt_hash_int_find(mdata->uid_hash, uid))
+  if ((uv != mdata->uid_validity) || !imap_uid_find(mdata, uid))
     mutt_bcache_del(bcache, id);
 
   return 0;
@@ -224,22 +229,21 @@ static int msg_cache_clean_cb(const char *id, struct BodyCache *bcache, void *da
 static char *msg_parse_flags(struct ImapHeader *h, char *s)
 {
   struct ImapEmailData *edata = h->edata;
+  struct ImapToken tok;
 
   /* sanity-check string */
-  size_t plen = mutt_str_startswith(s, "FLAGS", CASE_IGNORE);
-  if (plen == 0)
+  s = imap_next_token(s, &tok);
+  if (!imap_token_is(&tok, "FLAGS"))
   {
-    mutt_debug(LL_DEBUG1, "not a FLAGS response: %s\n", s);
+    mutt_debug(LL_DEBUG1, "not a FLAGS response: %s\n", tok.str);
     return NULL;
   }
-  s += plen;
-  SKIPWS(s);
-  if (*s != '(')
+  s = imap_next_token(s, &tok);
+  if (tok.type != IMAP_TOK_OPEN)
   {
-    mutt_debug(LL_DEBUG1, "bogus FLAGS response: %s\n", s);
+    mutt_debug(LL_DEBUG1, "bogus FLAGS response: %s\n", tok.str);
     return NULL;
   }
-  s++;
 
   FREE(&edata->flags_system);
   FREE(&edata->flags_remote);
@@ -251,67 +255,45 @@ static char *msg_parse_flags(struct ImapHeader *h, char *s)
   edata->old = false;
 
   /* start parsing */
-  while (*s && (*s != ')'))
+  while (true)
   {
-    if ((plen = mutt_str_startswith(s, "\\deleted", CASE_IGNORE)))
-    {
-      s += plen;
+    s = imap_next_token(s, &tok);
+    if (tok.type != IMAP_TOK_ATOM)
+      break;
+
+    if (imap_token_is(&tok, "\\Deleted"))
       edata->deleted = true;
-    }
-    else if ((plen = mutt_str_startswith(s, "\\flagged", CASE_IGNORE)))
-    {
-      s += plen;
+    else if (imap_token_is(&tok, "\\Flagged"))
       edata->flagged = true;
-    }
-    else if ((plen = mutt_str_startswith(s, "\\answered", CASE_IGNORE)))
-    {
-      s += plen;
+    else if (imap_token_is(&tok, "\\Answered"))
       edata->replied = true;
-    }
-    else if ((plen = mutt_str_startswith(s, "\\seen", CASE_IGNORE)))
-    {
-      s += plen;
+    else if (imap_token_is(&tok, "\\Seen"))
       edata->read = true;
-    }
-    else if ((plen = mutt_str_startswith(s, "\\recent", CASE_IGNORE)))
-    {
-      s += plen;
-    }
-    else if ((plen = mutt_str_startswith(s, "old", CASE_IGNORE)))
-    {
-      s += plen;
+    else if (imap_token_is(&tok, "\\Recent"))
+      continue;
+    else if (imap_token_is(&tok, "Old"))
       edata->old = C_MarkOld ? true : false;
-    }
     else
     {
-      char ctmp;
-      char *flag_word = s;
-      bool is_system_keyword = mutt_str_startswith(s, "\\", CASE_IGNORE);
-
-      while (*s && !IS_SPACE(*s) && (*s != ')'))
-        s++;
-
-      ctmp = *s;
-      *s = '\0';
+      char *end = tok.str + tok.len;
+      char ctmp = *end;
+      *end = '\0';
 
       /* store other system flags as well (mainly \\Draft) */
-      if (is_system_keyword)
-        mutt_str_append_item(&edata->flags_system, flag_word, ' ');
+      if (tok.str[0] == '\\')
+        mutt_str_append_item(&edata->flags_system, tok.str, ' ');
       /* store custom flags as well */
       else
-        mutt_str_append_item(&edata->flags_remote, flag_word, ' ');
+        mutt_str_append_item(&edata->flags_remote, tok.str, ' ');
 
-      *s = ctmp;
+      *end = ctmp;
     }
-    SKIPWS(s);
   }
 
   /* wrap up, or note bad flags response */
-  if (*s == ')')
-    s++;
-  else
+  if (tok.type != IMAP_TOK_CLOSE)
   {
-    mutt_debug(LL_DEBUG1, "Unterminated FLAGS response: %s\n", s);
+    mutt_debug(LL_DEBUG1, "Unterminated FLAGS response: %s\n", tok.str);
     return NULL;
   }
 
@@ -331,91 +313,77 @@ static int msg_parse_fetch(struct ImapHeader *h, char *s)
   if (!s)
     return -1;
 
+  struct ImapToken tok;
+  unsigned long long num;
   char tmp[128];
-  char *ptmp = NULL;
-  size_t plen = 0;
 
-  while (*s)
+  while (true)
   {
-    SKIPWS(s);
+    char *next = imap_next_token(s, &tok);
+
+    if (tok.type == IMAP_TOK_END)
+      break;
 
-    if (mutt_str_startswith(s, "FLAGS", CASE_IGNORE))
+    if (tok.type == IMAP_TOK_CLOSE)
     {
-      s = msg_parse_flags(h, s);
+      s = next; /* end of request */
+    }
+    else if (imap_token_is(&tok, "FLAGS"))
+    {
+      s = msg_parse_flags(h, tok.str);
       if (!s)
         return -1;
     }
-    else if ((plen = mutt_str_startswith(s, "UID", CASE_IGNORE)))
+    else if (imap_token_is(&tok, "UID"))
     {
-      s += plen;
-      SKIPWS(s);
-      if (mutt_str_atoui(s, &h->edata->uid) < 0)
+      s = imap_next_token(next, &tok);
+      if ((imap_token_number(&tok, &num) < 0) || (num > UINT_MAX))
         return -1;
-
-      s = imap_next_word(s);
+      h->edata->uid = num;
     }
-    else if ((plen = mutt_str_startswith(s, "INTERNALDATE", CASE_IGNORE)))
+    else if (imap_token_is(&tok, "INTERNALDATE"))
     {
-      s += plen;
-      SKIPWS(s);
-      if (*s != '\"')
+      s = imap_next_token(next, &tok);
+      if (tok.type != IMAP_TOK_STRING)
       {
-        mutt_debug(LL_DEBUG1, "bogus INTERNALDATE entry: %s\n", s);
+        mutt_debug(LL_DEBUG1, "bogus INTERNALDATE entry: %s\n", tok.str);
         return -1;
       }
-      s++;
-      ptmp = tmp;
-      while (*s && (*s != '\"') && (ptmp != (tmp + sizeof(tmp) - 1)))
-        *ptmp++ = *s++;
-      if (*s != '\"')
-        return -1;
-      s++; /* skip past the trailing " */
-      *ptmp = '\0';
+      mutt_str_strfcpy(tmp, tok.str, MIN(tok.len + 1, sizeof(tmp)));
       h->received = mutt_date_parse_imap(tmp);
     }
-    else if ((plen = mutt_str_startswith(s, "RFC822.SIZE", CASE_IGNORE)))
+    else if (imap_token_is(&tok, "RFC822.SIZE"))
     {
-      s += plen;
-      SKIPWS(s);
-      ptmp = tmp;
-      while (isdigit((unsigned char) *s) && (ptmp != (tmp + sizeof(tmp) - 1)))
-        *ptmp++ = *s++;
-      *ptmp = '\0';
-      if (mutt_str_atol(tmp, &h->content_length) < 0)
+      s = imap_next_token(next, &tok);
+      if ((imap_token_number(&tok, &num) < 0) || (num > LONG_MAX))
         return -1;
+      h->content_length = num;
     }
-    else if (mutt_str_startswith(s, "BODY", CASE_IGNORE) ||
-             mutt_str_startswith(s, "RFC822.HEADER", CASE_IGNORE))
+    else if (imap_token_prefix(&tok, "BODY") || imap_token_prefix(&tok, "RFC822.HEADER"))
     {
       /* handle above, in msg_fetch_header */
       return -2;
     }
-    else if ((plen = mutt_str_startswith(s, "MODSEQ", CASE_IGNORE)))
+    else if (imap_token_is(&tok, "MODSEQ"))
     {
-      s += plen;
-      SKIPWS(s);
-      if (*s != '(')
+      s = imap_next_token(next, &tok);
+      if (tok.type != IMAP_TOK_OPEN)
       {
-        mutt_debug(LL_DEBUG1, "bogus MODSEQ response: %s\n", s);
+        mutt_debug(LL_DEBUG1, "bogus MODSEQ response: %s\n", tok.str);
         return -1;
       }
-      s++;
-      while (*s && (*s != ')'))
-        s++;
-      if (*s == ')')
-        s++;
-      else
+      s = imap_next_token(s, &tok);
+      s = imap_next_token(s, &tok);
+      if (tok.type != IMAP_TOK_CLOSE)
       {
-        mutt_debug(LL_DEBUG1, "Unterminated MODSEQ response: %s\n", s);
+        mutt_debug(LL_DEBUG1, "Unterminated MODSEQ response: %s\n", tok.str);
         return -1;
       }
     }
-    else if (*s == ')')
-      s++; /* end of request */
-    else if (*s)
+    else
     {
       /* got something i don't understand */
-      imap_error("msg_parse_fetch", s);
+      imap_error("msg_parse_fetch", tok.str);
       return -1;
     }
   }
@@ -493,6 +461,728 @@ static int msg_fetch_header(struct Mailbox *m, struct ImapHeader *ih, char *buf,
   return rc;
 }
 
+/**
+ * bs_string - Read a string from a BODYSTRUCTURE
+ * @param[in,out] s   Position in the response, advanced past the string
+ * @param[out]    buf Buffer for the string, may be NULL
+ * @retval  1 String read
+ * @retval  0 NIL read
+ * @retval -1 Error
+ *
+ * bs_gather() has already turned any literals into quoted strings.
+ */
+static int bs_string(char **s, struct Buffer *buf)
+{
+  char *p = *s;
+  SKIPWS(p);
+
+  if (buf)
+    mutt_buffer_reset(buf);
+
+  if (*p == '"')
+  {
+    for (p++; *p && (*p != '"'); p++)
+    {
+      if ((p[0] == '\\') && p[1])
+        p++;
+      if (buf)
+        mutt_buffer_addch(buf, *p);
+    }
+    if (*p != '"')
+      return -1;
+    *s = p + 1;
+    return 1;
+  }
+
+  if ((*p == '\0') || (*p == '{') || (*p == '(') || (*p == ')'))
+    return -1;
+
+  char *start = p;
+  while (*p && !IS_SPACE(*p) && (*p != '(') && (*p != ')'))
+    p++;
+  *s = p;
+
+  if (((p - start) == 3) && mutt_str_startswith(start, "NIL", CASE_IGNORE))
+    return 0;
+
+  if (buf)
+    mutt_buffer_addstr_n(buf, start, p - start);
+  return 1;
+}
+
+/**
+ * bs_skip - Skip over one value of a BODYSTRUCTURE
+ * @param[in,out] s Position in the response
+ * @retval  0 Success
+ * @retval -1 Error
+ */
+static int bs_skip(char **s)
+{
+  char *p = *s;
+  SKIPWS(p);
+
+  if (*p != '(')
+    return (bs_string(s, NULL) < 0) ? -1 : 0;
+
+  p++;
+  SKIPWS(p);
+  while (*p != ')')
+  {
+    if (bs_skip(&p) < 0)
+      return -1;
+    SKIPWS(p);
+  }
+  *s = p + 1;
+  return 0;
+}
+
+/**
+ * bs_params - Parse a parameter list of a BODYSTRUCTURE
+ * @param[in,out] s  Position in the response
+ * @param[in]     pl List for the parameters
+ * @retval  0 Success
+ * @retval -1 Error
+ */
+static int bs_params(char **s, struct ParameterList *pl)
+{
+  char *p = *s;
+  SKIPWS(p);
+
+  if (*p != '(')
+    return (bs_string(s, NULL) == 0) ? 0 : -1;
+
+  struct Buffer *attr = mutt_buffer_pool_get();
+  struct Buffer *val = mutt_buffer_pool_get();
+  int rc = -1;
+
+  p++;
+  SKIPWS(p);
+  while (*p != ')')
+  {
+    if ((bs_string(&p, attr) != 1) || (bs_string(&p, val) < 0))
+      goto done;
+    mutt_param_set(pl, mutt_b2s(attr), mutt_b2s(val));
+    SKIPWS(p);
+  }
+  *s = p + 1;
+  rc = 0;
+
+done:
+  mutt_buffer_pool_release(&attr);
+  mutt_buffer_pool_release(&val);
+  return rc;
+}
+
+/**
+ * bs_disposition - Parse the Content-Disposition of a BODYSTRUCTURE
+ * @param[in,out] s Position in the response
+ * @param[in]     b Body to update
+ * @retval  0 Success
+ * @retval -1 Error
+ */
+static int bs_disposition(char **s, struct Body *b)
+{
+  char *p = *s;
+  SKIPWS(p);
+
+  if (*p != '(')
+    return bs_skip(s);
+
+  struct Buffer *buf = mutt_buffer_pool_get();
+  struct ParameterList pl = TAILQ_HEAD_INITIALIZER(pl);
+  int rc = -1;
+
+  p++;
+  if (bs_string(&p, buf) != 1)
+    goto done;
+
+  if (mutt_str_strcasecmp(mutt_b2s(buf), "attachment") == 0)
+    b->disposition = DISP_ATTACH;
+  else if (mutt_str_strcasecmp(mutt_b2s(buf), "form-data") == 0)
+    b->disposition = DISP_FORM_DATA;
+  else
+    b->disposition = DISP_INLINE;
+
+  if (bs_params(&p, &pl) < 0)
+    goto done;
+  mutt_str_replace(&b->filename, mutt_param_get(&pl, "filename"));
+
+  SKIPWS(p);
+  if (*p != ')')
+    goto done;
+  *s = p + 1;
+  rc = 0;
+
+done:
+  mutt_param_free(&pl);
+  mutt_buffer_pool_release(&buf);
+  return rc;
+}
+
+/**
+ * bs_body - Parse one body of a BODYSTRUCTURE
+ * @param[in,out] s Position in the response
+ * @retval ptr  Body tree
+ * @retval NULL Error
+ *
+ * This builds the same tree as mutt_parse_part() would, minus the offsets,
+ * so it's only good for looking at the MIME types.
+ */
+static struct Body *bs_body(char **s)
+{
+  char *p = *s;
+  SKIPWS(p);
+  if (*p != '(')
+    return NULL;
+  p++;
+  SKIPWS(p);
+
+  struct Body *b = mutt_body_new();
+  struct Buffer *buf = mutt_buffer_pool_get();
+  b->disposition = DISP_INLINE;
+
+  if (*p == '(')
+  {
+    /* body-type-mpart */
+    b->type = TYPE_MULTIPART;
+    struct Body **last = &b->parts;
+    while (*p == '(')
+    {
+      *last = bs_body(&p);
+      if (!*last)
+        goto fail;
+      last = &(*last)->next;
+      SKIPWS(p);
+    }
+    if (bs_string(&p, buf) != 1)
+      goto fail;
+    b->subtype = mutt_str_strdup(mutt_b2s(buf));
+    mutt_str_strlower(b->subtype);
+
+    SKIPWS(p);
+    if ((*p != ')') && (bs_params(&p, &b->parameter) < 0))
+      goto fail;
+  }
+  else
+  {
+    /* body-type-1part */
+    if (bs_string(&p, buf) != 1)
+      goto fail;
+    b->type = mutt_check_mime_type(mutt_b2s(buf));
+    if (b->type == TYPE_OTHER)
+      b->xtype = mutt_str_strdup(mutt_b2s(buf));
+
+    if (bs_string(&p, buf) != 1)
+      goto fail;
+    b->subtype = mutt_str_strdup(mutt_b2s(buf));
+    mutt_str_strlower(b->subtype);
+
+    /* body-fields: param id desc enc octets */
+    if ((bs_params(&p, &b->parameter) < 0) || (bs_skip(&p) < 0))
+      goto fail;
+    if (bs_string(&p, buf) < 0)
+      goto fail;
+    if (!mutt_buffer_is_empty(buf))
+      b->description = mutt_str_strdup(mutt_b2s(buf));
+    if (bs_string(&p, buf) < 0)
+      goto fail;
+    b->encoding = mutt_check_encoding(mutt_b2s(buf));
+    if ((bs_string(&p, buf) < 0) || (mutt_str_atol(mutt_b2s(buf), &b->length) < 0))
+      goto fail;
+
+    if ((b->type == TYPE_MESSAGE) && (mutt_str_strcasecmp(b->subtype, "rfc822") == 0))
+    {
+      /* envelope body lines */
+      if (bs_skip(&p) < 0)
+        goto fail;
+      b->parts = bs_body(&p);
+      if (!b->parts || (bs_skip(&p) < 0))
+        goto fail;
+    }
+    else if (b->type == TYPE_TEXT)
+    {
+      if (bs_skip(&p) < 0)
+        goto fail;
+    }
+
+    /* md5 */
+    SKIPWS(p);
+    if ((*p != ')') && (bs_skip(&p) < 0))
+      goto fail;
+  }
+
+  SKIPWS(p);
+  if ((*p != ')') && (bs_disposition(&p, b) < 0))
+    goto fail;
+
+  /* language, location and any future extensions */
+  SKIPWS(p);
+  while (*p && (*p != ')'))
+  {
+    if (bs_skip(&p) < 0)
+      goto fail;
+    SKIPWS(p);
+  }
+  if (*p != ')')
+    goto fail;
+
+  *s = p + 1;
+  mutt_buffer_pool_release(&buf);
+  return b;
+
+fail:
+  mutt_buffer_pool_release(&buf);
+  mutt_body_free(&b);
+  return NULL;
+}
+
+/**
+ * struct SectionFetch - Download an Email one MIME part at a time
+ */
+struct SectionFetch
+{
+  struct ImapAccountData *adata; ///< Imap Account data
+  struct ImapMboxData *mdata;    ///< Imap Mailbox data
+  struct Email *email;           ///< Email being fetched
+  struct Buffer *items;          ///< FETCH items still to be requested
+};
+
+/**
+ * section_cache_id - Generate the message cache id of a MIME section
+ * @param sf      Section fetch
+ * @param section Section, e.g. "HEADER", "2.1.MIME"
+ * @param binary  Section is fetched with BINARY
+ * @param id      Buffer for the id
+ * @param idlen   Length of the buffer
+ *
+ * The id starts like the one of the whole message, so msg_cache_clean_cb()
+ * cleans up the sections too.
+ */
+static void section_cache_id(struct SectionFetch *sf, const char *section,
+                             bool binary, char *id, size_t idlen)
+{
+  snprintf(id, idlen, "%u-%u.%s%s", sf->mdata->uid_validity,
+           imap_edata_get(sf->email)->uid, section, binary ? ".BIN" : "");
+}
+
+/**
+ * section_is_binary - Should a MIME part be fetched with BINARY?
+ * @param sf Section fetch
+ * @param b  Body of the part
+ * @retval true The server should decode the part
+ *
+ * Only base64 attachments are worth it.  Decoded text would have to be
+ * translated back to local line endings.
+ */
+static bool section_is_binary(struct SectionFetch *sf, struct Body *b)
+{
+  return (sf->adata->capabilities & IMAP_CAP_BINARY) && (b->encoding == ENC_BASE64) &&
+         (b->type != TYPE_TEXT) && (b->type != TYPE_MESSAGE) &&
+         (b->type != TYPE_MULTIPART);
+}
+
+/**
+ * section_is_deferred - Can a MIME part be left out?
+ * @param b Body of the part
+ * @retval true The part won't be downloaded
+ *
+ * The pager only needs the parts it can display.
+ */
+static bool section_is_deferred(struct Body *b)
+{
+  return (b->type != TYPE_MULTIPART) && (b->length >= C_ImapPartialFetch) &&
+         !mutt_can_decode(b);
+}
+
+/**
+ * section_is_signed - Does a MIME part contain a signed or encrypted multipart?
+ * @param b Body of the part
+ * @retval true A signature or encryption covers some of the parts
+ *
+ * Rebuilding such a part wouldn't keep it byte for byte, e.g. nested
+ * preambles are lost, so the signature would no longer verify.
+ */
+static bool section_is_signed(struct Body *b)
+{
+  if (b->type != TYPE_MULTIPART)
+    return false;
+
+  if ((mutt_str_strcasecmp(b->subtype, "signed") == 0) ||
+      (mutt_str_strcasecmp(b->subtype, "encrypted") == 0))
+  {
+    return true;
+  }
+
+  for (struct Body *part = b->parts; part; part = part->next)
+    if (section_is_signed(part))
+      return true;
+
+  return false;
+}
+
+/**
+ * section_add - Request a MIME section, unless it's cached
+ * @param sf      Section fetch
+ * @param section Section, e.g. "HEADER", "2.1.MIME"
+ * @param binary  Fetch the section with BINARY
+ */
+static void section_add(struct SectionFetch *sf, const char *section, bool binary)
+{
+  char id[128];
+  section_cache_id(sf, section, binary, id, sizeof(id));
+  if (mutt_bcache_exists(sf->mdata->bcache, id) == 0)
+    return;
+
+  const char *peek = C_ImapPeek ? ".PEEK" : "";
+  mutt_buffer_add_printf(sf->items, "%s%s%s[%s]", mutt_buffer_is_empty(sf->items) ? "" : " ",
+                         binary ? "BINARY" : "BODY", peek, section);
+}
+
+/**
+ * section_request - Request the MIME sections of a multipart
+ * @param sf     Section fetch
+ * @param b      Body of the multipart
+ * @param prefix Section of the multipart, NULL for the message itself
+ */
+static void section_request(struct SectionFetch *sf, struct Body *b, const char *prefix)
+{
+  char section[64];
+  int num = 1;
+
+  for (struct Body *part = b->parts; part; part = part->next, num++)
+  {
+    if (prefix)
+      snprintf(section, sizeof(section), "%s.%d.MIME", prefix, num);
+    else
+      snprintf(section, sizeof(section), "%d.MIME", num);
+    section_add(sf, section, false);
+    section[mutt_str_strlen(section) - 5] = '\0';
+
+    if (part->type == TYPE_MULTIPART)
+      section_request(sf, part, section);
+    else if (!section_is_deferred(part))
+      section_add(sf, section, section_is_binary(sf, part));
+  }
+}
+
+/**
+ * section_read_literal - Read a MIME section into the message cache
+ * @param sf      Section fetch
+ * @param section Section, e.g. "2.1.MIME"
+ * @param binary  Section was fetched with BINARY
+ * @param bytes   Size of the literal, 0 for NIL
+ * @retval  0 Success
+ * @retval -1 Failure
+ *
+ * Binary sections are stored as they are, everything else gets local line
+ * endings, like imap_read_literal() does.
+ */
+static int section_read_literal(struct SectionFetch *sf, const char *section,
+                                bool binary, unsigned int bytes)
+{
+  char id[128];
+  section_cache_id(sf, section, binary, id, sizeof(id));
+
+  FILE *fp = mutt_bcache_put(sf->mdata->bcache, id);
+  if (!fp)
+    return -1;
+
+  int rc = 0;
+  if (binary)
+  {
+    char c;
+    for (unsigned int pos = 0; pos < bytes; pos++)
+    {
+      if (mutt_socket_readchar(sf->adata->conn, &c) != 1)
+      {
+        sf->adata->status = IMAP_FATAL;
+        rc = -1;
+        break;
+      }
+      fputc(c, fp);
+    }
+  }
+  else if (bytes > 0)
+  {
+    rc = imap_read_literal(fp, sf->adata, bytes, NULL);
+  }
+
+  if ((mutt_file_fclose(&fp) != 0) || (rc < 0))
+    return -1;
+  return mutt_bcache_commit(sf->mdata->bcache, id);
+}
+
+/**
+ * section_fetch - Download the requested MIME sections
+ * @param sf Section fetch
+ * @retval  0 Success
+ * @retval -1 Failure
+ */
+static int section_fetch(struct SectionFetch *sf)
+{
+  struct ImapAccountData *adata = sf->adata;
+  struct Email *e = sf->email;
+  struct Buffer *cmd = mutt_buffer_pool_get();
+  char section[64];
+  unsigned int bytes;
+  int rc;
+
+  mutt_buffer_printf(cmd, "UID FETCH %u (%s)", imap_edata_get(e)->uid, mutt_b2s(sf->items));
+  mutt_debug(LL_DEBUG2, "Fetching sections: %s\n", mutt_b2s(sf->items));
+
+  /* see imap_msg_open() */
+  e->active = false;
+
+  imap_cmd_start(adata, mutt_b2s(cmd));
+  do
+  {
+    rc = imap_cmd_step(adata);
+    if (rc != IMAP_RES_CONTINUE)
+      break;
+
+    /* Each line holds at most one literal, at its end */
+    char *pc = adata->buf;
+    while (*pc)
+    {
+      SKIPWS(pc);
+      if (*pc == '(')
+        pc++;
+
+      bool binary = mutt_str_startswith(pc, "BINARY[", CASE_IGNORE);
+      size_t plen = binary ? 7 : mutt_str_startswith(pc, "BODY[", CASE_IGNORE);
+      if (plen != 0)
+      {
+        pc += plen;
+        char *end = strchr(pc, ']');
+        if (!end || ((size_t)(end - pc) >= sizeof(section)))
+        {
+          rc = IMAP_RES_BAD;
+          break;
+        }
+        mutt_str_strfcpy(section, pc, end - pc + 1);
+        pc = imap_next_word(end);
+
+        bytes = 0;
+        if ((*pc == '~') || (*pc == '{'))
+        {
+          if ((imap_get_literal_count(pc, &bytes) < 0) ||
+              (section_read_literal(sf, section, binary, bytes) < 0))
+          {
+            rc = IMAP_RES_BAD;
+          }
+          break;
+        }
+
+        /* NIL or an empty string */
+        if (section_read_literal(sf, section, binary, 0) < 0)
+        {
+          rc = IMAP_RES_BAD;
+          break;
+        }
+      }
+      else if (mutt_str_startswith(pc, "FLAGS", CASE_IGNORE) && !e->changed)
+      {
+        pc = imap_set_flags(adata->mailbox, e, pc, NULL);
+        if (!pc)
+        {
+          rc = IMAP_RES_BAD;
+          break;
+        }
+        continue;
+      }
+      pc = imap_next_word(pc);
+    }
+  } while (rc == IMAP_RES_CONTINUE);
+
+  e->active = true;
+  mutt_buffer_pool_release(&cmd);
+
+  if ((rc != IMAP_RES_OK) || !imap_code(adata->buf))
+    return -1;
+  return 0;
+}
+
+/**
+ * section_copy - Copy a MIME section from the message cache
+ * @param sf      Section fetch
+ * @param section Section, e.g. "HEADER", "2.1.MIME"
+ * @param binary  Replace the Content-Transfer-Encoding with "binary"
+ * @param fp      File to write to
+ * @retval  0 Success
+ * @retval -1 Failure
+ */
+static int section_copy(struct SectionFetch *sf, const char *section, bool binary, FILE *fp)
+{
+  char id[128];
+  section_cache_id(sf, section, false, id, sizeof(id));
+
+  FILE *fp_in = mutt_bcache_get(sf->mdata->bcache, id);
+  if (!fp_in)
+    return -1;
+
+  char buf[1024];
+  bool skip = false;
+  bool bol = true;
+  while (fgets(buf, sizeof(buf), fp_in))
+  {
+    /* The header block ends with an empty line; we add our own */
+    if (bol && (buf[0] == '\n'))
+      break;
+
+    if (binary && bol)
+    {
+      if (mutt_str_startswith(buf, "Content-Transfer-Encoding:", CASE_IGNORE))
+        skip = true;
+      else if (!IS_SPACE(buf[0]))
+        skip = false;
+    }
+    if (!skip)
+      fputs(buf, fp);
+    bol = (buf[mutt_str_strlen(buf) - 1] == '\n');
+  }
+  if (!bol)
+    fputc('\n', fp);
+  if (binary)
+    fputs("Content-Transfer-Encoding: binary\n", fp);
+  fputc('\n', fp);
+
+  mutt_file_fclose(&fp_in);
+  return ferror(fp) ? -1 : 0;
+}
+
+/**
+ * section_write - Rebuild a multipart from the message cache
+ * @param sf     Section fetch
+ * @param b      Body of the multipart
+ * @param prefix Section of the multipart, NULL for the message itself
+ * @param fp     File to write to
+ * @retval  0 Success
+ * @retval -1 Failure
+ *
+ * Left out attachments become holes of the right size, so the rest of the
+ * message keeps its layout.
+ */
+static int section_write(struct SectionFetch *sf, struct Body *b,
+                         const char *prefix, FILE *fp)
+{
+  const char *boundary = mutt_param_get(&b->parameter, "boundary");
+  if (!boundary)
+    return -1;
+
+  char section[64];
+  int num = 1;
+  for (struct Body *part = b->parts; part; part = part->next, num++)
+  {
+    if (prefix)
+      snprintf(section, sizeof(section), "%s.%d.MIME", prefix, num);
+    else
+      snprintf(section, sizeof(section), "%d.MIME", num);
+
+    bool binary = (part->type != TYPE_MULTIPART) && !section_is_deferred(part) &&
+                  section_is_binary(sf, part);
+
+    fprintf(fp, "--%s\n", boundary);
+    if (section_copy(sf, section, binary, fp) < 0)
+      return -1;
+    section[mutt_str_strlen(section) - 5] = '\0';
+
+    if (part->type == TYPE_MULTIPART)
+    {
+      if (section_write(sf, part, section, fp) < 0)
+        return -1;
+    }
+    else if (section_is_deferred(part))
+    {
+      if (fseeko(fp, part->length, SEEK_CUR) < 0)
+        return -1;
+    }
+    else
+    {
+      char id[128];
+      section_cache_id(sf, section, binary, id, sizeof(id));
+      FILE *fp_in = mutt_bcache_get(sf->mdata->bcache, id);
+      if (!fp_in)
+        return -1;
+      int rc = mutt_file_copy_stream(fp_in, fp);
+      mutt_file_fclose(&fp_in);
+      if (rc < 0)
+        return -1;
+    }
+    fputc('\n', fp);
+  }
+  fprintf(fp, "--%s--\n", boundary);
+
+  return ferror(fp) ? -1 : 0;
+}
+
+/**
+ * msg_fetch_sections - Download a big Email one MIME part at a time
+ * @param[in]  m  Mailbox
+ * @param[in]  e  Email
+ * @param[out] fp Temporary file holding the Email
+ * @retval  0 Success
+ * @retval -1 Failure
+ * @retval -2 The Email isn't suitable, fetch it as a whole
+ *
+ * This is only done when the Email is being displayed, see #OptPartialFetch.
+ * Big attachments the pager can't show are left out.  The Email is rebuilt
+ * from its sections, so it isn't identical to the original and must never be
+ * committed to the message cache.
+ *
+ * The sections are kept in the message cache, so displaying the message again
+ * doesn't have to download them again.
+ */
+static int msg_fetch_sections(struct Mailbox *m, struct Email *e, FILE **fp)
+{
+  struct ImapAccountData *adata = imap_adata_get(m);
+  struct ImapMboxData *mdata = imap_mdata_get(m);
+
+  if (!OptPartialFetch || (C_ImapPartialFetch <= 0) ||
+      (e->content->length < C_ImapPartialFetch) ||
+      !(adata->capabilities & IMAP_CAP_IMAP4REV1))
+  {
+    return -2;
+  }
+
+  mdata->bcache = imap_cache_open(m);
+  if (!mdata->bcache)
+    return -2;
+
+  struct Body *bs = imap_body_structure(m, e);
+  if (!bs || (bs->type != TYPE_MULTIPART) || section_is_signed(bs))
+    return -2;
+
+  struct SectionFetch sf = { 0 };
+  sf.adata = adata;
+  sf.mdata = mdata;
+  sf.email = e;
+  sf.items = mutt_buffer_pool_get();
+
+  int rc = -1;
+  section_add(&sf, "HEADER", false);
+  section_request(&sf, bs, NULL);
+
+  if (!mutt_buffer_is_empty(sf.items) && (section_fetch(&sf) < 0))
+    goto done;
+
+  *fp = mutt_file_mkstemp();
+  if (!*fp)
+    goto done;
+
+  if ((section_copy(&sf, "HEADER", false, *fp) < 0) ||
+      (section_write(&sf, bs, NULL, *fp) < 0) || (fflush(*fp) != 0))
+  {
+    mutt_file_fclose(fp);
+    goto done;
+  }
+
+  rc = 0;
+
+done:
+  mutt_buffer_pool_release(&sf.items);
+  return rc;
+}
+
 /**
  * flush_buffer - Write data to a connection
  * @param buf  Buffer containing data
@@ -570,21 +1260,6 @@ static void alloc_msn_index(struct ImapAccountData *adata, size_t msn_count)
   mdata->msn_index_size = new_size;
 }
 
-/**
- * imap_alloc_uid_hash - Create a Hash Table for the UIDs
- * @param adata Imap Account data
- * @param msn_count Number of MSNs in use
- *
- * This function is run after imap_alloc_msn_index, so we skip the
- * malicious msn_count size check.
- */
-static void imap_alloc_uid_hash(struct ImapAccountData *adata, unsigned int msn_count)
-{
-  struct ImapMboxData *mdata = adata->mailbox->mdata;
-  if (!mdata->uid_hash)
-    mdata->uid_hash = mutt_hash_int_new(MAX(6 * msn_count / 5, 30), MUTT_HASH_NO_FLAGS);
-}
-
 /**
  * imap_fetch_msn_seqset - Generate a sequence set
  * @param[in]  buf           Buffer for the result
@@ -797,7 +1472,7 @@ static int read_headers_normal_eval_cache(struct ImapAccountData *adata,
       {
         mdata->max_msn = MAX(mdata->max_msn, h.edata->msn);
         mdata->msn_index[h.edata->msn - 1] = e;
-        mutt_hash_int_insert(mdata->uid_hash, h.edata->uid, e);
+        imap_uid_insert(mdata, h.edata->uid, e);
 
         e->index = idx;
         /* messages which have not been expunged are ACTIVE (borrowed from mh
@@ -910,7 +1585,7 @@ static int read_headers_qresync_eval_cache(struct ImapAccountData *adata, char *
 
       edata->msn = msn;
       edata->uid = uid;
-      mutt_hash_int_insert(mdata->uid_hash, uid, e);
+      imap_uid_insert(mdata, uid, e);
 
       mailbox_size_add(m, e);
       m->emails[m->msg_count++] = e;
@@ -1173,7 +1848,7 @@ static int read_headers_fetch_new(struct Mailbox *m, unsigned int msn_begin,
 
         mdata->max_msn = MAX(mdata->max_msn, h.edata->msn);
         mdata->msn_index[h.edata->msn - 1] = e;
-        mutt_hash_int_insert(mdata->uid_hash, h.edata->uid, e);
+        imap_uid_insert(mdata, h.edata->uid, e);
 
         e->index = idx;
         /* messages which have not been expunged are ACTIVE (borrowed from mh
@@ -1301,7 +1976,7 @@ int imap_read_headers(struct Mailbox *m, unsigned int msn_begin,
   while (msn_end > m->email_max)
     mx_alloc_memory(m);
   alloc_msn_index(adata, msn_end);
-  imap_alloc_uid_hash(adata, msn_end);
+  imap_uid_alloc(mdata, msn_end);
 
   oldmsgcount = m->msg_count;
   mdata->reopen &= ~(IMAP_REOPEN_ALLOW | IMAP_NEWMAIL_PENDING);
@@ -1429,24 +2104,272 @@ int imap_read_headers(struct Mailbox *m, unsigned int msn_begin,
   }
 #endif /* USE_HCACHE */
 
-  if (m->msg_count > oldmsgcount)
-  {
-    /* TODO: it's not clear to me why we are calling mx_alloc_memory
-     *       yet again. */
-    mx_alloc_memory(m);
-  }
+  if (m->msg_count > oldmsgcount)
+  {
+    /* TODO: it's not clear to me why we are calling mx_alloc_memory
+     *       yet again. */
+    mx_alloc_memory(m);
+  }
+
+  mdata->reopen |= IMAP_REOPEN_ALLOW;
+
+  retval = msn_end;
+
+bail:
+#ifdef USE_HCACHE
+  imap_hcache_close(mdata);
+  FREE(&uid_seqset);
+#endif /* USE_HCACHE */
+
+  return retval;
+}
+
+/**
+ * append_length - Measure a message as it will be sent
+ * @param fp File containing the message
+ * @retval num Size in bytes, with CRLF line endings
+ */
+static size_t append_length(FILE *fp)
+{
+  size_t len = 0;
+  int c, last;
+
+  /* currently we set the \Seen flag on all messages, but probably we
+   * should scan the message Status header for flag info. Since we're
+   * already rereading the whole file for length it isn't any more
+   * expensive (it'd be nice if we had the file size passed in already
+   * by the code that writes the file, but that's a lot of changes.
+   * Ideally we'd have an Email structure with flag info here... */
+  for (last = EOF; (c = fgetc(fp)) != EOF; last = c)
+  {
+    if ((c == '\n') && (last != '\r'))
+      len++;
+
+    len++;
+  }
+  rewind(fp);
+
+  return len;
+}
+
+/**
+ * append_header - Add the flags, date and literal size of a message to an APPEND
+ * @param adata Imap Account data
+ * @param buf   Buffer for the command
+ * @param msg   Message to append
+ * @param len   Size of the message
+ * @retval true The literal is non-synchronizing, don't wait for the server
+ */
+static bool append_header(struct ImapAccountData *adata, struct Buffer *buf,
+                          struct Message *msg, size_t len)
+{
+  char internaldate[IMAP_DATELEN];
+  char imap_flags[128];
+
+  mutt_date_make_imap(internaldate, sizeof(internaldate), msg->received);
+
+  imap_flags[0] = '\0';
+  imap_flags[1] = '\0';
+
+  if (msg->flags.read)
+    mutt_str_strcat(imap_flags, sizeof(imap_flags), " \\Seen");
+  if (msg->flags.replied)
+    mutt_str_strcat(imap_flags, sizeof(imap_flags), " \\Answered");
+  if (msg->flags.flagged)
+    mutt_str_strcat(imap_flags, sizeof(imap_flags), " \\Flagged");
+  if (msg->flags.draft)
+    mutt_str_strcat(imap_flags, sizeof(imap_flags), " \\Draft");
+
+  /* RFC7888: LITERAL- only allows small non-synchronizing literals */
+  bool nonsync = (adata->capabilities & IMAP_CAP_LITERALPLUS) ||
+                 ((adata->capabilities & IMAP_CAP_LITERALMINUS) && (len <= 4096));
+
+  mutt_buffer_add_printf(buf, " (%s) \"%s\" {%lu%s}", imap_flags + 1, internaldate,
+                         (unsigned long) len, nonsync ? "+" : "");
+  return nonsync;
+}
+
+/**
+ * append_literal - Send a message as an IMAP literal
+ * @param adata    Imap Account data
+ * @param fp       File containing the message
+ * @param progress Progress bar
+ * @param sent     Number of bytes sent so far, updated
+ * @retval  0 Success
+ * @retval -1 Failure
+ */
+static int append_literal(struct ImapAccountData *adata, FILE *fp,
+                          struct Progress *progress, size_t *sent)
+{
+  char buf[1024 * 2];
+  size_t len = 0;
+  int c, last;
+
+  for (last = EOF; (c = fgetc(fp)) != EOF; last = c)
+  {
+    if ((c == '\n') && (last != '\r'))
+      buf[len++] = '\r';
+
+    buf[len++] = c;
+
+    if (len > sizeof(buf) - 3)
+    {
+      *sent += len;
+      if (flush_buffer(buf, &len, adata->conn) < 0)
+        return -1;
+      mutt_progress_update(progress, *sent, -1);
+    }
+  }
+
+  if (len)
+  {
+    *sent += len;
+    if (flush_buffer(buf, &len, adata->conn) < 0)
+      return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * append_wait - Wait for the server to respond to an APPEND
+ * @param adata Imap Account data
+ * @retval num Result, e.g. #IMAP_RES_OK, #IMAP_RES_RESPOND
+ */
+static int append_wait(struct ImapAccountData *adata)
+{
+  int rc;
+
+  do
+  {
+    rc = imap_cmd_step(adata);
+  } while (rc == IMAP_RES_CONTINUE);
+
+  return rc;
+}
+
+/**
+ * imap_append_messages - Write several emails back to the server
+ * @param m     Mailbox
+ * @param msgs  Messages to save
+ * @param count Number of messages
+ * @retval  0 Success
+ * @retval -1 Failure
+ *
+ * With MULTIAPPEND (RFC3502) the messages are sent as a single command,
+ * otherwise they're sent one after another.  Where the server supports
+ * LITERAL+ or LITERAL- (RFC7888), we don't wait for its go-ahead before
+ * sending each message.
+ *
+ * All the files are opened before the command starts, so it can't be left
+ * half-sent because of a local error.  If the connection fails part way
+ * through, it's marked as fatal.
+ */
+int imap_append_messages(struct Mailbox *m, struct Message **msgs, size_t count)
+{
+  if (!m || !msgs || (count == 0))
+    return -1;
+
+  struct ImapAccountData *adata = imap_adata_get(m);
+  struct ImapMboxData *mdata = imap_mdata_get(m);
+  if (!adata || !mdata)
+    return -1;
+
+  struct Buffer *buf = mutt_buffer_pool_get();
+  struct Progress progress;
+  FILE **fps = mutt_mem_calloc(count, sizeof(FILE *));
+  size_t *lens = mutt_mem_calloc(count, sizeof(size_t));
+  size_t total = 0;
+  size_t sent = 0;
+  bool multi = (adata->capabilities & IMAP_CAP_MULTIAPPEND);
+  bool started = false;
+  int rc = IMAP_RES_OK;
+  int result = -1;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    fps[i] = fopen(msgs[i]->path, "r");
+    if (!fps[i])
+    {
+      mutt_perror(msgs[i]->path);
+      goto done;
+    }
+    lens[i] = append_length(fps[i]);
+    total += lens[i];
+  }
+
+  mutt_progress_init(&progress, _("Uploading message..."), MUTT_PROGRESS_NET, total);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    bool first = !multi || (i == 0);
+    mutt_buffer_reset(buf);
+    if (first)
+      mutt_buffer_printf(buf, "APPEND %s", mdata->munge_name);
+    bool nonsync = append_header(adata, buf, msgs[i], lens[i]);
+
+    if (first)
+    {
+      imap_cmd_start(adata, mutt_b2s(buf));
+      started = true;
+    }
+    else
+    {
+      mutt_buffer_addstr(buf, "\r\n");
+      if (mutt_socket_send(adata->conn, mutt_b2s(buf)) < 0)
+        goto done;
+    }
+
+    if (!nonsync)
+    {
+      rc = append_wait(adata);
+      if (rc != IMAP_RES_RESPOND)
+        goto cmd_step_fail;
+    }
+
+    if (append_literal(adata, fps[i], &progress, &sent) < 0)
+      goto done;
+    mutt_file_fclose(&fps[i]);
+
+    /* With MULTIAPPEND, the next message continues the same command */
+    if (multi && (i < (count - 1)))
+      continue;
 
-  mdata->reopen |= IMAP_REOPEN_ALLOW;
+    if (mutt_socket_send(adata->conn, "\r\n") < 0)
+      goto done;
 
-  retval = msn_end;
+    rc = append_wait(adata);
+    started = false;
+    if (rc != IMAP_RES_OK)
+      goto cmd_step_fail;
+  }
 
-bail:
-#ifdef USE_HCACHE
-  imap_hcache_close(mdata);
-  FREE(&uid_seqset);
-#endif /* USE_HCACHE */
+  result = 0;
+  goto done;
 
-  return retval;
+cmd_step_fail:
+  /* A tagged reply ends the command, a continuation request doesn't */
+  if (rc != IMAP_RES_RESPOND)
+    started = false;
+  mutt_debug(LL_DEBUG1, "command failed: %s\n", adata->buf);
+  if (rc != IMAP_RES_BAD)
+  {
+    char *pc = imap_next_word(adata->buf); /* skip sequence number or token */
+    pc = imap_next_word(pc);               /* skip response code */
+    if (*pc != '\0')
+      mutt_error("%s", pc);
+  }
+
+done:
+  /* The server is still waiting for the rest of the command */
+  if (started)
+    adata->status = IMAP_FATAL;
+  for (size_t i = 0; i < count; i++)
+    mutt_file_fclose(&fps[i]);
+  FREE(&fps);
+  FREE(&lens);
+  mutt_buffer_pool_release(&buf);
+  return result;
 }
 
 /**
@@ -1461,117 +2384,105 @@ int imap_append_message(struct Mailbox *m, struct Message *msg)
   if (!m || !msg)
     return -1;
 
-  FILE *fp = NULL;
-  char buf[1024 * 2];
-  char internaldate[IMAP_DATELEN];
-  char imap_flags[128];
-  size_t len;
-  struct Progress progress;
-  size_t sent;
-  int c, last;
-  int rc;
+  return imap_append_messages(m, &msg, 1);
+}
 
-  struct ImapAccountData *adata = imap_adata_get(m);
+/**
+ * append_flush - Send the queued messages to the server
+ * @param m Mailbox
+ * @retval  0 Success
+ * @retval -1 Failure
+ */
+static int append_flush(struct Mailbox *m)
+{
   struct ImapMboxData *mdata = imap_mdata_get(m);
+  if (!mdata || (mdata->append_count == 0))
+    return 0;
 
-  fp = fopen(msg->path, "r");
-  if (!fp)
-  {
-    mutt_perror(msg->path);
-    goto fail;
-  }
+  int rc = imap_append_messages(m, mdata->append_queue, mdata->append_count);
 
-  /* currently we set the \Seen flag on all messages, but probably we
-   * should scan the message Status header for flag info. Since we're
-   * already rereading the whole file for length it isn't any more
-   * expensive (it'd be nice if we had the file size passed in already
-   * by the code that writes the file, but that's a lot of changes.
-   * Ideally we'd have an Email structure with flag info here... */
-  for (last = EOF, len = 0; (c = fgetc(fp)) != EOF; last = c)
+  for (size_t i = 0; i < mdata->append_count; i++)
   {
-    if ((c == '\n') && (last != '\r'))
-      len++;
-
-    len++;
+    struct Message *msg = mdata->append_queue[i];
+    unlink(msg->path);
+    FREE(&msg->path);
+    FREE(&msg);
   }
-  rewind(fp);
+  mdata->append_count = 0;
 
-  mutt_progress_init(&progress, _("Uploading message..."), MUTT_PROGRESS_NET, len);
-
-  mutt_date_make_imap(internaldate, sizeof(internaldate), msg->received);
+  if (rc != 0)
+    mdata->append_failed = true;
+  return rc;
+}
 
-  imap_flags[0] = '\0';
-  imap_flags[1] = '\0';
+/**
+ * imap_append_begin - Start collecting messages to append in bulk
+ * @param m Mailbox being appended to
+ *
+ * Until imap_append_end() is called, committing a message only queues it.
+ * The queue is sent to the server in batches of #IMAP_APPEND_BATCH.
+ */
+void imap_append_begin(struct Mailbox *m)
+{
+  struct ImapMboxData *mdata = imap_mdata_get(m);
+  if (!mdata)
+    return;
 
-  if (msg->flags.read)
-    mutt_str_strcat(imap_flags, sizeof(imap_flags), " \\Seen");
-  if (msg->flags.replied)
-    mutt_str_strcat(imap_flags, sizeof(imap_flags), " \\Answered");
-  if (msg->flags.flagged)
-    mutt_str_strcat(imap_flags, sizeof(imap_flags), " \\Flagged");
-  if (msg->flags.draft)
-    mutt_str_strcat(imap_flags, sizeof(imap_flags), " \\Draft");
+  mdata->append_batch = true;
+  mdata->append_failed = false;
+}
 
-  snprintf(buf, sizeof(buf), "APPEND %s (%s) \"%s\" {%lu}", mdata->munge_name,
-           imap_flags + 1, internaldate, (unsigned long) len);
+/**
+ * imap_append_end - Send any queued messages to the server
+ * @param m Mailbox being appended to
+ * @retval  0 Success, every message was appended
+ * @retval -1 Failure, some messages may not have been appended
+ */
+int imap_append_end(struct Mailbox *m)
+{
+  struct ImapMboxData *mdata = imap_mdata_get(m);
+  if (!mdata || !mdata->append_batch)
+    return 0;
 
-  imap_cmd_start(adata, buf);
+  append_flush(m);
+  mdata->append_batch = false;
+  FREE(&mdata->append_queue);
+  mdata->append_max = 0;
 
-  do
-  {
-    rc = imap_cmd_step(adata);
-  } while (rc == IMAP_RES_CONTINUE);
+  return mdata->append_failed ? -1 : 0;
+}
 
-  if (rc != IMAP_RES_RESPOND)
-    goto cmd_step_fail;
+/**
+ * append_queue - Queue a message to be appended in bulk
+ * @param m   Mailbox
+ * @param msg Message, its temporary file is taken over
+ * @retval  0 Success
+ * @retval -1 Failure
+ */
+static int append_queue(struct Mailbox *m, struct Message *msg)
+{
+  struct ImapMboxData *mdata = imap_mdata_get(m);
 
-  for (last = EOF, sent = len = 0; (c = fgetc(fp)) != EOF; last = c)
+  if (mdata->append_count == mdata->append_max)
   {
-    if ((c == '\n') && (last != '\r'))
-      buf[len++] = '\r';
-
-    buf[len++] = c;
-
-    if (len > sizeof(buf) - 3)
-    {
-      sent += len;
-      if (flush_buffer(buf, &len, adata->conn) < 0)
-        goto fail;
-      mutt_progress_update(&progress, sent, -1);
-    }
+    mdata->append_max = IMAP_APPEND_BATCH;
+    mutt_mem_realloc(&mdata->append_queue, mdata->append_max * sizeof(struct Message *));
   }
 
-  if (len)
-    if (flush_buffer(buf, &len, adata->conn) < 0)
-      goto fail;
-
-  if (mutt_socket_send(adata->conn, "\r\n") < 0)
-    goto fail;
-  mutt_file_fclose(&fp);
-
-  do
-  {
-    rc = imap_cmd_step(adata);
-  } while (rc == IMAP_RES_CONTINUE);
-
-  if (rc != IMAP_RES_OK)
-    goto cmd_step_fail;
-
-  return 0;
+  struct Message *copy = mutt_mem_calloc(1, sizeof(struct Message));
+  copy->path = msg->path;
+  copy->flags.read = msg->flags.read;
+  copy->flags.flagged = msg->flags.flagged;
+  copy->flags.replied = msg->flags.replied;
+  copy->flags.draft = msg->flags.draft;
+  copy->received = msg->received;
+  msg->path = NULL;
 
-cmd_step_fail:
-  mutt_debug(LL_DEBUG1, "command failed: %s\n", adata->buf);
-  if (rc != IMAP_RES_BAD)
-  {
-    char *pc = imap_next_word(adata->buf); /* skip sequence number or token */
-    pc = imap_next_word(pc);               /* skip response code */
-    if (*pc != '\0')
-      mutt_error("%s", pc);
-  }
+  mdata->append_queue[mdata->append_count++] = copy;
 
-fail:
-  mutt_file_fclose(&fp);
-  return -1;
+  if (mdata->append_count < IMAP_APPEND_BATCH)
+    return 0;
+  return append_flush(m);
 }
 
 /**
@@ -1764,7 +2675,7 @@ int imap_cache_del(struct Mailbox *m, struct Email *e)
   if (!e || !adata || (adata->mailbox != m))
     return -1;
 
-  mdata->bcache = msg_cache_open(m);
+  mdata->bcache = imap_cache_open(m);
   char id[64];
   snprintf(id, sizeof(id), "%u-%u", mdata->uid_validity, imap_edata_get(e)->uid);
   return mutt_bcache_del(mdata->bcache, id);
@@ -1783,7 +2694,7 @@ int imap_cache_clean(struct Mailbox *m)
   if (!adata || (adata->mailbox != m))
     return -1;
 
-  mdata->bcache = msg_cache_open(m);
+  mdata->bcache = imap_cache_open(m);
   mutt_bcache_list(mdata->bcache, msg_cache_clean_cb, mdata);
 
   return 0;
@@ -1829,6 +2740,8 @@ char *imap_set_flags(struct Mailbox *m, struct Email *e, char *s, bool *server_c
   /* We take a copy of the tags so we can split the string */
   char *tags_copy = mutt_str_strdup(edata->flags_remote);
   driver_tags_replace(&e->tags, tags_copy);
+  mutt_pattern_memo_clear(e);
+  m->gen++;
   FREE(&tags_copy);
 
   /* YAUH (yet another ugly hack): temporarily set context to
@@ -1877,6 +2790,7 @@ int imap_msg_open(struct Mailbox *m, struct Message *msg, int msgno)
   unsigned int uid;
   bool retried = false;
   bool read;
+  bool partial = false;
   int rc;
 
   /* Sam's weird courier server returns an OK response even when FETCH
@@ -1896,7 +2810,7 @@ int imap_msg_open(struct Mailbox *m, struct Message *msg, int msgno)
   msg->fp = msg_cache_get(m, e);
   if (msg->fp)
   {
-    if (imap_edata_get(e)->parsed)
+    if (imap_edata_get(e)->parsed && !imap_edata_get(e)->partial)
       return 0;
     goto parsemsg;
   }
@@ -1907,6 +2821,15 @@ int imap_msg_open(struct Mailbox *m, struct Message *msg, int msgno)
   if (output_progress)
     mutt_message(_("Fetching message..."));
 
+  /* If the sections can't be fetched, e.g. the server refuses BINARY, the
+   * whole message is fetched instead */
+  rc = msg_fetch_sections(m, e, &msg->fp);
+  if (rc == 0)
+  {
+    partial = true;
+    goto parsemsg;
+  }
+
   msg->fp = msg_cache_put(m, e);
   if (!msg->fp)
   {
@@ -2043,6 +2966,19 @@ parsemsg:
   }
 
   e->content->length = ftell(msg->fp) - e->content->offset;
+  /* The Envelope and size were changed in place */
+  mutt_pattern_memo_clear(e);
+  m->gen++;
+
+  /* The MIME parts may have been parsed from the other kind of file, whole or
+   * rebuilt by msg_fetch_sections().  Their offsets don't fit this one. */
+  struct ImapEmailData *edata = imap_edata_get(e);
+  if ((edata->partial != partial) && e->content->parts)
+  {
+    mutt_body_free(&e->content->parts);
+    mutt_parse_part(msg->fp, e->content);
+  }
+  edata->partial = partial;
 
   mutt_clear_error();
   rewind(msg->fp);
@@ -2076,6 +3012,10 @@ int imap_msg_commit(struct Mailbox *m, struct Message *msg)
   if (rc != 0)
     return rc;
 
+  struct ImapMboxData *mdata = imap_mdata_get(m);
+  if (mdata && mdata->append_batch)
+    return append_queue(m, msg);
+
   return imap_append_message(m, msg);
 }
 
@@ -2111,3 +3051,243 @@ int imap_msg_save_hcache(struct Mailbox *m, struct Email *e)
 #endif
   return rc;
 }
+
+/**
+ * bs_gather - Collect a BODYSTRUCTURE that may contain literals
+ * @param[in]     adata Imap Account data
+ * @param[in,out] s     Position in the response, moved past the structure
+ * @param[out]    buf   Buffer for the structure
+ * @retval  0 Success
+ * @retval -1 Error
+ *
+ * The server may send any string as a literal, e.g. a filename containing
+ * quotes.  The literal is read from the connection and copied as a quoted
+ * string, then the rest of the response is read with imap_cmd_step(), like
+ * msg_fetch_header() does.  Afterwards, *s points into the last line read.
+ */
+static int bs_gather(struct ImapAccountData *adata, char **s, struct Buffer *buf)
+{
+  char *p = *s;
+  int depth = 0;
+
+  SKIPWS(p);
+  if (*p != '(')
+    return -1;
+
+  mutt_buffer_reset(buf);
+  do
+  {
+    if (*p == '\0')
+      return -1;
+
+    if (*p == '"')
+    {
+      char *start = p;
+      for (p++; *p && (*p != '"'); p++)
+        if ((p[0] == '\\') && p[1])
+          p++;
+      if (*p != '"')
+        return -1;
+      p++;
+      mutt_buffer_addstr_n(buf, start, p - start);
+      continue;
+    }
+
+    if (*p == '{')
+    {
+      unsigned int bytes = 0;
+      char *pc = strchr(p, '}');
+      /* Without a count we can't tell where the response carries on */
+      if (!pc || (pc[1] != '\0') || (imap_get_literal_count(p, &bytes) < 0))
+      {
+        adata->status = IMAP_FATAL;
+        return -1;
+      }
+
+      mutt_buffer_addch(buf, '"');
+      for (; bytes > 0; bytes--)
+      {
+        char c;
+        if (mutt_socket_readchar(adata->conn, &c) != 1)
+        {
+          adata->status = IMAP_FATAL;
+          return -1;
+        }
+        if ((c == '\r') || (c == '\n'))
+          continue;
+        if ((c == '"') || (c == '\\'))
+          mutt_buffer_addch(buf, '\\');
+        mutt_buffer_addch(buf, c);
+      }
+      mutt_buffer_addch(buf, '"');
+
+      if (imap_cmd_step(adata) != IMAP_RES_CONTINUE)
+        return -1;
+      p = adata->buf;
+      continue;
+    }
+
+    if (*p == '(')
+      depth++;
+    else if (*p == ')')
+      depth--;
+    mutt_buffer_addch(buf, *p);
+    p++;
+  } while (depth > 0);
+
+  *s = p;
+  return 0;
+}
+
+/**
+ * imap_parse_bodystructure - Parse a BODYSTRUCTURE from a FETCH response
+ * @param[in]     m Mailbox
+ * @param[in]     e Email the response is for
+ * @param[in,out] s Position in the response, just after "BODYSTRUCTURE"
+ * @retval  0 Success
+ * @retval -1 Error, the rest of the response can't be trusted
+ */
+int imap_parse_bodystructure(struct Mailbox *m, struct Email *e, char **s)
+{
+  struct ImapEmailData *edata = imap_edata_get(e);
+  if (!edata)
+    return -1;
+
+  struct ImapAccountData *adata = imap_adata_get(m);
+  struct Buffer *bs = mutt_buffer_pool_get();
+  struct Body *b = NULL;
+  if (adata && (bs_gather(adata, s, bs) == 0))
+  {
+    char *p = bs->data;
+    b = bs_body(&p);
+  }
+
+  if (!b)
+  {
+    mutt_debug(LL_DEBUG1, "Can't parse BODYSTRUCTURE of UID %u\n", edata->uid);
+    edata->bs_failed = true;
+    mutt_buffer_pool_release(&bs);
+    return -1;
+  }
+
+  mutt_body_free(&edata->bodystructure);
+  edata->bodystructure = b;
+  edata->bs_failed = false;
+
+#ifdef USE_HCACHE
+  imap_hcache_put_bodystructure(imap_mdata_get(m), edata->uid, mutt_b2s(bs),
+                                mutt_buffer_len(bs));
+#endif
+  mutt_buffer_pool_release(&bs);
+  return 0;
+}
+
+/**
+ * imap_body_structure - Get the MIME structure of an Email without fetching it
+ * @param m Mailbox
+ * @param e Email
+ * @retval ptr  Body tree, owned by the Email's private data
+ * @retval NULL The structure isn't available
+ *
+ * The tree comes from the header cache or a BODYSTRUCTURE request.  The
+ * request also covers the next Emails in the Mailbox, which are likely to be
+ * asked for next, e.g. by the index or by a pattern search.
+ *
+ * @note The Body tree has no offsets; it's only good for looking at types.
+ */
+struct Body *imap_body_structure(struct Mailbox *m, struct Email *e)
+{
+  struct ImapEmailData *edata = imap_edata_get(e);
+  if (!m || !edata || (m->magic != MUTT_IMAP))
+    return NULL;
+  if (edata->bodystructure || edata->bs_failed)
+    return edata->bodystructure;
+
+  struct ImapAccountData *adata = imap_adata_get(m);
+  struct ImapMboxData *mdata = imap_mdata_get(m);
+  if (!adata || !mdata || (adata->mailbox != m))
+    return NULL;
+
+#ifdef USE_HCACHE
+  bool close_hc = false;
+  if (!mdata->hcache)
+  {
+    mdata->hcache = imap_hcache_open(adata, mdata);
+    close_hc = true;
+  }
+#endif
+
+  struct Buffer *cmd = mutt_buffer_pool_get();
+  unsigned int first = 0;
+  unsigned int last = 0;
+  int count = 0;
+  int i;
+
+  mutt_buffer_addstr(cmd, "UID FETCH ");
+  for (i = e->msgno; (i < m->msg_count) && (count < IMAP_BODYSTRUCTURE_WINDOW); i++)
+  {
+    struct Email *e2 = m->emails[i];
+    struct ImapEmailData *edata2 = imap_edata_get(e2);
+    if (!edata2 || !e2->active || edata2->bodystructure || edata2->bs_failed)
+      continue;
+
+#ifdef USE_HCACHE
+    char *hc_bs = imap_hcache_get_bodystructure(mdata, edata2->uid);
+    if (hc_bs)
+    {
+      char *s = hc_bs;
+      edata2->bodystructure = bs_body(&s);
+      FREE(&hc_bs);
+      if (edata2->bodystructure)
+        continue;
+    }
+#endif
+
+    if (count && (edata2->uid == (last + 1)))
+    {
+      last = edata2->uid;
+    }
+    else
+    {
+      if (count)
+      {
+        if (first == last)
+          mutt_buffer_add_printf(cmd, "%u,", first);
+        else
+          mutt_buffer_add_printf(cmd, "%u:%u,", first, last);
+      }
+      first = edata2->uid;
+      last = edata2->uid;
+    }
+    count++;
+  }
+
+  if (count)
+  {
+    if (first == last)
+      mutt_buffer_add_printf(cmd, "%u BODYSTRUCTURE", first);
+    else
+      mutt_buffer_add_printf(cmd, "%u:%u BODYSTRUCTURE", first, last);
+
+    mutt_debug(LL_DEBUG2, "Fetching BODYSTRUCTURE of %d messages\n", count);
+    if (imap_exec(adata, mutt_b2s(cmd), IMAP_CMD_NO_FLAGS) != IMAP_EXEC_SUCCESS)
+      mutt_debug(LL_DEBUG1, "BODYSTRUCTURE request failed\n");
+
+    /* Don't ask again for anything the server didn't tell us about, even if
+     * the request failed; otherwise every lookup would repeat it. */
+    for (int j = e->msgno; j < i; j++)
+    {
+      struct ImapEmailData *edata2 = imap_edata_get(m->emails[j]);
+      if (edata2 && !edata2->bodystructure)
+        edata2->bs_failed = true;
+    }
+  }
+
+  mutt_buffer_pool_release(&cmd);
+#ifdef USE_HCACHE
+  if (close_hc)
+    imap_hcache_close(mdata);
+#endif
+
+  return edata->bodystructure;
+}
@@ -27,6 +27,8 @@
 #include <stdbool.h>
 #include <time.h>
 
+struct Body;
+
 /**
  * struct ImapEmailData - IMAP-specific Email data - @extends Email
  */
@@ -40,12 +42,16 @@ struct ImapEmailData
   bool replied : 1;
 
   bool parsed : 1;
+  bool bs_failed : 1; ///< BODYSTRUCTURE couldn't be fetched or parsed
+  bool partial : 1;   ///< Last local copy was rebuilt from its MIME sections
 
   unsigned int uid; ///< 32-bit Message UID
   unsigned int msn; ///< Message Sequence Number
 
   char *flags_system;
   char *flags_remote;
+
+  struct Body *bodystructure; ///< MIME tree from BODYSTRUCTURE, see imap_body_structure()
 };
 
 /**
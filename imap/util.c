@@ -32,6 +32,7 @@
 #include "config.h"
 #include <ctype.h>
 #include <errno.h>
+#include <limits.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <signal.h>
@@ -213,13 +214,197 @@ struct ImapMboxData *imap_mdata_new(struct ImapAccountData *adata, const char *n
  */
 void imap_mdata_cache_reset(struct ImapMboxData *mdata)
 {
-  mutt_hash_free(&mdata->uid_hash);
+  FREE(&mdata->uid_index);
+  FREE(&mdata->uid_emails);
+  mdata->uid_count = 0;
+  mdata->uid_size = 0;
+  mdata->uid_removed = 0;
   FREE(&mdata->msn_index);
   mdata->msn_index_size = 0;
   mdata->max_msn = 0;
   mutt_bcache_close(&mdata->bcache);
 }
 
+/**
+ * imap_uid_alloc - Make room in the UID index
+ * @param mdata Imap Mailbox data
+ * @param count Number of UIDs expected
+ *
+ * The UID index is a pair of dense arrays, sorted by UID.  Because the server
+ * hands out UIDs in ascending order, new messages are almost always appended.
+ *
+ * This function is run after alloc_msn_index(), so we skip the malicious
+ * count size check.
+ */
+void imap_uid_alloc(struct ImapMboxData *mdata, size_t count)
+{
+  if (!mdata || (count <= mdata->uid_size))
+    return;
+
+  mutt_mem_realloc(&mdata->uid_index, count * sizeof(unsigned int));
+  mutt_mem_realloc(&mdata->uid_emails, count * sizeof(struct Email *));
+  mdata->uid_size = count;
+}
+
+/**
+ * uid_search - Find the position of a UID in the UID index
+ * @param[in]  mdata Imap Mailbox data
+ * @param[in]  uid   UID to look for
+ * @param[out] found Set to true if the UID was found
+ * @retval num Position of the UID, or where it should be inserted
+ *
+ * UIDs are usually densely packed, so an interpolation search will find them
+ * in a probe or two.  Interpolation and bisection steps are alternated, so a
+ * sparse index is still searched in logarithmic time.
+ */
+static size_t uid_search(const struct ImapMboxData *mdata, unsigned int uid, bool *found)
+{
+  const unsigned int *uids = mdata->uid_index;
+  size_t lo = 0;
+  size_t hi = mdata->uid_count;
+  bool interpolate = true;
+
+  *found = false;
+  while (lo < hi)
+  {
+    const unsigned int first = uids[lo];
+    const unsigned int last = uids[hi - 1];
+    size_t mid;
+
+    if (interpolate && (last > first) && (uid >= first) && (uid <= last))
+    {
+      mid = lo + (size_t) (((unsigned long long) (uid - first) * (hi - 1 - lo)) /
+                           (last - first));
+    }
+    else
+      mid = lo + ((hi - lo) / 2);
+    interpolate = !interpolate;
+
+    if (uids[mid] == uid)
+    {
+      *found = true;
+      return mid;
+    }
+
+    if (uids[mid] < uid)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
+
+/**
+ * uid_compact - Drop the removed entries from the UID index
+ * @param mdata Imap Mailbox data
+ */
+static void uid_compact(struct ImapMboxData *mdata)
+{
+  size_t dst = 0;
+  for (size_t src = 0; src < mdata->uid_count; src++)
+  {
+    if (!mdata->uid_emails[src])
+      continue;
+    mdata->uid_index[dst] = mdata->uid_index[src];
+    mdata->uid_emails[dst] = mdata->uid_emails[src];
+    dst++;
+  }
+
+  mutt_debug(LL_DEBUG3, "compacted UID index from %zu to %zu\n", mdata->uid_count, dst);
+  mdata->uid_count = dst;
+  mdata->uid_removed = 0;
+}
+
+/**
+ * imap_uid_find - Find an Email by its UID
+ * @param mdata Imap Mailbox data
+ * @param uid   UID to look for
+ * @retval ptr  Matching Email
+ * @retval NULL No match
+ */
+struct Email *imap_uid_find(struct ImapMboxData *mdata, unsigned int uid)
+{
+  if (!mdata || (mdata->uid_count == 0))
+    return NULL;
+
+  bool found = false;
+  size_t pos = uid_search(mdata, uid, &found);
+  return found ? mdata->uid_emails[pos] : NULL;
+}
+
+/**
+ * imap_uid_insert - Add an Email to the UID index
+ * @param mdata Imap Mailbox data
+ * @param uid   UID of the Email
+ * @param e     Email
+ *
+ * If the UID is already present, its Email is replaced.
+ */
+void imap_uid_insert(struct ImapMboxData *mdata, unsigned int uid, struct Email *e)
+{
+  if (!mdata || !e)
+    return;
+
+  size_t pos = mdata->uid_count;
+  bool found = false;
+
+  /* Fast path: new mail has the highest UID */
+  if ((mdata->uid_count != 0) && (uid <= mdata->uid_index[mdata->uid_count - 1]))
+  {
+    pos = uid_search(mdata, uid, &found);
+    if (found)
+    {
+      if (!mdata->uid_emails[pos])
+        mdata->uid_removed--;
+      mdata->uid_emails[pos] = e;
+      return;
+    }
+  }
+
+  if (mdata->uid_count == mdata->uid_size)
+    imap_uid_alloc(mdata, MAX(2 * mdata->uid_size, 32));
+
+  if (pos < mdata->uid_count)
+  {
+    memmove(mdata->uid_index + pos + 1, mdata->uid_index + pos,
+            (mdata->uid_count - pos) * sizeof(unsigned int));
+    memmove(mdata->uid_emails + pos + 1, mdata->uid_emails + pos,
+            (mdata->uid_count - pos) * sizeof(struct Email *));
+  }
+
+  mdata->uid_index[pos] = uid;
+  mdata->uid_emails[pos] = e;
+  mdata->uid_count++;
+}
+
+/**
+ * imap_uid_remove - Remove an Email from the UID index
+ * @param mdata Imap Mailbox data
+ * @param uid   UID of the Email
+ * @param e     Email, only removed if it matches the index entry
+ *
+ * Entries are only marked as removed, so that an EXPUNGE or VANISHED doesn't
+ * have to shuffle the whole index.  Once half the index has been removed, it
+ * is compacted.
+ */
+void imap_uid_remove(struct ImapMboxData *mdata, unsigned int uid, struct Email *e)
+{
+  if (!mdata || (mdata->uid_count == 0))
+    return;
+
+  bool found = false;
+  size_t pos = uid_search(mdata, uid, &found);
+  if (!found || !mdata->uid_emails[pos] || (e && (mdata->uid_emails[pos] != e)))
+    return;
+
+  mdata->uid_emails[pos] = NULL;
+  mdata->uid_removed++;
+
+  if (mdata->uid_removed > (mdata->uid_count / 2))
+    uid_compact(mdata);
+}
+
 /**
  * imap_mdata_free - Release and clear storage in an ImapMboxData structure
  * @param[out] ptr Imap Mailbox data
@@ -233,6 +418,13 @@ void imap_mdata_free(void **ptr)
 
   imap_mdata_cache_reset(mdata);
   mutt_list_free(&mdata->flags);
+  for (size_t i = 0; i < mdata->append_count; i++)
+  {
+    unlink(mdata->append_queue[i]->path);
+    FREE(&mdata->append_queue[i]->path);
+    FREE(&mdata->append_queue[i]);
+  }
+  FREE(&mdata->append_queue);
   FREE(&mdata->name);
   FREE(&mdata->real_name);
   FREE(&mdata->munge_name);
@@ -522,12 +714,73 @@ int imap_hcache_del(struct ImapMboxData *mdata, unsigned int uid)
   if (!mdata->hcache)
     return -1;
 
-  char key[16];
+  char key[32];
+
+  snprintf(key, sizeof(key), "/%u/BODYSTRUCTURE", uid);
+  mutt_hcache_delete_header(mdata->hcache, key, mutt_str_strlen(key));
 
   sprintf(key, "/%u", uid);
   return mutt_hcache_delete_header(mdata->hcache, key, mutt_str_strlen(key));
 }
 
+/**
+ * imap_hcache_put_bodystructure - Store a BODYSTRUCTURE in the header cache
+ * @param mdata Imap Mailbox data
+ * @param uid   UID of the Email
+ * @param bs    BODYSTRUCTURE, as sent by the server
+ * @param bslen Length of the BODYSTRUCTURE
+ * @retval  0 Success
+ * @retval -1 Failure
+ *
+ * The entry is prefixed with the UIDVALIDITY, like the Email entries.
+ */
+int imap_hcache_put_bodystructure(struct ImapMboxData *mdata, unsigned int uid,
+                                  const char *bs, size_t bslen)
+{
+  if (!mdata || !mdata->hcache || !bs)
+    return -1;
+
+  char key[32];
+  struct Buffer *buf = mutt_buffer_pool_get();
+
+  snprintf(key, sizeof(key), "/%u/BODYSTRUCTURE", uid);
+  mutt_buffer_printf(buf, "%u ", mdata->uid_validity);
+  mutt_buffer_addstr_n(buf, bs, bslen);
+  int rc = mutt_hcache_store_raw(mdata->hcache, key, mutt_str_strlen(key),
+                                 buf->data, mutt_buffer_len(buf) + 1);
+  mutt_buffer_pool_release(&buf);
+  return rc;
+}
+
+/**
+ * imap_hcache_get_bodystructure - Get a BODYSTRUCTURE from the header cache
+ * @param mdata Imap Mailbox data
+ * @param uid   UID of the Email
+ * @retval ptr  BODYSTRUCTURE, caller must free
+ * @retval NULL Not cached, or cached for a different UIDVALIDITY
+ */
+char *imap_hcache_get_bodystructure(struct ImapMboxData *mdata, unsigned int uid)
+{
+  if (!mdata->hcache)
+    return NULL;
+
+  char key[32];
+  char *bs = NULL;
+
+  snprintf(key, sizeof(key), "/%u/BODYSTRUCTURE", uid);
+  char *hc_bs = mutt_hcache_fetch_raw(mdata->hcache, key, mutt_str_strlen(key));
+  if (!hc_bs)
+    return NULL;
+
+  char *p = NULL;
+  unsigned long uid_validity = strtoul(hc_bs, &p, 10);
+  if ((p != hc_bs) && (*p == ' ') && (uid_validity == mdata->uid_validity))
+    bs = mutt_str_strdup(p + 1);
+
+  mutt_hcache_free(mdata->hcache, (void **) &hc_bs);
+  return bs;
+}
+
 /**
  * imap_hcache_store_uid_seqset - Store a UID Sequence Set in the header cache
  * @param mdata Imap Mailbox data
@@ -932,6 +1185,147 @@ char *imap_next_word(char *s)
   return s;
 }
 
+/**
+ * imap_next_token - Split the next token off an IMAP response
+ * @param[in]  s   Position in the response
+ * @param[out] tok Token found
+ * @retval ptr Position after the token, and any whitespace
+ *
+ * This is a single pass over the response buffer: tokens are slices of it.
+ * Brackets belong to the atom they're in, so `BODY[HEADER.FIELDS (FROM)]`
+ * is one token.
+ */
+char *imap_next_token(char *s, struct ImapToken *tok)
+{
+  SKIPWS(s);
+  tok->str = s;
+  tok->len = 0;
+  tok->literal = 0;
+
+  switch (*s)
+  {
+    case '\0':
+      tok->type = IMAP_TOK_END;
+      return s;
+
+    case '(':
+    case ')':
+      tok->type = (*s == '(') ? IMAP_TOK_OPEN : IMAP_TOK_CLOSE;
+      tok->len = 1;
+      s++;
+      break;
+
+    case '"':
+      tok->type = IMAP_TOK_STRING;
+      tok->str = ++s;
+      while (*s && (*s != '"'))
+      {
+        if ((s[0] == '\\') && s[1])
+          s++;
+        s++;
+      }
+      if (*s != '"')
+      {
+        tok->type = IMAP_TOK_ERROR;
+        return s;
+      }
+      tok->len = s - tok->str;
+      s++;
+      break;
+
+    case '~':
+    case '{':
+      if (*s == '~')
+        s++;
+      if (*s != '{')
+        goto atom;
+      for (s++; isdigit((unsigned char) *s); s++)
+        tok->literal = (tok->literal * 10) + (*s - '0');
+      if (*s == '+') /* LITERAL+ */
+        s++;
+      if (*s != '}')
+      {
+        tok->type = IMAP_TOK_ERROR;
+        return s;
+      }
+      s++;
+      tok->type = IMAP_TOK_LITERAL;
+      tok->len = s - tok->str;
+      break;
+
+    default:
+    atom:
+    {
+      int depth = 0;
+      tok->type = IMAP_TOK_ATOM;
+      for (; *s; s++)
+      {
+        if (*s == '[')
+          depth++;
+        else if ((*s == ']') && (depth > 0))
+          depth--;
+        else if ((depth == 0) && (IS_SPACE(*s) || (*s == '(') || (*s == ')')))
+          break;
+      }
+      tok->len = s - tok->str;
+      break;
+    }
+  }
+
+  SKIPWS(s);
+  return s;
+}
+
+/**
+ * imap_token_is - Does a token match an atom?
+ * @param tok  Token
+ * @param atom Atom to match, case-insensitively
+ * @retval true The token is the atom
+ */
+bool imap_token_is(const struct ImapToken *tok, const char *atom)
+{
+  return (tok->type == IMAP_TOK_ATOM) && (tok->len == mutt_str_strlen(atom)) &&
+         (mutt_str_strncasecmp(tok->str, atom, tok->len) == 0);
+}
+
+/**
+ * imap_token_prefix - Does a token start with a prefix?
+ * @param tok    Token
+ * @param prefix Prefix to match, case-insensitively
+ * @retval true The token starts with the prefix
+ */
+bool imap_token_prefix(const struct ImapToken *tok, const char *prefix)
+{
+  size_t plen = mutt_str_strlen(prefix);
+  return (tok->type == IMAP_TOK_ATOM) && (tok->len >= plen) &&
+         (mutt_str_strncasecmp(tok->str, prefix, plen) == 0);
+}
+
+/**
+ * imap_token_number - Read a number token
+ * @param[in]  tok Token
+ * @param[out] num Number
+ * @retval  0 Success
+ * @retval -1 The token isn't a number, or it's too big
+ */
+int imap_token_number(const struct ImapToken *tok, unsigned long long *num)
+{
+  *num = 0;
+  if ((tok->type != IMAP_TOK_ATOM) || (tok->len == 0) || (tok->len > 20))
+    return -1;
+
+  for (size_t i = 0; i < tok->len; i++)
+  {
+    if (!isdigit((unsigned char) tok->str[i]))
+      return -1;
+    unsigned int digit = tok->str[i] - '0';
+    if (*num > ((ULLONG_MAX - digit) / 10))
+      return -1;
+    *num = (*num * 10) + digit;
+  }
+  return 0;
+}
+
 /**
  * imap_qualify_path - Make an absolute IMAP folder target
  * @param buf    Buffer for the result
@@ -497,10 +497,12 @@ static void update_index_threaded(struct Context *ctx, int check, int oldcount)
   }
 
   /* Sort first to thread the new messages, because some patterns
-   * require the threading information.
+   * require the threading information.  The Context may already have
+   * threaded them, when the Mailbox reported them.
    *
    * If the mailbox was reopened, need to rethread from scratch. */
-  mutt_sort_headers(ctx, (check == MUTT_REOPENED));
+  if ((check == MUTT_REOPENED) || (ctx->thread_count != ctx->mailbox->msg_count))
+    mutt_sort_headers(ctx, (check == MUTT_REOPENED));
 
   if (ctx->pattern)
   {
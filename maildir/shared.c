@@ -56,6 +56,7 @@
 #include "mx.h"
 #include "progress.h"
 #include "protos.h"
+#include "search_index.h"
 #include "sort.h"
 #ifdef USE_NOTMUCH
 #include "notmuch/mutt_notmuch.h"
@@ -1370,6 +1371,7 @@ int mh_sync_mailbox_message(struct Mailbox *m, int msgno, header_cache_t *hc)
           keylen = maildir_hcache_keylen(key);
         }
         mutt_hcache_delete_header(hc, key, keylen);
+        mutt_search_index_delete(hc, key, keylen);
       }
 #endif
       unlink(path);
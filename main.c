@@ -72,6 +72,7 @@
 #include "myvar.h"
 #include "ncrypt/ncrypt.h"
 #include "options.h"
+#include "pattern.h"
 #include "protos.h"
 #include "send.h"
 #include "sendlib.h"
@@ -773,6 +774,7 @@ int main(int argc, char *argv[], char *envp[])
   notify_observer_add(NeoMutt->notify, mutt_log_observer, NULL);
   notify_observer_add(NeoMutt->notify, mutt_menu_config_observer, NULL);
   notify_observer_add(NeoMutt->notify, mutt_reply_observer, NULL);
+  notify_observer_add(NeoMutt->notify, mutt_pattern_memo_observer, NULL);
   if (Colors)
     notify_observer_add(Colors->notify, mutt_menu_color_observer, NULL);
 
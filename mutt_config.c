@@ -68,6 +68,7 @@
 #include "remailer.h"
 #include "rfc3676.h"
 #include "score.h"
+#include "search_index.h"
 #include "send.h"
 #include "sendlib.h"
 #include "sidebar.h"
@@ -1661,6 +1662,15 @@ struct ConfigDef MuttVars[] = {
   ** .pp
   ** This variable defaults to the value of $$imap_user.
   */
+  { "imap_notify", DT_BOOL, &C_ImapNotify, false },
+  /*
+  ** .pp
+  ** When \fIset\fP, NeoMutt will use the IMAP NOTIFY extension (RFC5465), if
+  ** the server supports it, to have new mail and flag changes pushed for all
+  ** the mailboxes of an account over a single connection.  This replaces the
+  ** \fCSTATUS\fP commands that are otherwise sent for every mailbox each time
+  ** $$mail_check_stats runs.
+  */
   { "imap_oauth_refresh_command", DT_STRING|DT_COMMAND|DT_SENSITIVE, &C_ImapOauthRefreshCommand, 0 },
   /*
   ** .pp
@@ -1669,6 +1679,21 @@ struct ConfigDef MuttVars[] = {
   ** run on every connection attempt that uses the OAUTHBEARER authentication
   ** mechanism.  See "$oauth" for details.
   */
+  { "imap_partial_fetch", DT_LONG|DT_NOT_NEGATIVE, &C_ImapPartialFetch, 0 },
+  /*
+  ** .pp
+  ** When set to a value greater than 0, multipart messages larger than this
+  ** many bytes are downloaded one MIME part at a time for display.
+  ** Attachments of this size or larger which the pager can't show are left
+  ** out.  Parts are fetched with the IMAP BINARY extension (RFC3516) where
+  ** the server supports it, and kept in the $$message_cachedir.
+  ** .pp
+  ** The whole message is downloaded when it's needed for anything else,
+  ** e.g. to view or save an attachment.  Messages containing signed or
+  ** encrypted parts are always downloaded whole.
+  ** .pp
+  ** This has no effect unless $$message_cachedir is set.
+  */
   { "imap_pass", DT_STRING|DT_SENSITIVE, &C_ImapPass, 0 },
   /*
   ** .pp
@@ -2355,6 +2380,27 @@ struct ConfigDef MuttVars[] = {
   ** .pp
   ** This variable specifies the timeout for database open in seconds.
   */
+  { "nm_page_size", DT_NUMBER|DT_NOT_NEGATIVE, &C_NmPageSize, 0 },
+  /*
+  ** .pp
+  ** When set, NeoMutt only reads this many results of a notmuch query when the
+  ** mailbox is opened, so the index appears without waiting for the whole
+  ** query.  The remaining results are read a page at a time by the mailbox
+  ** check, or all at once when a search or a limit needs to see them.
+  ** In threads mode, the page size counts threads rather than messages.
+  ** .pp
+  ** A value of 0 reads the whole query at once.
+  */
+  { "nm_quick_headers", DT_BOOL, &C_NmQuickHeaders, false },
+  /*
+  ** .pp
+  ** When set, NeoMutt builds the index from the headers stored in the notmuch
+  ** database, rather than parsing every message file that isn't in the header
+  ** cache.  The rest of the headers are read when the message is opened.
+  ** .pp
+  ** Until then, patterns that match other headers, e.g. ~t or ~c, won't see
+  ** them.
+  */
   { "nm_query_type", DT_STRING, &C_NmQueryType, IP "messages" },
   /*
   ** .pp
@@ -3549,6 +3595,36 @@ struct ConfigDef MuttVars[] = {
   ** For the pager, this variable specifies the number of lines shown
   ** before search results. By default, search results will be top-aligned.
   */
+#ifdef USE_HCACHE
+  { "search_index", DT_BOOL, &C_SearchIndex, false },
+  /*
+  ** .pp
+  ** When \fIset\fP, NeoMutt keeps a full-text index of Maildir and MH folders
+  ** in the $$header_cache, which speeds up the \fC~b\fP, \fC~B\fP and
+  ** \fC~h\fP patterns.  Only the messages that contain the searched-for text
+  ** are read, which makes searching a large folder much faster.
+  ** .pp
+  ** For a regular expression, the index is used to look up the longest
+  ** piece of plain text that every match must contain.  The expression is
+  ** then only tried on the messages containing that text, e.g. for
+  ** \fC~b 'invoice-[0-9]+'\fP, only the messages containing
+  ** \fCinvoice-\fP.  Patterns without such text, e.g. \fC~b 'foo|bar'\fP,
+  ** can't use the index.  New messages are indexed the next time the folder
+  ** is searched.
+  */
+#endif
+  { "search_threads", DT_NUMBER|DT_NOT_NEGATIVE, &C_SearchThreads, 0 },
+  /*
+  ** .pp
+  ** The number of threads used to search the messages of a local mailbox
+  ** (Maildir, MH, mbox or MMDF) for the \fC~b\fP, \fC~B\fP and \fC~h\fP
+  ** patterns.  If $$thorough_search is \fIunset\fP, the threads match the
+  ** messages themselves.  Otherwise they read the messages ahead of the
+  ** search, which still decodes them one at a time.
+  ** .pp
+  ** A value of 0 uses one thread per CPU, up to 8.  A value of 1 disables
+  ** the threads.
+  */
   { "send_charset", DT_STRING, &C_SendCharset, IP "us-ascii:iso-8859-1:utf-8", 0, charset_validator },
   /*
   ** .pp
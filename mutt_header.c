@@ -44,6 +44,7 @@
 #include "muttlib.h"
 #include "ncrypt/ncrypt.h"
 #include "options.h"
+#include "pattern.h"
 #include "protos.h"
 #include "sendlib.h"
 
@@ -113,6 +114,8 @@ static bool label_message(struct Mailbox *m, struct Email *e, char *new_label)
 
   e->changed = true;
   e->env->changed |= MUTT_ENV_CHANGED_XLABEL;
+  mutt_pattern_memo_clear(e);
+  m->gen++;
   return true;
 }
 
@@ -13,6 +13,9 @@
 #include "muttlib.h"
 #include "mx.h"
 #include "protos.h"
+#ifdef USE_IMAP
+#include "imap/imap.h"
+#endif
 
 static time_t MailboxTime = 0; ///< last time we started checking for mail
 static time_t MailboxStatsTime = 0; ///< last time we check performed mail_check_stats
@@ -179,6 +182,11 @@ int mutt_mailbox_check(struct Mailbox *m_cur, int force)
   }
   neomutt_mailboxlist_clear(&ml);
 
+#ifdef USE_IMAP
+  /* send the queued STATUS commands in one go */
+  imap_status_flush();
+#endif
+
   return MailboxCount;
 }
 
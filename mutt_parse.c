@@ -35,6 +35,9 @@
 #include "mutt_parse.h"
 #include "mx.h"
 #include "ncrypt/ncrypt.h"
+#ifdef USE_IMAP
+#include "imap/imap.h"
+#endif
 
 struct ListHead AttachAllow = STAILQ_HEAD_INITIALIZER(AttachAllow); ///< List of attachment types to be counted
 struct ListHead AttachExclude = STAILQ_HEAD_INITIALIZER(AttachExclude); ///< List of attachment types to be ignored
@@ -206,19 +209,28 @@ static int count_body_parts(struct Body *body)
 int mutt_count_body_parts(struct Mailbox *m, struct Email *e)
 {
   bool keep_parts = false;
+  struct Body *body = e->content;
 
   if (e->attach_valid)
     return e->attach_total;
 
   if (e->content->parts)
     keep_parts = true;
+#ifdef USE_IMAP
+  /* Use the server's idea of the MIME structure, rather than downloading */
+  else if (m && (m->magic == MUTT_IMAP) && (body = imap_body_structure(m, e)))
+    keep_parts = true;
+#endif
   else
+  {
+    body = e->content;
     mutt_parse_mime_message(m, e);
+  }
 
   if (!STAILQ_EMPTY(&AttachAllow) || !STAILQ_EMPTY(&AttachExclude) ||
       !STAILQ_EMPTY(&InlineAllow) || !STAILQ_EMPTY(&InlineExclude))
   {
-    e->attach_total = count_body_parts(e->content);
+    e->attach_total = count_body_parts(body);
   }
   else
     e->attach_total = 0;
@@ -395,6 +395,39 @@ void mutt_draw_tree(struct Context *ctx)
   FREE(&arrow);
 }
 
+/**
+ * draw_thread - Draw the tree of a single top-level thread
+ * @param ctx    Mailbox
+ * @param thread Top-level thread
+ *
+ * The other threads' tree strings are left alone.
+ */
+static void draw_thread(struct Context *ctx, struct MuttThread *thread)
+{
+  struct MuttThread *tree = ctx->tree;
+  struct MuttThread *prev = thread->prev;
+  struct MuttThread *next = thread->next;
+
+  /* mutt_draw_tree() walks all the top-level threads, so hide the others */
+  thread->prev = NULL;
+  thread->next = NULL;
+  ctx->tree = thread;
+  mutt_draw_tree(ctx);
+  ctx->tree = tree;
+  thread->prev = prev;
+  thread->next = next;
+
+  thread->next_subtree_visible =
+      next && (next->next_subtree_visible || next->subtree_visible);
+  for (; prev; thread = prev, prev = prev->prev)
+  {
+    const bool visible = thread->next_subtree_visible || thread->subtree_visible;
+    if (prev->next_subtree_visible == visible)
+      break;
+    prev->next_subtree_visible = visible;
+  }
+}
+
 /**
  * make_subject_list - Create a sorted list of all subjects in a thread
  * @param[out] subjects String List of subjects
@@ -521,6 +554,67 @@ static struct Hash *make_subj_hash(struct Mailbox *m)
   return hash;
 }
 
+/**
+ * pseudo_thread - Thread a message by subject
+ * @param[in]     m   Mailbox
+ * @param[in,out] top List of top-level threads
+ * @param[in]     cur Top-level thread to attach
+ * @retval ptr  New parent of the thread
+ * @retval NULL No parent was found
+ */
+static struct MuttThread *pseudo_thread(struct Mailbox *m, struct MuttThread **top,
+                                        struct MuttThread *cur)
+{
+  struct MuttThread *tmp = NULL, *curchild = NULL, *nextchild = NULL;
+
+  struct MuttThread *parent = find_subject(m, cur);
+  if (!parent)
+    return NULL;
+
+  cur->fake_thread = true;
+  unlink_message(top, cur);
+  insert_message(&parent->child, parent, cur);
+  parent->sort_children = true;
+  tmp = cur;
+  while (true)
+  {
+    while (!tmp->message)
+      tmp = tmp->child;
+
+    /* if the message we're attaching has pseudo-children, they
+     * need to be attached to its parent, so move them up a level.
+     * but only do this if they have the same real subject as the
+     * parent, since otherwise they rightly belong to the message
+     * we're attaching. */
+    if ((tmp == cur) || (mutt_str_strcmp(tmp->message->env->real_subj,
+                                         parent->message->env->real_subj) == 0))
+    {
+      tmp->message->subject_changed = false;
+
+      for (curchild = tmp->child; curchild;)
+      {
+        nextchild = curchild->next;
+        if (curchild->fake_thread)
+        {
+          unlink_message(&tmp->child, curchild);
+          insert_message(&parent->child, parent, curchild);
+        }
+        curchild = nextchild;
+      }
+    }
+
+    while (!tmp->next && (tmp != cur))
+    {
+      tmp = tmp->parent;
+    }
+    if (tmp == cur)
+      break;
+    tmp = tmp->next;
+  }
+
+  return parent;
+}
+
 /**
  * pseudo_threads - Thread messages by subject
  * @param ctx Mailbox
@@ -536,8 +630,7 @@ static void pseudo_threads(struct Context *ctx)
 
   struct MuttThread *tree = ctx->tree;
   struct MuttThread *top = tree;
-  struct MuttThread *tmp = NULL, *cur = NULL, *parent = NULL, *curchild = NULL,
-                    *nextchild = NULL;
+  struct MuttThread *cur = NULL;
 
   if (!m->subj_hash)
     m->subj_hash = make_subj_hash(ctx->mailbox);
@@ -546,50 +639,7 @@ static void pseudo_threads(struct Context *ctx)
   {
     cur = tree;
     tree = tree->next;
-    parent = find_subject(ctx->mailbox, cur);
-    if (parent)
-    {
-      cur->fake_thread = true;
-      unlink_message(&top, cur);
-      insert_message(&parent->child, parent, cur);
-      parent->sort_children = true;
-      tmp = cur;
-      while (true)
-      {
-        while (!tmp->message)
-          tmp = tmp->child;
-
-        /* if the message we're attaching has pseudo-children, they
-         * need to be attached to its parent, so move them up a level.
-         * but only do this if they have the same real subject as the
-         * parent, since otherwise they rightly belong to the message
-         * we're attaching. */
-        if ((tmp == cur) || (mutt_str_strcmp(tmp->message->env->real_subj,
-                                             parent->message->env->real_subj) == 0))
-        {
-          tmp->message->subject_changed = false;
-
-          for (curchild = tmp->child; curchild;)
-          {
-            nextchild = curchild->next;
-            if (curchild->fake_thread)
-            {
-              unlink_message(&tmp->child, curchild);
-              insert_message(&parent->child, parent, curchild);
-            }
-            curchild = nextchild;
-          }
-        }
-
-        while (!tmp->next && (tmp != cur))
-        {
-          tmp = tmp->parent;
-        }
-        if (tmp == cur)
-          break;
-        tmp = tmp->next;
-      }
-    }
+    pseudo_thread(m, &top, cur);
   }
   ctx->tree = top;
 }
@@ -616,6 +666,7 @@ void mutt_clear_threads(struct Context *ctx)
     e->threaded = false;
   }
   ctx->tree = NULL;
+  ctx->thread_count = 0;
 
   mutt_hash_free(&ctx->thread_hash);
 }
@@ -784,6 +835,32 @@ struct MuttThread *mutt_sort_subthreads(struct MuttThread *thread, bool init)
   }
 }
 
+/**
+ * check_subject - Find out if an email's subject differs from its parent's
+ * @param e Email
+ */
+static void check_subject(struct Email *e)
+{
+  /* figure out which messages have subjects different than their parents' */
+  struct MuttThread *tmp = e->thread->parent;
+  while (tmp && !tmp->message)
+  {
+    tmp = tmp->parent;
+  }
+
+  if (!tmp)
+    e->subject_changed = true;
+  else if (e->env->real_subj && tmp->message->env->real_subj)
+  {
+    e->subject_changed =
+        (mutt_str_strcmp(e->env->real_subj, tmp->message->env->real_subj) != 0);
+  }
+  else
+  {
+    e->subject_changed = (e->env->real_subj || tmp->message->env->real_subj);
+  }
+}
+
 /**
  * check_subjects - Find out which emails' subjects differ from their parent's
  * @param m    Mailbox
@@ -805,25 +882,332 @@ static void check_subjects(struct Mailbox *m, bool init)
     else if (!init)
       continue;
 
-    /* figure out which messages have subjects different than their parents' */
-    struct MuttThread *tmp = e->thread->parent;
-    while (tmp && !tmp->message)
+    check_subject(e);
+  }
+}
+
+/**
+ * new_thread - Create a thread for an email
+ * @param ctx Mailbox
+ * @param e   Email
+ * @param dup Thread of an email with the same Message-ID, or NULL
+ *
+ * If dup is given, the email is threaded as its duplicate.
+ */
+static void new_thread(struct Context *ctx, struct Email *e, struct MuttThread *dup)
+{
+  struct MuttThread *thread = mutt_mem_calloc(1, sizeof(struct MuttThread));
+  thread->message = e;
+  thread->check_subject = true;
+  e->thread = thread;
+  mutt_hash_insert(ctx->thread_hash, e->env->message_id ? e->env->message_id : "", thread);
+
+  if (dup)
+  {
+    if (dup->duplicate_thread)
+      dup = dup->parent;
+
+    insert_message(&dup->child, dup, thread);
+    thread->duplicate_thread = true;
+    thread->message->threaded = true;
+  }
+}
+
+/**
+ * thread_by_references - Thread an email using its In-Reply-To and References
+ * @param ctx Mailbox
+ * @param top Temporary parent of the top-level threads
+ * @param e   Email
+ */
+static void thread_by_references(struct Context *ctx, struct MuttThread *top, struct Email *e)
+{
+  struct MuttThread *thread = NULL, *tnew = NULL;
+  struct ListNode *ref = NULL;
+  int using_refs = 0;
+
+  if (e->threaded)
+    return;
+  e->threaded = true;
+
+  thread = e->thread;
+  if (!thread)
+    return;
+
+  while (true)
+  {
+    if (using_refs == 0)
     {
-      tmp = tmp->parent;
+      /* look at the beginning of in-reply-to: */
+      ref = STAILQ_FIRST(&e->env->in_reply_to);
+      if (ref)
+        using_refs = 1;
+      else
+      {
+        ref = STAILQ_FIRST(&e->env->references);
+        using_refs = 2;
+      }
+    }
+    else if (using_refs == 1)
+    {
+      /* if there's no references header, use all the in-reply-to:
+       * data that we have.  otherwise, use the first reference
+       * if it's different than the first in-reply-to, otherwise use
+       * the second reference (since at least eudora puts the most
+       * recent reference in in-reply-to and the rest in references) */
+      if (STAILQ_EMPTY(&e->env->references))
+        ref = STAILQ_NEXT(ref, entries);
+      else
+      {
+        if (mutt_str_strcmp(ref->data, STAILQ_FIRST(&e->env->references)->data) != 0)
+          ref = STAILQ_FIRST(&e->env->references);
+        else
+          ref = STAILQ_NEXT(STAILQ_FIRST(&e->env->references), entries);
+
+        using_refs = 2;
+      }
     }
+    else
+      ref = STAILQ_NEXT(ref, entries); /* go on with references */
 
-    if (!tmp)
-      e->subject_changed = true;
-    else if (e->env->real_subj && tmp->message->env->real_subj)
+    if (!ref)
+      break;
+
+    tnew = mutt_hash_find(ctx->thread_hash, ref->data);
+    if (tnew)
     {
-      e->subject_changed =
-          (mutt_str_strcmp(e->env->real_subj, tmp->message->env->real_subj) != 0);
+      if (tnew->duplicate_thread)
+        tnew = tnew->parent;
+      if (is_descendant(tnew, thread)) /* no loops! */
+        continue;
     }
     else
     {
-      e->subject_changed = (e->env->real_subj || tmp->message->env->real_subj);
+      tnew = mutt_mem_calloc(1, sizeof(struct MuttThread));
+      mutt_hash_insert(ctx->thread_hash, ref->data, tnew);
     }
+
+    if (thread->parent)
+      unlink_message(&top->child, thread);
+    insert_message(&tnew->child, tnew, thread);
+    thread = tnew;
+    if (thread->message || (thread->parent && (thread->parent != top)))
+      break;
   }
+
+  if (!thread->parent)
+    insert_message(&top->child, top, thread);
+}
+
+/**
+ * thread_root - Find the top-level thread containing a thread
+ * @param thread Thread
+ * @retval ptr Top-level thread
+ */
+static struct MuttThread *thread_root(struct MuttThread *thread)
+{
+  while (thread->parent)
+    thread = thread->parent;
+  return thread;
+}
+
+/**
+ * compare_thread_ptrs - Compare two threads by address - Implements ::sort_t
+ */
+static int compare_thread_ptrs(const void *a, const void *b)
+{
+  const struct MuttThread *ta = *(struct MuttThread const *const *) a;
+  const struct MuttThread *tb = *(struct MuttThread const *const *) b;
+
+  return (ta > tb) - (ta < tb);
+}
+
+/**
+ * unique_threads - Remove the duplicates from an array of threads
+ * @param threads Array of threads
+ * @param num     Number of threads
+ * @retval num Number of unique threads
+ */
+static int unique_threads(struct MuttThread **threads, int num)
+{
+  if (num < 2)
+    return num;
+
+  qsort(threads, num, sizeof(struct MuttThread *), compare_thread_ptrs);
+
+  int n = 1;
+  for (int i = 1; i < num; i++)
+  {
+    if (threads[i] != threads[n - 1])
+      threads[n++] = threads[i];
+  }
+  return n;
+}
+
+/**
+ * can_insert_message - Can a new email be added to the existing threads?
+ * @param ctx Mailbox
+ * @param e   New Email
+ * @retval true The email only affects the thread it joins
+ *
+ * The whole tree needs to be rethreaded, if the email:
+ * - fills the gap left by a missing message, whose replies are already threaded
+ * - could be the subject parent of an existing thread, because it's no later
+ *   than another message with the same subject
+ */
+static bool can_insert_message(struct Context *ctx, struct Email *e)
+{
+  if (e->env->message_id)
+  {
+    struct MuttThread *thread = mutt_hash_find(ctx->thread_hash, e->env->message_id);
+    if (thread && !thread->message)
+      return false;
+  }
+
+  struct Mailbox *m = ctx->mailbox;
+  if (C_StrictThreads || !e->env->real_subj || !m->subj_hash)
+    return true;
+
+  const time_t date = C_ThreadReceived ? e->received : e->date_sent;
+  struct HashElem *he = mutt_hash_find_bucket(m->subj_hash, e->env->real_subj);
+  for (; he; he = he->next)
+  {
+    struct Email *e2 = he->data;
+    if (!e2->thread || (mutt_str_strcmp(e->env->real_subj, e2->env->real_subj) != 0))
+      continue;
+    if ((C_ThreadReceived ? e2->received : e2->date_sent) >= date)
+      return false;
+  }
+
+  return true;
+}
+
+/**
+ * thread_new_messages - Add new emails to the existing thread tree
+ * @param[in]  ctx     Mailbox
+ * @param[out] changed Top-level threads that have changed
+ * @retval num Number of changed threads
+ * @retval 0   The tree needs to be rethreaded, nothing was changed
+ *
+ * Rethreading is slow for large mailboxes, because every thread is walked,
+ * threaded by subject and re-sorted.  Instead, the new emails are linked into
+ * the tree using the thread and subject hashes.  Only the threads that they
+ * join are re-sorted, then merged back into the list of top-level threads.
+ *
+ * The caller must linearise the tree and draw the changed threads.
+ */
+static int thread_new_messages(struct Context *ctx, struct MuttThread ***changed)
+{
+  struct Mailbox *m = ctx->mailbox;
+  struct MuttThread *thread = NULL;
+  struct MuttThread top = { 0 };
+  int num = 0;
+
+  if (!ctx->tree)
+    return 0;
+
+  if (!C_StrictThreads && !m->subj_hash)
+    m->subj_hash = make_subj_hash(m);
+
+  struct Email **emails = mutt_mem_malloc(MAX(1, m->msg_count) * sizeof(struct Email *));
+  for (int i = 0; i < m->msg_count; i++)
+  {
+    struct Email *e = m->emails[i];
+    if (!e || e->thread)
+      continue;
+
+    if (!can_insert_message(ctx, e))
+    {
+      FREE(&emails);
+      return 0;
+    }
+    emails[num++] = e;
+  }
+
+  if (num == 0)
+  {
+    FREE(&emails);
+    return 0;
+  }
+
+  top.child = ctx->tree;
+  for (thread = ctx->tree; thread; thread = thread->next)
+    thread->parent = &top;
+
+  for (int i = 0; i < num; i++)
+  {
+    struct Email *e = emails[i];
+    if (C_DuplicateThreads && e->env->message_id)
+      thread = mutt_hash_find(ctx->thread_hash, e->env->message_id);
+    else
+      thread = NULL;
+    new_thread(ctx, e, thread);
+  }
+
+  for (int i = 0; i < num; i++)
+    thread_by_references(ctx, &top, emails[i]);
+
+  for (thread = top.child; thread; thread = thread->next)
+    thread->parent = NULL;
+  ctx->tree = top.child;
+
+  struct MuttThread **roots = mutt_mem_malloc(num * sizeof(struct MuttThread *));
+  for (int i = 0; i < num; i++)
+  {
+    emails[i]->thread->check_subject = false;
+    check_subject(emails[i]);
+    roots[i] = thread_root(emails[i]->thread);
+  }
+  FREE(&emails);
+
+  int num_roots = unique_threads(roots, num);
+  if (!C_StrictThreads)
+  {
+    for (int i = 0; i < num_roots; i++)
+      pseudo_thread(m, &ctx->tree, roots[i]);
+
+    /* Some of the threads have been attached to others */
+    for (int i = 0; i < num_roots; i++)
+      roots[i] = thread_root(roots[i]);
+    num_roots = unique_threads(roots, num_roots);
+  }
+
+  /* Sort each changed thread on its own */
+  for (int i = 0; i < num_roots; i++)
+  {
+    unlink_message(&ctx->tree, roots[i]);
+    roots[i]->next = NULL;
+    roots[i]->prev = NULL;
+    roots[i] = mutt_sort_subthreads(roots[i], false);
+  }
+
+  /* then merge them back into the sorted list of top-level threads */
+  compare_threads(NULL, NULL);
+  qsort(roots, num_roots, sizeof(struct MuttThread *), compare_threads);
+
+  struct MuttThread *prev = NULL;
+  struct MuttThread *next = ctx->tree;
+  for (int i = 0; i < num_roots; i++)
+  {
+    while (next && (compare_threads(&next, &roots[i]) <= 0))
+    {
+      prev = next;
+      next = next->next;
+    }
+
+    roots[i]->prev = prev;
+    roots[i]->next = next;
+    if (prev)
+      prev->next = roots[i];
+    else
+      ctx->tree = roots[i];
+    if (next)
+      next->prev = roots[i];
+    prev = roots[i];
+  }
+
+  mutt_debug(LL_DEBUG2, "threaded %d new emails into %d threads\n", num, num_roots);
+  *changed = roots;
+  return num_roots;
 }
 
 /**
@@ -839,10 +1223,9 @@ void mutt_sort_threads(struct Context *ctx, bool init)
   struct Mailbox *m = ctx->mailbox;
 
   struct Email *e = NULL;
-  int i, oldsort, using_refs = 0;
+  int i, oldsort;
   struct MuttThread *thread = NULL, *tnew = NULL, *tmp = NULL;
   struct MuttThread top = { 0 };
-  struct ListNode *ref = NULL;
 
   /* Set C_Sort to the secondary method to support the set sort_aux=reverse-*
    * settings.  The sorting functions just look at the value of SORT_REVERSE */
@@ -857,6 +1240,22 @@ void mutt_sort_threads(struct Context *ctx, bool init)
     ctx->thread_hash = mutt_hash_new(m->msg_count * 2, MUTT_HASH_ALLOW_DUPS);
     mutt_hash_set_destructor(ctx->thread_hash, thread_hash_destructor, 0);
   }
+  else
+  {
+    /* Link the new emails into the tree, without rethreading it */
+    struct MuttThread **changed = NULL;
+    const int num_changed = thread_new_messages(ctx, &changed);
+    if (num_changed > 0)
+    {
+      C_Sort = oldsort;
+      linearize_tree(ctx);
+      for (i = 0; i < num_changed; i++)
+        draw_thread(ctx, changed[i]);
+      FREE(&changed);
+      ctx->thread_count = m->msg_count;
+      return;
+    }
+  }
 
   /* we want a quick way to see if things are actually attached to the top of the
    * thread tree or if they're just dangling, so we attach everything to a top
@@ -925,26 +1324,7 @@ void mutt_sort_threads(struct Context *ctx, bool init)
       }
       else
       {
-        tnew = (C_DuplicateThreads ? thread : NULL);
-
-        thread = mutt_mem_calloc(1, sizeof(struct MuttThread));
-        thread->message = e;
-        thread->check_subject = true;
-        e->thread = thread;
-        mutt_hash_insert(ctx->thread_hash,
-                         e->env->message_id ? e->env->message_id : "", thread);
-
-        if (tnew)
-        {
-          if (tnew->duplicate_thread)
-            tnew = tnew->parent;
-
-          thread = e->thread;
-
-          insert_message(&tnew->child, tnew, thread);
-          thread->duplicate_thread = true;
-          thread->message->threaded = true;
-        }
+        new_thread(ctx, e, C_DuplicateThreads ? thread : NULL);
       }
     }
     else
@@ -973,78 +1353,7 @@ void mutt_sort_threads(struct Context *ctx, bool init)
     if (!e)
       break;
 
-    if (e->threaded)
-      continue;
-    e->threaded = true;
-
-    thread = e->thread;
-    if (!thread)
-      continue;
-    using_refs = 0;
-
-    while (true)
-    {
-      if (using_refs == 0)
-      {
-        /* look at the beginning of in-reply-to: */
-        ref = STAILQ_FIRST(&e->env->in_reply_to);
-        if (ref)
-          using_refs = 1;
-        else
-        {
-          ref = STAILQ_FIRST(&e->env->references);
-          using_refs = 2;
-        }
-      }
-      else if (using_refs == 1)
-      {
-        /* if there's no references header, use all the in-reply-to:
-         * data that we have.  otherwise, use the first reference
-         * if it's different than the first in-reply-to, otherwise use
-         * the second reference (since at least eudora puts the most
-         * recent reference in in-reply-to and the rest in references) */
-        if (STAILQ_EMPTY(&e->env->references))
-          ref = STAILQ_NEXT(ref, entries);
-        else
-        {
-          if (mutt_str_strcmp(ref->data, STAILQ_FIRST(&e->env->references)->data) != 0)
-            ref = STAILQ_FIRST(&e->env->references);
-          else
-            ref = STAILQ_NEXT(STAILQ_FIRST(&e->env->references), entries);
-
-          using_refs = 2;
-        }
-      }
-      else
-        ref = STAILQ_NEXT(ref, entries); /* go on with references */
-
-      if (!ref)
-        break;
-
-      tnew = mutt_hash_find(ctx->thread_hash, ref->data);
-      if (tnew)
-      {
-        if (tnew->duplicate_thread)
-          tnew = tnew->parent;
-        if (is_descendant(tnew, thread)) /* no loops! */
-          continue;
-      }
-      else
-      {
-        tnew = mutt_mem_calloc(1, sizeof(struct MuttThread));
-        mutt_hash_insert(ctx->thread_hash, ref->data, tnew);
-      }
-
-      if (thread->parent)
-        unlink_message(&top.child, thread);
-      insert_message(&tnew->child, tnew, thread);
-      thread = tnew;
-      if (thread->message || (thread->parent && (thread->parent != &top)))
-        break;
-    }
-
-    if (!thread->parent)
-      insert_message(&top.child, &top, thread);
+    thread_by_references(ctx, &top, e);
   }
 
   /* detach everything from the temporary top node */
@@ -1072,6 +1381,8 @@ void mutt_sort_threads(struct Context *ctx, bool init)
     /* Draw the thread tree. */
     mutt_draw_tree(ctx);
   }
+
+  ctx->thread_count = m->msg_count;
 }
 
 /**
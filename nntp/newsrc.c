@@ -31,10 +31,13 @@
 #include "config.h"
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
@@ -65,6 +68,128 @@ char *C_Newsrc; ///< Config: (nntp) File containing list of subscribed newsgroup
 
 struct BodyCache;
 
+/**
+ * struct ActiveCacheHeader - Header of the binary active list cache
+ *
+ * The header is followed by a table of ActiveCacheEntry, sorted by group name,
+ * then the group names and descriptions, as NUL-terminated strings.
+ */
+struct ActiveCacheHeader
+{
+  char magic[8];           ///< ACTIVE_CACHE_MAGIC
+  uint32_t version;        ///< ACTIVE_CACHE_VERSION
+  uint32_t count;          ///< Number of groups
+  uint64_t newgroups_time; ///< Time of the last NEWGROUPS check
+};
+
+/**
+ * struct ActiveCacheEntry - One newsgroup in the binary active list cache
+ */
+struct ActiveCacheEntry
+{
+  uint32_t name;  ///< File offset of the group name
+  uint32_t desc;  ///< File offset of the description, 0 if none
+  anum_t first;   ///< First article number
+  anum_t last;    ///< Last article number
+  uint32_t flags; ///< ACTIVE_CACHE_ALLOWED
+};
+
+/**
+ * struct NntpActiveCache - Memory-mapped active list cache
+ */
+struct NntpActiveCache
+{
+  void *map;                              ///< Mapping of the cache file
+  size_t len;                             ///< Length of the mapping
+  const struct ActiveCacheEntry *entries; ///< Groups, sorted by name
+  uint32_t count;                         ///< Number of groups
+};
+
+#define ACTIVE_CACHE_MAGIC "NMACTIVE"
+#define ACTIVE_CACHE_VERSION 1
+#define ACTIVE_CACHE_ALLOWED (1 << 0)
+
+/**
+ * active_cache_str - Get a string from the active list cache
+ * @param ac  Active list cache
+ * @param off File offset of the string
+ * @retval ptr String, or NULL if off is 0 or invalid
+ */
+static const char *active_cache_str(struct NntpActiveCache *ac, uint32_t off)
+{
+  if ((off == 0) || (off >= ac->len))
+    return NULL;
+  return (const char *) ac->map + off;
+}
+
+/**
+ * active_cache_search - Find a newsgroup in the active list cache
+ * @param ac    Active list cache
+ * @param group Newsgroup
+ * @retval ptr  Cache entry
+ * @retval NULL Not found
+ */
+static const struct ActiveCacheEntry *active_cache_search(struct NntpActiveCache *ac,
+                                                          const char *group)
+{
+  if (!ac)
+    return NULL;
+
+  uint32_t lo = 0, hi = ac->count;
+  while (lo < hi)
+  {
+    uint32_t mid = lo + (hi - lo) / 2;
+    const char *name = active_cache_str(ac, ac->entries[mid].name);
+    int cmp = mutt_str_strcmp(group, name);
+    if (cmp == 0)
+      return &ac->entries[mid];
+    if (cmp < 0)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  return NULL;
+}
+
+/**
+ * group_set_active - Set the active information of a newsgroup
+ * @param mdata   NNTP Mailbox data
+ * @param first   First article number
+ * @param last    Last article number
+ * @param allowed Posting is allowed
+ * @param desc    Description (OPTIONAL)
+ */
+static void group_set_active(struct NntpMboxData *mdata, anum_t first,
+                             anum_t last, bool allowed, const char *desc)
+{
+  mdata->deleted = false;
+  mdata->first_message = first;
+  mdata->last_message = last;
+  mdata->allowed = allowed;
+  mutt_str_replace(&mdata->desc, desc);
+  if (mdata->newsrc_ent || (mdata->last_cached != 0))
+    nntp_group_unread_stat(mdata);
+  else if (mdata->last_message && (mdata->first_message <= mdata->last_message))
+    mdata->unread = mdata->last_message - mdata->first_message + 1;
+  else
+    mdata->unread = 0;
+}
+
+/**
+ * active_cache_apply - Copy a newsgroup's details from the active list cache
+ * @param mdata NNTP Mailbox data
+ */
+static void active_cache_apply(struct NntpMboxData *mdata)
+{
+  struct NntpActiveCache *ac = mdata->adata->active_cache;
+  const struct ActiveCacheEntry *ace = active_cache_search(ac, mdata->group);
+  if (!ace)
+    return;
+
+  group_set_active(mdata, ace->first, ace->last, ace->flags & ACTIVE_CACHE_ALLOWED,
+                   active_cache_str(ac, ace->desc));
+}
+
 /**
  * mdata_find - Find NntpMboxData for given newsgroup or add it
  * @param adata NNTP server
@@ -86,6 +211,8 @@ static struct NntpMboxData *mdata_find(struct NntpAccountData *adata, const char
   mdata->adata = adata;
   mdata->deleted = true;
   mutt_hash_insert(adata->groups_hash, mdata->group, mdata);
+  if (adata->active_cache)
+    active_cache_apply(mdata);
 
   /* add NntpMboxData to list */
   if (adata->groups_num >= adata->groups_max)
@@ -220,14 +347,22 @@ int nntp_newsrc_parse(struct NntpAccountData *adata)
     mdata->subscribed = false;
     mdata->newsrc_len = 0;
     FREE(&mdata->newsrc_ent);
+    mdata->newsrc_dirty = false;
+    mdata->newsrc_linelen = 0;
   }
+  adata->newsrc_compact = false;
 
+  off_t pos = 0;
   line = mutt_mem_malloc(sb.st_size + 1);
   while (sb.st_size && fgets(line, sb.st_size + 1, adata->fp_newsrc))
   {
     char *b = NULL, *h = NULL;
     unsigned int j = 1;
     bool subs = false;
+    off_t line_off = pos;
+    size_t line_len = strlen(line);
+
+    pos += line_len;
 
     /* find end of newsgroup name */
     char *p = strpbrk(line, ":!");
@@ -243,6 +378,12 @@ int nntp_newsrc_parse(struct NntpAccountData *adata)
     struct NntpMboxData *mdata = mdata_find(adata, line);
     FREE(&mdata->newsrc_ent);
 
+    /* remember where the line is, to update it in place */
+    if (mdata->newsrc_linelen != 0)
+      adata->newsrc_compact = true;
+    mdata->newsrc_off = line_off;
+    mdata->newsrc_linelen = line_len;
+
     /* count number of entries */
     b = p;
     while (*b)
@@ -375,6 +516,7 @@ void nntp_newsrc_gen_entries(struct Mailbox *m)
     mdata->newsrc_len++;
   }
   mutt_mem_realloc(&mdata->newsrc_ent, mdata->newsrc_len * sizeof(struct NewsrcEntry));
+  nntp_newsrc_touch(mdata);
 
   if (save_sort != C_Sort)
   {
@@ -387,10 +529,11 @@ void nntp_newsrc_gen_entries(struct Mailbox *m)
  * update_file - Update file with new contents
  * @param filename File to update
  * @param buf      New context
+ * @param buflen   Length of the new context
  * @retval  0 Success
  * @retval -1 Failure
  */
-static int update_file(char *filename, char *buf)
+static int update_file(char *filename, const char *buf, size_t buflen)
 {
   FILE *fp = NULL;
   char tmpfile[PATH_MAX];
@@ -406,7 +549,7 @@ static int update_file(char *filename, char *buf)
       *tmpfile = '\0';
       break;
     }
-    if (fputs(buf, fp) == EOF)
+    if (fwrite(buf, 1, buflen, fp) != buflen)
     {
       mutt_perror(tmpfile);
       break;
@@ -435,83 +578,202 @@ static int update_file(char *filename, char *buf)
 }
 
 /**
- * nntp_newsrc_update - Update .newsrc file
+ * nntp_newsrc_touch - Mark a newsgroup's .newsrc line as changed
+ * @param mdata NNTP Mailbox data
+ */
+void nntp_newsrc_touch(struct NntpMboxData *mdata)
+{
+  mdata->newsrc_dirty = true;
+
+  /* lines can only be added or removed by rewriting the whole file */
+  if (mdata->adata && (!mdata->newsrc_ent != (mdata->newsrc_linelen == 0)))
+    mdata->adata->newsrc_compact = true;
+}
+
+/**
+ * newsrc_format_line - Generate a newsgroup's line of the .newsrc
+ * @param mdata NNTP Mailbox data
+ * @param buf   Buffer for the line
+ */
+static void newsrc_format_line(struct NntpMboxData *mdata, struct Buffer *buf)
+{
+  mutt_buffer_add_printf(buf, "%s%c ", mdata->group, mdata->subscribed ? ':' : '!');
+
+  for (unsigned int j = 0; j < mdata->newsrc_len; j++)
+  {
+    if (j)
+      mutt_buffer_addch(buf, ',');
+    if (mdata->newsrc_ent[j].first == mdata->newsrc_ent[j].last)
+      mutt_buffer_add_printf(buf, "%u", mdata->newsrc_ent[j].first);
+    else if (mdata->newsrc_ent[j].first < mdata->newsrc_ent[j].last)
+    {
+      mutt_buffer_add_printf(buf, "%u-%u", mdata->newsrc_ent[j].first,
+                             mdata->newsrc_ent[j].last);
+    }
+  }
+  mutt_buffer_addch(buf, '\n');
+}
+
+/**
+ * newsrc_stat - Remember the size and mtime of the .newsrc
  * @param adata NNTP server
  * @retval  0 Success
  * @retval -1 Failure
  */
-int nntp_newsrc_update(struct NntpAccountData *adata)
+static int newsrc_stat(struct NntpAccountData *adata)
 {
-  if (!adata)
+  struct stat sb;
+
+  if (stat(adata->newsrc_file, &sb) != 0)
+  {
+    mutt_perror(adata->newsrc_file);
     return -1;
+  }
+  adata->size = sb.st_size;
+  adata->mtime = sb.st_mtime;
+  return 0;
+}
 
-  int rc = -1;
+/**
+ * newsrc_update_lines - Overwrite the changed lines of the .newsrc in place
+ * @param adata NNTP server
+ * @retval  0 Success
+ * @retval  1 The file needs to be rewritten
+ *
+ * This only works if no line changes length and the file is the one we
+ * indexed, otherwise nothing is written.
+ */
+static int newsrc_update_lines(struct NntpAccountData *adata)
+{
+  struct stat sb;
 
-  size_t buflen = 10240;
-  char *buf = mutt_mem_calloc(1, buflen);
-  size_t off = 0;
+  if (adata->newsrc_compact || (stat(adata->newsrc_file, &sb) != 0) ||
+      (sb.st_size != adata->size) || (sb.st_mtime != adata->mtime))
+  {
+    return 1;
+  }
 
-  /* we will generate full newsrc here */
-  for (unsigned int i = 0; i < adata->groups_num; i++)
+  struct Buffer *buf = mutt_buffer_pool_get();
+  unsigned int dirty = 0;
+  int rc = 0;
+
+  for (unsigned int i = 0; (rc == 0) && (i < adata->groups_num); i++)
   {
     struct NntpMboxData *mdata = adata->groups_list[i];
-
-    if (!mdata || !mdata->newsrc_ent)
+    if (!mdata || !mdata->newsrc_dirty)
       continue;
 
-    /* write newsgroup name */
-    if (off + strlen(mdata->group) + 3 > buflen)
+    if (!mdata->newsrc_ent || (mdata->newsrc_linelen == 0))
     {
-      buflen *= 2;
-      mutt_mem_realloc(&buf, buflen);
+      rc = 1;
+      break;
     }
-    snprintf(buf + off, buflen - off, "%s%c ", mdata->group, mdata->subscribed ? ':' : '!');
-    off += strlen(buf + off);
 
-    /* write entries */
-    for (unsigned int j = 0; j < mdata->newsrc_len; j++)
-    {
-      if (off + 1024 > buflen)
-      {
-        buflen *= 2;
-        mutt_mem_realloc(&buf, buflen);
-      }
-      if (j)
-        buf[off++] = ',';
-      if (mdata->newsrc_ent[j].first == mdata->newsrc_ent[j].last)
-        snprintf(buf + off, buflen - off, "%u", mdata->newsrc_ent[j].first);
-      else if (mdata->newsrc_ent[j].first < mdata->newsrc_ent[j].last)
-      {
-        snprintf(buf + off, buflen - off, "%u-%u", mdata->newsrc_ent[j].first,
-                 mdata->newsrc_ent[j].last);
-      }
-      off += strlen(buf + off);
-    }
-    buf[off++] = '\n';
+    mutt_buffer_reset(buf);
+    newsrc_format_line(mdata, buf);
+    if (mutt_buffer_len(buf) != mdata->newsrc_linelen)
+      rc = 1;
+    dirty++;
   }
-  buf[off] = '\0';
 
-  /* newrc being fully rewritten */
-  mutt_debug(LL_DEBUG1, "Updating %s\n", adata->newsrc_file);
-  if (adata->newsrc_file && (update_file(adata->newsrc_file, buf) == 0))
+  int fd = -1;
+  if ((rc == 0) && (dirty > 0))
   {
-    struct stat sb;
+    fd = open(adata->newsrc_file, O_WRONLY);
+    if (fd < 0)
+      rc = 1;
+  }
 
-    rc = stat(adata->newsrc_file, &sb);
-    if (rc == 0)
-    {
-      adata->size = sb.st_size;
-      adata->mtime = sb.st_mtime;
-    }
-    else
+  for (unsigned int i = 0; (rc == 0) && (fd >= 0) && (i < adata->groups_num); i++)
+  {
+    struct NntpMboxData *mdata = adata->groups_list[i];
+    if (!mdata || !mdata->newsrc_dirty)
+      continue;
+
+    mutt_buffer_reset(buf);
+    newsrc_format_line(mdata, buf);
+    if (pwrite(fd, mutt_b2s(buf), mutt_buffer_len(buf), mdata->newsrc_off) !=
+        (ssize_t) mutt_buffer_len(buf))
     {
       mutt_perror(adata->newsrc_file);
+      rc = 1;
+      break;
     }
+    mdata->newsrc_dirty = false;
+  }
+
+  if ((fd >= 0) && (close(fd) != 0))
+    rc = 1;
+  mutt_buffer_pool_release(&buf);
+
+  if (rc == 0)
+  {
+    mutt_debug(LL_DEBUG1, "Updated %u lines of %s\n", dirty, adata->newsrc_file);
+    if (dirty > 0)
+      rc = (newsrc_stat(adata) == 0) ? 0 : 1;
   }
-  FREE(&buf);
   return rc;
 }
 
+/**
+ * newsrc_rewrite - Write the whole .newsrc, indexing its lines
+ * @param adata NNTP server
+ * @retval  0 Success
+ * @retval -1 Failure
+ */
+static int newsrc_rewrite(struct NntpAccountData *adata)
+{
+  struct Buffer buf = mutt_buffer_make(10240);
+  int rc = -1;
+
+  /* we will generate full newsrc here */
+  for (unsigned int i = 0; i < adata->groups_num; i++)
+  {
+    struct NntpMboxData *mdata = adata->groups_list[i];
+    if (!mdata)
+      continue;
+
+    mdata->newsrc_dirty = false;
+    mdata->newsrc_linelen = 0;
+    if (!mdata->newsrc_ent)
+      continue;
+
+    mdata->newsrc_off = mutt_buffer_len(&buf);
+    newsrc_format_line(mdata, &buf);
+    mdata->newsrc_linelen = mutt_buffer_len(&buf) - mdata->newsrc_off;
+  }
+
+  /* newrc being fully rewritten */
+  mutt_debug(LL_DEBUG1, "Updating %s\n", adata->newsrc_file);
+  if (update_file(adata->newsrc_file, NONULL(buf.data), mutt_buffer_len(&buf)) == 0)
+    rc = newsrc_stat(adata);
+
+  /* if anything failed, the index can't be trusted */
+  adata->newsrc_compact = (rc != 0);
+  mutt_buffer_dealloc(&buf);
+  return rc;
+}
+
+/**
+ * nntp_newsrc_update - Update .newsrc file
+ * @param adata NNTP server
+ * @retval  0 Success
+ * @retval -1 Failure
+ *
+ * Only the lines of groups that have changed are overwritten.  The file is
+ * rewritten if a line has changed length, or been added or removed.
+ */
+int nntp_newsrc_update(struct NntpAccountData *adata)
+{
+  if (!adata || !adata->newsrc_file)
+    return -1;
+
+  if (newsrc_update_lines(adata) == 0)
+    return 0;
+
+  return newsrc_rewrite(adata);
+}
+
 /**
  * cache_expand - Make fully qualified cache file name
  * @param dst    Buffer for filename
@@ -590,30 +852,98 @@ int nntp_add_group(char *line, void *data)
   }
 
   mdata = mdata_find(adata, group);
-  mdata->deleted = false;
-  mdata->first_message = first;
-  mdata->last_message = last;
-  mdata->allowed = (mod == 'y') || (mod == 'm');
-  mutt_str_replace(&mdata->desc, desc);
-  if (mdata->newsrc_ent || (mdata->last_cached != 0))
-    nntp_group_unread_stat(mdata);
-  else if (mdata->last_message && (mdata->first_message <= mdata->last_message))
-    mdata->unread = mdata->last_message - mdata->first_message + 1;
-  else
-    mdata->unread = 0;
+  group_set_active(mdata, first, last, (mod == 'y') || (mod == 'm'), desc);
   return 0;
 }
 
+/**
+ * nntp_active_cache_free - Unmap the active list cache
+ * @param adata NNTP server
+ */
+void nntp_active_cache_free(struct NntpAccountData *adata)
+{
+  struct NntpActiveCache *ac = adata->active_cache;
+  if (!ac)
+    return;
+
+  munmap(ac->map, ac->len);
+  FREE(&adata->active_cache);
+}
+
+/**
+ * nntp_group_find - Find a known newsgroup
+ * @param adata NNTP server
+ * @param group Newsgroup
+ * @retval ptr  NNTP Mailbox data
+ * @retval NULL Not found
+ *
+ * Groups that are only in the active list cache are loaded on demand.
+ */
+struct NntpMboxData *nntp_group_find(struct NntpAccountData *adata, const char *group)
+{
+  struct NntpMboxData *mdata = mutt_hash_find(adata->groups_hash, group);
+  if (mdata)
+    return mdata;
+
+  if (!active_cache_search(adata->active_cache, group))
+    return NULL;
+
+  return mdata_find(adata, group);
+}
+
+/**
+ * nntp_groups_load - Load every newsgroup from the active list cache
+ * @param adata NNTP server
+ *
+ * Called before anything that needs the full list of groups, e.g. the browser.
+ */
+void nntp_groups_load(struct NntpAccountData *adata)
+{
+  struct NntpActiveCache *ac = adata->active_cache;
+  if (!ac)
+    return;
+
+  for (uint32_t i = 0; i < ac->count; i++)
+  {
+    const char *group = active_cache_str(ac, ac->entries[i].name);
+    if (group && !mutt_hash_find(adata->groups_hash, group))
+      mdata_find(adata, group);
+  }
+  nntp_active_cache_free(adata);
+}
+
+/**
+ * active_get_text_cache - Load list of all newsgroups from an old text cache
+ * @param adata NNTP server
+ * @param fp    Cache file, positioned after the header line
+ */
+static void active_get_text_cache(struct NntpAccountData *adata, FILE *fp)
+{
+  char buf[8192];
+
+  mutt_message(_("Loading list of groups from cache..."));
+  while (fgets(buf, sizeof(buf), fp))
+    nntp_add_group(buf, adata);
+  nntp_add_group(NULL, NULL);
+  mutt_clear_error();
+}
+
 /**
  * active_get_cache - Load list of all newsgroups from cache
  * @param adata NNTP server
  * @retval  0 Success
  * @retval -1 Failure
+ *
+ * The binary cache is mapped into memory, so this doesn't depend on the number
+ * of groups.  Only the groups that are already known, from the .newsrc, are
+ * updated now.  The rest are loaded by nntp_group_find() as they're needed.
  */
 static int active_get_cache(struct NntpAccountData *adata)
 {
   char buf[8192];
   char file[4096];
+  struct ActiveCacheHeader hdr;
+  struct stat sb;
   time_t t;
 
   cache_expand(file, sizeof(file), &adata->conn->account, ".active");
@@ -622,37 +952,106 @@ static int active_get_cache(struct NntpAccountData *adata)
   if (!fp)
     return -1;
 
-  if (!fgets(buf, sizeof(buf), fp) || (sscanf(buf, "%ld%4095s", &t, file) != 1) || (t == 0))
+  if ((fstat(fileno(fp), &sb) != 0) || (fread(&hdr, sizeof(hdr), 1, fp) != 1) ||
+      (memcmp(hdr.magic, ACTIVE_CACHE_MAGIC, sizeof(hdr.magic)) != 0))
+  {
+    /* cache written by an older version */
+    rewind(fp);
+    if (!fgets(buf, sizeof(buf), fp) ||
+        (sscanf(buf, "%ld%4095s", &t, file) != 1) || (t == 0))
+    {
+      mutt_file_fclose(&fp);
+      return -1;
+    }
+    adata->newgroups_time = t;
+    active_get_text_cache(adata, fp);
+    mutt_file_fclose(&fp);
+    return 0;
+  }
+
+  size_t len = sb.st_size;
+  size_t table = sizeof(hdr) + (size_t) hdr.count * sizeof(struct ActiveCacheEntry);
+  if ((hdr.version != ACTIVE_CACHE_VERSION) || (hdr.newgroups_time == 0) || (table > len))
   {
     mutt_file_fclose(&fp);
     return -1;
   }
-  adata->newgroups_time = t;
 
-  mutt_message(_("Loading list of groups from cache..."));
-  while (fgets(buf, sizeof(buf), fp))
-    nntp_add_group(buf, adata);
-  nntp_add_group(NULL, NULL);
+  void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
   mutt_file_fclose(&fp);
-  mutt_clear_error();
+  if (map == MAP_FAILED)
+  {
+    mutt_debug(LL_DEBUG1, "mmap %s: %s\n", file, strerror(errno));
+    return -1;
+  }
+
+  /* the strings must be terminated within the file */
+  if ((len == table) || (((const char *) map)[len - 1] != '\0'))
+  {
+    munmap(map, len);
+    return -1;
+  }
+
+  nntp_active_cache_free(adata);
+  struct NntpActiveCache *ac = mutt_mem_calloc(1, sizeof(*ac));
+  ac->map = map;
+  ac->len = len;
+  ac->entries = (const struct ActiveCacheEntry *) ((const char *) map + sizeof(hdr));
+  ac->count = hdr.count;
+  adata->active_cache = ac;
+  adata->newgroups_time = hdr.newgroups_time;
+  mutt_debug(LL_DEBUG2, "%u groups in %s\n", ac->count, file);
+
+  for (unsigned int i = 0; i < adata->groups_num; i++)
+  {
+    struct NntpMboxData *mdata = adata->groups_list[i];
+    if (mdata)
+      active_cache_apply(mdata);
+  }
   return 0;
 }
 
+/**
+ * struct ActiveCacheItem - A newsgroup to be written to the active list cache
+ */
+struct ActiveCacheItem
+{
+  const char *name; ///< Group name
+  const char *desc; ///< Description
+  anum_t first;     ///< First article number
+  anum_t last;      ///< Last article number
+  uint32_t flags;   ///< ACTIVE_CACHE_ALLOWED
+};
+
+/**
+ * active_cache_item_cmp - Compare two newsgroups by name - Implements ::sort_t
+ */
+static int active_cache_item_cmp(const void *a, const void *b)
+{
+  const struct ActiveCacheItem *ia = a;
+  const struct ActiveCacheItem *ib = b;
+
+  return mutt_str_strcmp(ia->name, ib->name);
+}
+
 /**
  * nntp_active_save_cache - Save list of all newsgroups to cache
  * @param adata NNTP server
  * @retval  0 Success
  * @retval -1 Failure
+ *
+ * The groups that have been loaded are merged with the ones that are still
+ * only in the old cache.
  */
 int nntp_active_save_cache(struct NntpAccountData *adata)
 {
   if (!adata->cacheable)
     return 0;
 
-  size_t buflen = 10240;
-  char *buf = mutt_mem_calloc(1, buflen);
-  snprintf(buf, buflen, "%lu\n", (unsigned long) adata->newgroups_time);
-  size_t off = strlen(buf);
+  struct NntpActiveCache *ac = adata->active_cache;
+  size_t max = adata->groups_num + (ac ? ac->count : 0);
+  struct ActiveCacheItem *items = mutt_mem_calloc(max ? max : 1, sizeof(*items));
+  size_t num = 0, loaded = 0;
 
   for (unsigned int i = 0; i < adata->groups_num; i++)
   {
@@ -661,21 +1060,92 @@ int nntp_active_save_cache(struct NntpAccountData *adata)
     if (!mdata || mdata->deleted)
       continue;
 
-    if ((off + strlen(mdata->group) + (mdata->desc ? strlen(mdata->desc) : 0) + 50) > buflen)
+    struct ActiveCacheItem *item = &items[num++];
+    item->name = mdata->group;
+    item->desc = mdata->desc;
+    item->first = mdata->first_message;
+    item->last = mdata->last_message;
+    item->flags = mdata->allowed ? ACTIVE_CACHE_ALLOWED : 0;
+  }
+  qsort(items, num, sizeof(*items), active_cache_item_cmp);
+  loaded = num;
+
+  /* the cache is already sorted, so merge the rest in */
+  for (uint32_t i = 0; ac && (i < ac->count); i++)
+  {
+    const struct ActiveCacheEntry *ace = &ac->entries[i];
+    const char *name = active_cache_str(ac, ace->name);
+    if (!name || mutt_hash_find(adata->groups_hash, name))
+      continue;
+
+    struct ActiveCacheItem *item = &items[num++];
+    item->name = name;
+    item->desc = active_cache_str(ac, ace->desc);
+    item->first = ace->first;
+    item->last = ace->last;
+    item->flags = ace->flags;
+  }
+  if ((loaded > 0) && (num > loaded))
+  {
+    struct ActiveCacheItem *merged = mutt_mem_calloc(num, sizeof(*merged));
+    size_t a = 0, b = loaded, n = 0;
+    while ((a < loaded) || (b < num))
     {
-      buflen *= 2;
-      mutt_mem_realloc(&buf, buflen);
+      if ((b == num) || ((a < loaded) && (active_cache_item_cmp(&items[a], &items[b]) < 0)))
+        merged[n++] = items[a++];
+      else
+        merged[n++] = items[b++];
     }
-    snprintf(buf + off, buflen - off, "%s %u %u %c%s%s\n", mdata->group,
-             mdata->last_message, mdata->first_message, mdata->allowed ? 'y' : 'n',
-             mdata->desc ? " " : "", mdata->desc ? mdata->desc : "");
-    off += strlen(buf + off);
+    FREE(&items);
+    items = merged;
+  }
+
+  /* lay out the file: header, table, strings */
+  size_t len = sizeof(struct ActiveCacheHeader) + num * sizeof(struct ActiveCacheEntry);
+  for (size_t i = 0; i < num; i++)
+  {
+    len += strlen(items[i].name) + 1;
+    if (items[i].desc)
+      len += strlen(items[i].desc) + 1;
   }
+  if (len > UINT32_MAX)
+  {
+    FREE(&items);
+    return -1;
+  }
+
+  char *buf = mutt_mem_calloc(1, len);
+  struct ActiveCacheHeader *hdr = (struct ActiveCacheHeader *) buf;
+  memcpy(hdr->magic, ACTIVE_CACHE_MAGIC, sizeof(hdr->magic));
+  hdr->version = ACTIVE_CACHE_VERSION;
+  hdr->count = num;
+  hdr->newgroups_time = adata->newgroups_time;
+
+  struct ActiveCacheEntry *table = (struct ActiveCacheEntry *) (buf + sizeof(*hdr));
+  size_t off = sizeof(*hdr) + num * sizeof(*table);
+  for (size_t i = 0; i < num; i++)
+  {
+    size_t n = strlen(items[i].name) + 1;
+    table[i].name = off;
+    memcpy(buf + off, items[i].name, n);
+    off += n;
+    if (items[i].desc)
+    {
+      n = strlen(items[i].desc) + 1;
+      table[i].desc = off;
+      memcpy(buf + off, items[i].desc, n);
+      off += n;
+    }
+    table[i].first = items[i].first;
+    table[i].last = items[i].last;
+    table[i].flags = items[i].flags;
+  }
+  FREE(&items);
 
   char file[PATH_MAX];
   cache_expand(file, sizeof(file), &adata->conn->account, ".active");
   mutt_debug(LL_DEBUG1, "Updating %s\n", file);
-  int rc = update_file(file, buf);
+  int rc = update_file(file, buf, len);
   FREE(&buf);
   return rc;
 }
@@ -877,7 +1347,7 @@ void nntp_clear_cache(struct NntpAccountData *adata)
           if (!S_ISDIR(sb.st_mode))
         continue;
 
-      mdata = mutt_hash_find(adata->groups_hash, group);
+      mdata = nntp_group_find(adata, group);
       if (!mdata)
       {
         mdata = &tmp_mdata;
@@ -1113,7 +1583,7 @@ struct NntpAccountData *nntp_select_server(struct Mailbox *m, char *server, bool
         if ((strlen(group) < 8) || (strcmp(p, ".hcache") != 0))
           continue;
         *p = '\0';
-        struct NntpMboxData *mdata = mutt_hash_find(adata->groups_hash, group);
+        struct NntpMboxData *mdata = nntp_group_find(adata, group);
         if (!mdata)
           continue;
 
@@ -1154,6 +1624,7 @@ struct NntpAccountData *nntp_select_server(struct Mailbox *m, char *server, bool
 
   if (rc < 0)
   {
+    nntp_active_cache_free(adata);
     mutt_hash_free(&adata->groups_hash);
     FREE(&adata->groups_list);
     FREE(&adata->newsrc_file);
@@ -1229,6 +1700,7 @@ struct NntpMboxData *mutt_newsgroup_subscribe(struct NntpAccountData *adata, cha
     mdata->newsrc_ent[0].first = 1;
     mdata->newsrc_ent[0].last = 0;
   }
+  nntp_newsrc_touch(mdata);
   return mdata;
 }
 
@@ -1244,7 +1716,7 @@ struct NntpMboxData *mutt_newsgroup_unsubscribe(struct NntpAccountData *adata, c
   if (!adata || !adata->groups_hash || !group || !*group)
     return NULL;
 
-  struct NntpMboxData *mdata = mutt_hash_find(adata->groups_hash, group);
+  struct NntpMboxData *mdata = nntp_group_find(adata, group);
   if (!mdata)
     return NULL;
 
@@ -1254,6 +1726,7 @@ struct NntpMboxData *mutt_newsgroup_unsubscribe(struct NntpAccountData *adata, c
     mdata->newsrc_len = 0;
     FREE(&mdata->newsrc_ent);
   }
+  nntp_newsrc_touch(mdata);
   return mdata;
 }
 
@@ -1271,7 +1744,7 @@ struct NntpMboxData *mutt_newsgroup_catchup(struct Mailbox *m,
   if (!adata || !adata->groups_hash || !group || !*group)
     return NULL;
 
-  struct NntpMboxData *mdata = mutt_hash_find(adata->groups_hash, group);
+  struct NntpMboxData *mdata = nntp_group_find(adata, group);
   if (!mdata)
     return NULL;
 
@@ -1281,6 +1754,7 @@ struct NntpMboxData *mutt_newsgroup_catchup(struct Mailbox *m,
     mdata->newsrc_len = 1;
     mdata->newsrc_ent[0].first = 1;
     mdata->newsrc_ent[0].last = mdata->last_message;
+    nntp_newsrc_touch(mdata);
   }
   mdata->unread = 0;
   if (m && (m->mdata == mdata))
@@ -1310,7 +1784,7 @@ struct NntpMboxData *mutt_newsgroup_uncatchup(struct Mailbox *m,
   if (!adata || !adata->groups_hash || !group || !*group)
     return NULL;
 
-  struct NntpMboxData *mdata = mutt_hash_find(adata->groups_hash, group);
+  struct NntpMboxData *mdata = nntp_group_find(adata, group);
   if (!mdata)
     return NULL;
 
@@ -1320,6 +1794,7 @@ struct NntpMboxData *mutt_newsgroup_uncatchup(struct Mailbox *m,
     mdata->newsrc_len = 1;
     mdata->newsrc_ent[0].first = 1;
     mdata->newsrc_ent[0].last = mdata->first_message - 1;
+    nntp_newsrc_touch(mdata);
   }
   if (m && (m->mdata == mdata))
   {
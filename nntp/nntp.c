@@ -55,6 +55,7 @@
 #include "muttlib.h"
 #include "mx.h"
 #include "ncrypt/ncrypt.h"
+#include "pattern.h"
 #include "progress.h"
 #include "sort.h"
 #ifdef USE_HCACHE
@@ -67,6 +68,9 @@
 #if defined(USE_SSL) || defined(USE_HCACHE)
 #include "mutt.h"
 #endif
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
 
 /* These Config Variables are only used in nntp/nntp.c */
 char *C_NntpAuthenticators; ///< Config: (nntp) Allowed authentication methods
@@ -132,6 +136,7 @@ static void nntp_adata_free(void **ptr)
   FREE(&adata->authenticators);
   FREE(&adata->overview_fmt);
   FREE(&adata->conn);
+  nntp_active_cache_free(adata);
   FREE(&adata->groups_list);
   mutt_hash_free(&adata->groups_hash);
   FREE(ptr);
@@ -414,6 +419,36 @@ static int nntp_attempt_features(struct NntpAccountData *adata)
       adata->hasXOVER = true;
   }
 
+#ifdef USE_ZLIB
+  /* trying compressed overview: XZVER, then XFEATURE COMPRESS GZIP */
+  adata->hasXZVER = false;
+  adata->hasCOMPRESS = false;
+  if (adata->hasOVER || adata->hasXOVER)
+  {
+    if ((mutt_socket_send(conn, "XZVER\r\n") < 0) ||
+        (mutt_socket_readln(buf, sizeof(buf), conn) < 0))
+    {
+      return nntp_connect_error(adata);
+    }
+    /* no group is selected, so a server that knows XZVER refuses it */
+    if (mutt_str_startswith(buf, "412", CASE_MATCH) ||
+        mutt_str_startswith(buf, "420", CASE_MATCH))
+    {
+      adata->hasXZVER = true;
+    }
+  }
+  if ((adata->hasOVER || adata->hasXOVER) && !adata->hasXZVER)
+  {
+    if ((mutt_socket_send(conn, "XFEATURE COMPRESS GZIP\r\n") < 0) ||
+        (mutt_socket_readln(buf, sizeof(buf), conn) < 0))
+    {
+      return nntp_connect_error(adata);
+    }
+    if (mutt_str_startswith(buf, "290", CASE_MATCH))
+      adata->hasCOMPRESS = true;
+  }
+#endif
+
   /* trying LIST OVERVIEW.FMT */
   if (adata->hasOVER || adata->hasXOVER)
   {
@@ -852,6 +887,348 @@ static int nntp_query(struct NntpMboxData *mdata, char *line, size_t linelen)
   return 0;
 }
 
+/**
+ * nntp_fetch_text - Read a multi-line reply, calling a callback function for each line
+ * @param mdata NNTP Mailbox data
+ * @param msg   Progress message (OPTIONAL)
+ * @param func  Callback function
+ * @param data  Data for callback function
+ * @retval  0 Success
+ * @retval -1 Connection lost
+ * @retval -2 Error in func(*line, *data)
+ *
+ * The status line must already have been read.  The whole reply is consumed,
+ * even if func() fails, so that the connection stays in step.
+ */
+static int nntp_fetch_text(struct NntpMboxData *mdata, const char *msg,
+                           int (*func)(char *, void *), void *data)
+{
+  char buf[1024];
+  char *line = mutt_mem_malloc(sizeof(buf));
+  unsigned int lines = 0;
+  size_t off = 0;
+  int rc = 0;
+  struct Progress progress;
+
+  if (msg)
+    mutt_progress_init(&progress, msg, MUTT_PROGRESS_READ, 0);
+
+  while (true)
+  {
+    char *p = NULL;
+    int chunk = mutt_socket_readln_d(buf, sizeof(buf), mdata->adata->conn, MUTT_SOCK_LOG_FULL);
+    if (chunk < 0)
+    {
+      mdata->adata->status = NNTP_NONE;
+      rc = -1;
+      break;
+    }
+
+    p = buf;
+    if (!off && (buf[0] == '.'))
+    {
+      if (buf[1] == '\0')
+        break;
+      if (buf[1] == '.')
+        p++;
+    }
+
+    mutt_str_strfcpy(line + off, p, sizeof(buf));
+
+    if (chunk >= sizeof(buf))
+      off += strlen(p);
+    else
+    {
+      if (msg)
+        mutt_progress_update(&progress, ++lines, -1);
+
+      if ((rc == 0) && (func(line, data) < 0))
+        rc = -2;
+      off = 0;
+    }
+
+    mutt_mem_realloc(&line, off + sizeof(buf));
+  }
+  FREE(&line);
+  return rc;
+}
+
+#ifdef USE_ZLIB
+/**
+ * struct NntpInflate - Compressed reply being decoded
+ */
+struct NntpInflate
+{
+  z_stream zs;                 ///< zlib state
+  bool init;                   ///< zlib state has been initialised
+  bool done;                   ///< Terminating "." found in the inflated data
+  int rc;                      ///< Result of the callback function
+  struct Buffer line;          ///< Incomplete line, carried between chunks
+  int (*func)(char *, void *); ///< Callback function for each line
+  void *data;                  ///< Data for callback function
+};
+
+/**
+ * inflate_lines - Split inflated data into lines
+ * @param ni  Compressed reply
+ * @param buf Inflated data
+ * @param len Length of data
+ */
+static void inflate_lines(struct NntpInflate *ni, const char *buf, size_t len)
+{
+  while (len > 0)
+  {
+    const char *nl = memchr(buf, '\n', len);
+    size_t n = nl ? (nl - buf) : len;
+
+    mutt_buffer_addstr_n(&ni->line, buf, n);
+    if (!nl)
+      break;
+    buf += n + 1;
+    len -= n + 1;
+
+    char *p = ni->line.data;
+    size_t plen = mutt_buffer_len(&ni->line);
+    if ((plen > 0) && (p[plen - 1] == '\r'))
+      p[plen - 1] = '\0';
+
+    if (!ni->done)
+    {
+      if (mutt_str_strcmp(".", p) == 0)
+        ni->done = true;
+      else
+      {
+        if ((p[0] == '.') && (p[1] == '.'))
+          p++;
+        if ((ni->rc == 0) && (ni->func(p, ni->data) < 0))
+          ni->rc = -2;
+      }
+    }
+    mutt_buffer_reset(&ni->line);
+  }
+}
+
+/**
+ * inflate_data - Inflate a block of compressed data
+ * @param[in]  ni   Compressed reply
+ * @param[in]  in   Compressed data
+ * @param[in]  len  Length of data
+ * @param[out] used Number of bytes consumed
+ * @retval  1 End of the compressed stream
+ * @retval  0 More data needed
+ * @retval -1 Corrupt data
+ */
+static int inflate_data(struct NntpInflate *ni, const unsigned char *in, size_t len, size_t *used)
+{
+  char out[8192];
+  int zrc;
+
+  ni->zs.next_in = (Bytef *) in;
+  ni->zs.avail_in = len;
+  do
+  {
+    ni->zs.next_out = (Bytef *) out;
+    ni->zs.avail_out = sizeof(out);
+    zrc = inflate(&ni->zs, Z_NO_FLUSH);
+    if ((zrc != Z_OK) && (zrc != Z_STREAM_END) && (zrc != Z_BUF_ERROR))
+    {
+      mutt_debug(LL_DEBUG1, "inflate: %s\n", NONULL(ni->zs.msg));
+      return -1;
+    }
+    inflate_lines(ni, out, sizeof(out) - ni->zs.avail_out);
+  } while ((zrc == Z_OK) && ((ni->zs.avail_in > 0) || (ni->zs.avail_out == 0)));
+
+  *used = len - ni->zs.avail_in;
+  return (zrc == Z_STREAM_END) ? 1 : 0;
+}
+
+/**
+ * inflate_finish - Release a compressed reply
+ * @param ni Compressed reply
+ * @retval  0 Success
+ * @retval -2 Error in the callback function
+ */
+static int inflate_finish(struct NntpInflate *ni)
+{
+  /* last line may be missing its newline */
+  if (!ni->done && (mutt_buffer_len(&ni->line) > 0))
+    inflate_lines(ni, "\n", 1);
+  if (ni->init)
+    inflateEnd(&ni->zs);
+  mutt_buffer_dealloc(&ni->line);
+  return ni->rc;
+}
+
+/**
+ * fetch_yenc - Decode a line of yEnc and inflate it
+ * @param line Line of yEnc encoded data
+ * @param data NntpInflate
+ * @retval  0 Success
+ * @retval -1 Failure
+ *
+ * XZVER replies are overview lines, deflated, then yEnc encoded.
+ */
+static int fetch_yenc(char *line, void *data)
+{
+  struct NntpInflate *ni = data;
+
+  if (!line || mutt_str_startswith(line, "=y", CASE_MATCH))
+    return 0;
+
+  unsigned char *out = (unsigned char *) line;
+  for (const char *p = line; *p; p++)
+  {
+    unsigned char ch = *p;
+    if (ch == '=')
+    {
+      if (!*++p)
+        break;
+      ch = (unsigned char) *p - 64;
+    }
+    *out++ = ch - 42;
+  }
+
+  const unsigned char *in = (unsigned char *) line;
+  size_t len = out - in;
+  if (!ni->init)
+  {
+    /* most servers send raw deflate, but accept a zlib header too */
+    bool zlib = (len >= 2) && ((in[0] & 0x0f) == 8) && ((((in[0] << 8) | in[1]) % 31) == 0);
+    if (inflateInit2(&ni->zs, zlib ? 15 : -15) != Z_OK)
+      return -1;
+    ni->init = true;
+  }
+
+  size_t used = 0;
+  return (inflate_data(ni, in, len, &used) < 0) ? -1 : 0;
+}
+
+/**
+ * nntp_fetch_xzver - Read an XZVER reply
+ * @param mdata NNTP Mailbox data
+ * @param func  Callback function
+ * @param data  Data for callback function
+ * @retval  0 Success
+ * @retval -1 Connection lost
+ * @retval -2 Error in func(*line, *data) or corrupt data
+ */
+static int nntp_fetch_xzver(struct NntpMboxData *mdata, int (*func)(char *, void *), void *data)
+{
+  struct NntpInflate ni = { 0 };
+  ni.func = func;
+  ni.data = data;
+
+  int rc = nntp_fetch_text(mdata, NULL, fetch_yenc, &ni);
+  int rc2 = inflate_finish(&ni);
+  return (rc != 0) ? rc : rc2;
+}
+
+/**
+ * nntp_fetch_gzip - Read a reply compressed by XFEATURE COMPRESS GZIP
+ * @param mdata NNTP Mailbox data
+ * @param func  Callback function
+ * @param data  Data for callback function
+ * @retval  0 Success
+ * @retval -1 Connection lost
+ * @retval -2 Error in func(*line, *data) or corrupt data
+ *
+ * The reply is a binary zlib stream, inflated straight out of the socket
+ * buffer.  The terminating "." may be inside the stream or follow it.
+ */
+static int nntp_fetch_gzip(struct NntpMboxData *mdata, int (*func)(char *, void *), void *data)
+{
+  struct Connection *conn = mdata->adata->conn;
+  struct NntpInflate ni = { 0 };
+  int rc = 0;
+
+  ni.func = func;
+  ni.data = data;
+  if (inflateInit2(&ni.zs, 15 + 32) != Z_OK)
+    return -2;
+  ni.init = true;
+
+  while (true)
+  {
+    if (conn->bufpos >= conn->available)
+    {
+      char c;
+      if (mutt_socket_readchar(conn, &c) < 0)
+      {
+        mdata->adata->status = NNTP_NONE;
+        rc = -1;
+        break;
+      }
+      conn->bufpos--;
+    }
+
+    size_t used = 0;
+    int zrc = inflate_data(&ni, (unsigned char *) conn->inbuf + conn->bufpos,
+                           conn->available - conn->bufpos, &used);
+    conn->bufpos += used;
+    if (zrc < 0)
+    {
+      /* we can't find the end of the reply, so drop the connection */
+      mutt_socket_close(conn);
+      mdata->adata->status = NNTP_NONE;
+      rc = -2;
+      break;
+    }
+    if (zrc > 0)
+      break;
+  }
+
+  if ((rc == 0) && !ni.done)
+  {
+    char buf[1024];
+    if (mutt_socket_readln(buf, sizeof(buf), conn) < 0)
+    {
+      mdata->adata->status = NNTP_NONE;
+      rc = -1;
+    }
+    else if (mutt_str_strcmp(".", buf) != 0)
+      mutt_debug(LL_DEBUG1, "unexpected data after compressed reply: %s\n", buf);
+  }
+
+  int rc2 = inflate_finish(&ni);
+  return (rc != 0) ? rc : rc2;
+}
+#endif
+
+/**
+ * nntp_fetch_reply - Read the body of a reply
+ * @param mdata  NNTP Mailbox data
+ * @param status Status line of the reply
+ * @param xzver  Reply is to an XZVER command
+ * @param msg    Progress message (OPTIONAL)
+ * @param func   Callback function
+ * @param data   Data for callback function
+ * @retval  0 Success
+ * @retval -1 Connection lost
+ * @retval -2 Error in func(*line, *data)
+ */
+static int nntp_fetch_reply(struct NntpMboxData *mdata, const char *status, bool xzver,
+                            const char *msg, int (*func)(char *, void *), void *data)
+{
+#ifdef USE_ZLIB
+  if (xzver)
+    return nntp_fetch_xzver(mdata, func, data);
+  if (strstr(status, "[COMPRESS=GZIP]"))
+    return nntp_fetch_gzip(mdata, func, data);
+#endif
+  return nntp_fetch_text(mdata, msg, func, data);
+}
+
+/**
+ * fetch_discard - Ignore a line of a reply
+ * @param line Line of text
+ * @param data Unused
+ * @retval 0 Always
+ */
+static int fetch_discard(char *line, void *data)
+{
+  return 0;
+}
+
 /**
  * nntp_fetch_lines - Read lines, calling a callback function for each
  * @param mdata NNTP Mailbox data
@@ -871,19 +1248,11 @@ static int nntp_query(struct NntpMboxData *mdata, char *line, size_t linelen)
 static int nntp_fetch_lines(struct NntpMboxData *mdata, char *query, size_t qlen,
                             const char *msg, int (*func)(char *, void *), void *data)
 {
-  bool done = false;
   int rc;
 
-  while (!done)
+  while (true)
   {
     char buf[1024];
-    char *line = NULL;
-    unsigned int lines = 0;
-    size_t off = 0;
-    struct Progress progress;
-
-    if (msg)
-      mutt_progress_init(&progress, msg, MUTT_PROGRESS_READ, 0);
 
     mutt_str_strfcpy(buf, query, sizeof(buf));
     if (nntp_query(mdata, buf, sizeof(buf)) < 0)
@@ -894,49 +1263,10 @@ static int nntp_fetch_lines(struct NntpMboxData *mdata, char *query, size_t qlen
       return 1;
     }
 
-    line = mutt_mem_malloc(sizeof(buf));
-    rc = 0;
-
-    while (true)
-    {
-      char *p = NULL;
-      int chunk = mutt_socket_readln_d(buf, sizeof(buf), mdata->adata->conn, MUTT_SOCK_LOG_FULL);
-      if (chunk < 0)
-      {
-        mdata->adata->status = NNTP_NONE;
-        break;
-      }
-
-      p = buf;
-      if (!off && (buf[0] == '.'))
-      {
-        if (buf[1] == '\0')
-        {
-          done = true;
-          break;
-        }
-        if (buf[1] == '.')
-          p++;
-      }
-
-      mutt_str_strfcpy(line + off, p, sizeof(buf));
-
-      if (chunk >= sizeof(buf))
-        off += strlen(p);
-      else
-      {
-        if (msg)
-          mutt_progress_update(&progress, ++lines, -1);
-
-        if ((rc == 0) && (func(line, data) < 0))
-          rc = -2;
-        off = 0;
-      }
-
-      mutt_mem_realloc(&line, off + sizeof(buf));
-    }
-    FREE(&line);
+    rc = nntp_fetch_reply(mdata, buf, false, msg, func, data);
     func(NULL, data);
+    if (rc != -1)
+      break;
   }
   return rc;
 }
@@ -1243,6 +1573,296 @@ static int parse_overview_line(char *line, void *data)
   return 0;
 }
 
+/**
+ * nntp_pipeline - Send commands in windows and read the replies in order
+ * @param mdata NNTP Mailbox data
+ * @param num   Number of commands
+ * @param xzver Commands are XZVER
+ * @param cmd   Callback to format command number i, returns its length
+ * @param reply Callback to handle the reply to command number i
+ * @param data  Data for callback functions
+ * @retval  0 Success
+ * @retval -1 Connection lost
+ * @retval  n Result of the first failing reply() callback
+ *
+ * Up to #NNTP_PIPELINE_DEPTH commands are sent at once.  reply() is called with
+ * the status line and must read the rest of the reply.  If it returns -1 the
+ * connection was lost: we reconnect and resend from that command.  Any other
+ * failure stops the pipeline; the replies already in flight are discarded.
+ */
+static int nntp_pipeline(struct NntpMboxData *mdata, int num, bool xzver,
+                         size_t (*cmd)(int i, char *buf, size_t buflen, void *data),
+                         int (*reply)(int i, char *status, void *data), void *data)
+{
+  int done = 0;
+  int rc = 0;
+
+  while ((done < num) && (rc == 0))
+  {
+    char buf[1024];
+    size_t off = 0;
+    const int start = done;
+    int end = done;
+
+    while ((end < num) && ((end - done) < NNTP_PIPELINE_DEPTH) && ((sizeof(buf) - off) > 64))
+      off += cmd(end++, buf + off, sizeof(buf) - off, data);
+
+    if (nntp_query(mdata, buf, sizeof(buf)) < 0)
+      return -1;
+
+    /* nntp_query() read the status line of the first command */
+    for (int i = start; i < end; i++)
+    {
+      if ((i > start) && (mutt_socket_readln(buf, sizeof(buf), mdata->adata->conn) < 0))
+      {
+        mdata->adata->status = NNTP_NONE;
+        break;
+      }
+
+      /* something failed, just stay in step with the server */
+      if (rc != 0)
+      {
+        if ((buf[0] == '2') &&
+            (nntp_fetch_reply(mdata, buf, xzver, NULL, fetch_discard, NULL) == -1))
+        {
+          break;
+        }
+        continue;
+      }
+
+      int rc2 = reply(i, buf, data);
+      if (rc2 == -1)
+        break;
+      if (rc2 != 0)
+        rc = rc2;
+      done = i + 1;
+    }
+  }
+
+  return rc;
+}
+
+/**
+ * fetch_save_email - Add a fetched header to the Mailbox
+ * @param fc   FetchCtx
+ * @param e    Email, already in m->emails[m->msg_count]
+ * @param anum Article number
+ */
+static void fetch_save_email(struct FetchCtx *fc, struct Email *e, anum_t anum)
+{
+  struct Mailbox *m = fc->mailbox;
+  struct NntpMboxData *mdata = m->mdata;
+
+  e->index = m->msg_count++;
+  e->read = false;
+  e->old = false;
+  e->deleted = false;
+  e->edata = nntp_edata_new();
+  e->free_edata = nntp_edata_free;
+  nntp_edata_get(e)->article_num = anum;
+  if (fc->restore)
+    e->changed = true;
+  else
+  {
+    nntp_article_status(m, e, NULL, nntp_edata_get(e)->article_num);
+    if (!e->read)
+      nntp_parse_xref(m, e);
+  }
+  if (anum > mdata->last_loaded)
+    mdata->last_loaded = anum;
+}
+
+/**
+ * struct HeadCtx - Articles to fetch with HEAD
+ */
+struct HeadCtx
+{
+  struct FetchCtx *fc; ///< Fetch context
+  anum_t *anums;       ///< Article numbers
+};
+
+/**
+ * head_cmd - Format a HEAD command - Implements nntp_pipeline() cmd callback
+ */
+static size_t head_cmd(int i, char *buf, size_t buflen, void *data)
+{
+  struct HeadCtx *hc = data;
+  return snprintf(buf, buflen, "HEAD %u\r\n", hc->anums[i]);
+}
+
+/**
+ * head_reply - Parse the reply to a HEAD command - Implements nntp_pipeline() reply callback
+ */
+static int head_reply(int i, char *status, void *data)
+{
+  struct HeadCtx *hc = data;
+  struct Mailbox *m = hc->fc->mailbox;
+  struct NntpMboxData *mdata = m->mdata;
+  anum_t anum = hc->anums[i];
+
+  if (status[0] != '2')
+  {
+    /* invalid response */
+    if (!mutt_str_startswith(status, "423", CASE_MATCH))
+    {
+      mutt_error("HEAD: %s", status);
+      return 1;
+    }
+
+    /* no such article */
+    if (mdata->bcache)
+    {
+      char buf[16];
+      snprintf(buf, sizeof(buf), "%u", anum);
+      mutt_debug(LL_DEBUG2, "#3 mutt_bcache_del %s\n", buf);
+      mutt_bcache_del(mdata->bcache, buf);
+    }
+    return 0;
+  }
+
+  FILE *fp = mutt_file_mkstemp();
+  if (!fp)
+  {
+    mutt_perror(_("Can't create temporary file"));
+    if (nntp_fetch_reply(mdata, status, false, NULL, fetch_discard, NULL) == -1)
+      return -1;
+    return -2;
+  }
+
+  int rc = nntp_fetch_reply(mdata, status, false, NULL, fetch_tempfile, fp);
+  if (rc != 0)
+  {
+    mutt_file_fclose(&fp);
+    return rc;
+  }
+  rewind(fp);
+
+  /* parse header */
+  if (m->msg_count >= m->email_max)
+    mx_alloc_memory(m);
+  m->emails[m->msg_count] = email_new();
+  struct Email *e = m->emails[m->msg_count];
+  e->env = mutt_rfc822_read_header(fp, e, false, false);
+  e->received = e->date_sent;
+  mutt_file_fclose(&fp);
+
+  fetch_save_email(hc->fc, e, anum);
+  return 0;
+}
+
+/**
+ * nntp_fetch_heads - Fetch headers with pipelined HEAD commands
+ * @param fc    FetchCtx
+ * @param anums Article numbers
+ * @param num   Number of articles
+ * @retval 0 Success
+ * @retval 1 Failure
+ */
+static int nntp_fetch_heads(struct FetchCtx *fc, anum_t *anums, int num)
+{
+  struct HeadCtx hc = { fc, anums };
+
+  int rc = nntp_pipeline(fc->mailbox->mdata, num, false, head_cmd, head_reply, &hc);
+  return (rc == 0) ? 0 : 1;
+}
+
+/**
+ * struct OverCtx - Ranges of articles to fetch with OVER
+ */
+struct OverCtx
+{
+  struct FetchCtx *fc; ///< Fetch context
+  const char *cmd;     ///< OVER, XOVER or XZVER
+  anum_t *ranges;      ///< Pairs of first and last article numbers
+};
+
+/**
+ * over_cmd - Format an OVER command - Implements nntp_pipeline() cmd callback
+ */
+static size_t over_cmd(int i, char *buf, size_t buflen, void *data)
+{
+  struct OverCtx *oc = data;
+  return snprintf(buf, buflen, "%s %u-%u\r\n", oc->cmd, oc->ranges[2 * i],
+                  oc->ranges[2 * i + 1]);
+}
+
+/**
+ * over_reply - Parse the reply to an OVER command - Implements nntp_pipeline() reply callback
+ */
+static int over_reply(int i, char *status, void *data)
+{
+  struct OverCtx *oc = data;
+  struct NntpMboxData *mdata = oc->fc->mailbox->mdata;
+
+  if (status[0] != '2')
+  {
+    mutt_error("%s: %s", oc->cmd, status);
+    return 1;
+  }
+
+  anum_t loaded = mdata->last_loaded;
+  int rc = nntp_fetch_reply(mdata, status, mdata->adata->hasXZVER, NULL,
+                            parse_overview_line, oc->fc);
+
+  /* connection lost, don't fetch the same articles twice */
+  if ((rc == -1) && (mdata->last_loaded != loaded))
+  {
+    if (mdata->last_loaded >= oc->ranges[2 * i + 1])
+      return 0;
+    oc->ranges[2 * i] = mdata->last_loaded + 1;
+  }
+  return rc;
+}
+
+/**
+ * nntp_fetch_overview - Fetch overview information with pipelined OVER commands
+ * @param fc    FetchCtx
+ * @param first First article to fetch
+ * @retval 0 Success
+ * @retval 1 Failure
+ *
+ * Articles missing from LISTGROUP aren't requested, unless the gap is small.
+ * Large ranges are split so the server can start on the next one early.
+ */
+static int nntp_fetch_overview(struct FetchCtx *fc, anum_t first)
+{
+  struct NntpMboxData *mdata = fc->mailbox->mdata;
+  struct OverCtx oc = { fc, NULL, NULL };
+  size_t max = 0;
+  int num = 0;
+
+  if (mdata->adata->hasXZVER)
+    oc.cmd = "XZVER";
+  else
+    oc.cmd = mdata->adata->hasOVER ? "OVER" : "XOVER";
+
+  for (anum_t anum = first; anum <= fc->last; anum++)
+  {
+    if (!fc->messages[anum - fc->first])
+      continue;
+
+    if ((num > 0) && ((anum - oc.ranges[2 * num - 1]) <= NNTP_OVER_GAP) &&
+        ((anum - oc.ranges[2 * num - 2]) < NNTP_OVER_RANGE))
+    {
+      oc.ranges[2 * num - 1] = anum;
+      continue;
+    }
+
+    if (num == max)
+    {
+      max += 32;
+      mutt_mem_realloc(&oc.ranges, 2 * max * sizeof(anum_t));
+    }
+    oc.ranges[2 * num] = anum;
+    oc.ranges[2 * num + 1] = anum;
+    num++;
+  }
+
+  int rc = nntp_pipeline(mdata, num, mdata->adata->hasXZVER, over_cmd, over_reply, &oc);
+  FREE(&oc.ranges);
+  return (rc == 0) ? 0 : 1;
+}
+
 /**
  * nntp_fetch_headers - Fetch headers
  * @param m       Mailbox
@@ -1265,6 +1885,8 @@ static int nntp_fetch_headers(struct Mailbox *m, void *hc, anum_t first, anum_t
   int rc = 0;
   anum_t current;
   anum_t first_over = first;
+  anum_t *heads = NULL;
+  int num_heads = 0;
 
   /* if empty group or nothing to do */
   if (!last || (first > last))
@@ -1343,15 +1965,27 @@ static int nntp_fetch_headers(struct Mailbox *m, void *hc, anum_t first, anum_t
     if (!fc.messages[current - first])
       continue;
 
-    /* allocate memory for headers */
-    if (m->msg_count >= m->email_max)
-      mx_alloc_memory(m);
-
 #ifdef USE_HCACHE
     /* try to fetch header from cache */
     void *hdata = mutt_hcache_fetch(fc.hc, buf, strlen(buf));
     if (hdata)
     {
+      /* keep the articles in order */
+      if (num_heads > 0)
+      {
+        rc = nntp_fetch_heads(&fc, heads, num_heads);
+        num_heads = 0;
+        if (rc != 0)
+        {
+          mutt_hcache_free(fc.hc, &hdata);
+          break;
+        }
+      }
+
+      /* allocate memory for headers */
+      if (m->msg_count >= m->email_max)
+        mx_alloc_memory(m);
+
       mutt_debug(LL_DEBUG2, "mutt_hcache_fetch %s\n", buf);
       e = mutt_hcache_restore(hdata);
       m->emails[m->msg_count] = e;
@@ -1390,85 +2024,32 @@ static int nntp_fetch_headers(struct Mailbox *m, void *hc, anum_t first, anum_t
         continue;
     }
 
-    /* fetch header from server */
+    /* fetch header from server, several at a time */
     else
     {
-      FILE *fp = mutt_file_mkstemp();
-      if (!fp)
-      {
-        mutt_perror(_("Can't create temporary file"));
-        rc = -1;
-        break;
-      }
-
-      snprintf(buf, sizeof(buf), "HEAD %u\r\n", current);
-      rc = nntp_fetch_lines(mdata, buf, sizeof(buf), NULL, fetch_tempfile, fp);
-      if (rc)
-      {
-        mutt_file_fclose(&fp);
-        if (rc < 0)
-          break;
-
-        /* invalid response */
-        if (!mutt_str_startswith(buf, "423", CASE_MATCH))
-        {
-          mutt_error("HEAD: %s", buf);
-          break;
-        }
-
-        /* no such article */
-        if (mdata->bcache)
-        {
-          snprintf(buf, sizeof(buf), "%u", current);
-          mutt_debug(LL_DEBUG2, "#3 mutt_bcache_del %s\n", buf);
-          mutt_bcache_del(mdata->bcache, buf);
-        }
-        rc = 0;
-        continue;
-      }
-
-      /* parse header */
-      m->emails[m->msg_count] = email_new();
-      e = m->emails[m->msg_count];
-      e->env = mutt_rfc822_read_header(fp, e, false, false);
-      e->received = e->date_sent;
-      mutt_file_fclose(&fp);
+      if (!heads)
+        heads = mutt_mem_calloc(last - current + 1, sizeof(anum_t));
+      heads[num_heads++] = current;
+      continue;
     }
 
     /* save header in context */
-    e->index = m->msg_count++;
-    e->read = false;
-    e->old = false;
-    e->deleted = false;
-    e->edata = nntp_edata_new();
-    e->free_edata = nntp_edata_free;
-    nntp_edata_get(e)->article_num = current;
-    if (restore)
-      e->changed = true;
-    else
-    {
-      nntp_article_status(m, e, NULL, nntp_edata_get(e)->article_num);
-      if (!e->read)
-        nntp_parse_xref(m, e);
-    }
-    if (current > mdata->last_loaded)
-      mdata->last_loaded = current;
+    fetch_save_email(&fc, e, current);
     first_over = current + 1;
   }
 
+  if ((rc == 0) && (num_heads > 0))
+    rc = nntp_fetch_heads(&fc, heads, num_heads);
+  FREE(&heads);
+
   if (!C_NntpListgroup || !mdata->adata->hasLISTGROUP)
     current = first_over;
 
   /* fetch overview information */
-  if ((current <= last) && (rc == 0) && !mdata->deleted)
+  if ((current <= last) && (rc == 0) && !mdata->deleted &&
+      (mdata->adata->hasOVER || mdata->adata->hasXOVER))
   {
-    char *cmd = mdata->adata->hasOVER ? "OVER" : "XOVER";
-    snprintf(buf, sizeof(buf), "%s %u-%u\r\n", cmd, current, last);
-    rc = nntp_fetch_lines(mdata, buf, sizeof(buf), NULL, parse_overview_line, &fc);
-    if (rc > 0)
-    {
-      mutt_error("%s: %s", cmd, buf);
-    }
+    rc = nntp_fetch_overview(&fc, current);
   }
 
   FREE(&fc.messages);
@@ -1509,6 +2090,7 @@ static int nntp_group_poll(struct NntpMboxData *mdata, bool update_stat)
       mdata->newsrc_len = 1;
       mdata->newsrc_ent[0].first = 1;
       mdata->newsrc_ent[0].last = 0;
+      nntp_newsrc_touch(mdata);
     }
   }
   mdata->first_message = first;
@@ -2069,6 +2651,9 @@ int nntp_active_fetch(struct NntpAccountData *adata, bool mark_new)
   if (nntp_date(adata, &adata->newgroups_time) < 0)
     return -1;
 
+  /* every cached group must be known, to tell which ones are new */
+  nntp_groups_load(adata);
+
   tmp_mdata.adata = adata;
   tmp_mdata.group = NULL;
   i = adata->groups_num;
@@ -2471,7 +3056,7 @@ static int nntp_mbox_open(struct Mailbox *m)
     group++;
 
   /* find news group data structure */
-  struct NntpMboxData *mdata = mutt_hash_find(adata->groups_hash, group);
+  struct NntpMboxData *mdata = nntp_group_find(adata, group);
   if (!mdata)
   {
     nntp_newsrc_close(adata);
@@ -2507,6 +3092,7 @@ static int nntp_mbox_open(struct Mailbox *m)
     {
       FREE(&mdata->newsrc_ent);
       mdata->newsrc_len = 0;
+      nntp_newsrc_touch(mdata);
       nntp_delete_group_cache(mdata);
       nntp_newsrc_update(adata);
     }
@@ -2802,6 +3388,8 @@ static int nntp_msg_open(struct Mailbox *m, struct Message *msg, int msgno)
   /* fix content length */
   fseek(msg->fp, 0, SEEK_END);
   e->content->length = ftell(msg->fp) - e->content->offset;
+  mutt_pattern_memo_clear(e);
+  m->gen++; /* cached limit results may depend on the old headers */
 
   /* this is called in neomutt before the open which fetches the message,
    * which is probably wrong, but we just call it again here to handle
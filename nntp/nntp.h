@@ -48,6 +48,7 @@
 #include "mx.h"
 
 struct ConnAccount;
+struct NntpActiveCache;
 struct stat;
 
 /* These Config Variables are only used in nntp/nntp.c */
@@ -83,10 +84,13 @@ struct NntpAccountData
   bool hasLISTGROUPrange  : 1;
   bool hasOVER            : 1;
   bool hasXOVER           : 1;
+  bool hasXZVER           : 1;
+  bool hasCOMPRESS        : 1;
   unsigned int use_tls    : 3;
   unsigned int status     : 3;
   bool cacheable          : 1;
   bool newsrc_modified    : 1;
+  bool newsrc_compact     : 1;
   FILE *fp_newsrc;
   char *newsrc_file;
   char *authenticators;
@@ -99,6 +103,7 @@ struct NntpAccountData
   unsigned int groups_max;
   void **groups_list;
   struct Hash *groups_hash;
+  struct NntpActiveCache *active_cache;
   struct Connection *conn;
 };
 
@@ -148,8 +153,11 @@ struct NntpMboxData
   bool has_new_mail : 1;
   bool allowed      : 1;
   bool deleted      : 1;
+  bool newsrc_dirty : 1;
   unsigned int newsrc_len;
   struct NewsrcEntry *newsrc_ent;
+  off_t newsrc_off;
+  size_t newsrc_linelen;
   struct NntpAccountData *adata;
   struct NntpAcache acache[NNTP_ACACHE_LEN];
   struct BodyCache *bcache;
@@ -161,6 +169,7 @@ struct NntpMboxData *mutt_newsgroup_unsubscribe(struct NntpAccountData *adata, c
 struct NntpMboxData *mutt_newsgroup_catchup(struct Mailbox *m, struct NntpAccountData *adata, char *group);
 struct NntpMboxData *mutt_newsgroup_uncatchup(struct Mailbox *m, struct NntpAccountData *adata, char *group);
 int nntp_active_fetch(struct NntpAccountData *adata, bool mark_new);
+void nntp_groups_load(struct NntpAccountData *adata);
 int nntp_newsrc_update(struct NntpAccountData *adata);
 int nntp_post(struct Mailbox *m, const char *msg);
 int nntp_check_msgid(struct Mailbox *m, const char *msgid);
@@ -35,6 +35,13 @@ struct Mailbox;
 #define NNTP_PORT 119
 #define NNTP_SSL_PORT 563
 
+/* maximum number of commands in flight */
+#define NNTP_PIPELINE_DEPTH 16
+/* maximum number of articles requested by one OVER command */
+#define NNTP_OVER_RANGE 2048
+/* missing articles that are fetched over, rather than splitting a range */
+#define NNTP_OVER_GAP 64
+
 /**
  * enum NntpStatus - NNTP server return values
  */
@@ -46,6 +53,7 @@ enum NntpStatus
 };
 
 void nntp_acache_free(struct NntpMboxData *mdata);
+void nntp_active_cache_free(struct NntpAccountData *adata);
 int  nntp_active_save_cache(struct NntpAccountData *adata);
 struct NntpAccountData *nntp_adata_new(struct Connection *conn);
 int  nntp_add_group(char *line, void *data);
@@ -53,10 +61,12 @@ void nntp_bcache_update(struct NntpMboxData *mdata);
 int  nntp_check_new_groups(struct Mailbox *m, struct NntpAccountData *adata);
 void nntp_delete_group_cache(struct NntpMboxData *mdata);
 struct NntpEmailData *nntp_edata_get(struct Email *e);
+struct NntpMboxData *nntp_group_find(struct NntpAccountData *adata, const char *group);
 void nntp_group_unread_stat(struct NntpMboxData *mdata);
 void nntp_hash_destructor_t(int type, void *obj, intptr_t data);
 void nntp_mdata_free(void **ptr);
 void nntp_newsrc_gen_entries(struct Mailbox *m);
+void nntp_newsrc_touch(struct NntpMboxData *mdata);
 int  nntp_open_connection(struct NntpAccountData *adata);
 void nntp_article_status(struct Mailbox *m, struct Email *e, char *group, anum_t anum);
 header_cache_t *nntp_hcache_open(struct NntpMboxData *mdata);
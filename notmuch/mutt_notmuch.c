@@ -49,6 +49,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
 #include "notmuch_private.h"
@@ -65,6 +66,7 @@
 #include "maildir/lib.h"
 #include "mutt_thread.h"
 #include "mx.h"
+#include "pattern.h"
 #include "progress.h"
 #include "protos.h"
 
@@ -76,6 +78,8 @@ int C_NmDbLimit;       ///< Config: (notmuch) Default limit for Notmuch queries
 char *C_NmDefaultUri;  ///< Config: (notmuch) Path to the Notmuch database
 char *C_NmExcludeTags; ///< Config: (notmuch) Exclude messages with these tags
 int C_NmOpenTimeout;   ///< Config: (notmuch) Database timeout
+int C_NmPageSize;      ///< Config: (notmuch) Number of results to read at a time
+bool C_NmQuickHeaders; ///< Config: (notmuch) Read the index headers from the database
 char *C_NmQueryType; ///< Config: (notmuch) Default query type: 'threads' or 'messages'
 int C_NmQueryWindowCurrentPosition; ///< Config: (notmuch) Position of current search window
 char *C_NmQueryWindowTimebase; ///< Config: (notmuch) Units for the time duration
@@ -192,6 +196,7 @@ void nm_mdata_free(void **ptr)
 
   url_free(&mdata->db_url);
   FREE(&mdata->db_query);
+  mutt_hash_free(&mdata->parents);
   FREE(ptr);
 }
 
@@ -621,12 +626,13 @@ err:
 
 /**
  * update_email_tags - Update the Email's tags from Notmuch
+ * @param m   Mailbox holding the Email, may be NULL for a new Email
  * @param e   Email
  * @param msg Notmuch message
  * @retval 0 Success
  * @retval 1 Tags unchanged
  */
-static int update_email_tags(struct Email *e, notmuch_message_t *msg)
+static int update_email_tags(struct Mailbox *m, struct Email *e, notmuch_message_t *msg)
 {
   struct NmEmailData *edata = e->edata;
   char *new_tags = NULL;
@@ -656,6 +662,9 @@ static int update_email_tags(struct Email *e, notmuch_message_t *msg)
 
   /* new version */
   driver_tags_replace(&e->tags, new_tags);
+  mutt_pattern_memo_clear(e);
+  if (m)
+    m->gen++;
   FREE(&new_tags);
 
   new_tags = driver_tags_get_transformed(&e->tags);
@@ -794,7 +803,7 @@ static int init_email(struct Email *e, const char *path, notmuch_message_t *msg)
   if (update_message_path(e, path) != 0)
     return -1;
 
-  update_email_tags(e, msg);
+  update_email_tags(NULL, e, msg);
 
   return 0;
 }
@@ -898,6 +907,276 @@ static struct Email *get_mutt_email(struct Mailbox *m, notmuch_message_t *msg)
   return e;
 }
 
+/**
+ * get_threads - load threads for a query
+ * @param query Notmuch query
+ * @retval ptr Threads matching query
+ * @retval NULL Error occurred
+ *
+ * This helper method is to be the single point for retrieving messages. It
+ * handles version specific calls, which will make maintenance easier.
+ */
+static notmuch_threads_t *get_threads(notmuch_query_t *query)
+{
+  if (!query)
+    return NULL;
+
+  notmuch_threads_t *threads = NULL;
+#if LIBNOTMUCH_CHECK_VERSION(5, 0, 0)
+  if (notmuch_query_search_threads(query, &threads) != NOTMUCH_STATUS_SUCCESS)
+    return false;
+#elif LIBNOTMUCH_CHECK_VERSION(4, 3, 0)
+  if (notmuch_query_search_threads_st(query, &threads) != NOTMUCH_STATUS_SUCCESS)
+    return false;
+#else
+  threads = notmuch_query_search_threads(query);
+#endif
+
+  return threads;
+}
+
+/**
+ * parents_add_replies - Remember the parent of each reply to a message
+ * @param parents Hash table of parent ids, see NmMboxData::parents
+ * @param top     Notmuch message
+ */
+static void parents_add_replies(struct Hash *parents, notmuch_message_t *top)
+{
+  const char *parent = notmuch_message_get_message_id(top);
+
+  for (notmuch_messages_t *msgs = notmuch_message_get_replies(top);
+       notmuch_messages_valid(msgs); notmuch_messages_move_to_next(msgs))
+  {
+    notmuch_message_t *nm = notmuch_messages_get(msgs);
+    const char *id = notmuch_message_get_message_id(nm);
+    if (id && !mutt_hash_find_elem(parents, id))
+      mutt_hash_insert(parents, id, mutt_str_strdup(parent));
+    parents_add_replies(parents, nm);
+    notmuch_message_destroy(nm);
+  }
+}
+
+/**
+ * parents_free - Free a parent id - Implements ::hashelem_free_t
+ */
+static void parents_free(int type, void *obj, intptr_t data)
+{
+  FREE(&obj);
+}
+
+/**
+ * get_parent_id - Find the parent of a message in its notmuch thread
+ * @param m   Mailbox
+ * @param msg Notmuch message
+ * @retval ptr  Notmuch id of the parent
+ * @retval NULL The message starts its thread
+ *
+ * notmuch has already threaded the messages, but In-Reply-To and References
+ * aren't stored in the database.  The first lookup walks the whole thread and
+ * remembers the parents of all of its messages.
+ */
+static const char *get_parent_id(struct Mailbox *m, notmuch_message_t *msg)
+{
+  struct NmMboxData *mdata = nm_mdata_get(m);
+  const char *id = notmuch_message_get_message_id(msg);
+  if (!mdata || !id)
+    return NULL;
+
+  if (!mdata->parents)
+  {
+    mdata->parents = mutt_hash_new(1024, MUTT_HASH_STRDUP_KEYS);
+    mutt_hash_set_destructor(mdata->parents, parents_free, 0);
+  }
+
+  struct HashElem *he = mutt_hash_find_elem(mdata->parents, id);
+  if (he)
+    return he->data;
+
+  const char *tid = notmuch_message_get_thread_id(msg);
+  notmuch_database_t *db = nm_db_get(m, false);
+  if (!tid || !db)
+    return NULL;
+
+  char *qstr = NULL;
+  mutt_str_append_item(&qstr, "thread:", '\0');
+  mutt_str_append_item(&qstr, tid, '\0');
+  notmuch_query_t *q = notmuch_query_create(db, qstr);
+  FREE(&qstr);
+  if (!q)
+    return NULL;
+
+  notmuch_threads_t *threads = get_threads(q);
+  if (threads && notmuch_threads_valid(threads))
+  {
+    notmuch_thread_t *thread = notmuch_threads_get(threads);
+    for (notmuch_messages_t *msgs = notmuch_thread_get_toplevel_messages(thread);
+         notmuch_messages_valid(msgs); notmuch_messages_move_to_next(msgs))
+    {
+      notmuch_message_t *nm = notmuch_messages_get(msgs);
+      const char *top = notmuch_message_get_message_id(nm);
+      if (top && !mutt_hash_find_elem(mdata->parents, top))
+        mutt_hash_insert(mdata->parents, top, NULL);
+      parents_add_replies(mdata->parents, nm);
+      notmuch_message_destroy(nm);
+    }
+    notmuch_thread_destroy(thread);
+  }
+  notmuch_query_destroy(q);
+
+  /* Don't walk the thread again if the message wasn't in it */
+  he = mutt_hash_find_elem(mdata->parents, id);
+  if (!he)
+    he = mutt_hash_insert(mdata->parents, id, NULL);
+  return he->data;
+}
+
+/**
+ * parse_from_header - Parse a From header decoded by notmuch
+ * @param al    AddressList to add to
+ * @param value Decoded header
+ *
+ * notmuch has decoded any RFC2047 name, which may now hold a comma, so take
+ * the last address in angle brackets as the only one.
+ */
+static void parse_from_header(struct AddressList *al, const char *value)
+{
+  const char *lt = strrchr(value, '<');
+  const char *gt = lt ? strchr(lt, '>') : NULL;
+  if (!gt)
+  {
+    mutt_addrlist_parse(al, value);
+    return;
+  }
+
+  struct Address *a = mutt_addr_new();
+  a->mailbox = mutt_str_substr_dup(lt + 1, gt);
+
+  const char *end = lt;
+  while ((end > value) && IS_SPACE(end[-1]))
+    end--;
+  if ((end - value >= 2) && (value[0] == '"') && (end[-1] == '"'))
+  {
+    value++;
+    end--;
+  }
+  if (end > value)
+    a->personal = mutt_str_substr_dup(value, end);
+
+  mutt_addrlist_append(al, a);
+}
+
+/**
+ * email_from_headers - Create an Email from the headers notmuch has indexed
+ * @param m    Mailbox
+ * @param msg  Notmuch message
+ * @param path Path of the message file
+ * @retval ptr  New Email with a partial Envelope
+ * @retval NULL The message file is missing
+ *
+ * The Envelope only holds what the index needs: From and Subject, which notmuch
+ * stores, and the date and parent, which notmuch knows itself.  init_email()
+ * adds the message id.  complete_email() reads the rest of the file when the
+ * message is opened.
+ */
+static struct Email *email_from_headers(struct Mailbox *m, notmuch_message_t *msg,
+                                        const char *path)
+{
+  struct stat st;
+  if (stat(path, &st) != 0)
+    return NULL;
+
+  struct Email *e = email_new();
+  e->env = mutt_env_new();
+  e->content = mutt_body_new();
+  e->content->type = TYPE_TEXT;
+  e->content->subtype = mutt_str_strdup("plain");
+  e->content->encoding = ENC_7BIT;
+  e->content->disposition = DISP_INLINE;
+  e->content->length = st.st_size;
+
+  /* notmuch has already decoded the values */
+  const char *value = notmuch_message_get_header(msg, "from");
+  if (value && (*value != '\0'))
+    parse_from_header(&e->env->from, value);
+
+  value = notmuch_message_get_header(msg, "subject");
+  if (value && (*value != '\0'))
+  {
+    e->env->subject = mutt_str_strdup(value);
+
+    regmatch_t pmatch[1];
+
+    if (mutt_regex_capture(C_ReplyRegex, e->env->subject, 1, pmatch))
+      e->env->real_subj = e->env->subject + pmatch[0].rm_eo;
+    else
+      e->env->real_subj = e->env->subject;
+  }
+
+  const char *parent = get_parent_id(m, msg);
+  if (parent)
+    mutt_list_insert_tail(&e->env->in_reply_to, nm2mutt_message_id(parent));
+
+  e->date_sent = notmuch_message_get_date(msg);
+  e->received = e->date_sent;
+  e->index = -1;
+  maildir_parse_flags(e, path);
+
+  return e;
+}
+
+/**
+ * complete_email - Read the rest of a partial Envelope from the message file
+ * @param m  Mailbox
+ * @param e  Email created by email_from_headers()
+ * @param fp Message file
+ */
+static void complete_email(struct Mailbox *m, struct Email *e, FILE *fp)
+{
+  struct NmEmailData *edata = e->edata;
+
+  mutt_debug(LL_DEBUG2, "nm: completing envelope (%s)\n", edata->virtual_id);
+
+  struct Email *e_full = email_new();
+  e_full->env = mutt_rfc822_read_header(fp, e_full, false, false);
+
+  struct stat st;
+  if (fstat(fileno(fp), &st) == 0)
+    e_full->content->length = st.st_size - e_full->content->offset;
+  rewind(fp);
+
+  /* The file's From and Subject win over notmuch's decoded values.  The
+   * message id and In-Reply-To are keys of the thread hash, so they stay. */
+  if (m->subj_hash && e->env->real_subj)
+    mutt_hash_delete(m->subj_hash, e->env->real_subj, e);
+  mutt_addrlist_clear(&e->env->from);
+  FREE(&e->env->subject);
+  FREE(&e->env->disp_subj);
+  e->env->real_subj = NULL;
+  mutt_env_merge(e->env, &e_full->env);
+  if (m->subj_hash && e->env->real_subj)
+    mutt_hash_insert(m->subj_hash, e->env->real_subj, e);
+
+  mutt_body_free(&e->content);
+  e->content = e_full->content;
+  e_full->content = NULL;
+  e->lines = e_full->lines;
+  e->date_sent = e_full->date_sent;
+  e->zhours = e_full->zhours;
+  e->zminutes = e_full->zminutes;
+  e->zoccident = e_full->zoccident;
+  email_free(&e_full);
+  mutt_pattern_memo_clear(e);
+  m->gen++;
+
+  edata->partial = false;
+
+#ifdef USE_HCACHE
+  header_cache_t *h = nm_hcache_open(m);
+  mutt_hcache_store(h, edata->virtual_id, mutt_str_strlen(edata->virtual_id), e, 0);
+  nm_hcache_close(h);
+#endif
+}
+
 /**
  * append_message - Associate a message
  * @param h     Header cache handle
@@ -930,8 +1209,9 @@ static void append_message(header_cache_t *h, struct Mailbox *m,
   if (!path)
     return;
 
+  const char *id = notmuch_message_get_message_id(msg);
   mutt_debug(LL_DEBUG2, "nm: appending message, i=%d, id=%s, path=%s\n",
-             m->msg_count, notmuch_message_get_message_id(msg), path);
+             m->msg_count, id, path);
 
   if (m->msg_count >= m->email_max)
   {
@@ -939,14 +1219,23 @@ static void append_message(header_cache_t *h, struct Mailbox *m,
     mx_alloc_memory(m);
   }
 
+  bool partial = false;
+
 #ifdef USE_HCACHE
-  void *from_cache = mutt_hcache_fetch(h, path, mutt_str_strlen(path));
+  /* The filename changes with the maildir flags, the message id doesn't */
+  void *from_cache = mutt_hcache_fetch(h, id, mutt_str_strlen(id));
   if (from_cache)
   {
     e = mutt_hcache_restore(from_cache);
+    maildir_parse_flags(e, path);
   }
-  else
 #endif
+  if (!e && C_NmQuickHeaders)
+  {
+    e = email_from_headers(m, msg, path);
+    partial = (e != NULL);
+  }
+  if (!e)
   {
     if (access(path, F_OK) == 0)
       e = maildir_parse_message(MUTT_MAILDIR, path, false, NULL);
@@ -982,10 +1271,9 @@ static void append_message(header_cache_t *h, struct Mailbox *m,
   {
     mutt_hcache_free(h, &from_cache);
   }
-  else
+  else if (!partial)
   {
-    mutt_hcache_store(h, newpath ? newpath : path,
-                      mutt_str_strlen(newpath ? newpath : path), e, 0);
+    mutt_hcache_store(h, id, mutt_str_strlen(id), e, 0);
   }
 #endif
   if (init_email(e, newpath ? newpath : path, msg) != 0)
@@ -995,6 +1283,9 @@ static void append_message(header_cache_t *h, struct Mailbox *m,
     goto done;
   }
 
+  struct NmEmailData *edata = e->edata;
+  edata->partial = partial;
+
   e->active = true;
   e->index = m->msg_count;
   mailbox_size_add(m, e);
@@ -1103,10 +1394,17 @@ static notmuch_messages_t *get_messages(notmuch_query_t *query)
  * @param m     Mailbox
  * @param q     Notmuch query
  * @param dedup De-duplicate the results
+ * @param pos   Position in the results, advanced past each result read (OPTIONAL)
+ * @param page  Maximum number of new results to read, 0 for all of them
  * @retval true  Success
  * @retval false Failure
+ *
+ * Results before pos are skipped.  When reading the Mailbox's query, i.e. with
+ * pos, NmMboxData::page_more tells whether the page filled up before the query
+ * was exhausted.
  */
-static bool read_mesgs_query(struct Mailbox *m, notmuch_query_t *q, bool dedup)
+static bool read_mesgs_query(struct Mailbox *m, notmuch_query_t *q, bool dedup,
+                             int *pos, int page)
 {
   struct NmMboxData *mdata = nm_mdata_get(m);
   if (!mdata)
@@ -1120,7 +1418,11 @@ static bool read_mesgs_query(struct Mailbox *m, notmuch_query_t *q, bool dedup)
     return false;
 
   header_cache_t *h = nm_hcache_open(m);
+  int skip = pos ? *pos : 0;
+  int count = 0;
 
+  if (pos)
+    mdata->page_more = false;
   for (; notmuch_messages_valid(msgs) && ((limit == 0) || (m->msg_count < limit));
        notmuch_messages_move_to_next(msgs))
   {
@@ -1130,53 +1432,45 @@ static bool read_mesgs_query(struct Mailbox *m, notmuch_query_t *q, bool dedup)
       SigInt = 0;
       return false;
     }
+    if (skip > 0)
+    {
+      skip--;
+      continue;
+    }
+    if ((page > 0) && (count >= page))
+    {
+      mdata->page_more = true;
+      break;
+    }
     notmuch_message_t *nm = notmuch_messages_get(msgs);
     append_message(h, m, q, nm, dedup);
     notmuch_message_destroy(nm);
+    if (pos)
+      (*pos)++;
+    count++;
   }
 
   nm_hcache_close(h);
   return true;
 }
 
-/**
- * get_threads - load threads for a query
- * @param query Notmuch query
- * @retval ptr Threads matching query
- * @retval NULL Error occurred
- *
- * This helper method is to be the single point for retrieving messages. It
- * handles version specific calls, which will make maintenance easier.
- */
-static notmuch_threads_t *get_threads(notmuch_query_t *query)
-{
-  if (!query)
-    return NULL;
-
-  notmuch_threads_t *threads = NULL;
-#if LIBNOTMUCH_CHECK_VERSION(5, 0, 0)
-  if (notmuch_query_search_threads(query, &threads) != NOTMUCH_STATUS_SUCCESS)
-    return false;
-#elif LIBNOTMUCH_CHECK_VERSION(4, 3, 0)
-  if (notmuch_query_search_threads_st(query, &threads) != NOTMUCH_STATUS_SUCCESS)
-    return false;
-#else
-  threads = notmuch_query_search_threads(query);
-#endif
-
-  return threads;
-}
-
 /**
  * read_threads_query - Perform a query with threads
  * @param m     Mailbox
  * @param q     Query type
  * @param dedup Should the results be de-duped?
  * @param limit Maximum number of results
+ * @param pos   Position in the threads, advanced past each thread read (OPTIONAL)
+ * @param page  Maximum number of new threads to read, 0 for all of them
  * @retval true  Success
  * @retval false Failure
+ *
+ * Threads before pos are skipped.  When reading the Mailbox's query, i.e. with
+ * pos, NmMboxData::page_more tells whether the page filled up before the query
+ * was exhausted.
  */
-static bool read_threads_query(struct Mailbox *m, notmuch_query_t *q, bool dedup, int limit)
+static bool read_threads_query(struct Mailbox *m, notmuch_query_t *q, bool dedup,
+                               int limit, int *pos, int page)
 {
   struct NmMboxData *mdata = nm_mdata_get(m);
   if (!mdata)
@@ -1187,7 +1481,11 @@ static bool read_threads_query(struct Mailbox *m, notmuch_query_t *q, bool dedup
     return false;
 
   header_cache_t *h = nm_hcache_open(m);
+  int skip = pos ? *pos : 0;
+  int count = 0;
 
+  if (pos)
+    mdata->page_more = false;
   for (; notmuch_threads_valid(threads) && ((limit == 0) || (m->msg_count < limit));
        notmuch_threads_move_to_next(threads))
   {
@@ -1197,15 +1495,74 @@ static bool read_threads_query(struct Mailbox *m, notmuch_query_t *q, bool dedup
       SigInt = 0;
       return false;
     }
+    if (skip > 0)
+    {
+      skip--;
+      continue;
+    }
+    if ((page > 0) && (count >= page))
+    {
+      mdata->page_more = true;
+      break;
+    }
     notmuch_thread_t *thread = notmuch_threads_get(threads);
     append_thread(h, m, q, thread, dedup);
     notmuch_thread_destroy(thread);
+    if (pos)
+      (*pos)++;
+    count++;
   }
 
   nm_hcache_close(h);
   return true;
 }
 
+/**
+ * read_query_page - Read the next page of the Mailbox's query
+ * @param m     Mailbox
+ * @param dedup De-duplicate the results
+ * @param page  Maximum number of new results to read, 0 for all of them
+ * @retval  0 Success
+ * @retval -1 The query couldn't be created
+ * @retval -2 Reading failed, or was interrupted
+ *
+ * Notmuch has no way to resume a query, so it's run again and the results
+ * read by the previous pages are skipped.  Walking the result set is cheap
+ * compared to creating an Email for each result.
+ */
+static int read_query_page(struct Mailbox *m, bool dedup, int page)
+{
+  struct NmMboxData *mdata = nm_mdata_get(m);
+  if (!mdata)
+    return -1;
+
+  notmuch_query_t *q = get_query(m, false);
+  int rc = q ? 0 : -1;
+  if (q)
+  {
+    switch (mdata->query_type)
+    {
+      case NM_QUERY_TYPE_MESGS:
+        if (!read_mesgs_query(m, q, dedup, &mdata->page_done, page))
+          rc = -2;
+        break;
+      case NM_QUERY_TYPE_THREADS:
+        if (!read_threads_query(m, q, dedup, get_limit(mdata), &mdata->page_done, page))
+          rc = -2;
+        break;
+    }
+    notmuch_query_destroy(q);
+  }
+
+  /* The parents are only needed while the query is being read */
+  if (!mdata->page_more)
+    mutt_hash_free(&mdata->parents);
+
+  /* Don't hold the database open between pages */
+  nm_db_release(m);
+  return rc;
+}
+
 /**
  * get_nm_message - Find a Notmuch message
  * @param db  Notmuch database
@@ -1583,12 +1940,15 @@ static int rename_filename(struct Mailbox *m, const char *old_file,
 
   if ((st == NOTMUCH_STATUS_SUCCESS) && e && msg)
   {
+    /* Coalesce the flag and tag changes into a single write of the message */
+    notmuch_message_freeze(msg);
     notmuch_message_maildir_flags_to_tags(msg);
-    update_email_tags(e, msg);
+    update_email_tags(m, e, msg);
 
     char *tags = driver_tags_get(&e->tags);
     update_tags(msg, tags);
     FREE(&tags);
+    notmuch_message_thaw(msg);
   }
 
   rc = 0;
@@ -1688,7 +2048,9 @@ int nm_read_entire_thread(struct Mailbox *m, struct Email *e)
   apply_exclude_tags(q);
   notmuch_query_set_sort(q, NOTMUCH_SORT_NEWEST_FIRST);
 
-  read_threads_query(m, q, true, 0);
+  read_threads_query(m, q, true, 0, NULL, 0);
+  if (!mdata->page_more)
+    mutt_hash_free(&mdata->parents);
   m->mtime.tv_sec = mutt_date_epoch();
   m->mtime.tv_nsec = 0;
   rc = 0;
@@ -1710,6 +2072,42 @@ done:
   return rc;
 }
 
+/**
+ * nm_read_remaining - Read the rest of a paged query
+ * @param m Mailbox
+ * @retval  0 Success, or nothing left to read
+ * @retval -1 Failure
+ *
+ * When $nm_page_size is set, only the first page of the query is read when
+ * the Mailbox is opened.  Anything that needs to see every result, such as a
+ * search or a limit, must call this first.
+ */
+int nm_read_remaining(struct Mailbox *m)
+{
+  if (!m)
+    return -1;
+
+  struct NmMboxData *mdata = nm_mdata_get(m);
+  if (!mdata)
+    return -1;
+
+  if (!mdata->page_more)
+    return 0;
+
+  mutt_debug(LL_DEBUG1, "nm: reading remaining messages...[done=%d]\n", mdata->page_done);
+
+  progress_reset(m);
+  int rc = read_query_page(m, true, 0);
+
+  if (m->msg_count > mdata->oldmsgcount)
+    mailbox_changed(m, NT_MAILBOX_INVALID);
+  mdata->oldmsgcount = 0;
+
+  mutt_debug(LL_DEBUG1, "nm: reading remaining messages... done [rc=%d, count=%d]\n",
+             rc, m->msg_count);
+  return (rc == 0) ? 0 : -1;
+}
+
 /**
  * nm_parse_type_from_query - Parse a query type out of a query
  * @param mdata Mailbox, used for the query_type
@@ -2168,27 +2566,9 @@ static int nm_mbox_open(struct Mailbox *m)
 
   progress_reset(m);
 
-  int rc = -1;
-
-  notmuch_query_t *q = get_query(m, false);
-  if (q)
-  {
-    rc = 0;
-    switch (mdata->query_type)
-    {
-      case NM_QUERY_TYPE_MESGS:
-        if (!read_mesgs_query(m, q, false))
-          rc = -2;
-        break;
-      case NM_QUERY_TYPE_THREADS:
-        if (!read_threads_query(m, q, false, get_limit(mdata)))
-          rc = -2;
-        break;
-    }
-    notmuch_query_destroy(q);
-  }
-
-  nm_db_release(m);
+  mdata->page_done = 0;
+  mdata->page_more = false;
+  int rc = read_query_page(m, false, C_NmPageSize);
 
   m->mtime.tv_sec = mutt_date_epoch();
   m->mtime.tv_nsec = 0;
@@ -2222,6 +2602,21 @@ static int nm_mbox_check(struct Mailbox *m, int *index_hint)
   int new_flags = 0;
   bool occult = false;
 
+  if (mdata->page_more)
+  {
+    /* The query hasn't been read completely, yet.  Read the next page rather
+     * than checking the results; the full check resumes once it's done. */
+    mutt_debug(LL_DEBUG1, "nm: reading next page [done=%d]\n", mdata->page_done);
+    progress_reset(m);
+    mdata->noprogress = true;
+    if (read_query_page(m, true, C_NmPageSize) == -1)
+      return -1;
+    if (m->msg_count == mdata->oldmsgcount)
+      return 0;
+    mailbox_changed(m, NT_MAILBOX_INVALID);
+    return MUTT_NEW_MAIL;
+  }
+
   if (m->mtime.tv_sec >= mtime)
   {
     mutt_debug(LL_DEBUG2, "nm: check unnecessary (db=%lu mailbox=%lu)\n", mtime,
@@ -2298,7 +2693,7 @@ static int nm_mbox_check(struct Mailbox *m, int *index_hint)
       maildir_update_flags(m, e, &e_tmp);
     }
 
-    if (update_email_tags(e, msg) == 0)
+    if (update_email_tags(m, e, msg) == 0)
       new_flags++;
 
     notmuch_message_destroy(msg);
@@ -2338,8 +2733,40 @@ done:
                                                         new_flags ? MUTT_FLAGS : 0;
 }
 
+/**
+ * struct NmSyncOp - A planned change to one Email's file
+ */
+struct NmSyncOp
+{
+  struct Email *e; ///< Email to sync
+  int msgno;       ///< Index of the Email in the Mailbox
+  char *old_file;  ///< Path of the file before the sync
+  char *new_file;  ///< Path of the file after the sync, NULL if it was deleted
+};
+
+/**
+ * sync_needed - Does an Email's file need to be synced?
+ * @param e Email
+ * @retval true The file may be renamed or deleted
+ */
+static bool sync_needed(struct Email *e)
+{
+  struct NmEmailData *edata = e->edata;
+
+  return e->deleted || e->changed || e->attach_del || e->trash || edata->oldpath;
+}
+
 /**
  * nm_mbox_sync - Save changes to the Mailbox - Implements MxOps::mbox_sync()
+ *
+ * The sync is done in three passes:
+ * - plan: find the Emails that have changed
+ * - files: rename or delete their maildir files
+ * - database: record the new filenames and tags in one atomic section
+ *
+ * notmuch indexes the renamed file, so the files must be dealt with first.
+ * Batching the database updates means Xapian only commits once, rather than
+ * once per Email.
  */
 static int nm_mbox_sync(struct Mailbox *m, int *index_hint)
 {
@@ -2357,27 +2784,52 @@ static int nm_mbox_sync(struct Mailbox *m, int *index_hint)
 
   mutt_debug(LL_DEBUG1, "nm: sync start\n");
 
+  /* Plan */
+  struct NmSyncOp *ops = NULL;
+  int num_ops = 0;
+  for (int i = 0; i < m->msg_count; i++)
+  {
+    struct Email *e = m->emails[i];
+    if (!e)
+      break;
+    if (!sync_needed(e))
+      continue;
+
+    if (!ops)
+      ops = mutt_mem_calloc(m->msg_count - i, sizeof(struct NmSyncOp));
+    ops[num_ops].e = e;
+    ops[num_ops].msgno = i;
+    num_ops++;
+  }
+
+  if (num_ops == 0)
+  {
+    FREE(&uri);
+    mutt_debug(LL_DEBUG1, "nm: .... sync done, nothing to do\n");
+    return 0;
+  }
+
   if (!m->quiet)
   {
     /* all is in this function so we don't use data->progress here */
     char msg[PATH_MAX];
     snprintf(msg, sizeof(msg), _("Writing %s..."), mailbox_path(m));
-    mutt_progress_init(&progress, msg, MUTT_PROGRESS_WRITE, m->msg_count);
+    mutt_progress_init(&progress, msg, MUTT_PROGRESS_WRITE, 2 * num_ops);
   }
 
+  /* Files */
   header_cache_t *h = nm_hcache_open(m);
 
-  for (int i = 0; i < m->msg_count; i++)
+  int done = 0;
+  for (; done < num_ops; done++)
   {
     char old_file[PATH_MAX], new_file[PATH_MAX];
-    struct Email *e = m->emails[i];
-    if (!e)
-      break;
-
+    struct NmSyncOp *op = &ops[done];
+    struct Email *e = op->e;
     struct NmEmailData *edata = e->edata;
 
     if (!m->quiet)
-      mutt_progress_update(&progress, i, -1);
+      mutt_progress_update(&progress, done, -1);
 
     *old_file = '\0';
     *new_file = '\0';
@@ -2393,7 +2845,7 @@ static int nm_mbox_sync(struct Mailbox *m, int *index_hint)
 
     mutt_buffer_strcpy(&m->pathbuf, edata->folder);
     m->magic = edata->magic;
-    rc = mh_sync_mailbox_message(m, i, h);
+    rc = mh_sync_mailbox_message(m, op->msgno, h);
     mutt_buffer_strcpy(&m->pathbuf, uri);
     m->magic = MUTT_NOTMUCH;
 
@@ -2403,30 +2855,61 @@ static int nm_mbox_sync(struct Mailbox *m, int *index_hint)
     if (!e->deleted)
       email_get_fullpath(e, new_file, sizeof(new_file));
 
-    if (e->deleted || (strcmp(old_file, new_file) != 0))
-    {
-      if (e->deleted && (remove_filename(m, old_file) == 0))
-        changed = true;
-      else if (*new_file && *old_file && (rename_filename(m, old_file, new_file, e) == 0))
-        changed = true;
-    }
+    op->old_file = mutt_str_strdup(old_file);
+    op->new_file = e->deleted ? NULL : mutt_str_strdup(new_file);
 
     FREE(&edata->oldpath);
   }
 
-  mutt_buffer_strcpy(&m->pathbuf, uri);
-  m->magic = MUTT_NOTMUCH;
+  nm_hcache_close(h);
+
+  /* Database */
+  if (nm_db_get(m, true))
+  {
+    int trans = nm_db_trans_begin(m);
+
+    for (int i = 0; i < done; i++)
+    {
+      struct NmSyncOp *op = &ops[i];
+
+      if (!m->quiet)
+        mutt_progress_update(&progress, num_ops + i, -1);
+
+      if (!op->new_file)
+      {
+        if (remove_filename(m, op->old_file) == 0)
+          changed = true;
+      }
+      else if (*op->old_file && *op->new_file &&
+               (strcmp(op->old_file, op->new_file) != 0))
+      {
+        if (rename_filename(m, op->old_file, op->new_file, op->e) == 0)
+          changed = true;
+      }
+    }
+
+    if ((trans == 1) && (nm_db_trans_end(m) != 0))
+    {
+      mutt_debug(LL_DEBUG1, "nm: failed to commit the sync\n");
+      rc = -1;
+    }
+  }
 
   nm_db_release(m);
 
+  for (int i = 0; i < num_ops; i++)
+  {
+    FREE(&ops[i].old_file);
+    FREE(&ops[i].new_file);
+  }
+  FREE(&ops);
+
   if (changed)
   {
     m->mtime.tv_sec = mutt_date_epoch();
     m->mtime.tv_nsec = 0;
   }
 
-  nm_hcache_close(h);
-
   FREE(&uri);
   mutt_debug(LL_DEBUG1, "nm: .... sync done [rc=%d]\n", rc);
   return rc;
@@ -2469,6 +2952,10 @@ static int nm_msg_open(struct Mailbox *m, struct Message *msg, int msgno)
   if (!msg->fp)
     return -1;
 
+  struct NmEmailData *edata = e->edata;
+  if (edata && edata->partial)
+    complete_email(m, e, msg->fp);
+
   return 0;
 }
 
@@ -2527,7 +3014,7 @@ static int nm_tags_commit(struct Mailbox *m, struct Email *e, char *buf)
 
   update_tags(msg, buf);
   update_email_flags(m, e, buf);
-  update_email_tags(e, msg);
+  update_email_tags(m, e, msg);
   mutt_set_header_color(m, e);
 
   rc = 0;
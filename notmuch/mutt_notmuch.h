@@ -48,6 +48,8 @@ extern int   C_NmDbLimit;
 extern char *C_NmDefaultUri;
 extern char *C_NmExcludeTags;
 extern int   C_NmOpenTimeout;
+extern int   C_NmPageSize;
+extern bool  C_NmQuickHeaders;
 extern char *C_NmQueryType;
 extern int   C_NmQueryWindowCurrentPosition;
 extern char *C_NmQueryWindowTimebase;
@@ -69,6 +71,7 @@ enum MailboxType nm_path_probe   (const char *path, const struct stat *st);
 void  nm_query_window_backward   (void);
 void  nm_query_window_forward    (void);
 int   nm_read_entire_thread      (struct Mailbox *m, struct Email *e);
+int   nm_read_remaining          (struct Mailbox *m);
 int   nm_record_message          (struct Mailbox *m, char *path, struct Email *e);
 int   nm_update_filename         (struct Mailbox *m, const char *old_file, const char *new_file, struct Email *e);
 char *nm_uri_from_query          (struct Mailbox *m, char *buf, size_t buflen);
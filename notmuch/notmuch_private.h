@@ -76,9 +76,12 @@ struct NmMboxData
   struct Progress progress; ///< A progress bar
   int oldmsgcount;
   int ignmsgcount; ///< Ignored messages
+  int page_done;   ///< Number of query results read so far ($nm_page_size)
+  struct Hash *parents; ///< Parent ids by message id, see get_parent_id()
 
   bool noprogress : 1;     ///< Don't show the progress bar
   bool progress_ready : 1; ///< A progress bar has been initialised
+  bool page_more : 1;      ///< The query has results that haven't been read
 };
 
 /**
@@ -90,6 +93,7 @@ struct NmEmailData
   char *oldpath;
   char *virtual_id;       ///< Unique Notmuch Id
   enum MailboxType magic; ///< Type of Mailbox the Email is in
+  bool partial;           ///< Envelope only holds the headers from the database
 };
 
 notmuch_database_t *nm_db_do_open     (const char *filename, bool writable, bool verbose);
@@ -44,6 +44,7 @@ WHERE bool OptNews;                ///< (pseudo) used to change reader mode
 WHERE bool OptNewsSend;            ///< (pseudo) used to change behavior when posting
 #endif
 WHERE bool OptNoCurses;            ///< (pseudo) when sending in batch mode
+WHERE bool OptPartialFetch;        ///< (pseudo) message is only being displayed, attachments may be left out
 WHERE bool OptPgpCheckTrust;       ///< (pseudo) used by pgp_select_key()
 WHERE bool OptRedrawTree;          ///< (pseudo) redraw the thread tree
 WHERE bool OptResortInit;          ///< (pseudo) used to force the next resort to be from scratch
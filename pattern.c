@@ -33,6 +33,7 @@
 #include <regex.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -59,15 +60,28 @@
 #include "options.h"
 #include "progress.h"
 #include "protos.h"
+#include "range_index.h"
 #include "state.h"
 #ifndef USE_FMEMOPEN
 #include <sys/stat.h>
 #endif
+#ifdef HAVE_PTHREAD_CREATE
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+#ifdef USE_HCACHE
+#include "search_index.h"
+#endif
 #ifdef USE_IMAP
 #include "imap/imap.h"
 #endif
+#ifdef USE_NOTMUCH
+#include "notmuch/mutt_notmuch.h"
+#endif
 
 /* These Config Variables are only used in pattern.c */
+short C_SearchThreads; ///< Config: Number of threads for searching local messages
 bool C_ThoroughSearch; ///< Config: Decode headers and messages before searching them
 
 // clang-format off
@@ -94,6 +108,32 @@ bool C_ThoroughSearch; ///< Config: Decode headers and messages before searching
 
 #define MUTT_MAXRANGE -1
 
+/**
+ * struct MemoResult - A remembered result of a Pattern
+ */
+struct MemoResult
+{
+  uint32_t key; ///< Pattern::memo_id and the #MUTT_MATCH_FULL_ADDRESS flag
+  int rc;       ///< Result of mutt_pattern_exec()
+};
+
+/**
+ * struct PatternMemo - The remembered Pattern results of an Email
+ *
+ * The results are valid while the config and the Email don't change.
+ * This is a single allocation, so email_free() can free it.
+ */
+struct PatternMemo
+{
+  unsigned int version;          ///< PatternMemoVersion when the results were stored
+  uint32_t flags;                ///< Email's flags, see memo_flags()
+  const struct Envelope *env;    ///< Email's Envelope
+  const struct Body *content;    ///< Email's Body
+  int num;                       ///< Number of results
+  int max;                       ///< Number of results allocated
+  struct MemoResult results[];   ///< Results of Patterns
+};
+
 typedef uint16_t ParseDateRangeFlags; ///< Flags for parse_date_range(), e.g. #MUTT_PDR_MINUS
 #define MUTT_PDR_NO_FLAGS       0  ///< No flags are set
 #define MUTT_PDR_MINUS    (1 << 0) ///< Pattern contains a range
@@ -179,6 +219,55 @@ struct PatternFlags
   pattern_eat_t *eat_arg; ///< Callback function to parse the argument
 };
 
+/**
+ * enum PatternInsnOp - Operations of a compiled Pattern program
+ */
+enum PatternInsnOp
+{
+  PI_MATCH = 1, ///< Evaluate a (non-logical) Pattern, result = the match
+  PI_JUMP_FALSE, ///< Short-circuit an AND: jump if the result is false
+  PI_JUMP_TRUE,  ///< Short-circuit an OR: jump if the result is true
+  PI_BOOL,       ///< Turn the result into a boolean
+  PI_NOT,        ///< Turn the result into a boolean, inverting it
+};
+
+/**
+ * struct PatternInsn - One instruction of a compiled Pattern program
+ */
+struct PatternInsn
+{
+  enum PatternInsnOp op; ///< Operation, e.g. #PI_MATCH
+  struct Pattern *pat;   ///< Pattern to evaluate (#PI_MATCH)
+  int target;            ///< Instruction to jump to (#PI_JUMP_FALSE, #PI_JUMP_TRUE)
+};
+
+/**
+ * struct PatternProgram - A logical Pattern flattened into a list of instructions
+ *
+ * The AND/OR tree is replaced by a loop over the instructions, using jumps to
+ * short-circuit the evaluation.  Within each AND or OR, the cheap tests are
+ * moved ahead of the expensive ones.
+ */
+struct PatternProgram
+{
+  struct PatternInsn *insns; ///< Instructions
+  int len;                   ///< Number of instructions
+  int size;                  ///< Allocated size of insns
+};
+
+/**
+ * enum PatternCost - Rough cost of evaluating a Pattern
+ */
+enum PatternCost
+{
+  PAT_COST_FLAG = 0, ///< Test a flag or number in the Email
+  PAT_COST_HEADER,   ///< Match a string in the Envelope
+  PAT_COST_ADDRESS,  ///< Match a list of Addresses
+  PAT_COST_THREAD,   ///< Walk the thread
+  PAT_COST_MESSAGE,  ///< Open and read the message
+  PAT_COST_FIXED,    ///< Has side effects, don't reorder
+};
+
 // clang-format off
 /**
  * range_regexes - Set of Regexes for various range types
@@ -194,7 +283,11 @@ static struct RangeRegex range_regexes[] = {
 };
 // clang-format on
 
+static unsigned int PatternMemoVersion = 0; ///< Incremented when the config changes
+static unsigned int PatternMemoNextId = 0;  ///< Last memo id given to a Pattern
+
 static struct PatternList *SearchPattern = NULL; ///< current search pattern
+static int SearchServer = 0; ///< Result of the server-side search for SearchPattern
 static char LastSearch[256] = { 0 };             ///< last pattern searched for
 static char LastSearchExpn[1024] = { 0 }; ///< expanded version of LastSearch
 
@@ -205,6 +298,178 @@ static char LastSearchExpn[1024] = { 0 }; ///< expanded version of LastSearch
  */
 typedef bool (*addr_predicate_t)(const struct Address *a);
 
+/**
+ * skip_interval - Find the end of a regex interval, e.g. {2,5}
+ * @param p Regex, positioned at the '{'
+ * @retval ptr  Closing '}'
+ * @retval NULL Not an interval
+ */
+static const char *skip_interval(const char *p)
+{
+  const char *q = p + 1;
+  while (isdigit((unsigned char) *q) || (*q == ','))
+    q++;
+  if ((*q != '}') || (q == (p + 1)))
+    return NULL;
+  return q;
+}
+
+/**
+ * skip_bracket - Find the end of a regex bracket expression, e.g. [^]a-z]
+ * @param p Regex, positioned at the '['
+ * @retval ptr Closing ']', or the last character of the regex
+ */
+static const char *skip_bracket(const char *p)
+{
+  const char *q = p + 1;
+  if (*q == '^')
+    q++;
+  if (*q == ']')
+    q++;
+  while (*q && (*q != ']'))
+  {
+    /* Character classes, e.g. [:alpha:], may contain a ']' */
+    if ((q[0] == '[') && ((q[1] == ':') || (q[1] == '.') || (q[1] == '=')))
+    {
+      const char end[3] = { q[1], ']', '\0' };
+      const char *e = strstr(q + 2, end);
+      if (!e)
+        break;
+      q = e + 2;
+      continue;
+    }
+    q++;
+  }
+  if (*q == '\0')
+    q--;
+  return q;
+}
+
+/**
+ * regex_required - Find the text that every match of a regex must contain
+ * @param pat Pattern to update
+ * @param rx  Extended regex, as entered
+ *
+ * The longest run of ordinary characters, outside of groups and alternations,
+ * is saved in Pattern.required.  It's searched for before calling regexec(),
+ * which is much slower.  If the regex is nothing but plain text, with an
+ * optional leading '^', then finding the text is a match.
+ *
+ * When ignoring case, non-ASCII characters end a run; strcasestr() can't fold
+ * them the way regexec() does.
+ */
+static void regex_required(struct Pattern *pat, const char *rx)
+{
+  const size_t len = mutt_str_strlen(rx);
+  char *cur = mutt_mem_malloc(len + 1);
+  char *best = mutt_mem_malloc(len + 1);
+  size_t clen = 0; /* length of the current run */
+  size_t blen = 0; /* length of the best run */
+  size_t atom = 0; /* start of the last character of the current run */
+  int depth = 0;
+  bool exact = true;
+  bool bol = false;
+
+  const char *p = rx;
+  if (*p == '^')
+  {
+    bol = true;
+    p++;
+  }
+
+  for (; *p; p++)
+  {
+    unsigned char c = *p;
+    bool ordinary = false;
+
+    if (c == '\\')
+    {
+      /* \w, \<, \1, etc are special, other escapes are plain characters */
+      if ((p[1] == '\0') || isalnum((unsigned char) p[1]) || strchr("<>`'", p[1]))
+      {
+        if (p[1] != '\0')
+          p++;
+      }
+      else
+      {
+        p++;
+        c = *p;
+        ordinary = true;
+      }
+    }
+    else if (c == '|')
+    {
+      if (depth == 0)
+      {
+        /* A top-level alternation means no text is required */
+        blen = 0;
+        clen = 0;
+        exact = false;
+        break;
+      }
+    }
+    else if (c == '(')
+      depth++;
+    else if (c == ')')
+    {
+      if (depth > 0)
+        depth--;
+    }
+    else if (c == '[')
+      p = skip_bracket(p);
+    else if ((c == '*') || (c == '+') || (c == '?') || (c == '{'))
+    {
+      /* The quantified character may be optional, e.g. "a+?" */
+      clen = atom;
+      if (c == '{')
+      {
+        const char *end = skip_interval(p);
+        if (end)
+          p = end;
+      }
+    }
+    else if ((c != '.') && (c != '^') && (c != '$') && (c != ']') && (c != '}'))
+      ordinary = true;
+
+    if (ordinary && (depth == 0) && !(pat->ign_case && (c >= 0x80)))
+    {
+      /* Multibyte characters are a single atom */
+      if ((c & 0xC0) != 0x80)
+        atom = clen;
+      cur[clen++] = c;
+      continue;
+    }
+
+    exact = false;
+
+    if (clen > blen)
+    {
+      memcpy(best, cur, clen);
+      blen = clen;
+    }
+    clen = 0;
+    atom = 0;
+  }
+
+  if (clen > blen)
+  {
+    memcpy(best, cur, clen);
+    blen = clen;
+  }
+  FREE(&cur);
+
+  if (blen == 0)
+  {
+    FREE(&best);
+    return;
+  }
+
+  best[blen] = '\0';
+  pat->required = best;
+  pat->required_only = exact;
+  pat->required_bol = exact && bol;
+}
+
 /**
  * eat_regex - Parse a regex - Implements ::pattern_eat_t
  */
@@ -252,7 +517,9 @@ static bool eat_regex(struct Pattern *pat, int flags, struct Buffer *s, struct B
       FREE(&pat->p.regex);
       return false;
     }
-    FREE(&buf.data);
+    pat->ign_case = (case_flags != 0);
+    regex_required(pat, buf.data);
+    pat->source = buf.data;
   }
 
   return true;
@@ -1066,6 +1333,31 @@ out:
   return rc;
 }
 
+/**
+ * match_bol - Does a line of a string start with a Pattern's text?
+ * @param pat Pattern to use, a regex like "^text"
+ * @param buf String to compare
+ * @retval true  Match
+ * @retval false No match
+ */
+static bool match_bol(const struct Pattern *pat, const char *buf)
+{
+  const size_t len = mutt_str_strlen(pat->required);
+
+  /* The regex is compiled with REG_NEWLINE, so '^' matches after a newline */
+  for (const char *p = buf; p; p = strchr(p, '\n'))
+  {
+    if (*p == '\n')
+      p++;
+    if ((pat->ign_case ? strncasecmp(p, pat->required, len) :
+                         strncmp(p, pat->required, len)) == 0)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
 /**
  * patmatch - Compare a string to a Pattern
  * @param pat Pattern to use
@@ -1081,9 +1373,197 @@ static bool patmatch(const struct Pattern *pat, const char *buf)
     return pat->ign_case ? strcasestr(buf, pat->p.str) : strstr(buf, pat->p.str);
   if (pat->group_match)
     return mutt_group_match(pat->p.group, buf);
+  if (pat->required_bol)
+    return match_bol(pat, buf);
+  if (pat->required)
+  {
+    /* Rule out most strings without calling the (slow) regexec() */
+    if (!(pat->ign_case ? strcasestr(buf, pat->required) : strstr(buf, pat->required)))
+      return false;
+    if (pat->required_only)
+      return true;
+  }
   return (regexec(pat->p.regex, buf, 0, NULL, 0) == 0);
 }
 
+/**
+ * scan_stream - Search a stream, line by line, for a Pattern
+ * @param pat Pattern to find, e.g. ~b
+ * @param fp  Stream, positioned at the start of the text
+ * @param lng Number of bytes to search
+ * @retval true The Pattern matched a line
+ */
+static bool scan_stream(const struct Pattern *pat, FILE *fp, long lng)
+{
+  bool match = false;
+  size_t blen = 256;
+  char *buf = mutt_mem_malloc(blen);
+
+  /* search the file "fp" */
+  while (lng > 0)
+  {
+    if (pat->op == MUTT_PAT_HEADER)
+    {
+      buf = mutt_rfc822_read_line(fp, buf, &blen);
+      if (*buf == '\0')
+        break;
+    }
+    else if (!fgets(buf, blen - 1, fp))
+      break; /* don't loop forever */
+    if (patmatch(pat, buf))
+    {
+      match = true;
+      break;
+    }
+    lng -= mutt_str_strlen(buf);
+  }
+
+  FREE(&buf);
+  return match;
+}
+
+#ifdef USE_HCACHE
+/**
+ * struct SearchFilter - Candidates for ~b, ~B and ~h from the search index
+ */
+struct SearchFilter
+{
+  struct Mailbox *m;     ///< Mailbox being searched
+  struct Pattern **pats; ///< Patterns with plain text to look up
+  bool **cands;          ///< Candidates for each Pattern, by msgno, or NULL for all
+  int num_pats;          ///< Number of Patterns
+  int msg_count;         ///< Number of Emails when the filter was made
+  unsigned int gen;      ///< Mailbox::gen when the filter was made
+};
+
+static struct SearchFilter *SearchFilterCur = NULL; ///< Filter for mutt_pattern_func()
+static struct SearchFilter *SearchPatternFilter = NULL; ///< Filter for SearchPattern
+
+/**
+ * search_filter_collect - Find the Patterns that can be looked up in the index
+ * @param pat Pattern tree
+ * @param sf  Search filter to add them to
+ */
+static void search_filter_collect(struct PatternList *pat, struct SearchFilter *sf)
+{
+  struct Pattern *np = NULL;
+  SLIST_FOREACH(np, pat, entries)
+  {
+    if (((np->op == MUTT_PAT_BODY) || (np->op == MUTT_PAT_HEADER) ||
+         (np->op == MUTT_PAT_WHOLE_MSG)) &&
+        ((np->string_match && np->p.str) || np->required))
+    {
+      mutt_mem_realloc(&sf->pats, (sf->num_pats + 1) * sizeof(struct Pattern *));
+      sf->pats[sf->num_pats++] = np;
+    }
+    if (np->child)
+      search_filter_collect(np->child, sf);
+  }
+}
+
+/**
+ * search_filter_free - Free a search filter
+ * @param[out] ptr Search filter
+ */
+static void search_filter_free(struct SearchFilter **ptr)
+{
+  if (!ptr || !*ptr)
+    return;
+
+  struct SearchFilter *sf = *ptr;
+  for (int i = 0; i < sf->num_pats; i++)
+    FREE(&sf->cands[i]);
+  FREE(&sf->cands);
+  FREE(&sf->pats);
+  FREE(ptr);
+}
+
+/**
+ * search_filter_new - Look up the plain text of a Pattern in the search index
+ * @param m   Mailbox
+ * @param pat Pattern to be executed
+ * @retval ptr  Search filter
+ * @retval NULL The index can't help
+ */
+static struct SearchFilter *search_filter_new(struct Mailbox *m, struct PatternList *pat)
+{
+  if (!C_SearchIndex || !m || !pat)
+    return NULL;
+
+  struct SearchFilter *sf = mutt_mem_calloc(1, sizeof(struct SearchFilter));
+  search_filter_collect(pat, sf);
+  if (sf->num_pats == 0)
+  {
+    search_filter_free(&sf);
+    return NULL;
+  }
+
+  struct SearchIndex *si = mutt_search_index_open(m);
+  if (!si)
+  {
+    search_filter_free(&sf);
+    return NULL;
+  }
+
+  sf->m = m;
+  sf->msg_count = m->msg_count;
+  sf->gen = m->gen;
+  sf->cands = mutt_mem_calloc(sf->num_pats, sizeof(bool *));
+  for (int i = 0; i < sf->num_pats; i++)
+  {
+    struct Pattern *np = sf->pats[i];
+    if (np->string_match)
+      sf->cands[i] = mutt_search_index_lookup(si, np->p.str, np->ign_case);
+    else
+      sf->cands[i] = mutt_search_index_lookup(si, np->required, np->ign_case);
+  }
+  mutt_search_index_close(&si);
+
+  return sf;
+}
+
+/**
+ * search_filter_is_stale - Do the candidates still fit the Mailbox?
+ * @param sf Search filter
+ * @param m  Mailbox
+ * @retval true The Emails have changed or been renumbered since
+ *
+ * The candidates are kept by msgno, so a sort or new mail makes them useless.
+ */
+static bool search_filter_is_stale(const struct SearchFilter *sf, const struct Mailbox *m)
+{
+  return (sf->m != m) || (sf->msg_count != m->msg_count) || (sf->gen != m->gen);
+}
+
+/**
+ * search_filter_excludes - Does the search index rule out an Email?
+ * @param m     Mailbox
+ * @param pat   Pattern, e.g. ~b
+ * @param msgno Index of the Email
+ * @retval true The Email can't match the Pattern
+ *
+ * Changing flags during mutt_pattern_func() bumps Mailbox::gen, so staleness
+ * is checked when a filter is made or reused, see mutt_search_command().
+ */
+static bool search_filter_excludes(struct Mailbox *m, const struct Pattern *pat, int msgno)
+{
+  struct SearchFilter *filters[] = { SearchFilterCur, SearchPatternFilter };
+
+  for (size_t f = 0; f < mutt_array_size(filters); f++)
+  {
+    struct SearchFilter *sf = filters[f];
+    if (!sf || (sf->m != m) || (sf->msg_count != m->msg_count))
+      continue;
+    for (int i = 0; i < sf->num_pats; i++)
+    {
+      if (sf->pats[i] == pat)
+        return sf->cands[i] && !sf->cands[i][msgno];
+    }
+  }
+  return false;
+}
+#endif
+
 /**
  * msg_search - Search an email
  * @param m   Mailbox
@@ -1095,6 +1575,10 @@ static bool patmatch(const struct Pattern *pat, const char *buf)
 static bool msg_search(struct Mailbox *m, struct Pattern *pat, int msgno)
 {
   bool match = false;
+#ifdef USE_HCACHE
+  if (search_filter_excludes(m, pat, msgno))
+    return match;
+#endif
   struct Message *msg = mx_msg_open(m, msgno);
   if (!msg)
   {
@@ -1205,44 +1689,390 @@ static bool msg_search(struct Mailbox *m, struct Pattern *pat, int msgno)
     }
   }
 
-  size_t blen = 256;
-  char *buf = mutt_mem_malloc(blen);
+  match = scan_stream(pat, fp, lng);
 
-  /* search the file "fp" */
-  while (lng > 0)
+  mx_msg_close(m, &msg);
+
+  if (C_ThoroughSearch)
   {
-    if (pat->op == MUTT_PAT_HEADER)
+    mutt_file_fclose(&fp);
+#ifdef USE_FMEMOPEN
+    if (tempsize)
+      FREE(&temp);
+#endif
+  }
+
+  return match;
+}
+
+#ifdef HAVE_PTHREAD_CREATE
+/**
+ * struct SearchTask - One message to be searched by the SearchPool
+ */
+struct SearchTask
+{
+  char *path;    ///< File containing the message
+  LOFF_T offset; ///< Start of the message's header
+  long hdr_len;  ///< Length of the header
+  long body_len; ///< Length of the body
+  int msgno;     ///< Index of the Email
+  bool done;     ///< The task has been finished
+};
+
+/**
+ * struct SearchPool - Search local messages for ~b, ~B and ~h in parallel
+ *
+ * The worker threads take the tasks in message order.  When $thorough_search
+ * is unset, they match the raw text themselves.  Otherwise, decoding the
+ * message isn't thread-safe, so they just read the files ahead of
+ * msg_search().
+ */
+struct SearchPool
+{
+  struct Mailbox *m;          ///< Mailbox being searched
+  struct Pattern **pats;      ///< Body and header Patterns
+  int num_pats;               ///< Number of Patterns
+  uint8_t *matches;           ///< Results, [pattern][msgno]: 0 unknown, 1 false, 2 true
+  int msg_count;              ///< Number of Emails when the search began
+  int *task_of_msg;           ///< Index of the task for each msgno, or -1
+  struct SearchTask *tasks;   ///< Messages to search
+  int num_tasks;              ///< Number of tasks
+  int next;                   ///< Next task for a worker to take
+  bool prefetch;              ///< Only read the files, don't match them
+  bool cancel;                ///< Stop the workers
+  pthread_mutex_t lock;       ///< Protects next, cancel and SearchTask::done
+  pthread_cond_t cond;        ///< Signalled when a task is done
+  pthread_t *threads;         ///< Worker threads
+  int num_threads;            ///< Number of worker threads
+};
+
+static struct SearchPool *SearchPoolCur = NULL; ///< Parallel search in progress
+
+/**
+ * search_task_run - Search one message
+ * @param pool Search pool
+ * @param t    Index of the task
+ *
+ * This runs in a worker thread, so it mustn't touch the Mailbox or Email.
+ */
+static void search_task_run(struct SearchPool *pool, int t)
+{
+  struct SearchTask *task = &pool->tasks[t];
+
+  FILE *fp = fopen(task->path, "r");
+  if (!fp)
+    return; /* The result stays unknown, msg_search() will deal with it */
+
+  if (pool->prefetch)
+  {
+    /* Pull the message into the page cache */
+    char buf[8192];
+    long lng = task->hdr_len + task->body_len;
+    fseeko(fp, task->offset, SEEK_SET);
+    while ((lng > 0) && fread(buf, 1, sizeof(buf), fp) > 0)
+      lng -= sizeof(buf);
+    fclose(fp);
+    return;
+  }
+
+  int msgno = task->msgno;
+  for (int i = 0; i < pool->num_pats; i++)
+  {
+    const struct Pattern *pat = pool->pats[i];
+    uint8_t *result = &pool->matches[(i * pool->msg_count) + msgno];
+    if (*result != 0)
+      continue;
+
+    LOFF_T start = task->offset;
+    long lng = 0;
+    if (pat->op != MUTT_PAT_BODY)
+      lng = task->hdr_len;
+    else
+      start += task->hdr_len;
+    if (pat->op != MUTT_PAT_HEADER)
+      lng += task->body_len;
+
+    fseeko(fp, start, SEEK_SET);
+    *result = scan_stream(pat, fp, lng) ? 2 : 1;
+  }
+
+  fclose(fp);
+}
+
+/**
+ * search_worker - Take tasks from the SearchPool until there are none left
+ * @param arg Search pool
+ * @retval NULL Always
+ */
+static void *search_worker(void *arg)
+{
+  struct SearchPool *pool = arg;
+
+  while (true)
+  {
+    pthread_mutex_lock(&pool->lock);
+    if (pool->cancel || (pool->next >= pool->num_tasks))
     {
-      buf = mutt_rfc822_read_line(fp, buf, &blen);
-      if (*buf == '\0')
-        break;
+      pthread_mutex_unlock(&pool->lock);
+      break;
     }
-    else if (!fgets(buf, blen - 1, fp))
-      break; /* don't loop forever */
-    if (patmatch(pat, buf))
+    int t = pool->next++;
+    pthread_mutex_unlock(&pool->lock);
+
+    search_task_run(pool, t);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->tasks[t].done = true;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+  }
+
+  return NULL;
+}
+
+/**
+ * search_pool_collect - Find the body and header Patterns in a tree
+ * @param[in]  pat    Patterns
+ * @param[in]  pool   Search pool to add them to
+ * @param[out] simple Cleared if the tree makes the candidate filter unreliable
+ */
+static void search_pool_collect(struct PatternList *pat, struct SearchPool *pool, bool *simple)
+{
+  struct Pattern *np = NULL;
+  SLIST_FOREACH(np, pat, entries)
+  {
+    switch (np->op)
     {
-      match = true;
-      break;
+      case MUTT_PAT_BODY:
+      case MUTT_PAT_HEADER:
+      case MUTT_PAT_WHOLE_MSG:
+        mutt_mem_realloc(&pool->pats, (pool->num_pats + 1) * sizeof(struct Pattern *));
+        pool->pats[pool->num_pats++] = np;
+        break;
+      case MUTT_PAT_THREAD:
+      case MUTT_PAT_PARENT:
+      case MUTT_PAT_CHILDREN:
+      case MUTT_PAT_MIMEATTACH:
+      case MUTT_PAT_MIMETYPE:
+        *simple = false;
+        break;
     }
-    lng -= mutt_str_strlen(buf);
+    if (np->child)
+      search_pool_collect(np->child, pool, simple);
   }
+}
 
-  FREE(&buf);
+/**
+ * search_pool_needed - Does evaluating an Email need its body searched?
+ * @param pool Search pool
+ * @param pat  Pattern being executed
+ * @param e    Email
+ * @retval true The result depends on the body search
+ *
+ * The pattern is run twice, with the body search forced to match, then not
+ * to match.  This is only valid if there's a single body Pattern.
+ */
+static bool search_pool_needed(struct SearchPool *pool, struct PatternList *pat,
+                               struct Email *e)
+{
+  uint8_t *result = &pool->matches[e->msgno];
 
-  mx_msg_close(m, &msg);
+  *result = 2;
+  int match = mutt_pattern_exec(SLIST_FIRST(pat), MUTT_MATCH_FULL_ADDRESS,
+                                pool->m, e, NULL);
+  *result = 1;
+  int nomatch = mutt_pattern_exec(SLIST_FIRST(pat), MUTT_MATCH_FULL_ADDRESS,
+                                  pool->m, e, NULL);
+  *result = 0;
 
-  if (C_ThoroughSearch)
+  return (match > 0) != (nomatch > 0);
+}
+
+/**
+ * search_pool_stop - Stop a parallel search and free its resources
+ * @param[out] ptr Search pool
+ */
+static void search_pool_stop(struct SearchPool **ptr)
+{
+  if (!ptr || !*ptr)
+    return;
+
+  struct SearchPool *pool = *ptr;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->cancel = true;
+  pthread_cond_broadcast(&pool->cond);
+  pthread_mutex_unlock(&pool->lock);
+  for (int i = 0; i < pool->num_threads; i++)
+    pthread_join(pool->threads[i], NULL);
+
+  pthread_cond_destroy(&pool->cond);
+  pthread_mutex_destroy(&pool->lock);
+
+  if (SearchPoolCur == pool)
+    SearchPoolCur = NULL;
+
+  for (int i = 0; i < pool->num_tasks; i++)
+    FREE(&pool->tasks[i].path);
+  FREE(&pool->tasks);
+  FREE(&pool->task_of_msg);
+  FREE(&pool->matches);
+  FREE(&pool->pats);
+  FREE(&pool->threads);
+  FREE(ptr);
+}
+/**
+ * search_pool_start - Start searching the messages of a local Mailbox in parallel
+ * @param m     Mailbox
+ * @param pat   Pattern to be executed
+ * @param limit If true, search every Email, otherwise just the visible ones
+ * @param cands If not NULL, only these Emails, by msgno, can match
+ * @retval ptr  Search pool
+ * @retval NULL No parallel search is needed, or possible
+ */
+static struct SearchPool *search_pool_start(struct Mailbox *m, struct PatternList *pat,
+                                            bool limit, const bool *cands)
+{
+  if ((m->magic != MUTT_MAILDIR) && (m->magic != MUTT_MH) &&
+      (m->magic != MUTT_MBOX) && (m->magic != MUTT_MMDF))
   {
-    mutt_file_fclose(&fp);
-#ifdef USE_FMEMOPEN
-    if (tempsize)
-      FREE(&temp);
+    return NULL;
+  }
+
+  int num_threads = C_SearchThreads;
+  if (num_threads == 0)
+  {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    num_threads = (cpus > 0) ? MIN(cpus, 8) : 1;
+  }
+  if (num_threads < 2)
+    return NULL;
+
+  struct SearchPool *pool = mutt_mem_calloc(1, sizeof(struct SearchPool));
+  bool simple = true;
+  search_pool_collect(pat, pool, &simple);
+  if (pool->num_pats == 0)
+  {
+    FREE(&pool);
+    return NULL;
+  }
+
+  pool->m = m;
+  pool->msg_count = m->msg_count;
+  pool->prefetch = C_ThoroughSearch;
+  pool->matches = mutt_mem_calloc(pool->num_pats * m->msg_count, sizeof(uint8_t));
+  pool->task_of_msg = mutt_mem_malloc(m->msg_count * sizeof(int));
+  pool->tasks = mutt_mem_calloc(m->msg_count, sizeof(struct SearchTask));
+  for (int i = 0; i < m->msg_count; i++)
+    pool->task_of_msg[i] = -1;
+  simple = simple && (pool->num_pats == 1);
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->cond, NULL);
+
+  /* The filter runs the Pattern, which looks up the forced results */
+  SearchPoolCur = pool;
+
+  int count = limit ? m->msg_count : m->vcount;
+  for (int i = 0; i < count; i++)
+  {
+    struct Email *e = limit ? m->emails[i] : mutt_get_virt_email(m, i);
+    if (!e || !e->content)
+      continue;
+    /* Don't read the messages outside the pattern's ranges */
+    if (cands && !cands[e->msgno])
+      continue;
+    if (simple && !search_pool_needed(pool, pat, e))
+      continue;
+#ifdef USE_HCACHE
+    /* Don't read the messages that the search index has ruled out */
+    bool excluded = true;
+    for (int j = 0; excluded && (j < pool->num_pats); j++)
+      excluded = search_filter_excludes(m, pool->pats[j], e->msgno);
+    if (excluded)
+      continue;
 #endif
+
+    struct SearchTask *task = &pool->tasks[pool->num_tasks];
+    if ((m->magic == MUTT_MAILDIR) || (m->magic == MUTT_MH))
+      mutt_str_asprintf(&task->path, "%s/%s", mailbox_path(m), e->path);
+    else
+      task->path = mutt_str_strdup(mailbox_path(m));
+    task->offset = e->offset;
+    task->hdr_len = e->content->offset - e->offset;
+    task->body_len = e->content->length;
+    task->msgno = e->msgno;
+    pool->task_of_msg[e->msgno] = pool->num_tasks++;
   }
 
-  return match;
+  /* Not worth it: let msg_search() do the work */
+  if (pool->num_tasks < 2)
+  {
+    search_pool_stop(&pool);
+    return NULL;
+  }
+
+  num_threads = MIN(num_threads, pool->num_tasks);
+  pool->threads = mutt_mem_calloc(num_threads, sizeof(pthread_t));
+
+  /* Leave the signals to the main thread */
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  for (int i = 0; i < num_threads; i++)
+  {
+    if (pthread_create(&pool->threads[pool->num_threads], NULL, search_worker, pool) == 0)
+      pool->num_threads++;
+  }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  /* Without any workers, the tasks are never done; don't wait for them */
+  if (pool->num_threads == 0)
+    pool->cancel = true;
+
+  mutt_debug(LL_DEBUG1, "%d messages to search, using %d threads%s\n",
+             pool->num_tasks, pool->num_threads, pool->prefetch ? " (prefetch)" : "");
+  return pool;
 }
 
+/**
+ * search_pool_result - Get the result of a parallel search
+ * @param m     Mailbox
+ * @param pat   Body or header Pattern
+ * @param msgno Index of the Email
+ * @retval  1 The Pattern matched
+ * @retval  0 The Pattern didn't match
+ * @retval -1 Unknown, msg_search() must be used
+ *
+ * If the message is still being searched, wait for it.
+ */
+static int search_pool_result(struct Mailbox *m, struct Pattern *pat, int msgno)
+{
+  struct SearchPool *pool = SearchPoolCur;
+  if (!pool || (pool->m != m) || (msgno < 0) || (msgno >= pool->msg_count))
+    return -1;
+
+  int i = 0;
+  for (; i < pool->num_pats; i++)
+    if (pool->pats[i] == pat)
+      break;
+  if (i == pool->num_pats)
+    return -1;
+
+  uint8_t *result = &pool->matches[(i * pool->msg_count) + msgno];
+  int t = pool->task_of_msg[msgno];
+  if ((*result == 0) && (t >= 0) && !pool->prefetch)
+  {
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->tasks[t].done && !pool->cancel)
+      pthread_cond_wait(&pool->cond, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+  }
+
+  return (*result == 0) ? -1 : (*result == 2);
+}
+
+#endif
+
 // clang-format off
 /**
  * Flags - Lookup table for all patterns
@@ -1336,7 +2166,293 @@ static /* const */ char *find_matching_paren(/* const */ char *s)
         break;
     }
   }
-  return s;
+  return s;
+}
+
+/**
+ * pattern_cost - Estimate the cost of evaluating a Pattern
+ * @param pat Pattern
+ * @retval enum #PatternCost, e.g. #PAT_COST_FLAG
+ */
+static enum PatternCost pattern_cost(const struct Pattern *pat)
+{
+  switch (pat->op)
+  {
+    case MUTT_PAT_AND:
+    case MUTT_PAT_OR:
+    {
+      enum PatternCost cost = PAT_COST_FLAG;
+      const struct Pattern *np = NULL;
+      SLIST_FOREACH(np, pat->child, entries)
+      {
+        enum PatternCost c = pattern_cost(np);
+        if (c > cost)
+          cost = c;
+      }
+      return cost;
+    }
+    case MUTT_ALL:
+    case MUTT_EXPIRED:
+    case MUTT_SUPERSEDED:
+    case MUTT_FLAG:
+    case MUTT_TAG:
+    case MUTT_NEW:
+    case MUTT_UNREAD:
+    case MUTT_REPLIED:
+    case MUTT_OLD:
+    case MUTT_READ:
+    case MUTT_DELETED:
+    case MUTT_PAT_MESSAGE:
+    case MUTT_PAT_DATE:
+    case MUTT_PAT_DATE_RECEIVED:
+    case MUTT_PAT_SCORE:
+    case MUTT_PAT_SIZE:
+    case MUTT_PAT_COLLAPSED:
+    case MUTT_PAT_CRYPT_SIGN:
+    case MUTT_PAT_CRYPT_VERIFIED:
+    case MUTT_PAT_CRYPT_ENCRYPT:
+    case MUTT_PAT_PGP_KEY:
+    case MUTT_PAT_DUPLICATED:
+    case MUTT_PAT_UNREFERENCED:
+    case MUTT_PAT_BROKEN:
+      return PAT_COST_FLAG;
+    case MUTT_PAT_SUBJECT:
+    case MUTT_PAT_ID:
+    case MUTT_PAT_ID_EXTERNAL:
+    case MUTT_PAT_REFERENCE:
+    case MUTT_PAT_XLABEL:
+    case MUTT_PAT_DRIVER_TAGS:
+    case MUTT_PAT_HORMEL:
+#ifdef USE_NNTP
+    case MUTT_PAT_NEWSGROUPS:
+#endif
+      return PAT_COST_HEADER;
+    case MUTT_PAT_SENDER:
+    case MUTT_PAT_FROM:
+    case MUTT_PAT_TO:
+    case MUTT_PAT_CC:
+    case MUTT_PAT_ADDRESS:
+    case MUTT_PAT_RECIPIENT:
+    case MUTT_PAT_LIST:
+    case MUTT_PAT_SUBSCRIBED_LIST:
+    case MUTT_PAT_PERSONAL_RECIP:
+    case MUTT_PAT_PERSONAL_FROM:
+      return PAT_COST_ADDRESS;
+    case MUTT_PAT_THREAD:
+    case MUTT_PAT_PARENT:
+    case MUTT_PAT_CHILDREN:
+      return PAT_COST_THREAD;
+    case MUTT_PAT_BODY:
+    case MUTT_PAT_HEADER:
+    case MUTT_PAT_WHOLE_MSG:
+    case MUTT_PAT_MIMEATTACH:
+    case MUTT_PAT_MIMETYPE:
+      return PAT_COST_MESSAGE;
+  }
+
+  /* e.g. MUTT_PAT_SERVERSEARCH, which may print an error */
+  return PAT_COST_FIXED;
+}
+
+/**
+ * program_emit - Add an instruction to a Pattern program
+ * @param prog Program
+ * @param op   Operation, e.g. #PI_MATCH
+ * @param pat  Pattern to evaluate (OPTIONAL)
+ * @retval num Index of the new instruction
+ */
+static int program_emit(struct PatternProgram *prog, enum PatternInsnOp op,
+                        struct Pattern *pat)
+{
+  if (prog->len == prog->size)
+  {
+    prog->size = prog->size ? (prog->size * 2) : 8;
+    mutt_mem_realloc(&prog->insns, prog->size * sizeof(struct PatternInsn));
+  }
+
+  struct PatternInsn *insn = &prog->insns[prog->len];
+  insn->op = op;
+  insn->pat = pat;
+  insn->target = -1;
+  return prog->len++;
+}
+
+/**
+ * program_collect - Gather the operands of a logical Pattern
+ * @param[in]  pat   AND or OR Pattern
+ * @param[out] ops   Array for the operands, may be NULL to count them
+ * @param[in]  num   Number of operands already gathered
+ * @retval num Number of operands gathered
+ *
+ * An un-negated child of the same type, e.g. an AND within an AND, is merged
+ * into its parent.
+ */
+static int program_collect(const struct Pattern *pat, struct Pattern **ops, int num)
+{
+  struct Pattern *np = NULL;
+  SLIST_FOREACH(np, pat->child, entries)
+  {
+    if ((np->op == pat->op) && !np->pat_not)
+    {
+      num = program_collect(np, ops, num);
+      continue;
+    }
+
+    if (ops)
+      ops[num] = np;
+    num++;
+  }
+  return num;
+}
+
+/**
+ * program_compile - Compile a Pattern into a program
+ * @param prog Program to add to
+ * @param pat  Pattern to compile
+ *
+ * The operands of each AND or OR are evaluated cheapest first.  The sort is
+ * stable, so operands of equal cost keep the order the user gave them.
+ * Reordering doesn't change the result because the operands have no side
+ * effects.  If one does, the group is left alone.
+ */
+static void program_compile(struct PatternProgram *prog, struct Pattern *pat)
+{
+  if ((pat->op != MUTT_PAT_AND) && (pat->op != MUTT_PAT_OR))
+  {
+    program_emit(prog, PI_MATCH, pat);
+    return;
+  }
+
+  int num = program_collect(pat, NULL, 0);
+  struct Pattern **ops = mutt_mem_calloc(num, sizeof(struct Pattern *));
+  enum PatternCost *costs = mutt_mem_calloc(num, sizeof(enum PatternCost));
+  program_collect(pat, ops, 0);
+
+  bool fixed = false;
+  for (int i = 0; i < num; i++)
+  {
+    costs[i] = pattern_cost(ops[i]);
+    if (costs[i] == PAT_COST_FIXED)
+      fixed = true;
+  }
+
+  /* Insertion sort: the lists are short and it's stable */
+  for (int i = 1; !fixed && (i < num); i++)
+  {
+    struct Pattern *op = ops[i];
+    enum PatternCost cost = costs[i];
+    int j = i;
+    for (; (j > 0) && (costs[j - 1] > cost); j--)
+    {
+      ops[j] = ops[j - 1];
+      costs[j] = costs[j - 1];
+    }
+    ops[j] = op;
+    costs[j] = cost;
+  }
+
+  enum PatternInsnOp jump = (pat->op == MUTT_PAT_AND) ? PI_JUMP_FALSE : PI_JUMP_TRUE;
+  int *jumps = mutt_mem_calloc(num, sizeof(int));
+  for (int i = 0; i < num; i++)
+  {
+    program_compile(prog, ops[i]);
+    if (i < (num - 1))
+      jumps[i] = program_emit(prog, jump, NULL);
+  }
+
+  /* The short-circuit jumps land on the final conversion to a boolean */
+  int end = program_emit(prog, pat->pat_not ? PI_NOT : PI_BOOL, NULL);
+  for (int i = 0; i < (num - 1); i++)
+    prog->insns[jumps[i]].target = end;
+
+  FREE(&jumps);
+  FREE(&costs);
+  FREE(&ops);
+}
+
+/**
+ * program_free - Free a Pattern program
+ * @param[out] ptr Program to free
+ */
+static void program_free(struct PatternProgram **ptr)
+{
+  if (!ptr || !*ptr)
+    return;
+
+  FREE(&(*ptr)->insns);
+  FREE(ptr);
+}
+
+/**
+ * program_exec - Run a Pattern program
+ * @param prog  Program
+ * @param flags Flags, e.g. #MUTT_MATCH_FULL_ADDRESS
+ * @param m     Mailbox
+ * @param e     Email
+ * @param cache Cache for common Patterns
+ * @retval  1 Success, pattern matched
+ * @retval  0 Pattern did not match
+ */
+static int program_exec(const struct PatternProgram *prog, PatternExecFlags flags,
+                        struct Mailbox *m, struct Email *e, struct PatternCache *cache)
+{
+  int rc = 0;
+
+  for (int pc = 0; pc < prog->len;)
+  {
+    const struct PatternInsn *insn = &prog->insns[pc++];
+    switch (insn->op)
+    {
+      case PI_MATCH:
+        rc = mutt_pattern_exec(insn->pat, flags, m, e, cache);
+        break;
+      case PI_JUMP_FALSE:
+        if (rc <= 0)
+          pc = insn->target;
+        break;
+      case PI_JUMP_TRUE:
+        if (rc > 0)
+          pc = insn->target;
+        break;
+      case PI_BOOL:
+        rc = (rc > 0);
+        break;
+      case PI_NOT:
+        rc = (rc <= 0);
+        break;
+    }
+  }
+
+  return rc;
+}
+
+/**
+ * compile_programs - Compile the logical Patterns into programs
+ * @param pat  Patterns
+ * @param root True if pat is the top of a Pattern tree
+ *
+ * Only the top of each tree is compiled; any logical Patterns below it are
+ * flattened into its program.  The thread Patterns, e.g. ~(...), evaluate
+ * their own trees, so those are compiled separately.
+ */
+static void compile_programs(struct PatternList *pat, bool root)
+{
+  struct Pattern *np = SLIST_FIRST(pat);
+  if (root && np && ((np->op == MUTT_PAT_AND) || (np->op == MUTT_PAT_OR)))
+  {
+    np->prog = mutt_mem_calloc(1, sizeof(struct PatternProgram));
+    program_compile(np->prog, np);
+  }
+
+  SLIST_FOREACH(np, pat, entries)
+  {
+    if (!np->child)
+      continue;
+
+    bool thread = (np->op == MUTT_PAT_THREAD) || (np->op == MUTT_PAT_PARENT) ||
+                  (np->op == MUTT_PAT_CHILDREN);
+    compile_programs(np->child, thread);
+  }
 }
 
 /**
@@ -1366,6 +2482,9 @@ void mutt_pattern_free(struct PatternList **pat)
       FREE(&np->p.regex);
     }
 
+    FREE(&np->required);
+    FREE(&np->source);
+    program_free(&np->prog);
     mutt_pattern_free(&np->child);
     FREE(&np);
 
@@ -1389,13 +2508,14 @@ static struct PatternList *mutt_pattern_node_new(void)
 }
 
 /**
- * mutt_pattern_comp - Create a Pattern
+ * pattern_parse - Parse a Pattern string into a tree
  * @param s     Pattern string
  * @param flags Flags, e.g. #MUTT_PC_FULL_MSG
  * @param err   Buffer for error messages
  * @retval ptr Newly allocated Pattern
  */
-struct PatternList *mutt_pattern_comp(const char *s, PatternCompFlags flags, struct Buffer *err)
+static struct PatternList *pattern_parse(const char *s, PatternCompFlags flags,
+                                         struct Buffer *err)
 {
   /* curlist when assigned will always point to a list containing at least one node
    * with a Pattern value.  */
@@ -1509,7 +2629,7 @@ struct PatternList *mutt_pattern_comp(const char *s, PatternCompFlags flags, str
           is_alias = false;
           /* compile the sub-expression */
           buf = mutt_str_substr_dup(ps.dptr + 1, p);
-          tmp2 = mutt_pattern_comp(buf, flags, err);
+          tmp2 = pattern_parse(buf, flags, err);
           if (!tmp2)
           {
             FREE(&buf);
@@ -1594,7 +2714,7 @@ struct PatternList *mutt_pattern_comp(const char *s, PatternCompFlags flags, str
         }
         /* compile the sub-expression */
         buf = mutt_str_substr_dup(ps.dptr + 1, p);
-        tmp = mutt_pattern_comp(buf, flags, err);
+        tmp = pattern_parse(buf, flags, err);
         FREE(&buf);
         if (!tmp)
           goto cleanup;
@@ -1643,6 +2763,80 @@ cleanup:
   return NULL;
 }
 
+/**
+ * pattern_is_stable - Does a Pattern only depend on its Email?
+ * @param pat    Pattern
+ * @param config Config changes are being tracked
+ * @retval true The result only changes if the Email does
+ *
+ * Thread patterns depend on other Emails, and patterns such as ~l or ~n
+ * depend on the config, which can change without the Mailbox changing.
+ */
+static bool pattern_is_stable(const struct Pattern *pat, bool config)
+{
+  switch (pat->op)
+  {
+    case MUTT_PAT_THREAD:
+    case MUTT_PAT_PARENT:
+    case MUTT_PAT_CHILDREN:
+    case MUTT_PAT_COLLAPSED:
+    case MUTT_PAT_DUPLICATED:
+    case MUTT_PAT_UNREFERENCED:
+    case MUTT_PAT_BROKEN:
+    case MUTT_PAT_ID_EXTERNAL:
+    case MUTT_PAT_MESSAGE:
+    case MUTT_PAT_SERVERSEARCH:
+    case MUTT_EXPIRED:
+      return false;
+    case MUTT_PAT_SCORE:
+    case MUTT_PAT_LIST:
+    case MUTT_PAT_SUBSCRIBED_LIST:
+    case MUTT_PAT_PERSONAL_RECIP:
+    case MUTT_PAT_PERSONAL_FROM:
+      if (!config)
+        return false;
+      break;
+  }
+
+  if (pat->dynamic || pat->is_multi || pat->is_alias)
+    return false;
+  if (pat->group_match && !config)
+    return false;
+
+  const struct Pattern *np = NULL;
+  if (pat->child)
+  {
+    SLIST_FOREACH(np, pat->child, entries)
+    {
+      if (!pattern_is_stable(np, config))
+        return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * mutt_pattern_comp - Create a Pattern
+ * @param s     Pattern string
+ * @param flags Flags, e.g. #MUTT_PC_FULL_MSG
+ * @param err   Buffer for error messages
+ * @retval ptr Newly allocated Pattern
+ */
+struct PatternList *mutt_pattern_comp(const char *s, PatternCompFlags flags, struct Buffer *err)
+{
+  struct PatternList *pat = pattern_parse(s, flags, err);
+  if (!pat)
+    return NULL;
+
+  compile_programs(pat, true);
+
+  struct Pattern *first = SLIST_FIRST(pat);
+  if ((flags & MUTT_PC_MEMO) && pattern_is_stable(first, true))
+    first->memo_id = ++PatternMemoNextId;
+
+  return pat;
+}
+
 /**
  * perform_and - Perform a logical AND on a set of Patterns
  * @param pat   Patterns to test
@@ -1952,6 +3146,14 @@ static bool match_update_dynamic_date(struct Pattern *pat)
 static bool match_mime_content_type(const struct Pattern *pat,
                                     struct Mailbox *m, struct Email *e)
 {
+#ifdef USE_IMAP
+  if (!e->content->parts && (m->magic == MUTT_IMAP))
+  {
+    struct Body *b = imap_body_structure(m, e);
+    if (b)
+      return match_content_type(pat, b);
+  }
+#endif
   mutt_parse_mime_message(m, e);
   return match_content_type(pat, e->content);
 }
@@ -1990,23 +3192,24 @@ static int is_pattern_cache_set(int cache_entry)
 }
 
 /**
- * mutt_pattern_exec - Match a pattern against an email header
+ * pattern_exec - Match a pattern against an email header
  * @param pat   Pattern to match
  * @param flags Flags, e.g. #MUTT_MATCH_FULL_ADDRESS
- * @param m   Mailbox
+ * @param m     Mailbox
  * @param e     Email
  * @param cache Cache for common Patterns
  * @retval  1 Success, pattern matched
  * @retval  0 Pattern did not match
  * @retval -1 Error
  *
- * flags: MUTT_MATCH_FULL_ADDRESS - match both personal and machine address
- * cache: For repeated matches against the same Header, passing in non-NULL will
- *        store some of the cacheable pattern matches in this structure.
+ * @sa mutt_pattern_exec()
  */
-int mutt_pattern_exec(struct Pattern *pat, PatternExecFlags flags,
-                      struct Mailbox *m, struct Email *e, struct PatternCache *cache)
+static int pattern_exec(struct Pattern *pat, PatternExecFlags flags,
+                        struct Mailbox *m, struct Email *e, struct PatternCache *cache)
 {
+  if (pat->prog)
+    return program_exec(pat->prog, flags, m, e, cache);
+
   switch (pat->op)
   {
     case MUTT_PAT_AND:
@@ -2061,9 +3264,16 @@ int mutt_pattern_exec(struct Pattern *pat, PatternExecFlags flags,
       if (!m)
         return 0;
 #ifdef USE_IMAP
-      /* IMAP search sets e->matched at search compile time */
-      if ((m->magic == MUTT_IMAP) && pat->string_match)
-        return e->matched;
+      /* The IMAP server has already checked this for the search candidates */
+      if ((m->magic == MUTT_IMAP) && pat->server_match && e->matched)
+        return 1;
+#endif
+#ifdef HAVE_PTHREAD_CREATE
+    {
+      int rc = search_pool_result(m, pat, e->msgno);
+      if (rc >= 0)
+        return pat->pat_not ^ rc;
+    }
 #endif
       return pat->pat_not ^ msg_search(m, pat, e->msgno);
     case MUTT_PAT_SERVERSEARCH:
@@ -2276,6 +3486,149 @@ int mutt_pattern_exec(struct Pattern *pat, PatternExecFlags flags,
   return -1;
 }
 
+/**
+ * memo_flags - Get the flags of an Email that Patterns can test
+ * @param e Email
+ * @retval num Flags, packed into a number
+ */
+static uint32_t memo_flags(const struct Email *e)
+{
+  return (uint32_t) e->flagged | ((uint32_t) e->tagged << 1) |
+         ((uint32_t) e->deleted << 2) | ((uint32_t) e->purge << 3) |
+         ((uint32_t) e->quasi_deleted << 4) | ((uint32_t) e->changed << 5) |
+         ((uint32_t) e->attach_del << 6) | ((uint32_t) e->old << 7) |
+         ((uint32_t) e->read << 8) | ((uint32_t) e->expired << 9) |
+         ((uint32_t) e->superseded << 10) | ((uint32_t) e->replied << 11) |
+         ((uint32_t) e->trash << 12) | ((uint32_t) e->security << 16);
+}
+
+/**
+ * memo_check - Forget an Email's Pattern results if they're out of date
+ * @param e Email
+ * @retval ptr  Email's memo
+ * @retval NULL The Email has no memo
+ */
+static struct PatternMemo *memo_check(struct Email *e)
+{
+  struct PatternMemo *memo = e->memo;
+  if (!memo)
+    return NULL;
+
+  const uint32_t flags = memo_flags(e);
+  if ((memo->version != PatternMemoVersion) || (memo->flags != flags) ||
+      (memo->env != e->env) || (memo->content != e->content))
+  {
+    memo->version = PatternMemoVersion;
+    memo->flags = flags;
+    memo->env = e->env;
+    memo->content = e->content;
+    memo->num = 0;
+  }
+
+  return memo;
+}
+
+/**
+ * memo_exec - Match a pattern against an email, remembering the result
+ * @param pat   Pattern to match, with a Pattern::memo_id
+ * @param flags Flags, e.g. #MUTT_MATCH_FULL_ADDRESS
+ * @param m     Mailbox
+ * @param e     Email
+ * @param cache Cache for common Patterns
+ * @retval num Result of pattern_exec()
+ */
+static int memo_exec(struct Pattern *pat, PatternExecFlags flags,
+                     struct Mailbox *m, struct Email *e, struct PatternCache *cache)
+{
+  const uint32_t key = (pat->memo_id << 1) | ((flags & MUTT_MATCH_FULL_ADDRESS) ? 1 : 0);
+
+  struct PatternMemo *memo = memo_check(e);
+  for (int i = 0; memo && (i < memo->num); i++)
+  {
+    if (memo->results[i].key == key)
+      return memo->results[i].rc;
+  }
+
+  const int rc = pattern_exec(pat, flags, m, e, cache);
+
+  /* Matching may have changed the Email, e.g. by parsing its MIME parts */
+  memo = memo_check(e);
+  if (!memo || (memo->num == memo->max))
+  {
+    const int max = memo ? (memo->max * 2) : 8;
+    mutt_mem_realloc(&e->memo, sizeof(struct PatternMemo) + (max * sizeof(struct MemoResult)));
+    if (!memo)
+    {
+      e->memo->version = PatternMemoVersion;
+      e->memo->flags = memo_flags(e);
+      e->memo->env = e->env;
+      e->memo->content = e->content;
+      e->memo->num = 0;
+    }
+    memo = e->memo;
+    memo->max = max;
+  }
+
+  memo->results[memo->num].key = key;
+  memo->results[memo->num].rc = rc;
+  memo->num++;
+
+  return rc;
+}
+
+/**
+ * mutt_pattern_exec - Match a pattern against an email header
+ * @param pat   Pattern to match
+ * @param flags Flags, e.g. #MUTT_MATCH_FULL_ADDRESS
+ * @param m   Mailbox
+ * @param e     Email
+ * @param cache Cache for common Patterns
+ * @retval  1 Success, pattern matched
+ * @retval  0 Pattern did not match
+ * @retval -1 Error
+ *
+ * flags: MUTT_MATCH_FULL_ADDRESS - match both personal and machine address
+ * cache: For repeated matches against the same Header, passing in non-NULL will
+ *        store some of the cacheable pattern matches in this structure.
+ */
+int mutt_pattern_exec(struct Pattern *pat, PatternExecFlags flags,
+                      struct Mailbox *m, struct Email *e, struct PatternCache *cache)
+{
+  /* The results of the color and index-format-hook Patterns are remembered */
+  if (pat->memo_id && m && e)
+    return memo_exec(pat, flags, m, e, cache);
+
+  return pattern_exec(pat, flags, m, e, cache);
+}
+
+/**
+ * mutt_pattern_memo_clear - Forget the remembered Pattern results of an Email
+ * @param e Email
+ *
+ * Flag changes are noticed automatically, but changes to the Envelope's
+ * contents, the tags or the size aren't.
+ */
+void mutt_pattern_memo_clear(struct Email *e)
+{
+  if (e)
+    FREE(&e->memo);
+}
+
+/**
+ * mutt_pattern_memo_observer - Forget all the Pattern results when the config changes - Implements ::observer_t
+ */
+int mutt_pattern_memo_observer(struct NotifyCallback *nc)
+{
+  if (!nc)
+    return -1;
+
+  /* Commands, e.g. alternates, lists, score, change the results too */
+  if ((nc->event_type == NT_CONFIG) || (nc->event_type == NT_COMMAND))
+    PatternMemoVersion++;
+
+  return 0;
+}
+
 /**
  * quote_simple - Apply simple quoting to a string
  * @param str    String to quote
@@ -2417,6 +3770,221 @@ bool mutt_limit_current_thread(struct Email *e)
   return true;
 }
 
+/**
+ * search_exec - Match a Pattern, using the results of a server-side search
+ * @param pat    Pattern to match
+ * @param m      Mailbox
+ * @param e      Email
+ * @param server Result of the server-side search, e.g. #IMAP_SEARCH_EXACT
+ * @retval  1 Success, pattern matched
+ * @retval  0 Pattern did not match
+ * @retval -1 Error
+ */
+static int search_exec(struct PatternList *pat, struct Mailbox *m, struct Email *e, int server)
+{
+#ifdef USE_IMAP
+  if (server == IMAP_SEARCH_EXACT)
+    return e->matched;
+  /* The server doesn't know about unsynced flag changes */
+  if ((server == IMAP_SEARCH_CANDIDATES) && !e->matched && !e->changed)
+    return 0;
+#endif
+  return mutt_pattern_exec(SLIST_FIRST(pat), MUTT_MATCH_FULL_ADDRESS, m, e, NULL);
+}
+
+/**
+ * pattern_equal - Are two Patterns the same?
+ * @param a First Pattern
+ * @param b Second Pattern
+ * @retval true The Patterns are identical
+ */
+static bool pattern_equal(const struct Pattern *a, const struct Pattern *b)
+{
+  if ((a->op != b->op) || (a->pat_not != b->pat_not) ||
+      (a->all_addr != b->all_addr) || (a->string_match != b->string_match) ||
+      (a->group_match != b->group_match) || (a->ign_case != b->ign_case) ||
+      (a->is_alias != b->is_alias) || (a->dynamic != b->dynamic) ||
+      (a->is_multi != b->is_multi) || (a->min != b->min) || (a->max != b->max))
+  {
+    return false;
+  }
+
+  if (a->string_match && (mutt_str_strcmp(a->p.str, b->p.str) != 0))
+    return false;
+  if (mutt_str_strcmp(a->source, b->source) != 0)
+    return false;
+
+  if (!a->child || !b->child)
+    return (a->child == b->child);
+
+  const struct Pattern *na = SLIST_FIRST(a->child);
+  const struct Pattern *nb = SLIST_FIRST(b->child);
+  for (; na && nb; na = SLIST_NEXT(na, entries), nb = SLIST_NEXT(nb, entries))
+  {
+    if (!pattern_equal(na, nb))
+      return false;
+  }
+  return !na && !nb;
+}
+
+/**
+ * pattern_implies - Does one Pattern imply another?
+ * @param a Pattern
+ * @param b Pattern that may be implied
+ * @retval true Every Email matching @a a also matches @a b
+ *
+ * Besides identical Patterns, this spots narrowed ranges, e.g. ~d<1w implies
+ * ~d<1m, even if the two were compiled at different times.
+ */
+static bool pattern_implies(const struct Pattern *a, const struct Pattern *b)
+{
+  if ((a->op == b->op) && (a->pat_not == b->pat_not) && !a->dynamic &&
+      !b->dynamic && ((a->op == MUTT_PAT_DATE) ||
+                      (a->op == MUTT_PAT_DATE_RECEIVED) || (a->op == MUTT_PAT_SIZE)))
+  {
+    if (a->pat_not)
+      return (a->min <= b->min) && (a->max >= b->max);
+    return (a->min >= b->min) && (a->max <= b->max);
+  }
+
+  return pattern_equal(a, b);
+}
+
+/**
+ * pattern_conjuncts - Split a Pattern into the terms that must all match
+ * @param[in]  pat  Pattern
+ * @param[out] list Array of terms
+ * @param[out] num  Number of terms
+ */
+static void pattern_conjuncts(struct PatternList *pat, struct Pattern ***list, int *num)
+{
+  struct Pattern *np = NULL;
+  SLIST_FOREACH(np, pat, entries)
+  {
+    if ((np->op == MUTT_PAT_AND) && !np->pat_not)
+    {
+      pattern_conjuncts(np->child, list, num);
+      continue;
+    }
+    mutt_mem_realloc(list, (*num + 1) * sizeof(struct Pattern *));
+    (*list)[(*num)++] = np;
+  }
+}
+
+/**
+ * pattern_refines - Can a Pattern only match a subset of another's matches?
+ * @param pat Pattern
+ * @param old Previous Pattern
+ * @retval true Every Email matching @a pat also matches @a old
+ *
+ * This is true if @a pat is a conjunction, and each of the terms of @a old is
+ * implied by one of them, e.g. "~f foo ~d<1m" refines "~f foo".
+ */
+static bool pattern_refines(struct PatternList *pat, struct PatternList *old)
+{
+  if (!pat || !old)
+    return false;
+
+  struct Pattern **terms = NULL, **old_terms = NULL;
+  int num = 0, old_num = 0;
+  pattern_conjuncts(pat, &terms, &num);
+  pattern_conjuncts(old, &old_terms, &old_num);
+
+  bool refines = (old_num > 0);
+  for (int i = 0; refines && (i < old_num); i++)
+  {
+    refines = pattern_is_stable(old_terms[i], false);
+    bool implied = false;
+    for (int j = 0; refines && !implied && (j < num); j++)
+      implied = pattern_implies(terms[j], old_terms[i]);
+    refines = refines && implied;
+  }
+
+  FREE(&terms);
+  FREE(&old_terms);
+  return refines;
+}
+
+/**
+ * range_candidates - Find the Emails allowed by a Pattern's ranges
+ * @param ctx Context
+ * @param pat Pattern
+ * @retval ptr  Array, by msgno, of the Emails that can match
+ * @retval NULL The Pattern has no ranges that can be looked up
+ *
+ * The date, size and message number ranges that must all match are looked up
+ * in the range index, without testing every Email.
+ */
+static bool *range_candidates(struct Context *ctx, struct PatternList *pat)
+{
+  struct Mailbox *m = ctx->mailbox;
+  struct Pattern **terms = NULL;
+  int num = 0;
+  bool *cands = NULL;
+  bool *term_cands = NULL;
+
+  pattern_conjuncts(pat, &terms, &num);
+  for (int i = 0; i < num; i++)
+  {
+    struct Pattern *np = terms[i];
+    if (np->pat_not)
+      continue;
+
+    enum RangeIndexKey key;
+    if (np->op == MUTT_PAT_DATE)
+      key = RI_KEY_SENT;
+    else if (np->op == MUTT_PAT_DATE_RECEIVED)
+      key = RI_KEY_RECEIVED;
+    else if (np->op == MUTT_PAT_SIZE)
+      key = RI_KEY_SIZE;
+    else if (np->op == MUTT_PAT_MESSAGE)
+      key = RI_KEY_MAX;
+    else
+      continue;
+
+    struct RangeIndex *ri = NULL;
+    if (key != RI_KEY_MAX)
+    {
+      ri = mutt_range_index_get(ctx);
+      if (!ri)
+        continue;
+    }
+
+    if (!term_cands)
+      term_cands = mutt_mem_malloc(MAX(1, m->msg_count) * sizeof(bool));
+    memset(term_cands, 0, m->msg_count * sizeof(bool));
+
+    if (key == RI_KEY_MAX)
+    {
+      /* ~m is a range of EMSG() */
+      for (int j = MAX(np->min, 1) - 1; (j < np->max) && (j < m->msg_count); j++)
+        term_cands[j] = true;
+    }
+    else
+    {
+      if (np->dynamic)
+        match_update_dynamic_date(np);
+      int64_t max = np->max;
+      if ((key == RI_KEY_SIZE) && (np->max == MUTT_MAXRANGE))
+        max = INT64_MAX;
+      mutt_range_index_select(ri, key, np->min, max, term_cands, m->msg_count);
+    }
+
+    if (!cands)
+    {
+      cands = term_cands;
+      term_cands = NULL;
+      continue;
+    }
+    for (int j = 0; j < m->msg_count; j++)
+      cands[j] = cands[j] && term_cands[j];
+  }
+
+  FREE(&term_cands);
+  FREE(&terms);
+  return cands;
+}
+
 /**
  * mutt_pattern_func - Perform some Pattern matching
  * @param op     Operation to perform, e.g. #MUTT_LIMIT
@@ -2434,6 +4002,9 @@ int mutt_pattern_func(int op, char *prompt)
   struct Progress progress;
   struct Buffer *buf = mutt_buffer_pool_get();
   struct Mailbox *m = Context->mailbox;
+  bool *matches = NULL;
+  bool *cands = NULL;
+  unsigned int gen = 0;
 
   mutt_buffer_strcpy(buf, NONULL(Context->pattern));
   if (prompt || (op != MUTT_LIMIT))
@@ -2461,16 +4032,49 @@ int mutt_pattern_func(int op, char *prompt)
     goto bail;
   }
 
-#ifdef USE_IMAP
-  if ((m->magic == MUTT_IMAP) && (imap_search(m, pat) < 0))
+#ifdef USE_NOTMUCH
+  /* The pattern must see every message, not just the pages read so far */
+  if ((m->magic == MUTT_NOTMUCH) && (nm_read_remaining(m) != 0))
     goto bail;
 #endif
 
+  int server = 0;
+#ifdef USE_IMAP
+  if (m->magic == MUTT_IMAP)
+  {
+    server = imap_search(m, pat);
+    if (server < 0)
+      goto bail;
+  }
+#endif
+
+#ifdef USE_HCACHE
+  SearchFilterCur = search_filter_new(m, pat);
+#endif
+
   mutt_progress_init(&progress, _("Executing command on matching messages..."),
                      MUTT_PROGRESS_READ, (op == MUTT_LIMIT) ? m->msg_count : m->vcount);
 
+  cands = range_candidates(Context, pat);
+
+#ifdef HAVE_PTHREAD_CREATE
+  struct SearchPool *pool = search_pool_start(m, pat, (op == MUTT_LIMIT), cands);
+#endif
+
   if (op == MUTT_LIMIT)
   {
+    /* If the new limit narrows the old one, only its matches need testing */
+    const bool *prev = NULL;
+    if (Context->limit_matches && (Context->limit_gen == m->gen) &&
+        (Context->limit_count == m->msg_count) &&
+        pattern_refines(pat, Context->limit_pattern))
+    {
+      prev = Context->limit_matches;
+      mutt_debug(LL_DEBUG1, "refining the previous limit\n");
+    }
+
+    gen = m->gen;
+    matches = mutt_mem_calloc(MAX(1, m->msg_count), sizeof(bool));
     m->vcount = 0;
     Context->vsize = 0;
     Context->collapsed = false;
@@ -2488,8 +4092,9 @@ int mutt_pattern_func(int op, char *prompt)
       e->limited = false;
       e->collapsed = false;
       e->num_hidden = 0;
-      if (mutt_pattern_exec(SLIST_FIRST(pat), MUTT_MATCH_FULL_ADDRESS, m, e, NULL))
+      if ((!prev || prev[i]) && (!cands || cands[i]) && search_exec(pat, m, e, server))
       {
+        matches[i] = true;
         e->vnum = m->vcount;
         e->limited = true;
         m->v2r[m->vcount] = i;
@@ -2507,7 +4112,7 @@ int mutt_pattern_func(int op, char *prompt)
       if (!e)
         continue;
       mutt_progress_update(&progress, i, -1);
-      if (mutt_pattern_exec(SLIST_FIRST(pat), MUTT_MATCH_FULL_ADDRESS, m, e, NULL))
+      if ((!cands || cands[e->msgno]) && search_exec(pat, m, e, server))
       {
         switch (op)
         {
@@ -2526,6 +4131,13 @@ int mutt_pattern_func(int op, char *prompt)
     }
   }
 
+#ifdef HAVE_PTHREAD_CREATE
+  search_pool_stop(&pool);
+#endif
+#ifdef USE_HCACHE
+  search_filter_free(&SearchFilterCur);
+#endif
+
   mutt_clear_error();
 
   if (op == MUTT_LIMIT)
@@ -2533,6 +4145,7 @@ int mutt_pattern_func(int op, char *prompt)
     /* drop previous limit pattern */
     FREE(&Context->pattern);
     mutt_pattern_free(&Context->limit_pattern);
+    FREE(&Context->limit_matches);
 
     if (m->msg_count && !m->vcount)
       mutt_error(_("No messages matched criteria"));
@@ -2545,7 +4158,13 @@ int mutt_pattern_func(int op, char *prompt)
     {
       Context->pattern = simple;
       simple = NULL; /* don't clobber it */
-      Context->limit_pattern = mutt_pattern_comp(buf->data, MUTT_PC_FULL_MSG, &err);
+      /* keep the Pattern that produced limit_matches */
+      Context->limit_pattern = pat;
+      pat = NULL;
+      Context->limit_matches = matches;
+      Context->limit_count = m->msg_count;
+      Context->limit_gen = gen;
+      matches = NULL;
     }
   }
 
@@ -2554,6 +4173,8 @@ int mutt_pattern_func(int op, char *prompt)
 bail:
   mutt_buffer_pool_release(&buf);
   FREE(&simple);
+  FREE(&matches);
+  FREE(&cands);
   mutt_pattern_free(&pat);
   FREE(&err.data);
 
@@ -2603,6 +4224,9 @@ int mutt_search_command(int cur, int op)
       mutt_str_strfcpy(LastSearch, buf, sizeof(LastSearch));
       mutt_str_strfcpy(LastSearchExpn, mutt_b2s(tmp), sizeof(LastSearchExpn));
       mutt_message(_("Compiling search pattern..."));
+#ifdef USE_HCACHE
+      search_filter_free(&SearchPatternFilter);
+#endif
       mutt_pattern_free(&SearchPattern);
       err.dsize = 256;
       err.data = mutt_mem_malloc(err.dsize);
@@ -2623,17 +4247,37 @@ int mutt_search_command(int cur, int op)
     mutt_buffer_pool_release(&tmp);
   }
 
+#ifdef USE_NOTMUCH
+  if ((Context->mailbox->magic == MUTT_NOTMUCH) && (nm_read_remaining(Context->mailbox) != 0))
+    return -1;
+#endif
+
   if (OptSearchInvalid)
   {
     for (int i = 0; i < Context->mailbox->msg_count; i++)
       Context->mailbox->emails[i]->searched = false;
+    SearchServer = 0;
 #ifdef USE_IMAP
-    if ((Context->mailbox->magic == MUTT_IMAP) &&
-        (imap_search(Context->mailbox, SearchPattern) < 0))
-      return -1;
+    if (Context->mailbox->magic == MUTT_IMAP)
+    {
+      SearchServer = imap_search(Context->mailbox, SearchPattern);
+      if (SearchServer < 0)
+        return -1;
+    }
+#endif
+#ifdef USE_HCACHE
+    search_filter_free(&SearchPatternFilter);
+    SearchPatternFilter = search_filter_new(Context->mailbox, SearchPattern);
 #endif
     OptSearchInvalid = false;
   }
+#ifdef USE_HCACHE
+  else if (SearchPatternFilter && search_filter_is_stale(SearchPatternFilter, Context->mailbox))
+  {
+    search_filter_free(&SearchPatternFilter);
+    SearchPatternFilter = search_filter_new(Context->mailbox, SearchPattern);
+  }
+#endif
 
   int incr = OptSearchReverse ? -1 : 1;
   if (op == OP_SEARCH_OPPOSITE)
@@ -2685,8 +4329,7 @@ int mutt_search_command(int cur, int op)
     {
       /* remember that we've already searched this message */
       e->searched = true;
-      e->matched = mutt_pattern_exec(SLIST_FIRST(SearchPattern), MUTT_MATCH_FULL_ADDRESS,
-                                     Context->mailbox, e, NULL);
+      e->matched = search_exec(SearchPattern, Context->mailbox, e, SearchServer);
       if (e->matched > 0)
       {
         mutt_clear_error();
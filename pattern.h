@@ -34,14 +34,18 @@
 struct Email;
 struct Envelope;
 struct Mailbox;
+struct NotifyCallback;
+struct PatternProgram;
 
 /* These Config Variables are only used in pattern.c */
-extern bool C_ThoroughSearch;
+extern short C_SearchThreads;
+extern bool  C_ThoroughSearch;
 
 typedef uint8_t PatternCompFlags;       ///< Flags for mutt_pattern_comp(), e.g. #MUTT_PC_FULL_MSG
 #define MUTT_PC_NO_FLAGS            0   ///< No flags are set
 #define MUTT_PC_FULL_MSG        (1<<0)  ///< Enable body and header matching
 #define MUTT_PC_PATTERN_DYNAMIC (1<<1)  ///< Enable runtime date range evaluation
+#define MUTT_PC_MEMO            (1<<2)  ///< Remember the results for each Email
 
 /**
  * struct Pattern - A simple (non-regex) pattern
@@ -53,13 +57,20 @@ struct Pattern
   bool all_addr     : 1;         ///< All Addresses in the list must match
   bool string_match : 1;         ///< Check a string for a match
   bool group_match  : 1;         ///< Check a group of Addresses
-  bool ign_case     : 1;         ///< Ignore case for local string_match searches
+  bool ign_case     : 1;         ///< Ignore case for local string and regex searches
   bool is_alias     : 1;         ///< Is there an alias for this Address?
   bool dynamic      : 1;         ///< Evaluate date ranges at run time
   bool is_multi     : 1;         ///< Multiple case (only for ~I pattern now)
+  bool server_match : 1;         ///< Server has checked this for the search candidates (IMAP)
+  bool required_only : 1;        ///< Finding the required text is a match, regexec() isn't needed
+  bool required_bol : 1;         ///< The required text must start a line, e.g. "^text"
   int min;                       ///< Minimum for range checks
   int max;                       ///< Maximum for range checks
+  unsigned int memo_id;          ///< Key for the Email's memo, 0 if the results can't be remembered
   struct PatternList *child;     ///< Arguments to logical operation
+  struct PatternProgram *prog;   ///< Compiled form of a logical operation
+  char *required;                ///< Text that every match of the regex contains
+  char *source;                  ///< Regex as entered, for comparing Patterns
   union {
     regex_t *regex;              ///< Compiled regex, for non-pattern matching
     struct Group *group;         ///< Address group if group_match is set
@@ -155,6 +166,8 @@ int mutt_pattern_exec(struct Pattern *pat, PatternExecFlags flags,
 struct PatternList *mutt_pattern_comp(const char *s, PatternCompFlags flags, struct Buffer *err);
 void mutt_check_simple(struct Buffer *s, const char *simple);
 void mutt_pattern_free(struct PatternList **pat);
+void mutt_pattern_memo_clear(struct Email *e);
+int mutt_pattern_memo_observer(struct NotifyCallback *nc);
 
 int mutt_which_case(const char *s);
 int mutt_is_list_recipient(bool all_addr, struct Envelope *e);
@@ -55,6 +55,7 @@
 #include "muttlib.h"
 #include "mx.h"
 #include "ncrypt/ncrypt.h"
+#include "pattern.h"
 #include "progress.h"
 #ifdef ENABLE_NLS
 #include <libintl.h>
@@ -165,21 +166,74 @@ static int fetch_message(const char *line, void *data)
   return 0;
 }
 
+/**
+ * fetch_discard - Ignore a line - Implements ::pop_fetch_t
+ * @param line String to ignore
+ * @param data Unused
+ * @retval 0 Always
+ */
+static int fetch_discard(const char *line, void *data)
+{
+  return 0;
+}
+
+/**
+ * pop_header_send - Ask for the size and header of a message
+ * @param adata POP Account data
+ * @param e     Email
+ * @retval  0 Success
+ * @retval -1 Connection lost
+ *
+ * The answers are read by pop_read_header().  This must only be used if the
+ * server supports PIPELINING.
+ */
+static int pop_header_send(struct PopAccountData *adata, struct Email *e)
+{
+  char buf[128];
+  const int refno = pop_edata_get(e)->refno;
+
+  snprintf(buf, sizeof(buf), "LIST %d\r\nTOP %d 0\r\n", refno, refno);
+  return pop_query_send(adata, buf);
+}
+
+/**
+ * pop_header_skip - Throw away the answers sent by pop_header_send()
+ * @param adata POP Account data
+ * @retval  0 Success
+ * @retval -1 Connection lost
+ */
+static int pop_header_skip(struct PopAccountData *adata)
+{
+  char buf[1024];
+
+  if (pop_query_recv(adata, "LIST", buf, sizeof(buf)) == -1)
+    return -1;
+  if (pop_fetch_recv(adata, "TOP", NULL, fetch_discard, NULL) == -1)
+    return -1;
+  return 0;
+}
+
 /**
  * pop_read_header - Read header
  * @param adata POP Account data
  * @param e     Email
+ * @param sent  If true, the commands were already sent by pop_header_send()
  * @retval  0 Success
  * @retval -1 Connection lost
  * @retval -2 Invalid command or execution error
  * @retval -3 Error writing to tempfile
+ *
+ * If the commands were pipelined, all the answers are read, whatever happens,
+ * so that the next message's answers can be read.
  */
-static int pop_read_header(struct PopAccountData *adata, struct Email *e)
+static int pop_read_header(struct PopAccountData *adata, struct Email *e, bool sent)
 {
   FILE *fp = mutt_file_mkstemp();
   if (!fp)
   {
     mutt_perror(_("Can't create temporary file"));
+    if (sent && (pop_header_skip(adata) < 0))
+      return -1;
     return -3;
   }
 
@@ -190,13 +244,17 @@ static int pop_read_header(struct PopAccountData *adata, struct Email *e)
   struct PopEmailData *edata = pop_edata_get(e);
 
   snprintf(buf, sizeof(buf), "LIST %d\r\n", edata->refno);
-  int rc = pop_query(adata, buf, sizeof(buf));
+  int rc = sent ? pop_query_recv(adata, buf, buf, sizeof(buf)) :
+                  pop_query(adata, buf, sizeof(buf));
   if (rc == 0)
   {
     sscanf(buf, "+OK %d %zu", &index, &length);
 
     snprintf(buf, sizeof(buf), "TOP %d 0\r\n", edata->refno);
-    rc = pop_fetch_data(adata, buf, NULL, fetch_message, fp);
+    if (sent)
+      rc = pop_fetch_recv(adata, buf, NULL, fetch_message, fp);
+    else
+      rc = pop_fetch_data(adata, buf, NULL, fetch_message, fp);
 
     if (adata->cmd_top == 2)
     {
@@ -217,6 +275,15 @@ static int pop_read_header(struct PopAccountData *adata, struct Email *e)
       }
     }
   }
+  else if (sent && (rc == -2))
+  {
+    /* The TOP was sent anyway, skip its answer */
+    char err_msg[POP_CMD_RESPONSE];
+    mutt_str_strfcpy(err_msg, adata->err_msg, sizeof(err_msg));
+    if (pop_fetch_recv(adata, "TOP", NULL, fetch_discard, NULL) == -1)
+      rc = -1;
+    mutt_str_strfcpy(adata->err_msg, err_msg, sizeof(adata->err_msg));
+  }
 
   switch (rc)
   {
@@ -249,17 +316,85 @@ static int pop_read_header(struct PopAccountData *adata, struct Email *e)
   return rc;
 }
 
+/**
+ * struct PopUidlData - Private data for fetch_uidl()
+ */
+struct PopUidlData
+{
+  struct Mailbox *m;     ///< Mailbox
+  struct Hash *uid_hash; ///< Index of each Email (plus one), keyed by UID
+};
+
+/**
+ * pop_uid_hash - Create a hash table of the Emails' UIDs
+ * @param m Mailbox
+ * @retval ptr Hash table, see PopUidlData::uid_hash
+ *
+ * The Emails' position is stored, rather than the Email itself, because the
+ * Emails are replaced when they're restored from the header cache.
+ */
+static struct Hash *pop_uid_hash(struct Mailbox *m)
+{
+  struct Hash *hash = mutt_hash_new(MAX(m->msg_count * 2, 1024), MUTT_HASH_NO_FLAGS);
+
+  for (int i = 0; i < m->msg_count; i++)
+  {
+    struct PopEmailData *edata = pop_edata_get(m->emails[i]);
+    if (edata->uid)
+      mutt_hash_insert(hash, edata->uid, (void *) (intptr_t)(i + 1));
+  }
+
+  return hash;
+}
+
+/**
+ * pop_uidl_add - Record the number of a message on the server
+ * @param ud    UIDL data
+ * @param refno Message number on the server
+ * @param uid   UID of the message
+ *
+ * If we haven't seen the UID before, a new Email is created.
+ */
+static void pop_uidl_add(struct PopUidlData *ud, int refno, const char *uid)
+{
+  struct Mailbox *m = ud->m;
+  struct PopAccountData *adata = pop_adata_get(m);
+
+  int i = (intptr_t) mutt_hash_find(ud->uid_hash, uid) - 1;
+  if (i < 0)
+  {
+    mutt_debug(LL_DEBUG1, "new header %d %s\n", refno, uid);
+
+    i = m->msg_count;
+    if (i >= m->email_max)
+      mx_alloc_memory(m);
+
+    m->msg_count++;
+    m->emails[i] = email_new();
+
+    struct PopEmailData *edata = pop_edata_new(uid);
+    m->emails[i]->edata = edata;
+    m->emails[i]->free_edata = pop_edata_free;
+    mutt_hash_insert(ud->uid_hash, edata->uid, (void *) (intptr_t)(i + 1));
+  }
+  else if (m->emails[i]->index != refno - 1)
+    adata->clear_cache = true;
+
+  m->emails[i]->index = refno - 1;
+
+  struct PopEmailData *edata = pop_edata_get(m->emails[i]);
+  edata->refno = refno;
+}
+
 /**
  * fetch_uidl - parse UIDL - Implements ::pop_fetch_t
  * @param line String to parse
- * @param data Mailbox
+ * @param data UIDL data, see PopUidlData
  * @retval  0 Success
  * @retval -1 Failure
  */
 static int fetch_uidl(const char *line, void *data)
 {
-  struct Mailbox *m = data;
-  struct PopAccountData *adata = pop_adata_get(m);
   char *endp = NULL;
 
   errno = 0;
@@ -274,44 +409,259 @@ static int fetch_uidl(const char *line, void *data)
   if (strlen(line) == 0)
     return -1;
 
+  pop_uidl_add(data, index, line);
+  return 0;
+}
+
+/**
+ * pop_fetch_uidl_range - Get the UIDs of some messages, one at a time
+ * @param ud    UIDL data
+ * @param first First message number
+ * @param last  Last message number
+ * @retval  0 Success
+ * @retval -1 Connection lost
+ * @retval -2 Invalid command or execution error
+ * @retval -3 Error parsing the UIDs
+ *
+ * If the server doesn't support PIPELINING and there are a lot of messages,
+ * the whole list is fetched instead; it's quicker than a round trip each.
+ */
+static int pop_fetch_uidl_range(struct PopUidlData *ud, int first, int last)
+{
+  struct PopAccountData *adata = pop_adata_get(ud->m);
+  char buf[1024];
+
+  if (first > last)
+    return 0;
+
+  if (!adata->cmd_pipelining && ((last - first) >= POP_UIDL_SINGLE))
+    return pop_fetch_data(adata, "UIDL\r\n", NULL, fetch_uidl, ud);
+
+  const int depth = adata->cmd_pipelining ? POP_PIPELINE_DEPTH : 1;
+  int next = first;
+  int rc = 0;
   int i;
-  for (i = 0; i < m->msg_count; i++)
+  for (i = first; i <= last; i++)
   {
-    struct PopEmailData *edata = pop_edata_get(m->emails[i]);
-    if (mutt_str_strcmp(line, edata->uid) == 0)
+    for (; (next <= last) && ((next - i) < depth); next++)
+    {
+      snprintf(buf, sizeof(buf), "UIDL %d\r\n", next);
+      if (pop_query_send(adata, buf) < 0)
+        return -1;
+    }
+
+    rc = pop_query_recv(adata, "UIDL", buf, sizeof(buf));
+    if ((rc == 0) && (fetch_uidl(buf + 3, ud) < 0))
+      rc = -3;
+    if (rc < 0)
       break;
   }
 
-  if (i == m->msg_count)
+  /* Keep the connection in step, if we stopped early */
+  for (i++; (rc != -1) && (i < next); i++)
   {
-    mutt_debug(LL_DEBUG1, "new header %d %s\n", index, line);
+    if (pop_query_recv(adata, "UIDL", buf, sizeof(buf)) == -1)
+      return -1;
+  }
 
-    if (i >= m->email_max)
-      mx_alloc_memory(m);
+  return rc;
+}
 
-    m->msg_count++;
-    m->emails[i] = email_new();
+/**
+ * pop_fetch_uidl - Get the UIDs of the messages on the server
+ * @param[in]  ud        UIDL data
+ * @param[in]  known     UIDs saved in the header cache, in server order
+ * @param[in]  num_known Number of saved UIDs
+ * @param[out] changed   Set to true if the list of messages may have changed
+ * @retval  0 Success
+ * @retval -1 Connection lost
+ * @retval -2 Invalid command or execution error
+ * @retval -3 Error parsing the UIDs
+ *
+ * Every Email gets its current number on the server, or -1 if it's gone.
+ *
+ * Downloading the whole list is slow if a lot of mail is left on the server.
+ * Deleting a message renumbers all the later ones, so if the last message we
+ * know about still has the same number and UID, none of the messages before it
+ * have gone.  Then we only need to ask about the new ones, which `STAT` has
+ * already counted.
+ */
+static int pop_fetch_uidl(struct PopUidlData *ud, char **known, int num_known, bool *changed)
+{
+  struct Mailbox *m = ud->m;
+  struct PopAccountData *adata = pop_adata_get(m);
+  char buf[1024];
 
-    m->emails[i]->edata = pop_edata_new(line);
-    m->emails[i]->free_edata = pop_edata_free;
+  /* The last message we know about: in memory, or else in the header cache */
+  int last = 0;
+  const char *last_uid = NULL;
+  for (int i = 0; i < m->msg_count; i++)
+  {
+    struct PopEmailData *edata = pop_edata_get(m->emails[i]);
+    if (edata->refno > last)
+    {
+      last = edata->refno;
+      last_uid = edata->uid;
+    }
+  }
+  if ((m->msg_count == 0) && (num_known > 0))
+  {
+    last = num_known;
+    last_uid = known[num_known - 1];
   }
-  else if (m->emails[i]->index != index - 1)
-    adata->clear_cache = true;
 
-  m->emails[i]->index = index - 1;
+  *changed = true;
+  if ((adata->cmd_uidl == 1) && (last > 0) && (adata->stat_count >= last))
+  {
+    snprintf(buf, sizeof(buf), "UIDL %d\r\n", last);
+    int rc = pop_query(adata, buf, sizeof(buf));
+    if (rc == -1)
+      return -1;
 
-  struct PopEmailData *edata = pop_edata_get(m->emails[i]);
-  edata->refno = index;
+    char *uid = NULL;
+    int refno = (rc == 0) ? strtol(buf + 3, &uid, 10) : 0;
+    if ((refno == last) && (mutt_str_strcmp(mutt_str_skip_whitespace(uid), last_uid) == 0))
+    {
+      mutt_debug(LL_DEBUG1, "messages 1-%d are unchanged\n", last);
+      for (int i = 0; (m->msg_count == 0) && (i < num_known); i++)
+        pop_uidl_add(ud, i + 1, known[i]);
 
-  return 0;
+      *changed = (num_known > 0) || (adata->stat_count > last);
+      return pop_fetch_uidl_range(ud, last + 1, adata->stat_count);
+    }
+
+    mutt_debug(LL_DEBUG1, "message %d has changed, fetching all the UIDs\n", last);
+  }
+
+  for (int i = 0; i < m->msg_count; i++)
+  {
+    struct PopEmailData *edata = pop_edata_get(m->emails[i]);
+    edata->refno = -1;
+  }
+
+  return pop_fetch_data(adata, "UIDL\r\n", NULL, fetch_uidl, ud);
+}
+
+#ifdef USE_HCACHE
+/**
+ * pop_uidl_load - Read the saved list of UIDs from the header cache
+ * @param[in]  hc    Header cache
+ * @param[out] count Number of UIDs
+ * @retval ptr  Array of UIDs, in server order
+ * @retval NULL Nothing saved, or the list is damaged
+ *
+ * The list is stored as "count digest", followed by a UID per line.  The
+ * digest is the MD5 of the UID lines.
+ */
+static char **pop_uidl_load(header_cache_t *hc, int *count)
+{
+  *count = 0;
+
+  char *data = mutt_hcache_fetch_raw(hc, "/UIDL", 5);
+  if (!data)
+    return NULL;
+
+  char **uids = NULL;
+  char digest[33] = { 0 };
+  int num = 0;
+  char *list = strchr(data, '\n');
+  if (list && (sscanf(data, "%d %32s", &num, digest) == 2) && (num > 0))
+  {
+    unsigned char md5[16];
+    char ascii[33];
+    list++;
+    mutt_md5_bytes(list, strlen(list), md5);
+    mutt_md5_toascii(md5, ascii);
+    if (mutt_str_strcmp(ascii, digest) == 0)
+    {
+      uids = mutt_mem_calloc(num, sizeof(char *));
+      int i;
+      char *nl = NULL;
+      for (i = 0; (i < num) && (nl = strchr(list, '\n')); i++)
+      {
+        uids[i] = mutt_str_substr_dup(list, nl);
+        list = nl + 1;
+      }
+      if (i == num)
+        *count = num;
+      else
+      {
+        while (i > 0)
+          FREE(&uids[--i]);
+        FREE(&uids);
+      }
+    }
+  }
+
+  if (!uids)
+    mutt_debug(LL_DEBUG1, "ignoring damaged UIDL list\n");
+  mutt_hcache_free(hc, (void **) &data);
+  return uids;
 }
 
+/**
+ * pop_uidl_save - Save the list of UIDs in the header cache
+ * @param hc Header cache
+ * @param m  Mailbox
+ *
+ * See pop_uidl_load() for the format.
+ */
+static void pop_uidl_save(header_cache_t *hc, struct Mailbox *m)
+{
+  int num = 0;
+  for (int i = 0; i < m->msg_count; i++)
+    num = MAX(num, pop_edata_get(m->emails[i])->refno);
+
+  if (num == 0)
+  {
+    mutt_hcache_delete_header(hc, "/UIDL", 5);
+    return;
+  }
+
+  const char **uids = mutt_mem_calloc(num, sizeof(char *));
+  for (int i = 0; i < m->msg_count; i++)
+  {
+    struct PopEmailData *edata = pop_edata_get(m->emails[i]);
+    if (edata->refno > 0)
+      uids[edata->refno - 1] = edata->uid;
+  }
+
+  struct Buffer list = mutt_buffer_make(num * 32);
+  for (int i = 0; i < num; i++)
+  {
+    if (!uids[i])
+    {
+      /* We're missing part of the list, don't save it */
+      mutt_hcache_delete_header(hc, "/UIDL", 5);
+      goto done;
+    }
+    mutt_buffer_addstr(&list, uids[i]);
+    mutt_buffer_addch(&list, '\n');
+  }
+
+  unsigned char md5[16];
+  char ascii[33];
+  mutt_md5_bytes(mutt_b2s(&list), mutt_buffer_len(&list), md5);
+  mutt_md5_toascii(md5, ascii);
+
+  struct Buffer buf = mutt_buffer_make(mutt_buffer_len(&list) + 64);
+  mutt_buffer_printf(&buf, "%d %s\n%s", num, ascii, mutt_b2s(&list));
+  mutt_hcache_store_raw(hc, "/UIDL", 5, buf.data, mutt_buffer_len(&buf) + 1);
+  mutt_buffer_dealloc(&buf);
+
+done:
+  mutt_buffer_dealloc(&list);
+  FREE(&uids);
+}
+#endif
+
 /**
  * msg_cache_check - Check the Body Cache for an ID - Implements ::bcache_list_t
  */
 static int msg_cache_check(const char *id, struct BodyCache *bcache, void *data)
 {
-  struct Mailbox *m = data;
+  struct PopUidlData *ud = data;
+  struct Mailbox *m = ud->m;
   if (!m)
     return -1;
 
@@ -325,13 +675,9 @@ static int msg_cache_check(const char *id, struct BodyCache *bcache, void *data)
     return 0;
 #endif
 
-  for (int i = 0; i < m->msg_count; i++)
-  {
-    struct PopEmailData *edata = pop_edata_get(m->emails[i]);
-    /* if the id we get is known for a header: done (i.e. keep in cache) */
-    if (edata->uid && (mutt_str_strcmp(edata->uid, id) == 0))
-      return 0;
-  }
+  /* if the id we get is known for a header: done (i.e. keep in cache) */
+  if (mutt_hash_find(ud->uid_hash, id))
+    return 0;
 
   /* message not found in context -> remove it from cache
    * return the result of bcache, so we stop upon its first error */
@@ -391,17 +737,24 @@ static int pop_fetch_headers(struct Mailbox *m)
   adata->check_time = mutt_date_epoch();
   adata->clear_cache = false;
 
-  for (int i = 0; i < m->msg_count; i++)
-  {
-    struct PopEmailData *edata = pop_edata_get(m->emails[i]);
-    edata->refno = -1;
-  }
+  struct PopUidlData ud = { m, pop_uid_hash(m) };
+  char **known = NULL;
+  int num_known = 0;
+#ifdef USE_HCACHE
+  if (m->msg_count == 0)
+    known = pop_uidl_load(hc, &num_known);
+#endif
 
   const int old_count = m->msg_count;
-  int rc = pop_fetch_data(adata, "UIDL\r\n", NULL, fetch_uidl, m);
+  bool changed = true;
+  int rc = pop_fetch_uidl(&ud, known, num_known, &changed);
   const int new_count = m->msg_count;
   m->msg_count = old_count;
 
+  for (int i = 0; i < num_known; i++)
+    FREE(&known[i]);
+  FREE(&known);
+
   if (adata->cmd_uidl == 2)
   {
     if (rc == 0)
@@ -447,49 +800,93 @@ static int pop_fetch_headers(struct Mailbox *m)
           deleted);
     }
 
-    bool hcached = false;
+    /* Restore what we can from the header cache */
+    const int num = new_count - old_count;
+    bool *hcached = mutt_mem_calloc(MAX(num, 1), sizeof(bool));
+#ifdef USE_HCACHE
     for (i = old_count; i < new_count; i++)
     {
-      if (!m->quiet)
-        mutt_progress_update(&progress, i + 1 - old_count, -1);
       struct PopEmailData *edata = pop_edata_get(m->emails[i]);
-#ifdef USE_HCACHE
       void *data = mutt_hcache_fetch(hc, edata->uid, strlen(edata->uid));
-      if (data)
+      if (!data)
+        continue;
+
+      /* Detach the private data */
+      m->emails[i]->edata = NULL;
+
+      int index = m->emails[i]->index;
+      /* - POP dynamically numbers headers and relies on e->refno
+       *   to map messages; so restore header and overwrite restored
+       *   refno with current refno, same for index
+       * - e->data needs to a separate pointer as it's driver-specific
+       *   data freed separately elsewhere
+       *   (the old e->data should point inside a malloc'd block from
+       *   hcache so there shouldn't be a memleak here) */
+      struct Email *e = mutt_hcache_restore((unsigned char *) data);
+      mutt_hcache_free(hc, &data);
+      email_free(&m->emails[i]);
+      m->emails[i] = e;
+      m->emails[i]->index = index;
+
+      /* Reattach the private data */
+      m->emails[i]->edata = edata;
+      m->emails[i]->free_edata = pop_edata_free;
+      hcached[i - old_count] = true;
+    }
+#endif
+
+    /* Download the rest.  If the server supports PIPELINING, keep a window of
+     * requests in flight, so we don't wait for a round trip per message. */
+    const int depth = adata->cmd_pipelining ? POP_PIPELINE_DEPTH : 0;
+    int next = old_count;
+    int inflight = 0;
+    for (i = old_count; i < new_count; i++)
+    {
+      if (!m->quiet)
+        mutt_progress_update(&progress, i + 1 - old_count, -1);
+      if (hcached[i - old_count])
+        continue;
+
+      for (; (next < new_count) && (inflight < depth); next++)
       {
-        /* Detach the private data */
-        m->emails[i]->edata = NULL;
-
-        int index = m->emails[i]->index;
-        /* - POP dynamically numbers headers and relies on e->refno
-         *   to map messages; so restore header and overwrite restored
-         *   refno with current refno, same for index
-         * - e->data needs to a separate pointer as it's driver-specific
-         *   data freed separately elsewhere
-         *   (the old e->data should point inside a malloc'd block from
-         *   hcache so there shouldn't be a memleak here) */
-        struct Email *e = mutt_hcache_restore((unsigned char *) data);
-        mutt_hcache_free(hc, &data);
-        email_free(&m->emails[i]);
-        m->emails[i] = e;
-        m->emails[i]->index = index;
-
-        /* Reattach the private data */
-        m->emails[i]->edata = edata;
-        m->emails[i]->free_edata = pop_edata_free;
-        rc = 0;
-        hcached = true;
+        if (hcached[next - old_count])
+          continue;
+        if (pop_header_send(adata, m->emails[next]) < 0)
+        {
+          rc = -1;
+          break;
+        }
+        inflight++;
       }
-      else
-#endif
-          if ((rc = pop_read_header(adata, m->emails[i])) < 0)
+      if (rc < 0)
+        break;
+
+      const bool sent = (inflight > 0);
+      if (sent)
+        inflight--;
+      rc = pop_read_header(adata, m->emails[i], sent);
+      if (rc < 0)
         break;
 #ifdef USE_HCACHE
-      else
-      {
-        mutt_hcache_store(hc, edata->uid, strlen(edata->uid), m->emails[i], 0);
-      }
+      struct PopEmailData *edata = pop_edata_get(m->emails[i]);
+      mutt_hcache_store(hc, edata->uid, strlen(edata->uid), m->emails[i], 0);
 #endif
+    }
+    const int fetched = i;
+
+    /* Keep the connection in step, if we stopped early */
+    for (; (inflight > 0) && (rc != -1); inflight--)
+    {
+      if (pop_header_skip(adata) < 0)
+        break;
+    }
+
+    bool seen_hcached = false;
+    for (i = old_count; i < fetched; i++)
+    {
+      struct PopEmailData *edata = pop_edata_get(m->emails[i]);
+      if (hcached[i - old_count])
+        seen_hcached = true;
 
       /* faked support for flags works like this:
        * - if 'hcached' is true, we have the message in our hcache:
@@ -505,7 +902,7 @@ static int pop_fetch_headers(struct Mailbox *m)
           (mutt_bcache_exists(adata->bcache, cache_id(edata->uid)) == 0);
       m->emails[i]->old = false;
       m->emails[i]->read = false;
-      if (hcached)
+      if (seen_hcached)
       {
         if (bcached)
           m->emails[i]->read = true;
@@ -520,9 +917,12 @@ static int pop_fetch_headers(struct Mailbox *m)
 
       m->msg_count++;
     }
+    FREE(&hcached);
   }
 
 #ifdef USE_HCACHE
+  if ((rc >= 0) && changed)
+    pop_uidl_save(hc, m);
   mutt_hcache_close(hc);
 #endif
 
@@ -530,6 +930,7 @@ static int pop_fetch_headers(struct Mailbox *m)
   {
     for (int i = m->msg_count; i < new_count; i++)
       email_free(&m->emails[i]);
+    mutt_hash_free(&ud.uid_hash);
     return rc;
   }
 
@@ -537,12 +938,71 @@ static int pop_fetch_headers(struct Mailbox *m)
    * clean up cache, i.e. wipe messages deleted outside
    * the availability of our cache */
   if (C_MessageCacheClean)
-    mutt_bcache_list(adata->bcache, msg_cache_check, m);
+    mutt_bcache_list(adata->bcache, msg_cache_check, &ud);
 
+  mutt_hash_free(&ud.uid_hash);
   mutt_clear_error();
   return new_count - old_count;
 }
 
+/**
+ * pop_delete - Mark messages deleted on the server
+ * @param[in]  adata    POP Account data
+ * @param[in]  refnos   Message numbers on the server
+ * @param[in]  count    Number of messages
+ * @param[in]  progress Progress bar, may be NULL
+ * @param[out] deleted  Number of messages marked deleted
+ * @retval  0 Success
+ * @retval -1 Connection lost
+ * @retval -2 Invalid command or execution error
+ *
+ * If the server supports PIPELINING, a window of DELE commands is kept in
+ * flight.  We stop at the first failure, like we would without pipelining, so
+ * the first `deleted` messages are the ones that were marked.
+ */
+static int pop_delete(struct PopAccountData *adata, const int *refnos, int count,
+                      struct Progress *progress, int *deleted)
+{
+  char buf[1024];
+  const int depth = adata->cmd_pipelining ? POP_PIPELINE_DEPTH : 1;
+  int sent = 0;
+  int rc = 0;
+
+  *deleted = 0;
+  while (*deleted < count)
+  {
+    for (; (sent < count) && ((sent - *deleted) < depth); sent++)
+    {
+      snprintf(buf, sizeof(buf), "DELE %d\r\n", refnos[sent]);
+      if (pop_query_send(adata, buf) < 0)
+        return -1;
+    }
+
+    rc = pop_query_recv(adata, "DELE", buf, sizeof(buf));
+    if (rc < 0)
+      break;
+
+    (*deleted)++;
+    if (progress)
+      mutt_progress_update(progress, *deleted, -1);
+  }
+
+  /* Keep the connection in step, if we stopped early */
+  if (rc == -2)
+  {
+    char err_msg[POP_CMD_RESPONSE];
+    mutt_str_strfcpy(err_msg, adata->err_msg, sizeof(err_msg));
+    for (int i = *deleted + 1; i < sent; i++)
+    {
+      if (pop_query_recv(adata, "DELE", buf, sizeof(buf)) == -1)
+        return -1;
+    }
+    mutt_str_strfcpy(adata->err_msg, err_msg, sizeof(adata->err_msg));
+  }
+
+  return rc;
+}
+
 /**
  * pop_clear_cache - delete all cached messages
  * @param adata POP Account data
@@ -663,13 +1123,24 @@ void pop_fetch_mail(void)
            bytes);
   mutt_message("%s", msgbuf);
 
-  for (int i = last + 1; i <= msgs; i++)
+  /* If the server supports PIPELINING, keep a window of RETRs in flight */
+  const int depth = adata->cmd_pipelining ? POP_PIPELINE_DEPTH : 1;
+  int next = last + 1;
+  int i;
+  for (i = last + 1; i <= msgs; i++)
   {
-    struct Message *msg = mx_msg_open_new(ctx->mailbox, NULL, MUTT_ADD_FROM);
+    for (ret = 0; (next <= msgs) && ((next - i) < depth); next++)
+    {
+      snprintf(buf, sizeof(buf), "RETR %d\r\n", next);
+      ret = pop_query_send(adata, buf);
+      if (ret < 0)
+        break;
+    }
+
+    struct Message *msg = (ret == 0) ? mx_msg_open_new(ctx->mailbox, NULL, MUTT_ADD_FROM) : NULL;
     if (msg)
     {
-      snprintf(buf, sizeof(buf), "RETR %d\r\n", i);
-      ret = pop_fetch_data(adata, buf, NULL, fetch_message, msg->fp);
+      ret = pop_fetch_recv(adata, "RETR", NULL, fetch_message, msg->fp);
       if (ret == -3)
         rset = 1;
 
@@ -681,16 +1152,12 @@ void pop_fetch_mail(void)
 
       mx_msg_close(ctx->mailbox, &msg);
     }
-    else
-    {
-      ret = -3;
-    }
-
-    if ((ret == 0) && (delanswer == MUTT_YES))
+    else if (ret == 0)
     {
-      /* delete the message on the server */
-      snprintf(buf, sizeof(buf), "DELE %d\r\n", i);
-      ret = pop_query(adata, buf, sizeof(buf));
+      /* The RETR was sent anyway, skip its answer */
+      ret = pop_fetch_recv(adata, "RETR", NULL, fetch_discard, NULL);
+      if (ret != -1)
+        ret = -3;
     }
 
     if (ret == -1)
@@ -720,6 +1187,30 @@ void pop_fetch_mail(void)
   m_spool->append = old_append;
   mx_mbox_close(&ctx);
 
+  /* Keep the connection in step, if we stopped early */
+  for (int j = i + 1; j < next; j++)
+  {
+    if (pop_fetch_recv(adata, "RETR", NULL, fetch_discard, NULL) == -1)
+      goto fail;
+  }
+
+  /* delete the messages on the server; they're only removed by QUIT, so
+   * it doesn't matter that this happens after reading them all */
+  if ((delanswer == MUTT_YES) && !rset && (i > last + 1))
+  {
+    int *refnos = mutt_mem_calloc(i - last - 1, sizeof(int));
+    for (int j = last + 1; j < i; j++)
+      refnos[j - last - 1] = j;
+
+    int deleted = 0;
+    ret = pop_delete(adata, refnos, i - last - 1, NULL, &deleted);
+    FREE(&refnos);
+    if (ret == -1)
+      goto fail;
+    if (ret == -2)
+      mutt_error("%s", adata->err_msg);
+  }
+
   if (rset)
   {
     /* make sure no messages get deleted */
@@ -963,34 +1454,40 @@ static int pop_mbox_sync(struct Mailbox *m, int *index_hint)
     hc = pop_hcache_open(adata, mailbox_path(m));
 #endif
 
-    for (i = 0, j = 0, rc = 0; (rc == 0) && (i < m->msg_count); i++)
+    int *refnos = mutt_mem_calloc(MAX(num_deleted, 1), sizeof(int));
+    int *msgnos = mutt_mem_calloc(MAX(num_deleted, 1), sizeof(int));
+    for (i = 0, j = 0; i < m->msg_count; i++)
     {
       struct PopEmailData *edata = pop_edata_get(m->emails[i]);
-      if (m->emails[i]->deleted && (edata->refno != -1))
+      if (m->emails[i]->deleted && (edata->refno != -1) && (j < num_deleted))
       {
-        j++;
-        if (!m->quiet)
-          mutt_progress_update(&progress, j, -1);
-        snprintf(buf, sizeof(buf), "DELE %d\r\n", edata->refno);
-        rc = pop_query(adata, buf, sizeof(buf));
-        if (rc == 0)
-        {
-          mutt_bcache_del(adata->bcache, cache_id(edata->uid));
+        refnos[j] = edata->refno;
+        msgnos[j++] = i;
+      }
+    }
+
+    int deleted = 0;
+    rc = pop_delete(adata, refnos, j, m->quiet ? NULL : &progress, &deleted);
+    for (i = 0; i < deleted; i++)
+    {
+      struct PopEmailData *edata = pop_edata_get(m->emails[msgnos[i]]);
+      mutt_bcache_del(adata->bcache, cache_id(edata->uid));
 #ifdef USE_HCACHE
-          mutt_hcache_delete_header(hc, edata->uid, strlen(edata->uid));
+      mutt_hcache_delete_header(hc, edata->uid, strlen(edata->uid));
 #endif
-        }
-      }
+    }
+    FREE(&refnos);
+    FREE(&msgnos);
 
 #ifdef USE_HCACHE
+    for (i = 0; i < m->msg_count; i++)
+    {
+      struct PopEmailData *edata = pop_edata_get(m->emails[i]);
       if (m->emails[i]->changed)
       {
         mutt_hcache_store(hc, edata->uid, strlen(edata->uid), m->emails[i], 0);
       }
-#endif
     }
-
-#ifdef USE_HCACHE
     mutt_hcache_close(hc);
 #endif
 
@@ -1189,6 +1686,8 @@ static int pop_msg_open(struct Mailbox *m, struct Message *msg, int msgno)
   }
 
   e->content->length = ftello(msg->fp) - e->content->offset;
+  mutt_pattern_memo_clear(e);
+  m->gen++; /* cached limit results may depend on the old headers */
 
   /* This needs to be done in case this is a multipart message */
   if (!WithCrypto)
@@ -142,6 +142,8 @@ static int fetch_capa(const char *line, void *data)
     adata->cmd_uidl = 1;
   else if (mutt_str_startswith(line, "TOP", CASE_IGNORE))
     adata->cmd_top = 1;
+  else if (mutt_str_startswith(line, "PIPELINING", CASE_IGNORE))
+    adata->cmd_pipelining = true;
 
   return 0;
 }
@@ -189,6 +191,7 @@ static int pop_capabilities(struct PopAccountData *adata, int mode)
     adata->cmd_user = 0;
     adata->cmd_uidl = 0;
     adata->cmd_top = 0;
+    adata->cmd_pipelining = false;
     adata->resp_codes = false;
     adata->expire = true;
     adata->login_delay = 0;
@@ -392,6 +395,7 @@ int pop_open_connection(struct PopAccountData *adata)
   unsigned int n = 0, size = 0;
   sscanf(buf, "+OK %u %u", &n, &size);
   adata->size = size;
+  adata->stat_count = n;
   return 0;
 
 err_conn:
@@ -436,32 +440,47 @@ void pop_logout(struct Mailbox *m)
 }
 
 /**
- * pop_query_d - Send data from buffer and receive answer to the same buffer
- * @param adata  POP Account data
- * @param buf    Buffer to send/store data
- * @param buflen Buffer length
- * @param msg    Progress message
+ * pop_query_send - Send a command, without waiting for the answer
+ * @param adata POP Account data
+ * @param cmd   Command to send, terminated by "\r\n"
  * @retval  0 Successful
  * @retval -1 Connection lost
- * @retval -2 Invalid command or execution error
+ *
+ * The answers must be read with pop_query_recv() or pop_fetch_recv(), in the
+ * order the commands were sent.  Only a server that advertises PIPELINING may
+ * have more than one command outstanding.
  */
-int pop_query_d(struct PopAccountData *adata, char *buf, size_t buflen, char *msg)
+int pop_query_send(struct PopAccountData *adata, const char *cmd)
 {
   if (adata->status != POP_CONNECTED)
     return -1;
 
-  /* print msg instead of real command */
-  if (msg)
+  if (mutt_socket_send_d(adata->conn, cmd, MUTT_SOCK_LOG_FULL) < 0)
   {
-    mutt_debug(MUTT_SOCK_LOG_CMD, "> %s", msg);
+    adata->status = POP_DISCONNECTED;
+    return -1;
   }
 
-  mutt_socket_send_d(adata->conn, buf, MUTT_SOCK_LOG_FULL);
+  return 0;
+}
+
+/**
+ * pop_query_recv - Read the answer to a command
+ * @param adata  POP Account data
+ * @param cmd    Command that was sent, used for error messages
+ * @param buf    Buffer for the answer
+ * @param buflen Buffer length
+ * @retval  0 Successful
+ * @retval -1 Connection lost
+ * @retval -2 Invalid command or execution error
+ */
+int pop_query_recv(struct PopAccountData *adata, const char *cmd, char *buf, size_t buflen)
+{
+  if (adata->status != POP_CONNECTED)
+    return -1;
 
-  char *c = strpbrk(buf, " \r\n");
-  if (c)
-    *c = '\0';
-  snprintf(adata->err_msg, sizeof(adata->err_msg), "%s: ", buf);
+  snprintf(adata->err_msg, sizeof(adata->err_msg), "%.*s: ",
+           (int) strcspn(cmd, " \r\n"), cmd);
 
   if (mutt_socket_readln_d(buf, buflen, adata->conn, MUTT_SOCK_LOG_FULL) < 0)
   {
@@ -476,29 +495,55 @@ int pop_query_d(struct PopAccountData *adata, char *buf, size_t buflen, char *ms
 }
 
 /**
- * pop_fetch_data - Read Headers with callback function
+ * pop_query_d - Send data from buffer and receive answer to the same buffer
+ * @param adata  POP Account data
+ * @param buf    Buffer to send/store data
+ * @param buflen Buffer length
+ * @param msg    Progress message
+ * @retval  0 Successful
+ * @retval -1 Connection lost
+ * @retval -2 Invalid command or execution error
+ */
+int pop_query_d(struct PopAccountData *adata, char *buf, size_t buflen, char *msg)
+{
+  if (adata->status != POP_CONNECTED)
+    return -1;
+
+  /* print msg instead of real command */
+  if (msg)
+  {
+    mutt_debug(MUTT_SOCK_LOG_CMD, "> %s", msg);
+  }
+
+  if (pop_query_send(adata, buf) < 0)
+    return -1;
+
+  return pop_query_recv(adata, buf, buf, buflen);
+}
+
+/**
+ * pop_fetch_recv - Read the answer to a multi-line command
  * @param adata    POP Account data
- * @param query    POP query to send to server
+ * @param cmd      Command that was sent, used for error messages
  * @param progress Progress bar
- * @param callback Function called for each header read
+ * @param callback Function called for each line read
  * @param data     Data to pass to the callback
  * @retval  0 Successful
  * @retval -1 Connection lost
  * @retval -2 Invalid command or execution error
  * @retval -3 Error in callback(*line, *data)
  *
- * This function calls  callback(*line, *data)  for each received line,
- * callback(NULL, *data)  if  rewind(*data)  needs, exits when fail or done.
+ * The whole answer is always read, even if the callback fails, so that any
+ * pipelined answers that follow stay in step.
  */
-int pop_fetch_data(struct PopAccountData *adata, const char *query,
+int pop_fetch_recv(struct PopAccountData *adata, const char *cmd,
                    struct Progress *progress, pop_fetch_t callback, void *data)
 {
   char buf[1024];
   long pos = 0;
   size_t lenbuf = 0;
 
-  mutt_str_strfcpy(buf, query, sizeof(buf));
-  int rc = pop_query(adata, buf, sizeof(buf));
+  int rc = pop_query_recv(adata, cmd, buf, sizeof(buf));
   if (rc < 0)
     return rc;
 
@@ -547,6 +592,30 @@ int pop_fetch_data(struct PopAccountData *adata, const char *query,
   return rc;
 }
 
+/**
+ * pop_fetch_data - Read Headers with callback function
+ * @param adata    POP Account data
+ * @param query    POP query to send to server
+ * @param progress Progress bar
+ * @param callback Function called for each header read
+ * @param data     Data to pass to the callback
+ * @retval  0 Successful
+ * @retval -1 Connection lost
+ * @retval -2 Invalid command or execution error
+ * @retval -3 Error in callback(*line, *data)
+ *
+ * This function calls  callback(*line, *data)  for each received line,
+ * callback(NULL, *data)  if  rewind(*data)  needs, exits when fail or done.
+ */
+int pop_fetch_data(struct PopAccountData *adata, const char *query,
+                   struct Progress *progress, pop_fetch_t callback, void *data)
+{
+  if (pop_query_send(adata, query) < 0)
+    return -1;
+
+  return pop_fetch_recv(adata, query, progress, callback, data);
+}
+
 /**
  * check_uidl - find message with this UIDL and set refno - Implements ::pop_fetch_t
  * @param line String containing UIDL
@@ -42,6 +42,12 @@ struct Progress;
 /* maximal length of the server response (RFC1939) */
 #define POP_CMD_RESPONSE 512
 
+/* maximum number of commands in flight, if the server supports PIPELINING */
+#define POP_PIPELINE_DEPTH 32
+
+/* without PIPELINING, fetch the whole UIDL list rather than this many UIDs */
+#define POP_UIDL_SINGLE 8
+
 /**
  * enum PopStatus - POP server responses
  */
@@ -87,10 +93,12 @@ struct PopAccountData
   unsigned int cmd_user : 2; ///< optional command USER
   unsigned int cmd_uidl : 2; ///< optional command UIDL
   unsigned int cmd_top : 2;  ///< optional command TOP
+  bool cmd_pipelining : 1;   ///< server supports PIPELINING (RFC2449)
   bool resp_codes : 1;       ///< server supports extended response codes
   bool expire : 1;           ///< expire is greater than 0
   bool clear_cache : 1;
   size_t size;
+  int stat_count;          ///< number of messages, according to STAT
   time_t check_time;
   time_t login_delay; ///< minimal login delay  capability
   struct Buffer auth_list; ///< list of auth mechanisms
@@ -142,6 +150,10 @@ int pop_open_connection(struct PopAccountData *adata);
 int pop_query_d(struct PopAccountData *adata, char *buf, size_t buflen, char *msg);
 int pop_fetch_data(struct PopAccountData *adata, const char *query,
                    struct Progress *progress, pop_fetch_t callback, void *data);
+int pop_fetch_recv(struct PopAccountData *adata, const char *cmd,
+                   struct Progress *progress, pop_fetch_t callback, void *data);
+int pop_query_recv(struct PopAccountData *adata, const char *cmd, char *buf, size_t buflen);
+int pop_query_send(struct PopAccountData *adata, const char *cmd);
 int pop_reconnect(struct Mailbox *m);
 void pop_logout(struct Mailbox *m);
 struct PopAccountData *pop_adata_get(struct Mailbox *m);
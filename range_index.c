@@ -0,0 +1,391 @@
+/**
+ * @file
+ * Sorted indexes of the Emails' dates and sizes
+ *
+ * @authors
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @page range_index Sorted indexes of the Emails' dates and sizes
+ *
+ * Range patterns, e.g. ~d, ~r and ~z, would otherwise test every Email in the
+ * Mailbox.  The index keeps the Emails sorted by each of these keys, so the
+ * Emails in a range can be found with a binary search.
+ *
+ * The index belongs to the Context and is built the first time it's needed.
+ * It refers to the Emails, not their msgno, so sorting doesn't affect it.
+ * - ctx_update_tables() removes the expunged Emails
+ * - ctx_update() adds any new Emails
+ * - copy_message() removes and re-adds an Email whose size it changes
+ *
+ * Every indexed Email has Email.range_indexed set.  If ctx_update() finds
+ * fewer of them than the index holds, some Emails have been replaced, e.g.
+ * the mailbox was reopened, and the index is thrown away.
+ *
+ * Only local mailboxes are indexed.  The drivers of the others update the
+ * sizes of the Emails, as they're downloaded.
+ */
+
+#include "config.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "mutt/mutt.h"
+#include "email/lib.h"
+#include "core/lib.h"
+#include "range_index.h"
+#include "context.h"
+
+/**
+ * struct RangeEntry - An Email in a column of the index
+ */
+struct RangeEntry
+{
+  int64_t key;     ///< Email's value for the column
+  struct Email *e; ///< Email, NULL if it's been removed
+};
+
+/**
+ * struct RangeColumn - Emails sorted by one of their keys
+ */
+struct RangeColumn
+{
+  struct RangeEntry *entries; ///< Emails, sorted by key
+  int num;                    ///< Number of entries
+  int dead;                   ///< Number of removed entries
+};
+
+/**
+ * struct RangeIndex - Sorted indexes of a Mailbox's Emails
+ */
+struct RangeIndex
+{
+  struct RangeColumn cols[RI_KEY_MAX]; ///< One column for each key
+  int msg_count;                       ///< Mailbox::msg_count when last updated
+};
+
+/**
+ * email_key - Get an Email's value for a column
+ * @param e   Email
+ * @param key Column, e.g. #RI_KEY_SENT
+ * @retval num Value of the key
+ */
+static int64_t email_key(const struct Email *e, enum RangeIndexKey key)
+{
+  switch (key)
+  {
+    case RI_KEY_SENT:
+      return e->date_sent;
+    case RI_KEY_RECEIVED:
+      return e->received;
+    default:
+      return e->content ? e->content->length : 0;
+  }
+}
+
+/**
+ * entry_cmp - Compare two RangeEntry by key - Implements ::sort_t
+ */
+static int entry_cmp(const void *a, const void *b)
+{
+  const struct RangeEntry *ea = a;
+  const struct RangeEntry *eb = b;
+
+  return (ea->key > eb->key) - (ea->key < eb->key);
+}
+
+/**
+ * column_lower_bound - Find the first entry of a column not less than a key
+ * @param col Column
+ * @param key Value to find
+ * @retval num Index of the entry, or RangeColumn::num if there isn't one
+ */
+static int column_lower_bound(const struct RangeColumn *col, int64_t key)
+{
+  int lo = 0;
+  int hi = col->num;
+
+  while (lo < hi)
+  {
+    int mid = lo + ((hi - lo) / 2);
+    if (col->entries[mid].key < key)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
+
+/**
+ * column_add - Add some entries to a column
+ * @param col     Column
+ * @param add     Entries to add, will be sorted
+ * @param num_add Number of entries
+ *
+ * The new entries are merged with the old ones, dropping any removed entries.
+ */
+static void column_add(struct RangeColumn *col, struct RangeEntry *add, int num_add)
+{
+  if (num_add > 0)
+    qsort(add, num_add, sizeof(struct RangeEntry), entry_cmp);
+
+  struct RangeEntry *entries =
+      mutt_mem_malloc(MAX(1, col->num - col->dead + num_add) * sizeof(struct RangeEntry));
+  int i = 0, j = 0, n = 0;
+  while ((i < col->num) || (j < num_add))
+  {
+    if ((i < col->num) && !col->entries[i].e)
+    {
+      i++;
+      continue;
+    }
+    if ((j == num_add) || ((i < col->num) && (col->entries[i].key <= add[j].key)))
+      entries[n++] = col->entries[i++];
+    else
+      entries[n++] = add[j++];
+  }
+
+  FREE(&col->entries);
+  col->entries = entries;
+  col->num = n;
+  col->dead = 0;
+}
+
+/**
+ * index_add - Add some Emails to the index
+ * @param ri     Range index
+ * @param emails Emails to add
+ * @param num    Number of Emails
+ */
+static void index_add(struct RangeIndex *ri, struct Email **emails, int num)
+{
+  struct RangeEntry *add = mutt_mem_malloc(MAX(1, num) * sizeof(struct RangeEntry));
+
+  for (enum RangeIndexKey key = 0; key < RI_KEY_MAX; key++)
+  {
+    for (int i = 0; i < num; i++)
+    {
+      add[i].key = email_key(emails[i], key);
+      add[i].e = emails[i];
+    }
+    column_add(&ri->cols[key], add, num);
+  }
+
+  for (int i = 0; i < num; i++)
+    emails[i]->range_indexed = true;
+
+  FREE(&add);
+}
+
+/**
+ * mutt_range_index_free - Free a range index
+ * @param[out] ptr Range index to free
+ */
+void mutt_range_index_free(struct RangeIndex **ptr)
+{
+  if (!ptr || !*ptr)
+    return;
+
+  struct RangeIndex *ri = *ptr;
+  for (enum RangeIndexKey key = 0; key < RI_KEY_MAX; key++)
+    FREE(&ri->cols[key].entries);
+
+  FREE(ptr);
+}
+
+/**
+ * mutt_range_index_get - Get the range index of a Context, building it if needed
+ * @param ctx Context
+ * @retval ptr  Range index
+ * @retval NULL The Mailbox isn't indexed
+ */
+struct RangeIndex *mutt_range_index_get(struct Context *ctx)
+{
+  if (!ctx || !ctx->mailbox)
+    return NULL;
+
+  struct Mailbox *m = ctx->mailbox;
+  if ((m->magic != MUTT_MAILDIR) && (m->magic != MUTT_MH) &&
+      (m->magic != MUTT_MBOX) && (m->magic != MUTT_MMDF))
+  {
+    return NULL;
+  }
+
+  /* Emails have arrived without a notification */
+  if (ctx->range_index && (ctx->range_index->msg_count != m->msg_count))
+    mutt_range_index_free(&ctx->range_index);
+
+  if (!ctx->range_index)
+  {
+    struct Email **emails = mutt_mem_malloc(MAX(1, m->msg_count) * sizeof(struct Email *));
+    int num = 0;
+    for (int i = 0; i < m->msg_count; i++)
+    {
+      if (m->emails[i])
+        emails[num++] = m->emails[i];
+    }
+
+    struct RangeIndex *ri = mutt_mem_calloc(1, sizeof(struct RangeIndex));
+    index_add(ri, emails, num);
+    ri->msg_count = m->msg_count;
+    FREE(&emails);
+
+    mutt_debug(LL_DEBUG2, "built range index of %d emails\n", num);
+    ctx->range_index = ri;
+  }
+
+  return ctx->range_index;
+}
+
+/**
+ * mutt_range_index_select - Find the Emails with a key in a range
+ * @param ri        Range index
+ * @param key       Column to search, e.g. #RI_KEY_SIZE
+ * @param min       Minimum value of the key
+ * @param max       Maximum value of the key
+ * @param cands     Array to mark the Emails in, by msgno
+ * @param num_cands Size of the array
+ * @retval num Number of Emails marked
+ */
+int mutt_range_index_select(struct RangeIndex *ri, enum RangeIndexKey key,
+                            int64_t min, int64_t max, bool *cands, int num_cands)
+{
+  if (!ri || !cands || (key >= RI_KEY_MAX))
+    return 0;
+
+  const struct RangeColumn *col = &ri->cols[key];
+  int count = 0;
+
+  for (int i = column_lower_bound(col, min); (i < col->num) && (col->entries[i].key <= max); i++)
+  {
+    struct Email *e = col->entries[i].e;
+    if (!e || (e->msgno < 0) || (e->msgno >= num_cands))
+      continue;
+    cands[e->msgno] = true;
+    count++;
+  }
+
+  return count;
+}
+
+/**
+ * mutt_range_index_remove - Remove an Email from the range index
+ * @param ri Range index
+ * @param e  Email, about to be freed
+ */
+void mutt_range_index_remove(struct RangeIndex *ri, struct Email *e)
+{
+  if (!ri || !e || !e->range_indexed)
+    return;
+
+  for (enum RangeIndexKey key = 0; key < RI_KEY_MAX; key++)
+  {
+    struct RangeColumn *col = &ri->cols[key];
+    const int64_t val = email_key(e, key);
+    int found = -1;
+    for (int i = column_lower_bound(col, val); (i < col->num) && (col->entries[i].key == val); i++)
+    {
+      if (col->entries[i].e == e)
+      {
+        found = i;
+        break;
+      }
+    }
+
+    /* The key may have changed since the Email was indexed */
+    for (int i = 0; (found < 0) && (i < col->num); i++)
+    {
+      if (col->entries[i].e == e)
+        found = i;
+    }
+
+    if (found >= 0)
+    {
+      col->entries[found].e = NULL;
+      col->dead++;
+    }
+
+    /* Keep the binary searches short */
+    if (col->dead > (col->num / 2))
+      column_add(col, NULL, 0);
+  }
+
+  e->range_indexed = false;
+  ri->msg_count--;
+}
+
+/**
+ * mutt_range_index_add - Add an Email to the range index
+ * @param ri Range index
+ * @param e  Email
+ *
+ * This re-indexes an Email after mutt_range_index_remove(), once its keys
+ * have changed.
+ */
+void mutt_range_index_add(struct RangeIndex *ri, struct Email *e)
+{
+  if (!ri || !e || e->range_indexed)
+    return;
+
+  index_add(ri, &e, 1);
+  ri->msg_count++;
+}
+
+/**
+ * mutt_range_index_update - Add a Mailbox's new Emails to the range index
+ * @param ctx Context
+ */
+void mutt_range_index_update(struct Context *ctx)
+{
+  if (!ctx || !ctx->mailbox || !ctx->range_index)
+    return;
+
+  struct Mailbox *m = ctx->mailbox;
+  struct RangeIndex *ri = ctx->range_index;
+  struct Email **emails = mutt_mem_malloc(MAX(1, m->msg_count) * sizeof(struct Email *));
+  int num_old = 0;
+  int num_new = 0;
+
+  for (int i = 0; i < m->msg_count; i++)
+  {
+    struct Email *e = m->emails[i];
+    if (!e)
+      continue;
+    if (e->range_indexed)
+      num_old++;
+    else
+      emails[num_new++] = e;
+  }
+
+  const struct RangeColumn *col = &ri->cols[0];
+  if (num_old == (col->num - col->dead))
+  {
+    if (num_new > 0)
+      index_add(ri, emails, num_new);
+    ri->msg_count = m->msg_count;
+  }
+  else
+  {
+    /* Some indexed Emails have been freed */
+    mutt_debug(LL_DEBUG2, "range index is stale\n");
+    mutt_range_index_free(&ctx->range_index);
+  }
+
+  FREE(&emails);
+}
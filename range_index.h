@@ -0,0 +1,51 @@
+/**
+ * @file
+ * Sorted indexes of the Emails' dates and sizes
+ *
+ * @authors
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MUTT_RANGE_INDEX_H
+#define MUTT_RANGE_INDEX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct Context;
+struct Email;
+struct RangeIndex;
+
+/**
+ * enum RangeIndexKey - Columns of the range index
+ */
+enum RangeIndexKey
+{
+  RI_KEY_SENT,     ///< Email.date_sent, for ~d
+  RI_KEY_RECEIVED, ///< Email.received, for ~r
+  RI_KEY_SIZE,     ///< Size of the Email's body, for ~z
+  RI_KEY_MAX,
+};
+
+void               mutt_range_index_add   (struct RangeIndex *ri, struct Email *e);
+struct RangeIndex *mutt_range_index_get   (struct Context *ctx);
+int                mutt_range_index_select(struct RangeIndex *ri, enum RangeIndexKey key, int64_t min, int64_t max, bool *cands, int num_cands);
+void               mutt_range_index_remove(struct RangeIndex *ri, struct Email *e);
+void               mutt_range_index_update(struct Context *ctx);
+void               mutt_range_index_free  (struct RangeIndex **ptr);
+
+#endif /* MUTT_RANGE_INDEX_H */
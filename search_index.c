@@ -0,0 +1,899 @@
+/**
+ * @file
+ * Full-text index for body searches
+ *
+ * @authors
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @page search_index Full-text index for body searches
+ *
+ * Full-text index for the ~b, ~B and ~h patterns of Maildir and MH mailboxes.
+ *
+ * The index lives in the folder's header cache, next to the headers.  It maps
+ * every trigram (three bytes) of a message's text to the ids of the messages
+ * containing it.  Looking up the trigrams of a plain string gives a superset
+ * of the messages that can match it, which are then searched as usual.
+ *
+ * The text is folded in the same way when indexing and looking up: ASCII
+ * letters are lowercased and runs of whitespace become a single space.  Both
+ * the raw message and the decoded one are indexed, so the index is valid
+ * whatever the value of $thorough_search.
+ *
+ * Messages are indexed the first time they're searched.  The lists of ids are
+ * written in generations: each batch of new messages is added to the latest
+ * generation, or starts a new one when that's full.  Expunged messages are
+ * simply forgotten; when too many ids are stale, the index is rebuilt.
+ *
+ * | Key                | Data                                      |
+ * | :----------------- | :---------------------------------------- |
+ * | /fts/meta          | struct SidxMeta                           |
+ * | /fts/d<key>        | struct SidxDoc, for the header cache key  |
+ * | /fts/g/<gen>       | Trigrams written in a generation          |
+ * | /fts/p/<gen>/<tri> | Ids of the messages containing a trigram  |
+ */
+
+#include "config.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mutt/mutt.h"
+#include "email/lib.h"
+#include "core/lib.h"
+#include "search_index.h"
+#include "copy.h"
+#include "globals.h"
+#include "handler.h"
+#include "mutt_parse.h"
+#include "mx.h"
+#include "ncrypt/ncrypt.h"
+#include "progress.h"
+#include "state.h"
+#include "hcache/hcache.h"
+
+/* These Config Variables are only used in search_index.c */
+bool C_SearchIndex; ///< Config: (hcache) Keep a full-text index of Maildir and MH folders
+
+#define SIDX_VERSION 1         ///< Format of the index
+#define SIDX_GEN_MAX (1 << 20) ///< Number of postings in a full generation
+#define SIDX_NO_ID UINT32_MAX  ///< The Email isn't indexed, it always needs searching
+
+/**
+ * struct SidxMeta - Description of a folder's index
+ */
+struct SidxMeta
+{
+  uint32_t version;    ///< Format of the index, #SIDX_VERSION
+  uint32_t first_gen;  ///< Oldest generation in use
+  uint32_t next_gen;   ///< Next generation to be started
+  uint32_t tail_count; ///< Number of postings in the latest generation
+  uint32_t first_id;   ///< Oldest Email id in use
+  uint32_t next_id;    ///< Next Email id to be assigned
+  char charset[64];    ///< $charset that the messages were decoded into
+};
+
+/**
+ * struct SidxDoc - Index entry for one Email
+ */
+struct SidxDoc
+{
+  int64_t size; ///< Size of the message file, in case it's replaced
+  uint32_t id;  ///< Email id, or #SIDX_NO_ID if it couldn't be indexed
+};
+
+/**
+ * struct SidxPending - Index entry waiting for its postings to be written
+ */
+struct SidxPending
+{
+  char *key;          ///< Key of the entry
+  struct SidxDoc doc; ///< Index entry
+};
+
+/**
+ * struct SidxTokens - Trigram generator
+ */
+struct SidxTokens
+{
+  uint32_t tri; ///< Last three bytes of folded text
+  int len;      ///< Number of valid bytes in tri
+  bool space;   ///< Last byte was whitespace
+};
+
+/**
+ * struct SidxIds - Sorted list of Email ids
+ */
+struct SidxIds
+{
+  uint32_t *ids; ///< Email ids
+  size_t len;    ///< Number of ids
+  size_t size;   ///< Allocated number of ids
+};
+
+/**
+ * struct SearchIndex - Full-text index of a Mailbox
+ */
+struct SearchIndex
+{
+  struct Mailbox *m;    ///< Mailbox
+  header_cache_t *hc;   ///< Header cache containing the index
+  struct SidxMeta meta; ///< Description of the index
+  uint32_t *ids;        ///< Email id of each msgno
+  int msg_count;        ///< Number of Emails when the index was opened
+
+  uint8_t *seen;              ///< Bitmap of the trigrams of the Email being indexed
+  uint32_t *doc_tris;         ///< Trigrams of the Email being indexed
+  size_t num_doc_tris;        ///< Number of trigrams
+  size_t doc_tris_size;       ///< Allocated number of trigrams
+  uint64_t *postings;         ///< New (trigram << 32 | id) pairs
+  size_t num_postings;        ///< Number of postings
+  size_t postings_size;       ///< Allocated number of postings
+  struct SidxPending *docs;   ///< Index entries to write after the postings
+  size_t num_docs;            ///< Number of index entries
+  size_t docs_size;           ///< Allocated number of index entries
+};
+
+/**
+ * token_push - Add a byte to the trigram generator
+ * @param[in]  tok Trigram generator
+ * @param[in]  c   Byte of text
+ * @param[out] tri Completed trigram
+ * @retval true A trigram was completed
+ */
+static bool token_push(struct SidxTokens *tok, unsigned char c, uint32_t *tri)
+{
+  /* The searches work on C strings, so nothing can match across a NUL */
+  if (c == '\0')
+  {
+    tok->len = 0;
+    tok->space = false;
+    return false;
+  }
+
+  /* Folded headers are joined, by a single space, before they're matched */
+  if (IS_SPACE(c))
+  {
+    if (tok->space)
+      return false;
+    tok->space = true;
+    c = ' ';
+  }
+  else
+  {
+    tok->space = false;
+    if ((c >= 'A') && (c <= 'Z'))
+      c += 'a' - 'A';
+  }
+
+  tok->tri = ((tok->tri << 8) | c) & 0xffffff;
+  if (tok->len < 3)
+    tok->len++;
+  if (tok->len < 3)
+    return false;
+
+  *tri = tok->tri;
+  return true;
+}
+
+/**
+ * ids_add - Add an id to a list
+ * @param list List of ids
+ * @param id   Email id
+ */
+static void ids_add(struct SidxIds *list, uint32_t id)
+{
+  if (list->len == list->size)
+  {
+    list->size = MAX(64, list->size * 2);
+    mutt_mem_realloc(&list->ids, list->size * sizeof(uint32_t));
+  }
+  list->ids[list->len++] = id;
+}
+
+/**
+ * ids_decode - Decode a stored list of ids
+ * @param data     Stored list
+ * @param first_id Ignore ids older than this
+ * @param list     List to append to
+ *
+ * The list is stored as its length in bytes, followed by the differences
+ * between successive ids, seven bits per byte.
+ */
+static void ids_decode(const unsigned char *data, uint32_t first_id, struct SidxIds *list)
+{
+  uint32_t len = 0;
+  memcpy(&len, data, sizeof(len));
+  const unsigned char *p = data + sizeof(len);
+  const unsigned char *end = p + len;
+
+  uint32_t id = 0;
+  while (p < end)
+  {
+    uint32_t delta = 0;
+    for (int shift = 0; p < end; shift += 7)
+    {
+      delta |= (uint32_t)(*p & 0x7f) << shift;
+      if ((*p++ & 0x80) == 0)
+        break;
+    }
+    id += delta;
+    if (id >= first_id)
+      ids_add(list, id);
+  }
+}
+
+/**
+ * ids_encode - Encode a list of ids for storage
+ * @param[in]  list List of ids
+ * @param[out] dlen Length of the encoded list
+ * @retval ptr Encoded list, see ids_decode()
+ *
+ * The caller must free the returned data.
+ */
+static unsigned char *ids_encode(const struct SidxIds *list, size_t *dlen)
+{
+  uint32_t len = 0;
+  unsigned char *data = mutt_mem_malloc(sizeof(len) + (list->len * 5));
+  unsigned char *p = data + sizeof(len);
+
+  uint32_t prev = 0;
+  for (size_t i = 0; i < list->len; i++)
+  {
+    uint32_t delta = list->ids[i] - prev;
+    prev = list->ids[i];
+    while (delta >= 0x80)
+    {
+      *p++ = (delta & 0x7f) | 0x80;
+      delta >>= 7;
+    }
+    *p++ = delta;
+  }
+
+  len = p - data - sizeof(len);
+  memcpy(data, &len, sizeof(len));
+  *dlen = p - data;
+  return data;
+}
+
+/**
+ * ids_intersect - Keep the ids that are in both lists
+ * @param list  List to reduce
+ * @param other Other list
+ */
+static void ids_intersect(struct SidxIds *list, const struct SidxIds *other)
+{
+  size_t i = 0, j = 0, k = 0;
+  while ((i < list->len) && (j < other->len))
+  {
+    if (list->ids[i] < other->ids[j])
+      i++;
+    else if (list->ids[i] > other->ids[j])
+      j++;
+    else
+    {
+      list->ids[k++] = list->ids[i++];
+      j++;
+    }
+  }
+  list->len = k;
+}
+
+/**
+ * ids_find - Is an id in a list?
+ * @param list List of ids
+ * @param id   Email id
+ * @retval true The id is in the list
+ */
+static bool ids_find(const struct SidxIds *list, uint32_t id)
+{
+  size_t lo = 0, hi = list->len;
+  while (lo < hi)
+  {
+    size_t mid = lo + ((hi - lo) / 2);
+    if (list->ids[mid] == id)
+      return true;
+    if (list->ids[mid] < id)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return false;
+}
+
+/**
+ * doc_key - Generate the key of an Email's index entry
+ * @param buf    Buffer for the key
+ * @param key    Header cache key of the Email
+ * @param keylen Length of the header cache key
+ */
+static void doc_key(struct Buffer *buf, const char *key, size_t keylen)
+{
+  mutt_buffer_printf(buf, "/fts/d%.*s", (int) keylen, key);
+}
+
+/**
+ * email_doc_key - Generate the key of an Email's index entry
+ * @param m   Mailbox
+ * @param e   Email
+ * @param buf Buffer for the key
+ *
+ * The key matches the one the header cache uses, so a Maildir message keeps
+ * its entry when its flags change.
+ */
+static void email_doc_key(struct Mailbox *m, struct Email *e, struct Buffer *buf)
+{
+  if (m->magic == MUTT_MH)
+  {
+    doc_key(buf, e->path, strlen(e->path));
+  }
+  else
+  {
+    const char *key = e->path + 3;
+    const char *colon = strrchr(key, ':');
+    doc_key(buf, key, colon ? (size_t)(colon - key) : strlen(key));
+  }
+}
+
+/**
+ * meta_store - Save the description of the index
+ * @param si Search index
+ */
+static void meta_store(struct SearchIndex *si)
+{
+  mutt_hcache_store_raw(si->hc, "/fts/meta", 9, &si->meta, sizeof(si->meta));
+}
+
+/**
+ * sidx_reset - Empty the index
+ * @param si Search index
+ *
+ * The ids and generations keep counting up, so any leftover entries are
+ * ignored.
+ */
+static void sidx_reset(struct SearchIndex *si)
+{
+  struct SidxMeta *meta = &si->meta;
+  struct Buffer *key = mutt_buffer_pool_get();
+
+  for (uint32_t gen = meta->first_gen; gen != meta->next_gen; gen++)
+  {
+    mutt_buffer_printf(key, "/fts/g/%x", gen);
+    void *data = mutt_hcache_fetch_raw(si->hc, mutt_b2s(key), mutt_buffer_len(key));
+    if (!data)
+      continue;
+
+    uint32_t num = 0;
+    memcpy(&num, data, sizeof(num));
+    const unsigned char *p = (unsigned char *) data + sizeof(num);
+    for (uint32_t i = 0; i < num; i++, p += sizeof(uint32_t))
+    {
+      uint32_t tri = 0;
+      memcpy(&tri, p, sizeof(tri));
+      struct Buffer *pkey = mutt_buffer_pool_get();
+      mutt_buffer_printf(pkey, "/fts/p/%x/%06x", gen, tri);
+      mutt_hcache_delete_header(si->hc, mutt_b2s(pkey), mutt_buffer_len(pkey));
+      mutt_buffer_pool_release(&pkey);
+    }
+    mutt_hcache_free(si->hc, &data);
+    mutt_hcache_delete_header(si->hc, mutt_b2s(key), mutt_buffer_len(key));
+  }
+  mutt_buffer_pool_release(&key);
+
+  meta->version = SIDX_VERSION;
+  meta->first_gen = meta->next_gen;
+  meta->tail_count = 0;
+  meta->first_id = meta->next_id;
+  mutt_str_strfcpy(meta->charset, NONULL(C_Charset), sizeof(meta->charset));
+  meta_store(si);
+}
+
+/**
+ * posting_cmp - Compare two postings - Implements ::sort_t
+ */
+static int posting_cmp(const void *a, const void *b)
+{
+  const uint64_t x = *(const uint64_t *) a;
+  const uint64_t y = *(const uint64_t *) b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * sidx_flush - Write the new postings and index entries
+ * @param si Search index
+ */
+static void sidx_flush(struct SearchIndex *si)
+{
+  struct SidxMeta *meta = &si->meta;
+  struct Buffer *key = mutt_buffer_pool_get();
+
+  if (si->num_postings > 0)
+  {
+    qsort(si->postings, si->num_postings, sizeof(uint64_t), posting_cmp);
+
+    bool merge = (meta->next_gen != meta->first_gen) &&
+                 ((meta->tail_count + si->num_postings) <= SIDX_GEN_MAX);
+    if (!merge)
+    {
+      meta->next_gen++;
+      meta->tail_count = 0;
+    }
+    const uint32_t gen = meta->next_gen - 1;
+
+    /* The trigrams in this generation, so it can be deleted */
+    struct SidxIds tris = { 0 };
+    if (merge)
+    {
+      mutt_buffer_printf(key, "/fts/g/%x", gen);
+      void *data = mutt_hcache_fetch_raw(si->hc, mutt_b2s(key), mutt_buffer_len(key));
+      if (data)
+      {
+        uint32_t num = 0;
+        memcpy(&num, data, sizeof(num));
+        for (uint32_t i = 0; i < num; i++)
+        {
+          uint32_t tri = 0;
+          memcpy(&tri, (unsigned char *) data + sizeof(num) + (i * sizeof(tri)), sizeof(tri));
+          ids_add(&tris, tri);
+        }
+        mutt_hcache_free(si->hc, &data);
+      }
+    }
+
+    struct SidxIds list = { 0 };
+    for (size_t i = 0; i < si->num_postings;)
+    {
+      const uint32_t tri = si->postings[i] >> 32;
+      mutt_buffer_printf(key, "/fts/p/%x/%06x", gen, tri);
+
+      list.len = 0;
+      void *data = merge ? mutt_hcache_fetch_raw(si->hc, mutt_b2s(key), mutt_buffer_len(key)) : NULL;
+      if (data)
+      {
+        ids_decode(data, 0, &list);
+        mutt_hcache_free(si->hc, &data);
+      }
+      else
+      {
+        ids_add(&tris, tri);
+      }
+
+      for (; (i < si->num_postings) && ((si->postings[i] >> 32) == tri); i++)
+        ids_add(&list, si->postings[i] & 0xffffffff);
+
+      size_t dlen = 0;
+      unsigned char *enc = ids_encode(&list, &dlen);
+      mutt_hcache_store_raw(si->hc, mutt_b2s(key), mutt_buffer_len(key), enc, dlen);
+      FREE(&enc);
+    }
+    FREE(&list.ids);
+
+    const uint32_t num = tris.len;
+    unsigned char *data = mutt_mem_malloc(sizeof(num) + (num * sizeof(uint32_t)));
+    memcpy(data, &num, sizeof(num));
+    if (num > 0)
+      memcpy(data + sizeof(num), tris.ids, num * sizeof(uint32_t));
+    mutt_buffer_printf(key, "/fts/g/%x", gen);
+    mutt_hcache_store_raw(si->hc, mutt_b2s(key), mutt_buffer_len(key), data,
+                          sizeof(num) + (num * sizeof(uint32_t)));
+    FREE(&data);
+    FREE(&tris.ids);
+
+    meta->tail_count += si->num_postings;
+    si->num_postings = 0;
+  }
+
+  meta_store(si);
+
+  /* The entries go last, so they never refer to missing postings */
+  for (size_t i = 0; i < si->num_docs; i++)
+  {
+    struct SidxPending *pd = &si->docs[i];
+    mutt_hcache_store_raw(si->hc, pd->key, strlen(pd->key), &pd->doc, sizeof(pd->doc));
+    FREE(&pd->key);
+  }
+  si->num_docs = 0;
+
+  mutt_buffer_pool_release(&key);
+}
+
+/**
+ * doc_add_stream - Add the trigrams of some text to the Email being indexed
+ * @param si  Search index
+ * @param fp  Stream, positioned at the start of the text
+ * @param len Number of bytes to read, or -1 to read it all
+ */
+static void doc_add_stream(struct SearchIndex *si, FILE *fp, long len)
+{
+  struct SidxTokens tok = { 0 };
+  unsigned char buf[8192];
+
+  while (len != 0)
+  {
+    size_t want = ((len < 0) || (len > (long) sizeof(buf))) ? sizeof(buf) : len;
+    size_t got = fread(buf, 1, want, fp);
+    if (got == 0)
+      break;
+    if (len > 0)
+      len -= got;
+
+    for (size_t i = 0; i < got; i++)
+    {
+      uint32_t tri = 0;
+      if (!token_push(&tok, buf[i], &tri))
+        continue;
+
+      const uint8_t bit = 1 << (tri & 7);
+      if (si->seen[tri >> 3] & bit)
+        continue;
+      si->seen[tri >> 3] |= bit;
+
+      if (si->num_doc_tris == si->doc_tris_size)
+      {
+        si->doc_tris_size = MAX(1024, si->doc_tris_size * 2);
+        mutt_mem_realloc(&si->doc_tris, si->doc_tris_size * sizeof(uint32_t));
+      }
+      si->doc_tris[si->num_doc_tris++] = tri;
+    }
+  }
+}
+
+/**
+ * doc_finish - Finish indexing an Email
+ * @param si Search index
+ * @param id Email id, or #SIDX_NO_ID to discard its trigrams
+ */
+static void doc_finish(struct SearchIndex *si, uint32_t id)
+{
+  if ((id != SIDX_NO_ID) && ((si->num_postings + si->num_doc_tris) > si->postings_size))
+  {
+    si->postings_size = MAX(si->postings_size * 2, si->num_postings + si->num_doc_tris);
+    mutt_mem_realloc(&si->postings, si->postings_size * sizeof(uint64_t));
+  }
+
+  for (size_t i = 0; i < si->num_doc_tris; i++)
+  {
+    const uint32_t tri = si->doc_tris[i];
+    si->seen[tri >> 3] &= ~(1 << (tri & 7));
+    if (id != SIDX_NO_ID)
+      si->postings[si->num_postings++] = ((uint64_t) tri << 32) | id;
+  }
+  si->num_doc_tris = 0;
+}
+
+/**
+ * doc_queue - Queue an Email's index entry, to be written by sidx_flush()
+ * @param si  Search index
+ * @param key Key of the entry
+ * @param e   Email
+ * @param id  Email id
+ */
+static void doc_queue(struct SearchIndex *si, const char *key, struct Email *e, uint32_t id)
+{
+  if (si->num_docs == si->docs_size)
+  {
+    si->docs_size = MAX(64, si->docs_size * 2);
+    mutt_mem_realloc(&si->docs, si->docs_size * sizeof(struct SidxPending));
+  }
+
+  struct SidxPending *pd = &si->docs[si->num_docs++];
+  memset(pd, 0, sizeof(*pd));
+  pd->key = mutt_str_strdup(key);
+  pd->doc.size = email_size(e);
+  pd->doc.id = id;
+}
+
+/**
+ * index_email - Gather the trigrams of an Email
+ * @param si    Search index
+ * @param msgno Index of the Email
+ * @retval  1 Success
+ * @retval  0 The Email can't be indexed, it's encrypted
+ * @retval -1 Error, try again next time
+ *
+ * This indexes the same text that msg_search() looks at.
+ */
+static int index_email(struct SearchIndex *si, int msgno)
+{
+  struct Mailbox *m = si->m;
+  struct Email *e = m->emails[msgno];
+
+  struct Message *msg = mx_msg_open(m, msgno);
+  if (!msg)
+    return -1;
+
+  struct State s = { 0 };
+  s.fp_in = msg->fp;
+  s.flags = MUTT_CHARCONV;
+  s.fp_out = mutt_file_mkstemp();
+  if (!s.fp_out)
+  {
+    mutt_perror(_("Can't create temporary file"));
+    mx_msg_close(m, &msg);
+    return -1;
+  }
+
+  int rc = 0;
+
+  /* The raw header and body */
+  fseeko(msg->fp, e->offset, SEEK_SET);
+  doc_add_stream(si, msg->fp, email_size(e));
+
+  /* The decoded header and body */
+  mutt_copy_header(msg->fp, e, s.fp_out, CH_FROM | CH_DECODE, NULL, 0);
+  mutt_parse_mime_message(m, e);
+  if ((WithCrypto != 0) && (e->security & SEC_ENCRYPT))
+    goto done;
+
+  fseeko(msg->fp, e->offset, SEEK_SET);
+  mutt_body_handler(e->content, &s);
+
+  fflush(s.fp_out);
+  rewind(s.fp_out);
+  doc_add_stream(si, s.fp_out, -1);
+  rc = 1;
+
+done:
+  mutt_file_fclose(&s.fp_out);
+  mx_msg_close(m, &msg);
+  return rc;
+}
+
+/**
+ * sidx_update - Index the Emails that aren't in the index yet
+ * @param si Search index
+ */
+static void sidx_update(struct SearchIndex *si)
+{
+  struct Mailbox *m = si->m;
+  struct Buffer *key = mutt_buffer_pool_get();
+  int *todo = mutt_mem_malloc(MAX(1, si->msg_count) * sizeof(int));
+  int num_todo = 0;
+
+  for (int i = 0; i < si->msg_count; i++)
+  {
+    struct Email *e = m->emails[i];
+    si->ids[i] = SIDX_NO_ID;
+    if (!e || !e->content || !e->path)
+      continue;
+
+    email_doc_key(m, e, key);
+    void *data = mutt_hcache_fetch_raw(si->hc, mutt_b2s(key), mutt_buffer_len(key));
+    if (data)
+    {
+      struct SidxDoc doc;
+      memcpy(&doc, data, sizeof(doc));
+      mutt_hcache_free(si->hc, &data);
+      if ((doc.size == (int64_t) email_size(e)) &&
+          ((doc.id == SIDX_NO_ID) ||
+           ((doc.id >= si->meta.first_id) && (doc.id < si->meta.next_id))))
+      {
+        si->ids[i] = doc.id;
+        continue;
+      }
+    }
+    todo[num_todo++] = i;
+  }
+
+  if (num_todo > 0)
+  {
+    mutt_debug(LL_DEBUG1, "indexing %d of %d messages\n", num_todo, si->msg_count);
+
+    struct Progress progress;
+    mutt_progress_init(&progress, _("Indexing messages..."), MUTT_PROGRESS_READ, num_todo);
+    si->seen = mutt_mem_calloc(1 << 21, sizeof(uint8_t));
+
+    for (int i = 0; i < num_todo; i++)
+    {
+      mutt_progress_update(&progress, i, -1);
+
+      const int msgno = todo[i];
+      int rc = index_email(si, msgno);
+      if (rc < 0)
+      {
+        doc_finish(si, SIDX_NO_ID);
+        continue;
+      }
+
+      uint32_t id = SIDX_NO_ID;
+      if (rc > 0)
+        id = si->meta.next_id++;
+      doc_finish(si, id);
+
+      email_doc_key(m, m->emails[msgno], key);
+      doc_queue(si, mutt_b2s(key), m->emails[msgno], id);
+      si->ids[msgno] = id;
+
+      if (si->num_postings >= SIDX_GEN_MAX)
+        sidx_flush(si);
+    }
+    sidx_flush(si);
+
+    FREE(&si->seen);
+    FREE(&si->doc_tris);
+    FREE(&si->postings);
+    FREE(&si->docs);
+    si->doc_tris_size = 0;
+    si->postings_size = 0;
+    si->docs_size = 0;
+  }
+
+  FREE(&todo);
+  mutt_buffer_pool_release(&key);
+}
+
+/**
+ * mutt_search_index_open - Open a Mailbox's index, adding any new Emails
+ * @param m Mailbox
+ * @retval ptr  Search index
+ * @retval NULL The Mailbox can't be indexed, or $search_index is unset
+ */
+struct SearchIndex *mutt_search_index_open(struct Mailbox *m)
+{
+  if (!C_SearchIndex || !C_HeaderCache || !m)
+    return NULL;
+  if ((m->magic != MUTT_MAILDIR) && (m->magic != MUTT_MH))
+    return NULL;
+
+  header_cache_t *hc = mutt_hcache_open(C_HeaderCache, mailbox_path(m), NULL);
+  if (!hc)
+    return NULL;
+
+  struct SearchIndex *si = mutt_mem_calloc(1, sizeof(struct SearchIndex));
+  si->m = m;
+  si->hc = hc;
+  si->msg_count = m->msg_count;
+  si->ids = mutt_mem_malloc(MAX(1, m->msg_count) * sizeof(uint32_t));
+
+  void *data = mutt_hcache_fetch_raw(hc, "/fts/meta", 9);
+  if (data)
+  {
+    memcpy(&si->meta, data, sizeof(si->meta));
+    mutt_hcache_free(hc, &data);
+  }
+
+  /* Rebuild the index if the decoded text would differ, or most of it is stale */
+  struct SidxMeta *meta = &si->meta;
+  if ((meta->version != SIDX_VERSION) ||
+      (mutt_str_strcmp(meta->charset, NONULL(C_Charset)) != 0) ||
+      ((meta->next_id - meta->first_id) > ((2 * (uint32_t) m->msg_count) + 1024)))
+  {
+    mutt_debug(LL_DEBUG1, "resetting the search index of %s\n", mailbox_path(m));
+    sidx_reset(si);
+  }
+
+  sidx_update(si);
+  return si;
+}
+
+/**
+ * mutt_search_index_lookup - Find the Emails that may contain some text
+ * @param si    Search index
+ * @param str   Plain text to look for
+ * @param icase True if the search ignores case
+ * @retval ptr  Array of candidates, indexed by msgno
+ * @retval NULL The index can't help, every Email must be searched
+ *
+ * The caller must free the returned array.
+ */
+bool *mutt_search_index_lookup(struct SearchIndex *si, const char *str, bool icase)
+{
+  if (!si || !str)
+    return NULL;
+
+  /* Only ASCII letters are folded in the index */
+  struct SidxIds tris = { 0 };
+  struct SidxTokens tok = { 0 };
+  for (const unsigned char *p = (const unsigned char *) str; *p; p++)
+  {
+    if (icase && (*p & 0x80))
+    {
+      FREE(&tris.ids);
+      return NULL;
+    }
+
+    uint32_t tri = 0;
+    if (!token_push(&tok, *p, &tri))
+      continue;
+
+    bool dup = false;
+    for (size_t i = 0; !dup && (i < tris.len); i++)
+      dup = (tris.ids[i] == tri);
+    if (!dup)
+      ids_add(&tris, tri);
+  }
+
+  if (tris.len == 0)
+    return NULL;
+
+  struct Buffer *key = mutt_buffer_pool_get();
+  struct SidxIds found = { 0 };
+  struct SidxIds list = { 0 };
+  for (size_t i = 0; i < tris.len; i++)
+  {
+    struct SidxIds *dest = (i == 0) ? &found : &list;
+    dest->len = 0;
+
+    /* Later generations hold later ids, so the list stays sorted */
+    for (uint32_t gen = si->meta.first_gen; gen != si->meta.next_gen; gen++)
+    {
+      mutt_buffer_printf(key, "/fts/p/%x/%06x", gen, tris.ids[i]);
+      void *data = mutt_hcache_fetch_raw(si->hc, mutt_b2s(key), mutt_buffer_len(key));
+      if (!data)
+        continue;
+      ids_decode(data, si->meta.first_id, dest);
+      mutt_hcache_free(si->hc, &data);
+    }
+
+    if (i > 0)
+      ids_intersect(&found, &list);
+    if (found.len == 0)
+      break;
+  }
+  FREE(&list.ids);
+  FREE(&tris.ids);
+  mutt_buffer_pool_release(&key);
+
+  bool *cands = mutt_mem_calloc(MAX(1, si->msg_count), sizeof(bool));
+  int num = 0;
+  for (int i = 0; i < si->msg_count; i++)
+  {
+    cands[i] = (si->ids[i] == SIDX_NO_ID) || ids_find(&found, si->ids[i]);
+    if (cands[i])
+      num++;
+  }
+  FREE(&found.ids);
+
+  mutt_debug(LL_DEBUG1, "'%s': %d of %d messages to search\n", str, num, si->msg_count);
+  return cands;
+}
+
+/**
+ * mutt_search_index_close - Close a Mailbox's index
+ * @param[out] ptr Search index
+ */
+void mutt_search_index_close(struct SearchIndex **ptr)
+{
+  if (!ptr || !*ptr)
+    return;
+
+  struct SearchIndex *si = *ptr;
+  mutt_hcache_close(si->hc);
+  FREE(&si->ids);
+  FREE(ptr);
+}
+
+/**
+ * mutt_search_index_delete - Forget an expunged Email
+ * @param hc     Header cache
+ * @param key    Header cache key of the Email
+ * @param keylen Length of the key
+ *
+ * Its postings stay behind, but nothing refers to their id any more.
+ */
+void mutt_search_index_delete(header_cache_t *hc, const char *key, size_t keylen)
+{
+  if (!C_SearchIndex || !hc)
+    return;
+
+  struct Buffer *buf = mutt_buffer_pool_get();
+  doc_key(buf, key, keylen);
+  mutt_hcache_delete_header(hc, mutt_b2s(buf), mutt_buffer_len(buf));
+  mutt_buffer_pool_release(&buf);
+}
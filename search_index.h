@@ -0,0 +1,41 @@
+/**
+ * @file
+ * Full-text index for body searches
+ *
+ * @authors
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MUTT_SEARCH_INDEX_H
+#define MUTT_SEARCH_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "hcache/hcache.h"
+
+struct Mailbox;
+struct SearchIndex;
+
+/* These Config Variables are only used in search_index.c */
+extern bool C_SearchIndex;
+
+struct SearchIndex *mutt_search_index_open  (struct Mailbox *m);
+bool *              mutt_search_index_lookup(struct SearchIndex *si, const char *str, bool icase);
+void                mutt_search_index_close (struct SearchIndex **ptr);
+void                mutt_search_index_delete(header_cache_t *hc, const char *key, size_t keylen);
+
+#endif /* MUTT_SEARCH_INDEX_H */
@@ -435,6 +435,7 @@ void mutt_sort_headers(struct Context *ctx, bool init)
   }
 
   /* adjust the virtual message numbers */
+  bool renumbered = false;
   m->vcount = 0;
   for (int i = 0; i < m->msg_count; i++)
   {
@@ -448,8 +449,12 @@ void mutt_sort_headers(struct Context *ctx, bool init)
       m->v2r[m->vcount] = i;
       m->vcount++;
     }
+    if (e_cur->msgno != i)
+      renumbered = true;
     e_cur->msgno = i;
   }
+  if (renumbered)
+    m->gen++; /* results kept by msgno no longer fit */
 
   /* re-collapse threads marked as collapsed */
   if ((C_Sort & SORT_MASK) == SORT_THREADS)
@@ -22,6 +22,7 @@
 
 #include "config.h"
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -30,12 +31,15 @@
 struct Address;
 struct Body;
 struct Buffer;
+struct Context;
 struct Email;
 struct Envelope;
 struct Mailbox;
 struct Message;
 struct Pattern;
+struct PatternList;
 struct Progress;
+struct RangeIndex;
 struct State;
 
 bool g_addr_is_user = false;
@@ -49,7 +53,12 @@ int crypt_valid_passphrase(int flags)
   return 0;
 }
 
-int imap_search(struct Mailbox *m, const struct Pattern *pat)
+struct Body *imap_body_structure(struct Mailbox *m, struct Email *e)
+{
+  return NULL;
+}
+
+int imap_search(struct Mailbox *m, struct PatternList *pat)
 {
   return -1;
 }
@@ -116,6 +125,17 @@ void mutt_progress_update(struct Progress *progress, long pos, int percent)
 {
 }
 
+struct RangeIndex *mutt_range_index_get(struct Context *ctx)
+{
+  return NULL;
+}
+
+int mutt_range_index_select(struct RangeIndex *ri, int key, int64_t min,
+                            int64_t max, bool *cands, int num_cands)
+{
+  return 0;
+}
+
 void mutt_set_flag_update(struct Mailbox *m, struct Email *e, int flag, bool bf, bool upd_mbox)
 {
 }
@@ -0,0 +1,151 @@
+/**
+ * @file
+ * Test code for mutt_pattern_exec()
+ *
+ * @authors
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define TEST_NO_MAIN
+#include "acutest.h"
+#include "config.h"
+#include <string.h>
+#include "mutt/mutt.h"
+#include "email/lib.h"
+#include "core/lib.h"
+#include "pattern.h"
+
+struct ExecTest
+{
+  const char *pattern;
+  bool expected[4];
+};
+
+void test_mutt_pattern_exec(void)
+{
+  // int mutt_pattern_exec(struct Pattern *pat, PatternExecFlags flags, struct Mailbox *m, struct Email *e, struct PatternCache *cache);
+
+  /* flagged, read, subject */
+  static const struct
+  {
+    bool flagged;
+    bool read;
+    const char *subject;
+  } emails[4] = {
+    { false, false, "apple" },
+    { true, false, "apple" },
+    { false, true, "banana" },
+    { true, true, "banana" },
+  };
+
+  /* The expensive tests come first, so these are reordered when compiled */
+  static const struct ExecTest tests[] = {
+    // clang-format off
+    { "~F",                          { false, true,  false, true  } },
+    { "~s apple ~F",                 { false, true,  false, false } },
+    { "~s apple | ~F",               { true,  true,  false, true  } },
+    { "!~s apple ~F",                { false, false, false, true  } },
+    { "~s banana ~U",                { false, false, false, false } },
+    { "(~s apple | ~R) ~F",          { false, true,  false, true  } },
+    { "!(~s apple ~F)",              { true,  false, true,  true  } },
+    { "~s apple (~F | ~R)",          { false, true,  false, false } },
+    { "!(~s banana | ~F) | (~s banana ~F)", { true, false, false, true } },
+    { "~s apple ~s apple ~U !~F",    { true,  false, false, false } },
+    { "~s Apple",                    { false, false, false, false } },
+    { "~s ^ban",                     { false, false, true,  true  } },
+    { "~s ^nan",                     { false, false, false, false } },
+    { "~s 'an(an)*a$'",              { false, false, true,  true  } },
+    { "~s 'ap+le'",                  { true,  true,  false, false } },
+    { "~s 'bx?an'",                  { false, false, true,  true  } },
+    { "~s 'b[aeiou]n'",              { false, false, true,  true  } },
+    { "~s 'x|pl'",                   { true,  true,  false, false } },
+    { "~s 'nana\\.'",                { false, false, false, false } },
+    { "~s 'p{2}l'",                  { true,  true,  false, false } },
+    // clang-format on
+  };
+
+  struct Email *e[4];
+  for (size_t i = 0; i < mutt_array_size(e); i++)
+  {
+    e[i] = email_new();
+    e[i]->env = mutt_env_new();
+    e[i]->env->subject = mutt_str_strdup(emails[i].subject);
+    e[i]->flagged = emails[i].flagged;
+    e[i]->read = emails[i].read;
+  }
+
+  struct Buffer err = mutt_buffer_make(256);
+  for (size_t i = 0; i < mutt_array_size(tests); i++)
+  {
+    TEST_CASE(tests[i].pattern);
+    mutt_buffer_reset(&err);
+    struct PatternList *pat = mutt_pattern_comp(tests[i].pattern, MUTT_PC_NO_FLAGS, &err);
+    if (!TEST_CHECK(pat != NULL))
+    {
+      TEST_MSG("Error: %s", mutt_b2s(&err));
+      continue;
+    }
+
+    for (size_t j = 0; j < mutt_array_size(e); j++)
+    {
+      bool rc = (mutt_pattern_exec(SLIST_FIRST(pat), MUTT_PAT_EXEC_NO_FLAGS,
+                                   NULL, e[j], NULL) > 0);
+      if (!TEST_CHECK(rc == tests[i].expected[j]))
+      {
+        TEST_MSG("Email %zu", j);
+        TEST_MSG("Expected: %d", tests[i].expected[j]);
+        TEST_MSG("Actual  : %d", rc);
+      }
+    }
+
+    mutt_pattern_free(&pat);
+  }
+
+  for (size_t i = 0; i < mutt_array_size(e); i++)
+    email_free(&e[i]);
+
+  {
+    /* Remembered results follow the Email's flags */
+    struct Mailbox m = { 0 };
+    struct Email *e2 = email_new();
+    e2->env = mutt_env_new();
+    e2->env->subject = mutt_str_strdup("apple");
+
+    struct PatternList *pat = mutt_pattern_comp("~F ~s apple", MUTT_PC_MEMO, &err);
+    TEST_CHECK(pat != NULL);
+    TEST_CHECK(SLIST_FIRST(pat)->memo_id != 0);
+    TEST_CHECK(mutt_pattern_exec(SLIST_FIRST(pat), MUTT_PAT_EXEC_NO_FLAGS, &m, e2, NULL) == 0);
+    e2->flagged = true;
+    TEST_CHECK(mutt_pattern_exec(SLIST_FIRST(pat), MUTT_PAT_EXEC_NO_FLAGS, &m, e2, NULL) == 1);
+
+    /* Changes to the Envelope's contents must be reported */
+    mutt_str_replace(&e2->env->subject, "banana");
+    TEST_CHECK(mutt_pattern_exec(SLIST_FIRST(pat), MUTT_PAT_EXEC_NO_FLAGS, &m, e2, NULL) == 1);
+    mutt_pattern_memo_clear(e2);
+    TEST_CHECK(mutt_pattern_exec(SLIST_FIRST(pat), MUTT_PAT_EXEC_NO_FLAGS, &m, e2, NULL) == 0);
+    mutt_pattern_free(&pat);
+
+    /* Patterns that depend on other Emails aren't remembered */
+    pat = mutt_pattern_comp("~F ~$", MUTT_PC_MEMO, &err);
+    TEST_CHECK(pat != NULL);
+    TEST_CHECK(SLIST_FIRST(pat)->memo_id == 0);
+    mutt_pattern_free(&pat);
+
+    email_free(&e2);
+  }
+  mutt_buffer_dealloc(&err);
+}
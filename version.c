@@ -298,6 +298,11 @@ static struct CompileOptions comp_opts[] = {
   { "typeahead", 1 },
 #else
   { "typeahead", 0 },
+#endif
+#ifdef USE_ZLIB
+  { "zlib", 1 },
+#else
+  { "zlib", 0 },
 #endif
   { NULL, 0 },
 };